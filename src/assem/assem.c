@@ -1,13 +1,20 @@
 #include "assem.h"
+#include "../assem/debug.h"
+#include "../assem/fragment.h"
+#include "../assem/lexer.h"
+#include "../assem/object.h"
+#include "../assem/peephole.h"
+#include "../assem/source.h"
 #include "../assem/table.h"
 #include "../machine/cpu.h"
+#include "../machine/isa.h"
 #include "../machine/memory.h"
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-#define OPCODE_COUNT 16
-#define REGISTER_COUNT 13
 #define DIRECTIVE_COUNT 3
 
 typedef enum ParseState {
@@ -34,71 +41,501 @@ typedef enum { META_ORG, META_DATA, META_INCLUDE, META_ERROR } MetaDirective;
 
 #define DATA_OFFSET(ctx) ((ctx)->data - (ctx)->data_start)
 
-ParseState next_state[OPCODE_COUNT] = {
-    PARSE_DONE,     PARSE_DEST,     PARSE_DEST,     PARSE_OPER_SRC,
-    PARSE_OPER_SRC, PARSE_DEST,     PARSE_DEST,     PARSE_OPER_SRC,
-    PARSE_OPER_SRC, PARSE_OPER_SRC, PARSE_OPER_SRC, PARSE_PUSH_SRC,
-    PARSE_DEST,     PARSE_TEST,     PARSE_TEST,     PARSE_OPER_SRC};
-
+// The state that follows each opcode, by operand form.
+ParseState next_state[] = {[FORM_NONE] = PARSE_DONE,
+                           [FORM_DEST] = PARSE_DEST,
+                           [FORM_SRC] = PARSE_PUSH_SRC,
+                           [FORM_SRC_DEST] = PARSE_OPER_SRC,
+                           [FORM_TEST] = PARSE_TEST};
+
+// What a line that ends in each state was still missing.
+const char *parse_expected[] = {[PARSE_TEST] = "a condition",
+                                [PARSE_ADDR] = "an address",
+                                [PARSE_DEST] = "a destination",
+                                [PARSE_OPER_SRC] = "a source",
+                                [PARSE_PUSH_SRC] = "a source",
+                                [PARSE_ORG_ADDR] = "an address"};
+
+// Quads are written from `data_start` up to `data_end`. Errors are printed
+// unless `diagnostics` is set, in which case they are collected there.
 typedef struct context {
     uint8_t *data_start;
     uint8_t *data;
     table *symbols;
     uint32_t line;
+    uint8_t *data_end;
+    assem_diagnostics *diagnostics;
 } context;
 
-char *opcodes[OPCODE_COUNT] = {"NOP", "INC", "DEC", "ADD", "SUB", "RLC",
-                               "RRC", "AND", "OR",  "XOR", "CMP", "PSH",
-                               "POP", "JMP", "JSR", "MOV"};
-
-char *registers[REGISTER_COUNT] = {"a",  "b",  "c",  "d",  "e",  "f", "s0",
-                                   "s1", "pc", "sp", "iv", "ix", "ta"};
-// The CV, MD, and MX virtual registers are missing from this table
-// because they cannot be used in register specifiers.
+// Opcode, register, and condition names are shared with the machine in
+// isa.h.
 
 char *directives[DIRECTIVE_COUNT] = {"org", "data", "inc"};
 
-#define PUSH_NEXT(m, v) (*(m)++ = (v))
+// Nothing is written past the end of the output. A line that runs past it
+// still moves the data pointer, and is reported once it has been assembled.
+#define PUSH_NEXT(ctx, v)                                                      \
+    do {                                                                       \
+        if ((ctx)->data < (ctx)->data_end) {                                   \
+            *(ctx)->data = (v);                                                \
+        }                                                                      \
+        (ctx)->data++;                                                         \
+    } while (0)
 
-#define PUSH_QUARTET(m, v)                                                     \
+#define PUSH_QUARTET(ctx, v)                                                   \
     do {                                                                       \
-        *(m)++ = ((v) & 0xF000) >> 12;                                         \
-        *(m)++ = ((v) & 0xF00) >> 8;                                           \
-        *(m)++ = ((v) & 0xF0) >> 4;                                            \
-        *(m)++ = ((v) & 0xF);                                                  \
+        PUSH_NEXT(ctx, ((v) & 0xF000) >> 12);                                  \
+        PUSH_NEXT(ctx, ((v) & 0xF00) >> 8);                                    \
+        PUSH_NEXT(ctx, ((v) & 0xF0) >> 4);                                     \
+        PUSH_NEXT(ctx, ((v) & 0xF));                                           \
     } while (0)
 
 #define UPDATE_STATE(st, v) ((st) & ~MASK_PARSE_STATE | (v))
 
-static inline ParseState parse_directive(context *, char *);
-static inline ParseState parse_opcode(context *, char *);
-static inline ParseState parse_condition(context *, char *);
-static inline ParseState parse_dest(context *, char *, uint16_t *, char **);
-static inline ParseState parse_src(context *, char *, uint16_t *, char **);
-static inline bool parse_register(context *, char *, uint8_t *);
-static inline bool parse_addr(context *, char *, uint16_t *, char **);
-static inline bool parse_hex(char *, uint8_t, uint16_t *);
-static inline bool parse_int(char *, uint16_t *);
-static inline bool parse_label(char *);
+// Tokens are printed in diagnostics as "%.*s" with TOKEN_ARGS.
+#define TOKEN_ARGS(t) (int)(t)->length, (t)->start
+
+static void assem_error(context *, token *, const char *, ...);
+static inline ParseState parse_directive(context *, token *);
+static inline ParseState parse_opcode(context *, token *);
+static inline ParseState parse_condition(context *, token *);
+static inline ParseState parse_dest(context *, token *, uint16_t *, token *);
+static inline ParseState parse_src(context *, token *, uint16_t *, token *);
+static inline bool parse_register(context *, token *, uint8_t *);
+static inline bool parse_addr(context *, token *, uint16_t *, token *);
+static inline bool parse_hex(const char *, size_t, uint8_t, uint16_t *);
+static inline bool parse_int(const char *, size_t, uint16_t *);
+static inline bool parse_label(const char *, size_t);
 
 bool tokenize(context *, char *, uint16_t);
+static bool tokenize_line(context *, token *, size_t, size_t *);
+
+#define LINE_TOKENS(f, i) (&(f)->tokens.tokens[(f)->tokens.lines[i].first])
+
+static void assem_error(context *ctx, token *t, const char *format, ...) {
+    // Reports an error in the line being assembled. `t` is the token at
+    // fault, or NULL when the error belongs to no line.
+    va_list args;
+    va_start(args, format);
+
+    if (!ctx->diagnostics) {
+        fprintf(stderr, "error: ");
+        vfprintf(stderr, format, args);
+        fprintf(stderr, "\n");
+    } else if (ctx->diagnostics->count < ctx->diagnostics->capacity) {
+        assem_diagnostic *d =
+            &ctx->diagnostics->items[ctx->diagnostics->count];
+
+        d->line = t ? ctx->line : 0;
+        d->column = t ? t->column : 0;
+        vsnprintf(d->message, sizeof(d->message), format, args);
+    }
+
+    if (ctx->diagnostics) {
+        ctx->diagnostics->count++;
+    }
+
+    va_end(args);
+}
+
+// The section of an object being assembled, and where the symbols and
+// references added since it began start in the symbol table.
+typedef struct object_build {
+    object *object;
+    uint32_t origin;
+    bool absolute;
+    size_t syms;
+    size_t refs;
+} object_build;
+
+// What is kept while a program is assembled, besides its context. Each of
+// these is NULL when not in use.
+typedef struct build_state {
+    fragment_cache *fragments;
+    object_build *object;
+    peephole *peephole;
+    debug_builder *debug;
+} build_state;
+
+static bool line_is_instruction(token *tokens, size_t count) {
+    // Whether a line assembles an instruction rather than a directive. Any
+    // labels come first.
+    for (size_t i = 0; i < count; i++) {
+        if (tokens[i].start[tokens[i].length - 1] != ':') {
+            return tokens[i].start[0] != '#';
+        }
+    }
+
+    return false;
+}
+
+static bool assemble_lines(context *ctx, build_state *state, source_file *f,
+                           size_t first, size_t last, fragment *record) {
+    // Assembles lines [first, last) of a file, none of which is an #inc.
+    // When recording, the quads each line writes are added to the fragment,
+    // when optimizing, to the optimizer's view of the program, and when
+    // collecting debug information, to the line map.
+    for (size_t i = first; i < last; i++) {
+        token_line *line = &f->tokens.lines[i];
+        token *tokens = LINE_TOKENS(f, i);
+        size_t before = DATA_OFFSET(ctx);
+        size_t at = 0;
+
+        ctx->line = line->line;
+
+        if (!tokenize_line(ctx, tokens, line->count, &at)) {
+            fprintf(stderr, "%s:%u:%u: %.*s\n", f->path, line->line,
+                    tokens[at].column, (int)line->length, line->text);
+            return false;
+        }
+
+        // #org moves the data pointer without writing anything.
+        if (DATA_OFFSET(ctx) <= before || token_equal(tokens, "#org")) {
+            continue;
+        }
+
+        size_t length = DATA_OFFSET(ctx) - before;
+        bool instruction = line_is_instruction(tokens, line->count);
+
+        if (record) {
+            fragment_add_range(record, before, length);
+        }
+
+        if (record && instruction) {
+            fragment_add_instruction(record, before, length);
+        }
+
+        if (record) {
+            fragment_add_line(record, before, length, i - first);
+        }
+
+        if (state->debug) {
+            debug_add_line(state->debug, f->path, line->line, before, length);
+        }
+
+        if (state->peephole) {
+            peephole_add_range(state->peephole, before, length);
+        }
+
+        if (state->peephole && instruction) {
+            peephole_add_instruction(state->peephole, f->path, before, length);
+        }
+    }
+
+    return true;
+}
+
+static bool fragment_fits(uint32_t start, uint32_t length) {
+    // Whether a range of a cached fragment lies inside memory. The sum is
+    // not formed, as it could wrap.
+    return start <= CPU_MAX_ADDRESS && length <= CPU_MAX_ADDRESS - start;
+}
+
+static bool replay_fragment(context *ctx, build_state *state, source_file *f,
+                            size_t first, size_t last, fragment *frag) {
+    // A fragment that points outside memory, or past the lines it was built
+    // from, is not replayed, and the lines are assembled again instead.
+    const uint8_t *quads = frag->quads;
+    const char *label = frag->labels;
+
+    if (frag->end > CPU_MAX_ADDRESS) {
+        return false;
+    }
+
+    for (size_t i = 0; i < frag->range_count; i++) {
+        if (!fragment_fits(frag->ranges[i].start, frag->ranges[i].length)) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < frag->instruction_count; i++) {
+        if (!fragment_fits(frag->instructions[i].start,
+                           frag->instructions[i].length)) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < frag->line_count; i++) {
+        if (frag->lines[i].line >= last - first ||
+            !fragment_fits(frag->lines[i].start, frag->lines[i].length)) {
+            return false;
+        }
+    }
+
+    // References patch an address, four quads long.
+    for (size_t i = 0; i < frag->ref_count; i++) {
+        if (!fragment_fits(frag->refs[i].value, 4)) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < frag->range_count; i++) {
+        memcpy(ctx->data_start + frag->ranges[i].start, quads,
+               frag->ranges[i].length);
+        quads += frag->ranges[i].length;
+    }
+
+    for (size_t i = 0; state->peephole && i < frag->range_count; i++) {
+        peephole_add_range(state->peephole, frag->ranges[i].start,
+                           frag->ranges[i].length);
+    }
+
+    for (size_t i = 0; state->peephole && i < frag->instruction_count; i++) {
+        peephole_add_instruction(state->peephole, f->path,
+                                 frag->instructions[i].start,
+                                 frag->instructions[i].length);
+    }
+
+    for (size_t i = 0; state->debug && i < frag->line_count; i++) {
+        fragment_line *line = &frag->lines[i];
+        debug_add_line(state->debug, f->path,
+                       f->tokens.lines[first + line->line].line, line->start,
+                       line->length);
+    }
+
+    for (size_t i = 0; i < frag->symbol_count; i++) {
+        table_symbol_define_n(ctx->symbols, label, frag->symbols[i].length,
+                              frag->symbols[i].value);
+        label += frag->symbols[i].length;
+    }
+
+    for (size_t i = 0; i < frag->ref_count; i++) {
+        table_ref_add_n(ctx->symbols, label, frag->refs[i].length,
+                        ctx->data_start + frag->refs[i].value);
+        label += frag->refs[i].length;
+    }
+
+    ctx->data = ctx->data_start + frag->end;
+    return true;
+}
+
+static bool assemble_cached(context *ctx, build_state *state, source_file *f,
+                            size_t first, size_t last) {
+    // The output of a run of lines depends only on their text and, unless
+    // the run starts with #org, on where it starts. Runs seen before are
+    // copied from the cache rather than assembled again.
+    table *t = ctx->symbols;
+    uint32_t start = token_equal(LINE_TOKENS(f, first), "#org")
+                         ? FRAGMENT_ABSOLUTE
+                         : DATA_OFFSET(ctx);
+    uint64_t hash = 0;
+    fragment frag;
+
+    for (size_t i = first; i < last; i++) {
+        token_line *line = &f->tokens.lines[i];
+        hash = fragment_hash(hash, line->text, line->length);
+        hash = fragment_hash(hash, "\n", 1);
+    }
+
+    if (fragment_load(state->fragments, hash, start, &frag)) {
+        bool replayed = replay_fragment(ctx, state, f, first, last, &frag);
+        fragment_free(&frag);
+
+        if (replayed) {
+            return true;
+        }
+
+        // Counted as the miss it turned out to be.
+        state->fragments->hits--;
+        state->fragments->misses++;
+    }
+
+    size_t syms = t->syms_end - t->syms;
+    size_t refs = t->refs_end - t->refs;
+    frag = (fragment){.hash = hash, .start = start};
+
+    if (!assemble_lines(ctx, state, f, first, last, &frag)) {
+        fragment_free(&frag);
+        return false;
+    }
+
+    for (symbol *s = t->syms + syms; s < t->syms_end; s++) {
+        fragment_add_symbol(&frag, s->label, s->address);
+    }
+
+    for (reference *r = t->refs + refs; r < t->refs_end; r++) {
+        fragment_add_ref(&frag, r->label, r->offset - ctx->data_start);
+    }
+
+    frag.end = DATA_OFFSET(ctx);
+    fragment_capture(&frag, ctx->data_start);
+    fragment_store(state->fragments, &frag);
+    fragment_free(&frag);
+
+    return true;
+}
+
+static bool object_section_end(context *ctx, object_build *build) {
+    // Adds what was assembled since the section began to the object. Every
+    // reference becomes a relocation, since even a label in the same object
+    // may be in a relocatable section. Only the first definition of a label
+    // is kept, as that is the one references resolve to.
+    table *t = ctx->symbols;
+    object *o = build->object;
+    uint32_t section = o->section_count;
+    uint32_t end = DATA_OFFSET(ctx);
+    uint32_t length = end > build->origin ? end - build->origin : 0;
+
+    object_add_section(o, build->origin, build->absolute,
+                       ctx->data_start + build->origin, length);
+
+    for (symbol *s = t->syms + build->syms; s < t->syms_end; s++) {
+        if (s->label && table_symbol_lookup(t, s->label) == s) {
+            object_add_symbol(o, section, s->address - build->origin,
+                              s->label);
+        }
+    }
+
+    for (reference *r = t->refs + build->refs; r < t->refs_end; r++) {
+        size_t at = r->offset - ctx->data_start;
+
+        if (at < build->origin || at + 4 > end ||
+            !object_add_reloc(o, section, at - build->origin, r->label)) {
+            fprintf(stderr, "error: reference to '%s' is outside its section\n",
+                    r->label);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static uint16_t org_address(token *tokens, size_t count) {
+    // The address of an #org line. An address that cannot be parsed is
+    // reported when the line is assembled.
+    uint16_t origin = 0;
+
+    if (count > 1) {
+        parse_hex(tokens[1].start, tokens[1].length, 4, &origin);
+    }
+
+    return origin;
+}
+
+static bool object_section_begin(context *ctx, object_build *build,
+                                 token *tokens, size_t count) {
+    // Each #org ends the current section and begins an absolute one.
+    uint16_t origin = org_address(tokens, count);
+
+    if (!object_section_end(ctx, build)) {
+        return false;
+    }
+
+    build->origin = origin;
+    build->absolute = true;
+    build->syms = ctx->symbols->syms_end - ctx->symbols->syms;
+    build->refs = ctx->symbols->refs_end - ctx->symbols->refs;
+    return true;
+}
 
-memory *build_image(char *filename, char *prog) {
+static bool assemble_file(context *ctx, build_state *state, source_file *f,
+                          int depth) {
+    // Assembles a file, expanding each #inc line in place with the file it
+    // names. Files were tokenized when they were loaded. The lines between
+    // includes are assembled in runs that are split again at each #org, and
+    // each run is a fragment for incremental builds. When building an object,
+    // each #org also begins a new section, and when optimizing, it marks an
+    // address that must not move.
+    token_list *list = &f->tokens;
+    size_t include = 0;
+    bool success = true;
+
+    if (f->active || depth > SOURCE_MAX_DEPTH) {
+        fprintf(stderr, "error: '%s' includes itself\n", f->path);
+        return false;
+    }
+
+    f->active = true;
+
+    for (size_t i = 0; i < list->line_count && success;) {
+        token_line *line = &list->lines[i];
+        token *tokens = LINE_TOKENS(f, i);
+
+        ctx->line = line->line;
+
+        if (token_equal(tokens, "#inc")) {
+            source_file *inc = f->includes[include++];
+            i++;
+
+            if (inc && !inc->failed) {
+                success = assemble_file(ctx, state, inc, depth + 1);
+                continue;
+            }
+
+            if (line->count > 1) {
+                fprintf(stderr, "error: unable to include '%.*s'\n",
+                        TOKEN_ARGS(&tokens[1]));
+            } else {
+                fprintf(stderr, "error: expected a file name\n");
+            }
+
+            fprintf(stderr, "%s:%u:%u: %.*s\n", f->path, line->line,
+                    tokens[0].column, (int)line->length, line->text);
+            success = false;
+            continue;
+        }
+
+        bool org = token_equal(tokens, "#org");
+
+        if (org && state->object &&
+            !object_section_begin(ctx, state->object, tokens, line->count)) {
+            success = false;
+            continue;
+        }
+
+        if (org && state->peephole) {
+            peephole_add_anchor(state->peephole,
+                                org_address(tokens, line->count));
+        }
+
+        size_t last = i + 1;
+
+        while (last < list->line_count &&
+               !token_equal(LINE_TOKENS(f, last), "#inc") &&
+               !token_equal(LINE_TOKENS(f, last), "#org")) {
+            last++;
+        }
+
+        success = state->fragments
+                      ? assemble_cached(ctx, state, f, i, last)
+                      : assemble_lines(ctx, state, f, i, last, NULL);
+        i = last;
+    }
+
+    f->active = false;
+    return success;
+}
+
+static memory *build_source(source_file *root, build_options *options) {
     memory *mem = memory_init(CPU_MAX_ADDRESS);
     table *symbols = table_init();
 
     context ctx = {.data_start = mem->data,
                    .data = mem->data,
                    .symbols = symbols,
-                   .line = 0};
+                   .line = 0,
+                   .data_end = mem->data + mem->size};
 
-    for (char *l = strsep(&prog, "\n"); l != NULL; l = strsep(&prog, "\n")) {
-        char *line = strdup(l);
-        if (!tokenize(&ctx, line, ++ctx.line)) {
-            fprintf(stderr, "%s:%d: %s\n", filename, ctx.line, l);
-            break;
-        }
-        free(line);
+    build_state state = {0};
+
+    if (options) {
+        state.fragments = options->fragments;
+        state.peephole = options->peephole;
+        state.debug = options->debug;
+    }
+
+    // Tokens point into the source files, so no line is ever copied. As
+    // with an object, a program that does not assemble builds no image.
+    if (!assemble_file(&ctx, &state, root, 0)) {
+        table_free(symbols);
+        memory_free(mem);
+        return NULL;
+    }
+
+    // The optimizer moves code, so it runs while references are still
+    // offsets to patch rather than addresses written into the program.
+    if (state.peephole) {
+        peephole_run(state.peephole, mem->data, symbols, state.debug);
     }
 
     // table_print(symbols);
@@ -116,70 +553,196 @@ memory *build_image(char *filename, char *prog) {
         } else {
             fprintf(stderr, "error: reference to undefined symbol '%s'\n",
                     r->label);
+            table_free(symbols);
+            memory_free(mem);
             return NULL;
         }
     }
 
+    if (state.debug) {
+        debug_add_symbols(state.debug, symbols);
+    }
+
+    table_free(symbols);
     return mem;
 }
 
+memory *build_image(const char *filename, const char *prog) {
+    // Files included by the program are looked up relative to `filename`.
+    source_cache *cache = source_cache_init();
+    source_file *root =
+        source_cache_load_text(cache, filename, prog, strlen(prog));
+    memory *mem = build_source(root, NULL);
+
+    source_cache_free(cache);
+    return mem;
+}
+
+memory *build_file(source_cache *cache, build_options *options, char *path) {
+    // `options` may be NULL for a plain build.
+    source_file *root = source_cache_load(cache, path);
+
+    if (!root) {
+        fprintf(stderr, "error: unable to read '%s'\n", path);
+        return NULL;
+    }
+
+    return build_source(root, options);
+}
+
+bool build_object(source_cache *cache, fragment_cache *fragments, char *path,
+                  object *obj) {
+    // Assembles a file into a relocatable object. References are left for
+    // the linker, and unlike an image, an object is only built if the
+    // source assembles without errors.
+    source_file *root = source_cache_load(cache, path);
+
+    *obj = (object){0};
+
+    if (!root) {
+        fprintf(stderr, "error: unable to read '%s'\n", path);
+        return false;
+    }
+
+    memory *mem = memory_init(CPU_MAX_ADDRESS);
+    table *symbols = table_init();
+
+    context ctx = {.data_start = mem->data,
+                   .data = mem->data,
+                   .symbols = symbols,
+                   .line = 0,
+                   .data_end = mem->data + mem->size};
+    object_build build = {.object = obj};
+    build_state state = {.fragments = fragments, .object = &build};
+
+    bool success = assemble_file(&ctx, &state, root, 0) &&
+                   object_section_end(&ctx, &build);
+
+    table_free(symbols);
+    memory_free(mem);
+
+    if (!success) {
+        object_free(obj);
+    }
+
+    return success;
+}
+
+assembler *assembler_init() {
+    assembler *a = calloc(1, sizeof(assembler));
+    a->symbols = table_init();
+    return a;
+}
+
+void assembler_free(assembler *a) {
+    token_list_free(&a->tokens);
+    table_free(a->symbols);
+    free(a);
+}
+
+bool assembler_run(assembler *a, const char *prog, size_t length,
+                   memory *mem, assem_diagnostics *diagnostics) {
+    // Assembles a program into `mem`, which is cleared first and may be a
+    // machine's own memory. The program is not modified and cannot #inc
+    // other files. Errors are collected in `diagnostics`, or printed if it
+    // is NULL; as with build_image, assembly stops at the first bad line.
+    context ctx = {.data_start = mem->data,
+                   .data = mem->data,
+                   .symbols = a->symbols,
+                   .line = 0,
+                   .data_end = mem->data + mem->size,
+                   .diagnostics = diagnostics};
+    bool success = true;
+
+    a->tokens.token_count = 0;
+    a->tokens.line_count = 0;
+    lexer_tokenize(&a->tokens, prog, length);
+    table_clear(a->symbols);
+    memset(mem->data, 0, mem->size);
+
+    for (size_t i = 0; i < a->tokens.line_count && success; i++) {
+        token_line *line = &a->tokens.lines[i];
+        size_t at = 0;
+
+        ctx.line = line->line;
+        success = tokenize_line(&ctx, &a->tokens.tokens[line->first],
+                                line->count, &at);
+    }
+
+    for (reference *r = table_ref_pop(a->symbols); success && r != NULL;
+         r = table_ref_pop(a->symbols)) {
+        symbol *s = table_symbol_lookup(a->symbols, r->label);
+
+        if (s) {
+            uint16_t addr = s->address;
+            *(r->offset + 0) = (addr >> 12) & 0xF;
+            *(r->offset + 1) = (addr >> 8) & 0xF;
+            *(r->offset + 2) = (addr >> 4) & 0xF;
+            *(r->offset + 3) = (addr >> 0) & 0xF;
+        } else {
+            assem_error(&ctx, NULL, "reference to undefined symbol '%s'",
+                        r->label);
+            success = false;
+        }
+    }
+
+    return success;
+}
+
 bool tokenize(context *ctx, char *line, uint16_t num) {
-    char *delim = "\t ";
-    char *close = ")";
-    char *sep = delim;
+    // Assemble a single line of source.
+    token_list list = {0};
+    size_t at;
+    bool success = true;
+
+    lexer_tokenize(&list, line, strlen(line));
 
-    char *saveptr;
+    if (list.line_count > 0) {
+        success = tokenize_line(ctx, list.tokens, list.token_count, &at);
+    }
+
+    token_list_free(&list);
+    return success;
+}
+
+static bool tokenize_line(context *ctx, token *tokens, size_t count,
+                          size_t *at) {
+    // Assembles the tokens of one line. On failure, `at` is the token that
+    // was being parsed.
     ParseState st = PARSE_OPER;
     uint16_t src_ext = 0;
     uint16_t dst_ext = 0;
-    char *src_label;
-    char *dst_label;
-
-    for (char *t = strtok_r(line, sep, &saveptr); t != NULL;
-         t = strtok_r(NULL, sep, &saveptr)) {
-        size_t length = strlen(t);
-
-        src_label = NULL;
-        dst_label = NULL;
-
-        if (t[0] == '(') {
-            // If we encounter an opening parenthesis, the tokenizer must ignore
-            // all characters until the closing parenthesis. If the final
-            // character of the current token is not the closing parenthesis,
-            // switch the separator in the strtok call to ")". Then the next
-            // token will be the remainder of the comment.
-            if (t[length - 1] != ')') {
-                sep = close;
-            }
+    token src_label;
+    token dst_label;
 
-            continue;
-        } else if (strcmp(sep, close) == 0) {
-            // If we enter the loop when the separator is set to ")", it
-            // indicates we've parsed to the end of the comment and should swap
-            // the separator back.
-            sep = delim;
-            continue;
-        }
+    // Comments were skipped by the lexer, so every token here is meaningful.
+    for (size_t i = 0; i < count; i++) {
+        token *t = &tokens[i];
+        *at = i;
+        src_label.start = NULL;
+        dst_label.start = NULL;
 
-        if (t[0] == '#') {
+        if (t->start[0] == '#') {
             // Assembler directives start with '#' and should be the first token
             // on a line.
             if ((st & MASK_PARSE_STATE) != PARSE_OPER) {
-                fprintf(stderr,
-                        "error: didn't expect an assembler directive here\n");
+                assem_error(ctx, t,
+                            "didn't expect an assembler directive here");
                 return false;
             }
 
-            st = UPDATE_STATE(st, parse_directive(ctx, &t[1]));
+            token directive = {t->start + 1, t->length - 1, t->line,
+                               t->column + 1};
+            st = UPDATE_STATE(st, parse_directive(ctx, &directive));
             continue;
         }
 
-        if (t[length - 1] == ':') {
+        if (t->start[t->length - 1] == ':') {
             // Label definitions start with a letter or underscore followed by
             // letters, numbers, or underscores and end with ':'. If we
             // encounter one, we need to define it in the symbol table.
-            t[length - 1] = '\0';
-            table_symbol_define(ctx->symbols, t, DATA_OFFSET(ctx));
+            table_symbol_define_n(ctx->symbols, t->start, t->length - 1,
+                                  DATA_OFFSET(ctx));
             continue;
         }
 
@@ -197,7 +760,9 @@ bool tokenize(context *ctx, char *line, uint16_t num) {
                 st =
                     UPDATE_STATE(st, PARSE_DONE | (REGISTER_MD << OFFSET_DEST));
             } else {
-                fprintf(stderr, "error: expected address, found '%s'\n", t);
+                assem_error(ctx, t, "expected address, found '%.*s'",
+                            TOKEN_ARGS(t));
+                st = UPDATE_STATE(st, PARSE_ERROR);
             }
             break;
         }
@@ -219,11 +784,13 @@ bool tokenize(context *ctx, char *line, uint16_t num) {
         case PARSE_ORG_ADDR: {
             uint16_t offset = 0;
 
-            if (parse_hex(t, 4, &offset)) {
+            if (parse_hex(t->start, t->length, 4, &offset)) {
                 ctx->data = ctx->data_start + offset;
                 st = UPDATE_STATE(st, PARSE_DONE);
             } else {
-                fprintf(stderr, "error: expected address, found '%s'\n", t);
+                assem_error(ctx, t, "expected address, found '%.*s'",
+                            TOKEN_ARGS(t));
+                st = UPDATE_STATE(st, PARSE_ERROR);
             }
 
             break;
@@ -231,15 +798,16 @@ bool tokenize(context *ctx, char *line, uint16_t num) {
         case PARSE_DATA: {
             uint16_t data = 0;
 
-            if (parse_hex(t, 1, &data)) {
-                PUSH_NEXT(ctx->data, data & 0xF);
-            } else if (parse_hex(t, 2, &data)) {
-                PUSH_NEXT(ctx->data, data & 0xF);
-                PUSH_NEXT(ctx->data, data >> 2 & 0xF);
-            } else if (parse_hex(t, 4, &data)) {
-                PUSH_QUARTET(ctx->data, data);
+            if (parse_hex(t->start, t->length, 1, &data)) {
+                PUSH_NEXT(ctx, data & 0xF);
+            } else if (parse_hex(t->start, t->length, 2, &data)) {
+                PUSH_NEXT(ctx, data & 0xF);
+                PUSH_NEXT(ctx, data >> 2 & 0xF);
+            } else if (parse_hex(t->start, t->length, 4, &data)) {
+                PUSH_QUARTET(ctx, data);
             } else {
-                fprintf(stderr, "error: expected address, found '%s'\n", t);
+                assem_error(ctx, t, "expected address, found '%.*s'",
+                            TOKEN_ARGS(t));
             }
 
             break;
@@ -260,8 +828,9 @@ bool tokenize(context *ctx, char *line, uint16_t num) {
             uint8_t dest = (st & MASK_DST_REGISTER) >> OFFSET_DEST;
 
             if (((1 << source) & virt_register_mask) == (1 << source)) {
-                if (src_label) {
-                    table_ref_add(ctx->symbols, src_label, ctx->data);
+                if (src_label.start && ctx->data_end - ctx->data >= 4) {
+                    table_ref_add_n(ctx->symbols, src_label.start,
+                                    src_label.length, ctx->data);
                 }
 
                 if (source == REGISTER_CV &&
@@ -269,40 +838,63 @@ bool tokenize(context *ctx, char *line, uint16_t num) {
                     // We only want to push one word of data when a constant
                     // value's destination is a 4-bit general purpose register,
                     // a memory direct address, or a memory index address.
-                    PUSH_NEXT(ctx->data, src_ext & 0xF);
+                    PUSH_NEXT(ctx, src_ext & 0xF);
                 } else {
                     // In all other cases, we push four words of data.
-                    PUSH_QUARTET(ctx->data, src_ext);
+                    PUSH_QUARTET(ctx, src_ext);
                 }
             }
 
             if (((1 << dest) & virt_register_mask) == (1 << dest)) {
-                if (dst_label) {
-                    table_ref_add(ctx->symbols, dst_label, ctx->data);
+                if (dst_label.start && ctx->data_end - ctx->data >= 4) {
+                    table_ref_add_n(ctx->symbols, dst_label.start,
+                                    dst_label.length, ctx->data);
                 }
 
-                PUSH_QUARTET(ctx->data, dst_ext);
+                PUSH_QUARTET(ctx, dst_ext);
             }
         }
     }
 
+    if (ctx->data > ctx->data_end) {
+        assem_error(ctx, &tokens[*at], "program does not fit in memory");
+        return false;
+    }
+
     int state = st & MASK_PARSE_STATE;
 
     if (state == PARSE_OPER || state == PARSE_DONE || state == PARSE_DATA) {
         return true;
     }
 
+    if (state != PARSE_ERROR) {
+        // The line ended before the instruction did.
+        assem_error(ctx, &tokens[*at], "incomplete instruction, expected %s",
+                    parse_expected[state]);
+    }
+
     return false;
 }
 
-static inline ParseState parse_directive(context *ctx, char *token) {
+static inline ParseState parse_directive(context *ctx, token *t) {
+    // Directives differ in their first letter, which picks the only one the
+    // token could be.
     MetaDirective dir = META_ERROR;
 
-    for (size_t i = 0; i < DIRECTIVE_COUNT; i++) {
-        if (strcmp(token, directives[i]) == 0) {
-            dir = i;
-            break;
-        }
+    switch (t->length > 0 ? t->start[0] : '\0') {
+    case 'o':
+        dir = META_ORG;
+        break;
+    case 'd':
+        dir = META_DATA;
+        break;
+    case 'i':
+        dir = META_INCLUDE;
+        break;
+    }
+
+    if (dir != META_ERROR && !token_equal(t, directives[dir])) {
+        dir = META_ERROR;
     }
 
     switch (dir) {
@@ -310,161 +902,168 @@ static inline ParseState parse_directive(context *ctx, char *token) {
         return PARSE_ORG_ADDR;
     case META_DATA:
         return PARSE_DATA;
-    // TODO: add case META_INC:
+    case META_INCLUDE:
+        // Includes are expanded by assemble_file, and only ever reach here
+        // when there is no file to include from or the directive is not
+        // first on its line.
+        assem_error(ctx, t, "unexpected #inc");
+        return PARSE_ERROR;
     case META_ERROR:
     default:
-        fprintf(stderr, "error: unrecognized assembler directive '%s'\n",
-                token);
+        assem_error(ctx, t, "unrecognized assembler directive '%.*s'",
+                    TOKEN_ARGS(t));
         return PARSE_ERROR;
     }
 }
 
-static inline ParseState parse_opcode(context *ctx, char *token) {
-    for (uint8_t opcode = 0; opcode <= 0xF; opcode++) {
-        if (strcmp(token, opcodes[opcode]) == 0) {
-            PUSH_NEXT(ctx->data, opcode);
-            return next_state[opcode];
-        }
+static inline ParseState parse_opcode(context *ctx, token *t) {
+    int opcode = isa_opcode_lookup(t->start, t->length);
+
+    if (opcode >= 0) {
+        PUSH_NEXT(ctx, opcode);
+        return next_state[isa_opcodes[opcode].form];
     }
 
-    fprintf(stderr, "error: encountered unrecognized opcode '%s'\n", token);
+    assem_error(ctx, t, "encountered unrecognized opcode '%.*s'",
+                TOKEN_ARGS(t));
     return PARSE_ERROR;
 }
 
-static inline ParseState parse_condition(context *ctx, char *token) {
-    uint8_t test = (token[0] == 'N' && token[1] != '\0') ? 0x0 : 0x8;
+static inline ParseState parse_condition(context *ctx, token *t) {
+    int condition = isa_condition_lookup(t->start, t->length);
 
-    char *bitfield = "NZCOIHFT";
-    uint8_t index = token[1] != '\0';
-
-    for (uint8_t t = 0; t < 8; t++) {
-        if (token[index] == bitfield[t]) {
-            PUSH_NEXT(ctx->data, test | t);
-            return PARSE_ADDR;
-        }
+    if (condition >= 0) {
+        PUSH_NEXT(ctx, condition);
+        return PARSE_ADDR;
     }
 
-    fprintf(stderr, "error: encountered unrecognized condition '%s'\n", token);
+    assem_error(ctx, t, "encountered unrecognized condition '%.*s'",
+                TOKEN_ARGS(t));
     return PARSE_ERROR;
 }
 
-static inline ParseState parse_src(context *ctx, char *token, uint16_t *ext,
-                                   char **label) {
+static inline ParseState parse_src(context *ctx, token *t, uint16_t *ext,
+                                   token *label) {
     uint8_t reg;
 
-    if (token[0] == '%') {
-        if (parse_register(ctx, &token[1], &reg)) {
+    if (t->start[0] == '%') {
+        if (parse_register(ctx, t, &reg)) {
             return PARSE_DEST | (reg << OFFSET_SRC);
         } else {
-            fprintf(stderr, "error: unrecognized register '%s'\n", token);
+            assem_error(ctx, t, "unrecognized register '%.*s'", TOKEN_ARGS(t));
             return PARSE_ERROR;
         }
-    } else if (token[0] == '0' && token[1] == 'x') {
-        if (parse_hex(&token[2], 4, ext)) {
-            PUSH_NEXT(ctx->data, REGISTER_CV);
+    } else if (t->length > 1 && t->start[0] == '0' && t->start[1] == 'x') {
+        if (parse_hex(t->start + 2, t->length - 2, 4, ext)) {
+            PUSH_NEXT(ctx, REGISTER_CV);
             return PARSE_DEST | (REGISTER_CV << OFFSET_SRC);
-        } else if (parse_hex(&token[2], 1, ext)) {
-            PUSH_NEXT(ctx->data, REGISTER_CV);
+        } else if (parse_hex(t->start + 2, t->length - 2, 1, ext)) {
+            PUSH_NEXT(ctx, REGISTER_CV);
             return PARSE_DEST | (REGISTER_CV << OFFSET_SRC);
         } else {
-            fprintf(stderr, "error: unable to parse hex literal '%s'\n", token);
+            assem_error(ctx, t, "unable to parse hex literal '%.*s'",
+                        TOKEN_ARGS(t));
             return PARSE_ERROR;
         }
     }
 
-    if (parse_addr(ctx, token, ext, label)) {
-        switch (token[0]) {
+    if (parse_addr(ctx, t, ext, label)) {
+        switch (t->start[0]) {
         case '@': {
-            PUSH_NEXT(ctx->data, REGISTER_MD);
+            PUSH_NEXT(ctx, REGISTER_MD);
             break;
         }
         case '*': {
-            PUSH_NEXT(ctx->data, REGISTER_MX);
+            PUSH_NEXT(ctx, REGISTER_MX);
             break;
         }
         }
         return PARSE_DEST | (REGISTER_MD << OFFSET_SRC);
-    } else if (parse_int(token, ext)) {
-        PUSH_NEXT(ctx->data, REGISTER_CV);
+    } else if (parse_int(t->start, t->length, ext)) {
+        PUSH_NEXT(ctx, REGISTER_CV);
         return PARSE_DEST | (REGISTER_CV << OFFSET_SRC);
     }
 
-    fprintf(stderr, "error: unable to parse source operand '%s'\n", token);
+    assem_error(ctx, t, "unable to parse source operand '%.*s'", TOKEN_ARGS(t));
     return PARSE_ERROR;
 }
 
-static inline ParseState parse_dest(context *ctx, char *token, uint16_t *ext,
-                                    char **label) {
+static inline ParseState parse_dest(context *ctx, token *t, uint16_t *ext,
+                                    token *label) {
     uint8_t reg;
 
-    if (token[0] == '%') {
-        if (parse_register(ctx, &token[1], &reg)) {
+    if (t->start[0] == '%') {
+        if (parse_register(ctx, t, &reg)) {
             return PARSE_DONE | (reg << OFFSET_DEST);
         } else {
-            fprintf(stderr, "error: unrecognized register '%s'\n", token);
+            assem_error(ctx, t, "unrecognized register '%.*s'", TOKEN_ARGS(t));
             return PARSE_ERROR;
         }
     }
 
-    if (parse_addr(ctx, token, ext, label)) {
-        switch (token[0]) {
+    if (parse_addr(ctx, t, ext, label)) {
+        switch (t->start[0]) {
         case '@': {
-            PUSH_NEXT(ctx->data, REGISTER_MD);
+            PUSH_NEXT(ctx, REGISTER_MD);
             break;
         }
         case '*': {
-            PUSH_NEXT(ctx->data, REGISTER_MX);
+            PUSH_NEXT(ctx, REGISTER_MX);
             break;
         }
         }
         return PARSE_DONE | (REGISTER_MD << OFFSET_DEST);
     } else {
-        fprintf(stderr, "error: unable to parse destination operand '%s'\n",
-                token);
+        assem_error(ctx, t, "unable to parse destination operand '%.*s'",
+                    TOKEN_ARGS(t));
         return PARSE_ERROR;
     }
 }
 
-static inline bool parse_register(context *ctx, char *token, uint8_t *reg) {
-    for (uint8_t r = 0; r < REGISTER_COUNT; r++) {
-        if (strcmp(token, registers[r]) == 0) {
-            PUSH_NEXT(ctx->data, r);
-            *reg = r;
-            return true;
-        }
+static inline bool parse_register(context *ctx, token *t, uint8_t *reg) {
+    // The token includes the leading '%'.
+    int r = isa_register_lookup(t->start + 1, t->length - 1);
+
+    if (r < 0) {
+        return false;
     }
 
-    return false;
+    PUSH_NEXT(ctx, r);
+    *reg = r;
+    return true;
 }
 
-static inline bool parse_addr(context *ctx, char *token, uint16_t *addr,
-                              char **label) {
-    switch (token[0]) {
+static inline bool parse_addr(context *ctx, token *t, uint16_t *addr,
+                              token *label) {
+    switch (t->start[0]) {
     case '@': {
         // Memory direct address
-        if (parse_hex(&token[1], 4, addr)) {
+        if (parse_hex(t->start + 1, t->length - 1, 4, addr)) {
             return true;
         } else {
-            fprintf(stderr, "error: expected hex address, found '%s'\n", token);
+            assem_error(ctx, t, "expected hex address, found '%.*s'",
+                        TOKEN_ARGS(t));
             return false;
         }
     }
     case '*': {
         // Memory indexed
-        if (parse_hex(&token[1], 4, addr)) {
+        if (parse_hex(t->start + 1, t->length - 1, 4, addr)) {
             return true;
         } else {
-            fprintf(stderr, "error: expected hex address, found '%s'\n", token);
+            assem_error(ctx, t, "expected hex address, found '%.*s'",
+                        TOKEN_ARGS(t));
             return false;
         }
     }
     case '.': {
         // Label reference
-        if (parse_label(&token[1])) {
-            *label = &token[1];
+        if (parse_label(t->start + 1, t->length - 1)) {
+            *label = (token){t->start + 1, t->length - 1, t->line,
+                             t->column + 1};
             return true;
         } else {
-            fprintf(stderr, "error: expected label, found '%s'\n", token);
+            assem_error(ctx, t, "expected label, found '%.*s'", TOKEN_ARGS(t));
             return false;
         }
     }
@@ -473,12 +1072,16 @@ static inline bool parse_addr(context *ctx, char *token, uint16_t *addr,
     }
 }
 
-static inline bool parse_hex(char *token, uint8_t length, uint16_t *result) {
+static inline bool parse_hex(const char *s, size_t n, uint8_t length,
+                             uint16_t *result) {
     *result = 0;
 
-    for (char *ch = token; *ch != 0; ch++) {
+    if (n != length) {
+        return false;
+    }
+
+    for (const char *ch = s; ch < s + n; ch++) {
         *result <<= 4;
-        length--;
         if (*ch >= '0' && *ch <= '9') {
             *result += (*ch - '0');
         } else if (*ch >= 'A' && *ch <= 'F') {
@@ -488,13 +1091,13 @@ static inline bool parse_hex(char *token, uint8_t length, uint16_t *result) {
         }
     }
 
-    return length == 0;
+    return true;
 }
 
-static inline bool parse_int(char *token, uint16_t *result) {
+static inline bool parse_int(const char *s, size_t n, uint16_t *result) {
     *result = 0;
 
-    for (char *ch = token; *ch != 0; ch++) {
+    for (const char *ch = s; ch < s + n; ch++) {
         *result *= 10;
         if (*ch >= '0' && *ch <= '9') {
             *result += (*ch - '0');
@@ -506,18 +1109,16 @@ static inline bool parse_int(char *token, uint16_t *result) {
     return true;
 }
 
-static inline bool parse_label(char *token) {
-    // Parsing a label involves validating the characters and then scanning the
-    // label list for the current label. If the label is found, we set the
-    // result value to the pointer into the label list. If the label is not
-    // found, we add the label and return the pointer to the newly added label.
+static inline bool parse_label(const char *s, size_t n) {
+    // Parsing a label involves validating the characters. The label itself
+    // is only looked up once every line has been assembled.
 
-    if (!((token[0] >= 'A' && token[0] <= 'Z') ||
-          (token[0] >= 'a' && token[0] <= 'z'))) {
+    if (n == 0 || !((s[0] >= 'A' && s[0] <= 'Z') ||
+                    (s[0] >= 'a' && s[0] <= 'z'))) {
         return false;
     }
 
-    for (char *ch = token; *ch != 0; ch++) {
+    for (const char *ch = s; ch < s + n; ch++) {
         if (!((*ch >= 'A' && *ch <= 'Z') || (*ch >= 'a' && *ch <= 'z') ||
               (*ch == '_') || (*ch >= '0' && *ch <= '9'))) {
             return false;
@@ -2,8 +2,63 @@
 #define BBB_ASSEM_H
 
 #include "../machine/memory.h"
+#include "debug.h"
+#include "fragment.h"
+#include "lexer.h"
+#include "object.h"
+#include "peephole.h"
+#include "source.h"
+#include "table.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ASSEM_MESSAGE_LENGTH 128
+
+// An error found while assembling, where the line and column are those of
+// the token at fault. Both are 0 for errors that belong to no line, such as
+// a reference to a label that is never defined.
+typedef struct assem_diagnostic {
+    uint32_t line;
+    uint32_t column;
+    char message[ASSEM_MESSAGE_LENGTH];
+} assem_diagnostic;
+
+// Storage for diagnostics provided by the caller. `count` is every error
+// found, but only the first `capacity` are kept in `items`.
+typedef struct assem_diagnostics {
+    assem_diagnostic *items;
+    size_t capacity;
+    size_t count;
+} assem_diagnostics;
+
+// Assembles programs held in memory, such as those generated by tests. The
+// tokens and symbol table are kept between programs, so once they have grown
+// to fit, assembling allocates nothing and prints nothing. An assembler may
+// only be used by one thread at a time; use one per thread.
+typedef struct assembler {
+    token_list tokens;
+    table *symbols;
+} assembler;
+
+// How build_file assembles a program. Fragments are cached in `fragments`,
+// the program is optimized by `peephole`, and the lines and symbols of the
+// finished program are added to `debug`, unless any of them is NULL.
+typedef struct build_options {
+    fragment_cache *fragments;
+    peephole *peephole;
+    debug_builder *debug;
+} build_options;
 
 memory *assemble(char *prog);
-memory *build_image(char *filename, char *prog);
+memory *build_image(const char *filename, const char *prog);
+memory *build_file(source_cache *cache, build_options *options, char *path);
+bool build_object(source_cache *cache, fragment_cache *fragments, char *path,
+                  object *obj);
+
+assembler *assembler_init();
+bool assembler_run(assembler *a, const char *prog, size_t length,
+                   memory *mem, assem_diagnostics *diagnostics);
+void assembler_free(assembler *a);
 
 #endif
@@ -0,0 +1,353 @@
+#include "debug.h"
+#include "../machine/alloc.h"
+#include "table.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define DEBUG_ARRAY_LENGTH 64
+#define DEBUG_HEADER_SIZE 24
+
+// A line and the order it was assembled in, so that where #org made two
+// lines write the same address, the later one can win.
+typedef struct debug_sorted {
+    debug_line line;
+    size_t order;
+} debug_sorted;
+
+static uint32_t debug_add_string(debug_builder *d, const char *s) {
+    size_t n = strlen(s) + 1;
+    uint32_t offset = d->string_count;
+
+    d->strings = alloc_grow(d->strings, &d->string_length, sizeof(char),
+                            d->string_count + n, DEBUG_ARRAY_LENGTH);
+    memcpy(d->strings + d->string_count, s, n);
+    d->string_count += n;
+    return offset;
+}
+
+void debug_add_line(debug_builder *d, const char *path, uint32_t line,
+                    uint32_t start, uint32_t length) {
+    // Lines come a file at a time, so the last file is checked first.
+    size_t file = d->file_count;
+
+    for (size_t i = d->file_count; i-- > 0;) {
+        if (strcmp(d->strings + d->files[i], path) == 0) {
+            file = i;
+            break;
+        }
+    }
+
+    if (file == d->file_count) {
+        d->files = alloc_grow(d->files, &d->file_length, sizeof(uint32_t),
+                              d->file_count + 1, DEBUG_ARRAY_LENGTH);
+        d->files[d->file_count++] = debug_add_string(d, path);
+    }
+
+    d->lines = alloc_grow(d->lines, &d->line_length, sizeof(debug_line),
+                          d->line_count + 1, DEBUG_ARRAY_LENGTH);
+    d->lines[d->line_count++] = (debug_line){start, length, file, line};
+}
+
+void debug_add_symbols(debug_builder *d, table *symbols) {
+    // Only the first definition of a label is kept, since that is the one
+    // references resolve to.
+    for (symbol *s = symbols->syms; s < symbols->syms_end; s++) {
+        if (s->label && table_symbol_lookup(symbols, s->label) == s) {
+            d->symbols =
+                alloc_grow(d->symbols, &d->symbol_length, sizeof(debug_symbol),
+                           d->symbol_count + 1, DEBUG_ARRAY_LENGTH);
+            d->symbols[d->symbol_count++] =
+                (debug_symbol){s->address, debug_add_string(d, s->label)};
+        }
+    }
+}
+
+void debug_builder_free(debug_builder *d) {
+    free(d->lines);
+    free(d->files);
+    free(d->symbols);
+    free(d->strings);
+    *d = (debug_builder){0};
+}
+
+static int debug_compare_line(const void *a, const void *b) {
+    const debug_sorted *x = a;
+    const debug_sorted *y = b;
+
+    if (x->line.start != y->line.start) {
+        return x->line.start < y->line.start ? -1 : 1;
+    }
+
+    return (x->order > y->order) - (x->order < y->order);
+}
+
+static int debug_compare_symbol(const void *a, const void *b) {
+    // Symbols at the same address keep the order they were defined in.
+    const debug_symbol *x = a;
+    const debug_symbol *y = b;
+
+    if (x->address != y->address) {
+        return x->address < y->address ? -1 : 1;
+    }
+
+    return (x->name > y->name) - (x->name < y->name);
+}
+
+static bool debug_put(FILE *out, uint32_t value) {
+    uint8_t bytes[4] = {value, value >> 8, value >> 16, value >> 24};
+    return fwrite(bytes, 1, 4, out) == 4;
+}
+
+static size_t debug_sort_lines(debug_builder *d, debug_line *lines) {
+    // Sorts the lines by address and trims any that a later one overlaps.
+    // Returns how many are left.
+    debug_sorted *sorted = alloc_array(d->line_count, sizeof(debug_sorted));
+    size_t count = 0;
+
+    for (size_t i = 0; i < d->line_count; i++) {
+        sorted[i] = (debug_sorted){d->lines[i], i};
+    }
+
+    qsort(sorted, d->line_count, sizeof(debug_sorted), debug_compare_line);
+
+    for (size_t i = 0; i < d->line_count; i++) {
+        debug_line *line = &sorted[i].line;
+
+        if (line->length == 0) {
+            continue;
+        }
+
+        if (count > 0 &&
+            lines[count - 1].start + lines[count - 1].length > line->start) {
+            lines[count - 1].length = line->start - lines[count - 1].start;
+            count -= lines[count - 1].length == 0;
+        }
+
+        lines[count++] = *line;
+    }
+
+    free(sorted);
+    return count;
+}
+
+bool debug_write(const char *path, debug_builder *d) {
+    debug_line *lines = alloc_array(d->line_count, sizeof(debug_line));
+    size_t line_count = debug_sort_lines(d, lines);
+    FILE *out = fopen(path, "wb");
+
+    qsort(d->symbols, d->symbol_count, sizeof(debug_symbol),
+          debug_compare_symbol);
+
+    bool success = out && fwrite("BBBD", 1, 4, out) == 4 &&
+                   debug_put(out, DEBUG_VERSION) &&
+                   debug_put(out, line_count) &&
+                   debug_put(out, d->file_count) &&
+                   debug_put(out, d->symbol_count) &&
+                   debug_put(out, d->string_count);
+
+    for (size_t i = 0; success && i < line_count; i++) {
+        success = debug_put(out, lines[i].start) &&
+                  debug_put(out, lines[i].length) &&
+                  debug_put(out, lines[i].file) &&
+                  debug_put(out, lines[i].line);
+    }
+
+    for (size_t i = 0; success && i < d->file_count; i++) {
+        success = debug_put(out, d->files[i]);
+    }
+
+    for (size_t i = 0; success && i < d->symbol_count; i++) {
+        success = debug_put(out, d->symbols[i].address) &&
+                  debug_put(out, d->symbols[i].name);
+    }
+
+    success = success && fwrite(d->strings, 1, d->string_count, out) ==
+                             d->string_count;
+
+    if (out) {
+        success = fclose(out) == 0 && success;
+    }
+
+    free(lines);
+    return success;
+}
+
+static uint32_t debug_get(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static bool debug_valid(debug_info *info) {
+    // Everything the lookups rely on is checked once, when the file is
+    // loaded: the tables fit, every offset is in range, and the lines and
+    // symbols are sorted.
+    const uint8_t *data = info->data;
+    size_t length = info->length;
+
+    if (length < DEBUG_HEADER_SIZE || memcmp(data, "BBBD", 4) != 0 ||
+        debug_get(data + 4) != DEBUG_VERSION) {
+        return false;
+    }
+
+    info->line_count = debug_get(data + 8);
+    info->file_count = debug_get(data + 12);
+    info->symbol_count = debug_get(data + 16);
+    info->string_count = debug_get(data + 20);
+
+    uint64_t size = DEBUG_HEADER_SIZE + 16 * (uint64_t)info->line_count +
+                    4 * (uint64_t)info->file_count +
+                    8 * (uint64_t)info->symbol_count + info->string_count;
+
+    if (size != length) {
+        return false;
+    }
+
+    info->lines = data + DEBUG_HEADER_SIZE;
+    info->files = info->lines + 16 * (size_t)info->line_count;
+    info->symbols = info->files + 4 * (size_t)info->file_count;
+    info->strings =
+        (const char *)info->symbols + 8 * (size_t)info->symbol_count;
+
+    if (info->string_count > 0 &&
+        info->strings[info->string_count - 1] != '\0') {
+        return false;
+    }
+
+    uint64_t end = 0;
+
+    for (uint32_t i = 0; i < info->line_count; i++) {
+        const uint8_t *line = info->lines + 16 * (size_t)i;
+        uint32_t start = debug_get(line);
+
+        if (start < end || debug_get(line + 8) >= info->file_count) {
+            return false;
+        }
+
+        end = (uint64_t)start + debug_get(line + 4);
+    }
+
+    for (uint32_t i = 0; i < info->file_count; i++) {
+        if (debug_get(info->files + 4 * (size_t)i) >= info->string_count) {
+            return false;
+        }
+    }
+
+    uint32_t address = 0;
+
+    for (uint32_t i = 0; i < info->symbol_count; i++) {
+        const uint8_t *sym = info->symbols + 8 * (size_t)i;
+
+        if (debug_get(sym) < address ||
+            debug_get(sym + 4) >= info->string_count) {
+            return false;
+        }
+
+        address = debug_get(sym);
+    }
+
+    return true;
+}
+
+bool debug_load(const char *path, debug_info *info) {
+    // Maps a debug file. Lookups read straight from the mapping.
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+
+    *info = (debug_info){0};
+
+    if (fd < 0) {
+        return false;
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    void *mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+
+    info->data = mapped;
+    info->length = st.st_size;
+
+    if (!debug_valid(info)) {
+        debug_unload(info);
+        return false;
+    }
+
+    return true;
+}
+
+static uint32_t debug_search(const uint8_t *table, uint32_t count,
+                             size_t size, uint32_t address) {
+    // The number of entries that start at or before an address.
+    uint32_t lo = 0;
+    uint32_t hi = count;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+
+        if (debug_get(table + mid * size) <= address) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+bool debug_find_line(debug_info *info, uint32_t address, const char **file,
+                     uint32_t *line) {
+    // Finds the source line that wrote an address.
+    uint32_t i = debug_search(info->lines, info->line_count, 16, address);
+
+    if (i == 0) {
+        return false;
+    }
+
+    const uint8_t *entry = info->lines + 16 * (size_t)(i - 1);
+
+    if (address - debug_get(entry) >= debug_get(entry + 4)) {
+        return false;
+    }
+
+    *file = info->strings +
+            debug_get(info->files + 4 * (size_t)debug_get(entry + 8));
+    *line = debug_get(entry + 12);
+    return true;
+}
+
+const char *debug_find_symbol(debug_info *info, uint32_t address,
+                              uint32_t *offset) {
+    // Finds the closest label at or before an address, and how far past it
+    // the address is. Returns NULL if there is none.
+    uint32_t i = debug_search(info->symbols, info->symbol_count, 8, address);
+
+    if (i == 0) {
+        return NULL;
+    }
+
+    const uint8_t *entry = info->symbols + 8 * (size_t)(i - 1);
+    *offset = address - debug_get(entry);
+    return info->strings + debug_get(entry + 4);
+}
+
+void debug_unload(debug_info *info) {
+    if (info->data) {
+        munmap((void *)info->data, info->length);
+    }
+
+    *info = (debug_info){0};
+}
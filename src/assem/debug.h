@@ -0,0 +1,82 @@
+#ifndef BBB_DEBUG_H
+#define BBB_DEBUG_H
+
+#include "table.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DEBUG_VERSION 1
+
+// The extension added to an image's path for its debug file.
+#define DEBUG_EXTENSION ".dbg"
+
+// A debug file starts with "BBBD", a version, and the number of lines,
+// files and symbols and the size of the string table, each a little-endian
+// 32-bit word. Then come the lines, sorted by address and never
+// overlapping, as four words each: start, length, file and line number;
+// the files, as the offset of each path in the string table; the symbols,
+// sorted by address, as their address and the offset of their name; and
+// the string table of NUL-terminated strings. Every table is a run of
+// words, so the file can be searched in place once it is mapped.
+typedef struct debug_line {
+    uint32_t start;
+    uint32_t length;
+    uint32_t file;
+    uint32_t line;
+} debug_line;
+
+typedef struct debug_symbol {
+    uint32_t address;
+    uint32_t name;
+} debug_symbol;
+
+// Debug information collected while a program is assembled.
+typedef struct debug_builder {
+    debug_line *lines;
+    size_t line_count;
+    size_t line_length;
+
+    uint32_t *files;
+    size_t file_count;
+    size_t file_length;
+
+    debug_symbol *symbols;
+    size_t symbol_count;
+    size_t symbol_length;
+
+    char *strings;
+    size_t string_count;
+    size_t string_length;
+} debug_builder;
+
+// A mapped debug file.
+typedef struct debug_info {
+    const uint8_t *data;
+    size_t length;
+
+    uint32_t line_count;
+    uint32_t file_count;
+    uint32_t symbol_count;
+    uint32_t string_count;
+
+    const uint8_t *lines;
+    const uint8_t *files;
+    const uint8_t *symbols;
+    const char *strings;
+} debug_info;
+
+void debug_add_line(debug_builder *d, const char *path, uint32_t line,
+                    uint32_t start, uint32_t length);
+void debug_add_symbols(debug_builder *d, table *symbols);
+bool debug_write(const char *path, debug_builder *d);
+void debug_builder_free(debug_builder *d);
+
+bool debug_load(const char *path, debug_info *info);
+bool debug_find_line(debug_info *info, uint32_t address, const char **file,
+                     uint32_t *line);
+const char *debug_find_symbol(debug_info *info, uint32_t address,
+                              uint32_t *offset);
+void debug_unload(debug_info *info);
+
+#endif
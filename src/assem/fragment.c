@@ -0,0 +1,312 @@
+#include "fragment.h"
+#include "../machine/alloc.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FRAGMENT_ARRAY_LENGTH 16
+
+// Fragment files are a cache, so they are written in the host's byte order
+// and simply missed if they were written by a different version.
+typedef struct fragment_header {
+    char magic[4];
+    uint32_t version;
+    uint64_t hash;
+    uint32_t start;
+    uint32_t end;
+    uint32_t range_count;
+    uint32_t quad_count;
+    uint32_t instruction_count;
+    uint32_t line_count;
+    uint32_t symbol_count;
+    uint32_t ref_count;
+    uint32_t label_count;
+} fragment_header;
+
+uint64_t fragment_hash(uint64_t hash, const char *text, size_t length) {
+    // 64-bit FNV-1a, continued from `hash`. Start from 0 for a new hash.
+    if (hash == 0) {
+        hash = 14695981039346656037ull;
+    }
+
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t)text[i]) * 1099511628211ull;
+    }
+
+    return hash;
+}
+
+void fragment_add_range(fragment *f, uint32_t start, uint32_t length) {
+    // Writes that follow on from the previous one extend it.
+    if (f->range_count > 0) {
+        fragment_range *last = &f->ranges[f->range_count - 1];
+
+        if (last->start + last->length == start) {
+            last->length += length;
+            return;
+        }
+    }
+
+    f->ranges = alloc_grow(f->ranges, &f->range_length, sizeof(fragment_range),
+                           f->range_count + 1, FRAGMENT_ARRAY_LENGTH);
+    f->ranges[f->range_count++] = (fragment_range){start, length};
+}
+
+void fragment_add_instruction(fragment *f, uint32_t start, uint32_t length) {
+    f->instructions =
+        alloc_grow(f->instructions, &f->instruction_length,
+                   sizeof(fragment_range), f->instruction_count + 1,
+                   FRAGMENT_ARRAY_LENGTH);
+    f->instructions[f->instruction_count++] = (fragment_range){start, length};
+}
+
+void fragment_add_line(fragment *f, uint32_t start, uint32_t length,
+                       uint32_t line) {
+    f->lines = alloc_grow(f->lines, &f->line_length, sizeof(fragment_line),
+                          f->line_count + 1, FRAGMENT_ARRAY_LENGTH);
+    f->lines[f->line_count++] = (fragment_line){start, length, line};
+}
+
+static void fragment_add_label(fragment *f, fragment_label **labels,
+                               size_t *count, size_t *length,
+                               const char *label, uint32_t value) {
+    size_t n = strlen(label);
+
+    *labels = alloc_grow(*labels, length, sizeof(fragment_label), *count + 1,
+                         FRAGMENT_ARRAY_LENGTH);
+    (*labels)[(*count)++] = (fragment_label){value, n};
+
+    f->labels = alloc_grow(f->labels, &f->label_length, sizeof(char),
+                           f->label_count + n, FRAGMENT_ARRAY_LENGTH);
+    memcpy(f->labels + f->label_count, label, n);
+    f->label_count += n;
+}
+
+void fragment_add_symbol(fragment *f, const char *label, uint32_t address) {
+    fragment_add_label(f, &f->symbols, &f->symbol_count, &f->symbol_length,
+                       label, address);
+}
+
+void fragment_add_ref(fragment *f, const char *label, uint32_t offset) {
+    fragment_add_label(f, &f->refs, &f->ref_count, &f->ref_length, label,
+                       offset);
+}
+
+void fragment_capture(fragment *f, const uint8_t *data) {
+    // Copies the quads written in each range out of memory.
+    size_t count = 0;
+
+    for (size_t i = 0; i < f->range_count; i++) {
+        count += f->ranges[i].length;
+    }
+
+    free(f->quads);
+    f->quads = malloc(count ? count : 1);
+    f->quad_count = 0;
+
+    for (size_t i = 0; i < f->range_count; i++) {
+        memcpy(f->quads + f->quad_count, data + f->ranges[i].start,
+               f->ranges[i].length);
+        f->quad_count += f->ranges[i].length;
+    }
+}
+
+void fragment_free(fragment *f) {
+    free(f->ranges);
+    free(f->quads);
+    free(f->instructions);
+    free(f->lines);
+    free(f->symbols);
+    free(f->refs);
+    free(f->labels);
+    *f = (fragment){0};
+}
+
+fragment_cache *fragment_cache_init(const char *dir) {
+    // Creates the directory, and any missing parents, if necessary.
+    char path[PATH_MAX];
+
+    if (snprintf(path, sizeof(path), "%s", dir) >= (int)sizeof(path)) {
+        return NULL;
+    }
+
+    for (char *p = path + 1;; p++) {
+        if (*p == '/' || *p == '\0') {
+            char end = *p;
+            *p = '\0';
+
+            if (mkdir(path, 0777) != 0 && errno != EEXIST) {
+                return NULL;
+            }
+
+            if (end == '\0') {
+                break;
+            }
+
+            *p = end;
+        }
+    }
+
+    fragment_cache *c = calloc(1, sizeof(fragment_cache));
+    c->dir = strdup(dir);
+    return c;
+}
+
+static void fragment_path(fragment_cache *c, uint64_t hash, uint32_t start,
+                          char *path, size_t size) {
+    snprintf(path, size, "%s/%016" PRIx64 "-%05" PRIx32 ".frag", c->dir, hash,
+             start);
+}
+
+static bool fragment_read(FILE *in, void *data, size_t size, size_t count) {
+    return count == 0 || fread(data, size, count, in) == count;
+}
+
+bool fragment_load(fragment_cache *c, uint64_t hash, uint32_t start,
+                   fragment *f) {
+    char path[PATH_MAX];
+    fragment_header h;
+
+    fragment_path(c, hash, start, path, sizeof(path));
+    FILE *in = fopen(path, "rb");
+
+    if (!in) {
+        c->misses++;
+        return false;
+    }
+
+    bool valid = fread(&h, sizeof(h), 1, in) == 1 &&
+                 memcmp(h.magic, "BBBF", 4) == 0 &&
+                 h.version == FRAGMENT_VERSION && h.hash == hash &&
+                 h.start == start;
+
+    *f = (fragment){0};
+
+    if (valid) {
+        f->hash = h.hash;
+        f->start = h.start;
+        f->end = h.end;
+        f->range_count = f->range_length = h.range_count;
+        f->quad_count = h.quad_count;
+        f->instruction_count = f->instruction_length = h.instruction_count;
+        f->line_count = f->line_length = h.line_count;
+        f->symbol_count = f->symbol_length = h.symbol_count;
+        f->ref_count = f->ref_length = h.ref_count;
+        f->label_count = f->label_length = h.label_count;
+
+        f->ranges = alloc_array(h.range_count, sizeof(fragment_range));
+        f->quads = alloc_array(h.quad_count, 1);
+        f->instructions =
+            alloc_array(h.instruction_count, sizeof(fragment_range));
+        f->lines = alloc_array(h.line_count, sizeof(fragment_line));
+        f->symbols = alloc_array(h.symbol_count, sizeof(fragment_label));
+        f->refs = alloc_array(h.ref_count, sizeof(fragment_label));
+        f->labels = alloc_array(h.label_count, 1);
+
+        valid = fragment_read(in, f->ranges, sizeof(fragment_range),
+                              h.range_count) &&
+                fragment_read(in, f->quads, 1, h.quad_count) &&
+                fragment_read(in, f->instructions, sizeof(fragment_range),
+                              h.instruction_count) &&
+                fragment_read(in, f->lines, sizeof(fragment_line),
+                              h.line_count) &&
+                fragment_read(in, f->symbols, sizeof(fragment_label),
+                              h.symbol_count) &&
+                fragment_read(in, f->refs, sizeof(fragment_label),
+                              h.ref_count) &&
+                fragment_read(in, f->labels, 1, h.label_count);
+    }
+
+    fclose(in);
+
+    // The lengths must add up, or the file cannot be trusted.
+    size_t quads = 0;
+    size_t labels = 0;
+
+    for (size_t i = 0; valid && i < f->range_count; i++) {
+        quads += f->ranges[i].length;
+    }
+
+    for (size_t i = 0; valid && i < f->symbol_count; i++) {
+        labels += f->symbols[i].length;
+    }
+
+    for (size_t i = 0; valid && i < f->ref_count; i++) {
+        labels += f->refs[i].length;
+    }
+
+    valid = valid && quads == f->quad_count && labels == f->label_count;
+
+    if (!valid) {
+        fragment_free(f);
+        c->misses++;
+        return false;
+    }
+
+    c->hits++;
+    return true;
+}
+
+bool fragment_store(fragment_cache *c, fragment *f) {
+    // Written under a temporary name and renamed into place, so a fragment
+    // is either complete or missing.
+    char path[PATH_MAX];
+    char temp[PATH_MAX + 16];
+    fragment_header h = {.magic = {'B', 'B', 'B', 'F'},
+                         .version = FRAGMENT_VERSION,
+                         .hash = f->hash,
+                         .start = f->start,
+                         .end = f->end,
+                         .range_count = f->range_count,
+                         .quad_count = f->quad_count,
+                         .instruction_count = f->instruction_count,
+                         .line_count = f->line_count,
+                         .symbol_count = f->symbol_count,
+                         .ref_count = f->ref_count,
+                         .label_count = f->label_count};
+
+    fragment_path(c, f->hash, f->start, path, sizeof(path));
+    snprintf(temp, sizeof(temp), "%s.%d", path, (int)getpid());
+
+    FILE *out = fopen(temp, "wb");
+
+    if (!out) {
+        return false;
+    }
+
+    bool success =
+        fwrite(&h, sizeof(h), 1, out) == 1 &&
+        fwrite(f->ranges, sizeof(fragment_range), f->range_count, out) ==
+            f->range_count &&
+        fwrite(f->quads, 1, f->quad_count, out) == f->quad_count &&
+        fwrite(f->instructions, sizeof(fragment_range), f->instruction_count,
+               out) == f->instruction_count &&
+        fwrite(f->lines, sizeof(fragment_line), f->line_count, out) ==
+            f->line_count &&
+        fwrite(f->symbols, sizeof(fragment_label), f->symbol_count, out) ==
+            f->symbol_count &&
+        fwrite(f->refs, sizeof(fragment_label), f->ref_count, out) ==
+            f->ref_count &&
+        fwrite(f->labels, 1, f->label_count, out) == f->label_count;
+
+    success = fclose(out) == 0 && success;
+
+    if (!success || rename(temp, path) != 0) {
+        remove(temp);
+        return false;
+    }
+
+    return true;
+}
+
+void fragment_cache_free(fragment_cache *c) {
+    free(c->dir);
+    free(c);
+}
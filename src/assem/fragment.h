@@ -0,0 +1,96 @@
+#ifndef BBB_FRAGMENT_H
+#define BBB_FRAGMENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define FRAGMENT_VERSION 3
+
+// Fragments that start with #org do not depend on where the previous one
+// ended, and are cached under this start instead of their actual one.
+#define FRAGMENT_ABSOLUTE 0x10000
+
+// The output of assembling a run of source lines that contains no #inc
+// and no #org after its first line: the quads written, the labels defined,
+// and the references still to be resolved. Symbols hold addresses and
+// references hold the offset of the quartet to patch; their names are
+// stored back to back in `labels`. `instructions` are the parts of the
+// ranges written by instructions rather than #data, for the optimizer, and
+// `lines` what each line wrote, for debug information.
+typedef struct fragment_range {
+    uint32_t start;
+    uint32_t length;
+} fragment_range;
+
+// Lines are numbered from the first line of the run that has tokens, since
+// blank lines and comments are not part of the hash.
+typedef struct fragment_line {
+    uint32_t start;
+    uint32_t length;
+    uint32_t line;
+} fragment_line;
+
+typedef struct fragment_label {
+    uint32_t value;
+    uint32_t length;
+} fragment_label;
+
+typedef struct fragment {
+    uint64_t hash;
+    uint32_t start;
+    uint32_t end;
+
+    fragment_range *ranges;
+    size_t range_count;
+    size_t range_length;
+
+    uint8_t *quads;
+    size_t quad_count;
+
+    fragment_range *instructions;
+    size_t instruction_count;
+    size_t instruction_length;
+
+    fragment_line *lines;
+    size_t line_count;
+    size_t line_length;
+
+    fragment_label *symbols;
+    size_t symbol_count;
+    size_t symbol_length;
+
+    fragment_label *refs;
+    size_t ref_count;
+    size_t ref_length;
+
+    char *labels;
+    size_t label_count;
+    size_t label_length;
+} fragment;
+
+// Fragments are kept in a directory, one file per fragment, named after the
+// hash of their source text and where they start.
+typedef struct fragment_cache {
+    char *dir;
+    size_t hits;
+    size_t misses;
+} fragment_cache;
+
+fragment_cache *fragment_cache_init(const char *dir);
+bool fragment_load(fragment_cache *c, uint64_t hash, uint32_t start,
+                   fragment *f);
+bool fragment_store(fragment_cache *c, fragment *f);
+void fragment_cache_free(fragment_cache *c);
+
+uint64_t fragment_hash(uint64_t hash, const char *text, size_t length);
+void fragment_add_range(fragment *f, uint32_t start, uint32_t length);
+void fragment_add_instruction(fragment *f, uint32_t start, uint32_t length);
+void fragment_add_line(fragment *f, uint32_t start, uint32_t length,
+                       uint32_t line);
+void fragment_add_symbol(fragment *f, const char *label, uint32_t address);
+void fragment_add_ref(fragment *f, const char *label, uint32_t offset);
+void fragment_capture(fragment *f, const uint8_t *data);
+void fragment_free(fragment *f);
+
+#endif
@@ -0,0 +1,141 @@
+#include "lexer.h"
+#include "../machine/alloc.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Token separators. The line break is handled separately.
+static const bool spaces[256] = {[' '] = true, ['\t'] = true, ['\r'] = true};
+
+#define IS_SPACE(c) (spaces[(unsigned char)(c)])
+
+#define TOKENS_LENGTH 256
+#define LINES_LENGTH 64
+
+static void lexer_find_line_end(lexer *lx) {
+    const char *newline = memchr(lx->cursor, '\n', lx->end - lx->cursor);
+    lx->line_end = newline ? newline : lx->end;
+}
+
+void lexer_init(lexer *lx, const char *source, size_t length) {
+    lx->cursor = source;
+    lx->end = source + length;
+    lx->line_start = source;
+    lx->line = 1;
+    lx->column = 1;
+    lexer_find_line_end(lx);
+}
+
+bool lexer_next(lexer *lx, token *t) {
+    // Returns the next token on the current line, or false once the line
+    // has run out. Comments are skipped with memchr, which is much faster
+    // than stepping over them a byte at a time.
+    const char *p = lx->cursor;
+    const char *end = lx->line_end;
+
+    for (;;) {
+        while (p < end && IS_SPACE(*p)) {
+            p++;
+        }
+
+        if (p == end || *p != '(') {
+            break;
+        }
+
+        const char *close = memchr(p, ')', end - p);
+        p = close ? close + 1 : end;
+    }
+
+    if (p == end) {
+        lx->cursor = p;
+        return false;
+    }
+
+    t->start = p;
+    t->line = lx->line;
+    t->column = lx->column = p - lx->line_start + 1;
+
+    while (p < end && !IS_SPACE(*p)) {
+        p++;
+    }
+
+    t->length = p - t->start;
+    lx->cursor = p;
+    return true;
+}
+
+bool lexer_next_line(lexer *lx) {
+    // Skips whatever is left of the current line. Returns false if there is
+    // no next line.
+    if (lx->line_end == lx->end) {
+        lx->cursor = lx->end;
+        return false;
+    }
+
+    lx->cursor = lx->line_start = lx->line_end + 1;
+    lx->line++;
+    lx->column = 1;
+    lexer_find_line_end(lx);
+    return true;
+}
+
+size_t lexer_line_length(lexer *lx) {
+    return lx->line_end - lx->line_start;
+}
+
+void lexer_tokenize(token_list *list, const char *source, size_t length) {
+    // Appends every token in the source to the list. The tokens still point
+    // into the source, so it has to outlive the list.
+    lexer lx;
+    token t;
+
+    lexer_init(&lx, source, length);
+
+    do {
+        size_t first = list->token_count;
+
+        while (lexer_next(&lx, &t)) {
+            if (list->token_count == list->token_length) {
+                list->tokens = alloc_grow(list->tokens, &list->token_length,
+                                          sizeof(token), list->token_count + 1,
+                                          TOKENS_LENGTH);
+            }
+
+            list->tokens[list->token_count++] = t;
+        }
+
+        if (list->token_count == first) {
+            continue;
+        }
+
+        if (list->line_count == list->line_length) {
+            list->lines = alloc_grow(list->lines, &list->line_length,
+                                     sizeof(token_line), list->line_count + 1,
+                                     LINES_LENGTH);
+        }
+
+        list->lines[list->line_count++] =
+            (token_line){.text = lx.line_start,
+                         .length = lexer_line_length(&lx),
+                         .line = lx.line,
+                         .first = first,
+                         .count = list->token_count - first};
+    } while (lexer_next_line(&lx));
+}
+
+void token_list_free(token_list *list) {
+    free(list->tokens);
+    free(list->lines);
+    *list = (token_list){0};
+}
+
+bool token_equal(token *t, const char *s) {
+    // Most comparisons fail on the first character, so check it before
+    // calling strncmp.
+    return t->start[0] == s[0] && strncmp(t->start, s, t->length) == 0 &&
+           s[t->length] == '\0';
+}
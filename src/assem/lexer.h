@@ -0,0 +1,59 @@
+#ifndef BBB_LEXER_H
+#define BBB_LEXER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A token is a slice of the source buffer. Nothing is copied, and the source
+// is never modified, so tokens are not NUL-terminated.
+typedef struct token {
+    const char *start;
+    size_t length;
+    uint32_t line;
+    uint32_t column;
+} token;
+
+// The lexer walks the whole source buffer once, a line at a time. Tokens are
+// separated by spaces and tabs, and a token that starts with '(' opens a
+// comment that runs to the next ')' or to the end of the line. `column` is
+// that of the last token returned, so errors can point at it.
+typedef struct lexer {
+    const char *cursor;
+    const char *end;
+    const char *line_start;
+    const char *line_end;
+    uint32_t line;
+    uint32_t column;
+} lexer;
+
+// A whole source buffer lexed ahead of time. Only lines with tokens are
+// kept, each with its text for error messages and its run of tokens.
+typedef struct token_line {
+    const char *text;
+    uint32_t length;
+    uint32_t line;
+    size_t first;
+    size_t count;
+} token_line;
+
+typedef struct token_list {
+    token *tokens;
+    size_t token_count;
+    size_t token_length;
+    token_line *lines;
+    size_t line_count;
+    size_t line_length;
+} token_list;
+
+void lexer_init(lexer *lx, const char *source, size_t length);
+bool lexer_next(lexer *lx, token *t);
+bool lexer_next_line(lexer *lx);
+size_t lexer_line_length(lexer *lx);
+
+void lexer_tokenize(token_list *list, const char *source, size_t length);
+void token_list_free(token_list *list);
+
+bool token_equal(token *t, const char *s);
+
+#endif
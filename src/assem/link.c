@@ -0,0 +1,362 @@
+#include "link.h"
+#include "../machine/alloc.h"
+#include "../machine/cpu.h"
+#include "lexer.h"
+#include "object.h"
+#include "table.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PLACEMENTS_LENGTH 16
+
+// A section placed in the image. Sections are resolved by the worker that
+// claims them, so each one is patched by a single thread, and no two placed
+// sections overlap.
+typedef struct link_section {
+    object *object;
+    object_section *section;
+    char *name;
+    uint32_t address;
+} link_section;
+
+typedef struct link_job {
+    link_section *sections;
+    size_t section_count;
+    atomic_size_t next;
+    atomic_bool failed;
+
+    table *symbols;
+    memory *image;
+} link_job;
+
+static bool link_parse_address(token *t, uint32_t *address) {
+    // Addresses are four hex digits, as for #org.
+    *address = 0;
+
+    if (t->length != 4) {
+        return false;
+    }
+
+    for (size_t i = 0; i < t->length; i++) {
+        char ch = t->start[i];
+
+        if (ch >= '0' && ch <= '9') {
+            *address = *address << 4 | (ch - '0');
+        } else if (ch >= 'A' && ch <= 'F') {
+            *address = *address << 4 | (ch - 'A' + 0xA);
+        } else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool link_map_load(link_map *map, const char *path) {
+    // Each line of a placement map names an object and the address for its
+    // relocatable section. Comments are written as in assembly source.
+    FILE *in = fopen(path, "rb");
+    token_list list = {0};
+    bool valid = true;
+
+    *map = (link_map){0};
+
+    if (!in) {
+        fprintf(stderr, "error: unable to read placement map '%s'\n", path);
+        return false;
+    }
+
+    fseek(in, 0L, SEEK_END);
+    long length = ftell(in);
+    fseek(in, 0L, SEEK_SET);
+
+    char *text = calloc(length > 0 ? length + 1 : 1, sizeof(char));
+    valid = length >= 0 && fread(text, 1, length, in) == (size_t)length;
+    fclose(in);
+
+    if (valid) {
+        lexer_tokenize(&list, text, length);
+    }
+
+    for (size_t i = 0; valid && i < list.line_count; i++) {
+        token_line *line = &list.lines[i];
+        token *tokens = &list.tokens[line->first];
+        uint32_t address;
+
+        if (line->count != 2 || !link_parse_address(&tokens[1], &address)) {
+            fprintf(stderr, "error: expected an object and an address\n");
+            fprintf(stderr, "%s:%u:%u: %.*s\n", path, line->line,
+                    tokens[0].column, (int)line->length, line->text);
+            valid = false;
+            break;
+        }
+
+        map->placements = alloc_grow(
+            map->placements, &map->placement_length, sizeof(link_placement),
+            map->placement_count + 1, PLACEMENTS_LENGTH);
+
+        map->placements[map->placement_count++] = (link_placement){
+            strndup(tokens[0].start, tokens[0].length), address};
+    }
+
+    token_list_free(&list);
+    free(text);
+
+    if (!valid) {
+        link_map_free(map);
+    }
+
+    return valid;
+}
+
+void link_map_free(link_map *map) {
+    for (size_t i = 0; i < map->placement_count; i++) {
+        free(map->placements[i].name);
+    }
+
+    free(map->placements);
+    *map = (link_map){0};
+}
+
+static link_placement *link_map_find(link_map *map, const char *name) {
+    const char *slash = strrchr(name, '/');
+    const char *base = slash ? slash + 1 : name;
+
+    for (size_t i = 0; map && i < map->placement_count; i++) {
+        if (strcmp(map->placements[i].name, name) == 0 ||
+            strcmp(map->placements[i].name, base) == 0) {
+            return &map->placements[i];
+        }
+    }
+
+    return NULL;
+}
+
+static int link_section_compare(const void *a, const void *b) {
+    const link_section *x = a;
+    const link_section *y = b;
+    return (x->address > y->address) - (x->address < y->address);
+}
+
+static bool link_place(link_section *sections, size_t count, link_map *map) {
+    // Relocatable sections follow one another from address 0 unless the
+    // map places them; a placed section moves the ones after it along too.
+    uint32_t next = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        link_section *s = &sections[i];
+
+        if (s->section->absolute) {
+            s->address = s->section->origin;
+            continue;
+        }
+
+        link_placement *p = link_map_find(map, s->name);
+        s->address = p ? p->address : next;
+        next = s->address + s->section->length;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        link_section *s = &sections[i];
+
+        if (s->address + s->section->length > CPU_MAX_ADDRESS) {
+            fprintf(stderr, "error: '%s' does not fit at %04X\n", s->name,
+                    s->address);
+            return false;
+        }
+    }
+
+    // Once sorted by address, a section overlaps another if it starts before
+    // the end of the furthest-reaching one before it.
+    link_section *sorted = alloc_array(count, sizeof(link_section));
+    link_section *furthest = NULL;
+    bool valid = true;
+
+    memcpy(sorted, sections, count * sizeof(link_section));
+    qsort(sorted, count, sizeof(link_section), link_section_compare);
+
+    for (size_t i = 0; i < count && valid; i++) {
+        link_section *s = &sorted[i];
+
+        if (s->section->length == 0) {
+            continue;
+        }
+
+        if (furthest &&
+            furthest->address + furthest->section->length > s->address) {
+            fprintf(stderr, "error: '%s' at %04X overlaps '%s' at %04X\n",
+                    s->name, s->address, furthest->name, furthest->address);
+            valid = false;
+        }
+
+        if (!furthest || s->address + s->section->length >
+                             furthest->address + furthest->section->length) {
+            furthest = s;
+        }
+    }
+
+    free(sorted);
+    return valid;
+}
+
+static bool link_define(table *symbols, link_section *sections,
+                        size_t count) {
+    // Every object shares one namespace, so a label may only be defined
+    // once across all of them.
+    for (size_t i = 0; i < count; i++) {
+        object *o = sections[i].object;
+
+        // An object's sections are adjacent, so its symbols are defined
+        // when its first section is reached.
+        if (i > 0 && sections[i - 1].object == o) {
+            continue;
+        }
+
+        for (size_t j = 0; j < o->symbol_count; j++) {
+            object_label *l = &o->symbols[j];
+            char *label = o->labels + l->label;
+            link_section *s = &sections[i + l->section];
+
+            if (table_symbol_lookup(symbols, label)) {
+                fprintf(stderr, "error: '%s' is defined more than once\n",
+                        label);
+                return false;
+            }
+
+            table_symbol_define(symbols, label, s->address + l->offset);
+        }
+    }
+
+    return true;
+}
+
+static void *link_worker(void *arg) {
+    // Claims sections until there are none left, copying each into the
+    // image and patching its relocations. Symbols are only read here.
+    link_job *job = (link_job *)arg;
+
+    for (;;) {
+        size_t i = atomic_fetch_add(&job->next, 1);
+
+        if (i >= job->section_count) {
+            break;
+        }
+
+        link_section *s = &job->sections[i];
+        object_section *section = s->section;
+        uint8_t *data = job->image->data + s->address;
+
+        memcpy(data, section->quads, section->length);
+
+        for (size_t j = 0; j < section->reloc_count; j++) {
+            object_label *r = &s->object->relocs[section->reloc_first + j];
+            char *label = s->object->labels + r->label;
+            symbol *sym = table_symbol_lookup(job->symbols, label);
+
+            if (!sym) {
+                fprintf(stderr,
+                        "error: reference to undefined symbol '%s' in '%s'\n",
+                        label, s->name);
+                atomic_store(&job->failed, true);
+                continue;
+            }
+
+            uint16_t addr = sym->address;
+            data[r->offset + 0] = (addr >> 12) & 0xF;
+            data[r->offset + 1] = (addr >> 8) & 0xF;
+            data[r->offset + 2] = (addr >> 4) & 0xF;
+            data[r->offset + 3] = (addr >> 0) & 0xF;
+        }
+    }
+
+    return NULL;
+}
+
+static void link_resolve(link_job *job) {
+    // Sections are independent once every symbol is known, so they are
+    // resolved in parallel. Threads are only started if there is more than
+    // one section.
+    pthread_t threads[LINK_MAX_WORKERS];
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t count = cores < 1                  ? 1
+                   : cores > LINK_MAX_WORKERS ? LINK_MAX_WORKERS
+                                              : (size_t)cores;
+
+    if (count > job->section_count) {
+        count = job->section_count;
+    }
+
+    if (count <= 1) {
+        link_worker(job);
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (pthread_create(&threads[i], NULL, link_worker, job) != 0) {
+            count = i;
+            break;
+        }
+    }
+
+    if (count == 0) {
+        link_worker(job);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+memory *link_objects(object *objects, char **names, size_t count,
+                     link_map *map) {
+    // Links objects into an image. `names` are used to find objects in the
+    // placement map, which may be NULL, and in diagnostics.
+    size_t section_count = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        section_count += objects[i].section_count;
+    }
+
+    link_section *sections = alloc_array(section_count, sizeof(link_section));
+    size_t n = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        for (size_t j = 0; j < objects[i].section_count; j++) {
+            sections[n++] = (link_section){.object = &objects[i],
+                                           .section = &objects[i].sections[j],
+                                           .name = names[i]};
+        }
+    }
+
+    table *symbols = table_init();
+    memory *image = NULL;
+
+    if (link_place(sections, section_count, map) &&
+        link_define(symbols, sections, section_count)) {
+        link_job job = {.sections = sections,
+                        .section_count = section_count,
+                        .symbols = symbols,
+                        .image = memory_init(CPU_MAX_ADDRESS)};
+
+        atomic_init(&job.next, 0);
+        atomic_init(&job.failed, false);
+        link_resolve(&job);
+
+        image = job.image;
+
+        if (atomic_load(&job.failed)) {
+            memory_free(image);
+            image = NULL;
+        }
+    }
+
+    table_free(symbols);
+    free(sections);
+    return image;
+}
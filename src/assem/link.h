@@ -0,0 +1,31 @@
+#ifndef BBB_LINK_H
+#define BBB_LINK_H
+
+#include "../machine/memory.h"
+#include "object.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LINK_MAX_WORKERS 8
+
+// Where to place the relocatable section of an object, by the name the
+// object was given to the linker or by its file name alone.
+typedef struct link_placement {
+    char *name;
+    uint32_t address;
+} link_placement;
+
+typedef struct link_map {
+    link_placement *placements;
+    size_t placement_count;
+    size_t placement_length;
+} link_map;
+
+bool link_map_load(link_map *map, const char *path);
+void link_map_free(link_map *map);
+
+memory *link_objects(object *objects, char **names, size_t count,
+                     link_map *map);
+
+#endif
@@ -0,0 +1,289 @@
+#include "object.h"
+#include "../machine/alloc.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OBJECT_ARRAY_LENGTH 16
+#define OBJECT_MAX_QUADS 0x10000
+
+// Objects are kept between builds, so unlike fragments they are written in
+// a fixed byte order: every field is a little-endian 32-bit word.
+typedef struct object_reader {
+    const uint8_t *data;
+    size_t length;
+    size_t at;
+} object_reader;
+
+void object_add_section(object *o, uint32_t origin, bool absolute,
+                        const uint8_t *quads, uint32_t length) {
+    o->sections = alloc_grow(o->sections, &o->section_length,
+                             sizeof(object_section), o->section_count + 1,
+                             OBJECT_ARRAY_LENGTH);
+
+    object_section *s = &o->sections[o->section_count++];
+    *s = (object_section){.origin = origin,
+                          .length = length,
+                          .absolute = absolute,
+                          .quads = malloc(length ? length : 1),
+                          .reloc_first = o->reloc_count};
+    memcpy(s->quads, quads, length);
+}
+
+static uint32_t object_add_label(object *o, const char *label) {
+    size_t n = strlen(label) + 1;
+    uint32_t offset = o->label_count;
+
+    o->labels = alloc_grow(o->labels, &o->label_length, sizeof(char),
+                           o->label_count + n, OBJECT_ARRAY_LENGTH);
+    memcpy(o->labels + o->label_count, label, n);
+    o->label_count += n;
+
+    return offset;
+}
+
+void object_add_symbol(object *o, uint32_t section, uint32_t offset,
+                       const char *label) {
+    o->symbols = alloc_grow(o->symbols, &o->symbol_length,
+                            sizeof(object_label), o->symbol_count + 1,
+                            OBJECT_ARRAY_LENGTH);
+    o->symbols[o->symbol_count++] = (object_label){
+        section, offset, object_add_label(o, label), strlen(label)};
+}
+
+bool object_add_reloc(object *o, uint32_t section, uint32_t offset,
+                      const char *label) {
+    // Relocations must be added in section order, after their section.
+    if (section >= o->section_count ||
+        (o->reloc_count > 0 &&
+         o->relocs[o->reloc_count - 1].section > section)) {
+        return false;
+    }
+
+    o->relocs = alloc_grow(o->relocs, &o->reloc_length, sizeof(object_label),
+                           o->reloc_count + 1, OBJECT_ARRAY_LENGTH);
+    o->relocs[o->reloc_count++] = (object_label){
+        section, offset, object_add_label(o, label), strlen(label)};
+
+    object_section *s = &o->sections[section];
+
+    if (s->reloc_count == 0) {
+        s->reloc_first = o->reloc_count - 1;
+    }
+
+    s->reloc_count++;
+    return true;
+}
+
+void object_free(object *o) {
+    for (size_t i = 0; i < o->section_count; i++) {
+        free(o->sections[i].quads);
+    }
+
+    free(o->sections);
+    free(o->symbols);
+    free(o->relocs);
+    free(o->labels);
+    *o = (object){0};
+}
+
+static bool object_get(object_reader *r, uint32_t *value) {
+    if (r->length - r->at < 4) {
+        return false;
+    }
+
+    const uint8_t *p = r->data + r->at;
+    *value = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+    r->at += 4;
+    return true;
+}
+
+static bool object_get_label(object_reader *r, object_label *l) {
+    return object_get(r, &l->section) && object_get(r, &l->offset) &&
+           object_get(r, &l->label) && object_get(r, &l->length);
+}
+
+static bool object_valid_label(object *o, object_label *l, uint32_t end) {
+    // `end` is how far past the offset the label may reach into its section.
+    return l->section < o->section_count &&
+           (size_t)l->offset + end <= o->sections[l->section].length &&
+           (size_t)l->label + l->length < o->label_count &&
+           o->labels[l->label + l->length] == '\0' &&
+           strlen(o->labels + l->label) == l->length;
+}
+
+static bool object_parse(object_reader *r, object *o) {
+    uint32_t version, sections, symbols, relocs, labels;
+
+    if (r->length < 4 || memcmp(r->data, "BBBO", 4) != 0) {
+        return false;
+    }
+
+    r->at = 4;
+
+    if (!object_get(r, &version) || version != OBJECT_VERSION ||
+        !object_get(r, &sections) || !object_get(r, &symbols) ||
+        !object_get(r, &relocs) || !object_get(r, &labels)) {
+        return false;
+    }
+
+    // Each count is checked against what is left of the file before
+    // anything is allocated for it.
+    if (sections > (r->length - r->at) / 12) {
+        return false;
+    }
+
+    uint32_t *headers = alloc_array(sections * 3, sizeof(uint32_t));
+    bool valid = true;
+
+    for (size_t i = 0; valid && i < sections * 3; i++) {
+        valid = object_get(r, &headers[i]);
+    }
+
+    for (size_t i = 0; valid && i < sections; i++) {
+        uint32_t origin = headers[i * 3];
+        uint32_t length = headers[i * 3 + 1];
+
+        valid = origin < OBJECT_MAX_QUADS &&
+                length <= OBJECT_MAX_QUADS - origin &&
+                length <= r->length - r->at;
+
+        if (valid) {
+            object_add_section(o, origin, headers[i * 3 + 2] & 1,
+                               r->data + r->at, length);
+            r->at += length;
+        }
+    }
+
+    free(headers);
+
+    if (!valid || symbols > (r->length - r->at) / 16 ||
+        relocs > (r->length - r->at) / 16 - symbols) {
+        return false;
+    }
+
+    o->symbol_count = o->symbol_length = symbols;
+    o->symbols = alloc_array(symbols, sizeof(object_label));
+
+    for (size_t i = 0; valid && i < symbols; i++) {
+        valid = object_get_label(r, &o->symbols[i]);
+    }
+
+    o->reloc_count = o->reloc_length = relocs;
+    o->relocs = alloc_array(relocs, sizeof(object_label));
+
+    for (size_t i = 0; valid && i < relocs; i++) {
+        valid = object_get_label(r, &o->relocs[i]);
+    }
+
+    if (!valid || labels != r->length - r->at) {
+        return false;
+    }
+
+    o->label_count = o->label_length = labels;
+    o->labels = alloc_array(labels, 1);
+    memcpy(o->labels, r->data + r->at, labels);
+
+    for (size_t i = 0; valid && i < symbols; i++) {
+        valid = object_valid_label(o, &o->symbols[i], 0);
+    }
+
+    for (size_t i = 0; valid && i < relocs; i++) {
+        object_label *l = &o->relocs[i];
+        object_section *s = &o->sections[l->section];
+
+        valid = object_valid_label(o, l, 4) &&
+                (i == 0 || o->relocs[i - 1].section <= l->section);
+
+        if (valid && s->reloc_count++ == 0) {
+            s->reloc_first = i;
+        }
+    }
+
+    return valid;
+}
+
+bool object_read(const char *path, object *o) {
+    FILE *in = fopen(path, "rb");
+    object_reader r = {0};
+    bool valid = false;
+
+    *o = (object){0};
+
+    if (!in) {
+        return false;
+    }
+
+    if (fseek(in, 0L, SEEK_END) == 0) {
+        long length = ftell(in);
+        uint8_t *data = length > 0 ? malloc(length) : NULL;
+
+        fseek(in, 0L, SEEK_SET);
+
+        if (data && fread(data, 1, length, in) == (size_t)length) {
+            r = (object_reader){data, length, 0};
+            valid = object_parse(&r, o);
+        }
+
+        free(data);
+    }
+
+    fclose(in);
+
+    if (!valid) {
+        object_free(o);
+    }
+
+    return valid;
+}
+
+static bool object_put(FILE *out, uint32_t value) {
+    uint8_t bytes[4] = {value, value >> 8, value >> 16, value >> 24};
+    return fwrite(bytes, 1, 4, out) == 4;
+}
+
+static bool object_put_label(FILE *out, object_label *l) {
+    return object_put(out, l->section) && object_put(out, l->offset) &&
+           object_put(out, l->label) && object_put(out, l->length);
+}
+
+bool object_write(const char *path, object *o) {
+    FILE *out = fopen(path, "wb");
+
+    if (!out) {
+        return false;
+    }
+
+    bool success = fwrite("BBBO", 1, 4, out) == 4 &&
+                   object_put(out, OBJECT_VERSION) &&
+                   object_put(out, o->section_count) &&
+                   object_put(out, o->symbol_count) &&
+                   object_put(out, o->reloc_count) &&
+                   object_put(out, o->label_count);
+
+    for (size_t i = 0; success && i < o->section_count; i++) {
+        object_section *s = &o->sections[i];
+        success = object_put(out, s->origin) && object_put(out, s->length) &&
+                  object_put(out, s->absolute ? 1 : 0);
+    }
+
+    for (size_t i = 0; success && i < o->section_count; i++) {
+        object_section *s = &o->sections[i];
+        success = fwrite(s->quads, 1, s->length, out) == s->length;
+    }
+
+    for (size_t i = 0; success && i < o->symbol_count; i++) {
+        success = object_put_label(out, &o->symbols[i]);
+    }
+
+    for (size_t i = 0; success && i < o->reloc_count; i++) {
+        success = object_put_label(out, &o->relocs[i]);
+    }
+
+    success = success &&
+              fwrite(o->labels, 1, o->label_count, out) == o->label_count;
+
+    return fclose(out) == 0 && success;
+}
@@ -0,0 +1,63 @@
+#ifndef BBB_OBJECT_H
+#define BBB_OBJECT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define OBJECT_VERSION 1
+
+// A contiguous run of quads. The code before a source file's first #org is
+// relocatable and placed by the linker; each #org starts an absolute section
+// that is always linked at its origin. Relocations are kept in section
+// order, and each section knows the run of them that patch it.
+typedef struct object_section {
+    uint32_t origin;
+    uint32_t length;
+    bool absolute;
+    uint8_t *quads;
+
+    size_t reloc_first;
+    size_t reloc_count;
+} object_section;
+
+// Symbols give the offset of a label in a section, and relocations the
+// offset of a quartet to patch with the absolute address of a label. `label`
+// is the offset of the NUL-terminated name in the object's `labels`.
+typedef struct object_label {
+    uint32_t section;
+    uint32_t offset;
+    uint32_t label;
+    uint32_t length;
+} object_label;
+
+typedef struct object {
+    object_section *sections;
+    size_t section_count;
+    size_t section_length;
+
+    object_label *symbols;
+    size_t symbol_count;
+    size_t symbol_length;
+
+    object_label *relocs;
+    size_t reloc_count;
+    size_t reloc_length;
+
+    char *labels;
+    size_t label_count;
+    size_t label_length;
+} object;
+
+void object_add_section(object *o, uint32_t origin, bool absolute,
+                        const uint8_t *quads, uint32_t length);
+void object_add_symbol(object *o, uint32_t section, uint32_t offset,
+                       const char *label);
+bool object_add_reloc(object *o, uint32_t section, uint32_t offset,
+                      const char *label);
+
+bool object_read(const char *path, object *o);
+bool object_write(const char *path, object *o);
+void object_free(object *o);
+
+#endif
@@ -0,0 +1,424 @@
+#include "peephole.h"
+#include "../machine/alloc.h"
+#include "../machine/cpu.h"
+#include "table.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PEEPHOLE_ARRAY_LENGTH 64
+
+// Registers that an instruction can copy to themselves or push and pop
+// without any other effect. Moving the program counter is a jump.
+#define IS_PLAIN_REGISTER(r)                                                   \
+    ((r) <= REGISTER_F || ((r) > REGISTER_PC && (r) <= REGISTER_TA))
+
+// A contiguous run of memory that starts at an #org or where the program
+// starts. Blocks shrink from the end; their start never moves.
+typedef struct peephole_block {
+    uint32_t start;
+    uint32_t end;
+} peephole_block;
+
+// The state of one pass: which instructions go, and where everything that
+// stays ends up.
+typedef struct peephole_pass {
+    peephole_block *blocks;
+    size_t block_count;
+
+    peephole_range *deleted;
+    size_t *shift;
+    size_t deleted_count;
+} peephole_pass;
+
+void peephole_add_range(peephole *p, uint32_t start, uint32_t length) {
+    if (length == 0) {
+        return;
+    }
+
+    p->ranges = alloc_grow(p->ranges, &p->range_length, sizeof(peephole_range),
+                           p->range_count + 1, PEEPHOLE_ARRAY_LENGTH);
+    p->ranges[p->range_count++] = (peephole_range){start, length};
+}
+
+void peephole_add_instruction(peephole *p, const char *path, uint32_t start,
+                              uint32_t length) {
+    // Instructions come a file at a time, so the last file is checked first.
+    size_t file = p->file_count;
+
+    for (size_t i = p->file_count; i-- > 0;) {
+        if (p->files[i].path == path || strcmp(p->files[i].path, path) == 0) {
+            file = i;
+            break;
+        }
+    }
+
+    if (file == p->file_count) {
+        p->files = alloc_grow(p->files, &p->file_length, sizeof(peephole_file),
+                              p->file_count + 1, PEEPHOLE_ARRAY_LENGTH);
+        p->files[p->file_count++] = (peephole_file){path, 0, 0};
+    }
+
+    p->instructions =
+        alloc_grow(p->instructions, &p->instruction_length,
+                   sizeof(peephole_instruction), p->instruction_count + 1,
+                   PEEPHOLE_ARRAY_LENGTH);
+    p->instructions[p->instruction_count++] =
+        (peephole_instruction){start, length, file};
+}
+
+void peephole_add_anchor(peephole *p, uint32_t address) {
+    p->anchors = alloc_grow(p->anchors, &p->anchor_length, sizeof(uint32_t),
+                            p->anchor_count + 1, PEEPHOLE_ARRAY_LENGTH);
+    p->anchors[p->anchor_count++] = address;
+}
+
+void peephole_free(peephole *p) {
+    free(p->ranges);
+    free(p->instructions);
+    free(p->anchors);
+    free(p->files);
+    *p = (peephole){0};
+}
+
+static int peephole_compare_start(const void *a, const void *b) {
+    // Ranges and instructions both start with their start address.
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static bool peephole_is_anchor(peephole *p, uint32_t address) {
+    return bsearch(&address, p->anchors, p->anchor_count, sizeof(uint32_t),
+                   peephole_compare_start) != NULL;
+}
+
+static bool peephole_blocks(peephole *p, peephole_pass *pass) {
+    // Merges the ranges written into blocks, split at each #org. Output
+    // that was written over by a later #org cannot be moved safely.
+    pass->blocks = alloc_array(p->range_count, sizeof(peephole_block));
+    pass->block_count = 0;
+
+    for (size_t i = 0; i < p->range_count; i++) {
+        peephole_range *r = &p->ranges[i];
+        peephole_block *last =
+            pass->block_count ? &pass->blocks[pass->block_count - 1] : NULL;
+
+        if (last && r->start < last->end) {
+            fprintf(stderr,
+                    "warning: not optimized, output overlaps at %04X\n",
+                    r->start);
+            return false;
+        }
+
+        if (last && r->start == last->end &&
+            !peephole_is_anchor(p, r->start)) {
+            last->end = r->start + r->length;
+        } else {
+            pass->blocks[pass->block_count++] =
+                (peephole_block){r->start, r->start + r->length};
+        }
+    }
+
+    return true;
+}
+
+static size_t peephole_deleted_before(peephole_pass *pass, uint32_t address) {
+    // The number of deletions that start before an address.
+    size_t lo = 0;
+    size_t hi = pass->deleted_count;
+
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+
+        if (pass->deleted[mid].start < address) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+static peephole_block *peephole_block_at(peephole_pass *pass,
+                                         uint32_t address) {
+    // The last block that starts at or before the address, if the address is
+    // in it or just past its end.
+    size_t lo = 0;
+    size_t hi = pass->block_count;
+
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+
+        if (pass->blocks[mid].start <= address) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == 0 || address > pass->blocks[lo - 1].end) {
+        return NULL;
+    }
+
+    return &pass->blocks[lo - 1];
+}
+
+static uint32_t peephole_map(peephole_pass *pass, uint32_t address) {
+    // Where an address ends up: moved down by what was deleted before it in
+    // its block. Addresses outside every block stay where they are.
+    peephole_block *b = peephole_block_at(pass, address);
+
+    if (!b) {
+        return address;
+    }
+
+    size_t first = peephole_deleted_before(pass, b->start);
+    size_t last = peephole_deleted_before(pass, address);
+    return address - (pass->shift[last] - pass->shift[first]);
+}
+
+static bool peephole_in_deleted(peephole_pass *pass, uint32_t address) {
+    size_t i = peephole_deleted_before(pass, address + 1);
+    return i > 0 && address < pass->deleted[i - 1].start +
+                                  pass->deleted[i - 1].length;
+}
+
+static bool peephole_dead(peephole *p, uint8_t *data, table *symbols,
+                          peephole_instruction *in, peephole_instruction *next,
+                          const bool *labelled, reference **refs,
+                          bool *both) {
+    // Whether an instruction can be removed, and with it the one after it
+    // when `both` is set. `next` is NULL unless it directly follows in the
+    // same block.
+    uint8_t *code = data + in->start;
+    uint8_t *follow = next ? data + next->start : NULL;
+
+    *both = false;
+
+    switch (code[0]) {
+    case MOV: {
+        if (in->length != 3 && in->length != 4 && in->length != 7) {
+            return false;
+        }
+
+        // Copying a register to itself changes nothing, and moves do not
+        // touch the flags.
+        if (code[1] == code[2] && IS_PLAIN_REGISTER(code[1])) {
+            return true;
+        }
+
+        // A general purpose register that the next instruction overwrites
+        // without reading was never used.
+        return follow && code[2] <= REGISTER_F && follow[0] == MOV &&
+               next->length >= 3 && follow[2] == code[2] &&
+               follow[1] != code[2];
+    }
+    case PSH: {
+        // Pushing a register and popping it straight back only leaves a
+        // copy above the stack, unless something jumps to the pop.
+        *both = follow && in->length == 2 && next->length == 2 &&
+                follow[0] == POP && follow[1] == code[1] &&
+                IS_PLAIN_REGISTER(code[1]) && !labelled[next->start];
+        return *both;
+    }
+    case JMP: {
+        // An unconditional jump to the next instruction.
+        reference *r = in->length == 6 ? refs[in->start + 2] : NULL;
+        symbol *s = r ? table_symbol_lookup(symbols, r->label) : NULL;
+
+        return code[1] == 0xF && s && s->address == in->start + in->length;
+    }
+    default:
+        return false;
+    }
+}
+
+static size_t peephole_pass_run(peephole *p, uint8_t *data, table *symbols,
+                                debug_builder *debug, peephole_pass *pass) {
+    // Finds what to delete, then moves everything that stays. Returns the
+    // number of instructions deleted.
+    bool *labelled = calloc(CPU_MAX_ADDRESS + 1, sizeof(bool));
+    reference **refs = calloc(CPU_MAX_ADDRESS, sizeof(reference *));
+    bool *deleted = calloc(p->instruction_count + 1, sizeof(bool));
+    size_t count = 0;
+
+    for (symbol *s = symbols->syms; s < symbols->syms_end; s++) {
+        if (s->label && s->address <= CPU_MAX_ADDRESS) {
+            labelled[s->address] = true;
+        }
+    }
+
+    for (reference *r = symbols->refs; r < symbols->refs_end; r++) {
+        if (r->offset - data < CPU_MAX_ADDRESS) {
+            refs[r->offset - data] = r;
+        }
+    }
+
+    pass->deleted = alloc_array(p->instruction_count, sizeof(peephole_range));
+    pass->shift = calloc(p->instruction_count + 1, sizeof(size_t));
+    pass->deleted_count = 0;
+
+    for (size_t i = 0; i < p->instruction_count; i++) {
+        peephole_instruction *in = &p->instructions[i];
+        peephole_instruction *next =
+            i + 1 < p->instruction_count ? in + 1 : NULL;
+        bool both;
+
+        if (next && (next->start != in->start + in->length ||
+                     peephole_is_anchor(p, next->start))) {
+            next = NULL;
+        }
+
+        if (!peephole_dead(p, data, symbols, in, next, labelled, refs,
+                           &both)) {
+            continue;
+        }
+
+        for (size_t j = i; j <= i + both; j++) {
+            peephole_instruction *d = &p->instructions[j];
+
+            deleted[j] = true;
+            pass->deleted[pass->deleted_count] =
+                (peephole_range){d->start, d->length};
+            pass->shift[pass->deleted_count + 1] =
+                pass->shift[pass->deleted_count] + d->length;
+            pass->deleted_count++;
+
+            p->files[d->file].instructions++;
+            p->files[d->file].quads += d->length;
+            count++;
+        }
+
+        i += both;
+    }
+
+    // Each block is compacted in place and zeroed past its new end.
+    size_t d = 0;
+
+    for (size_t b = 0; count && b < pass->block_count; b++) {
+        peephole_block *block = &pass->blocks[b];
+        uint32_t to = block->start;
+        uint32_t from = block->start;
+
+        for (; d < pass->deleted_count &&
+               pass->deleted[d].start < block->end;
+             d++) {
+            memmove(data + to, data + from, pass->deleted[d].start - from);
+            to += pass->deleted[d].start - from;
+            from = pass->deleted[d].start + pass->deleted[d].length;
+        }
+
+        memmove(data + to, data + from, block->end - from);
+        to += block->end - from;
+        memset(data + to, 0, block->end - to);
+    }
+
+    // Labels and references follow the code they point at, and references
+    // inside deleted instructions go with them. Block ends are mapped last,
+    // since mapping depends on where the blocks were.
+    for (symbol *s = symbols->syms; count && s < symbols->syms_end; s++) {
+        if (s->label) {
+            s->address = peephole_map(pass, s->address);
+        }
+    }
+
+    reference *kept = symbols->refs;
+
+    for (reference *r = symbols->refs; count && r < symbols->refs_end; r++) {
+        uint32_t address = r->offset - data;
+
+        if (!peephole_in_deleted(pass, address)) {
+            *kept = *r;
+            kept->offset = data + peephole_map(pass, address);
+            kept++;
+        }
+    }
+
+    if (count) {
+        symbols->refs_end = kept;
+    }
+
+    // Each line of debug information is all of one instruction or none.
+    size_t lines = 0;
+
+    for (size_t i = 0; count && debug && i < debug->line_count; i++) {
+        debug_line *line = &debug->lines[i];
+
+        if (line->length == 0 || !peephole_in_deleted(pass, line->start)) {
+            debug->lines[lines] = *line;
+            debug->lines[lines].start = peephole_map(pass, line->start);
+            lines++;
+        }
+    }
+
+    if (count && debug) {
+        debug->line_count = lines;
+    }
+
+    size_t n = 0;
+
+    for (size_t i = 0; count && i < p->instruction_count; i++) {
+        if (!deleted[i]) {
+            p->instructions[n] = p->instructions[i];
+            p->instructions[n].start =
+                peephole_map(pass, p->instructions[n].start);
+            n++;
+        }
+    }
+
+    if (count) {
+        p->instruction_count = n;
+        p->range_count = 0;
+
+        for (size_t b = 0; b < pass->block_count; b++) {
+            peephole_block *block = &pass->blocks[b];
+            uint32_t end = peephole_map(pass, block->end);
+            peephole_add_range(p, block->start, end - block->start);
+        }
+    }
+
+    free(labelled);
+    free(refs);
+    free(deleted);
+    return count;
+}
+
+bool peephole_run(peephole *p, uint8_t *data, table *symbols,
+                  debug_builder *debug) {
+    // Rewrites the program in memory before references are resolved, moving
+    // any debug lines along with it. Returns false if the layout could not
+    // be optimized.
+    bool success = true;
+
+    qsort(p->ranges, p->range_count, sizeof(peephole_range),
+          peephole_compare_start);
+    qsort(p->instructions, p->instruction_count,
+          sizeof(peephole_instruction), peephole_compare_start);
+    qsort(p->anchors, p->anchor_count, sizeof(uint32_t),
+          peephole_compare_start);
+
+    for (size_t i = 0; i < PEEPHOLE_MAX_PASSES; i++) {
+        peephole_pass pass = {0};
+        size_t count = 0;
+
+        success = peephole_blocks(p, &pass);
+
+        if (success) {
+            count = peephole_pass_run(p, data, symbols, debug, &pass);
+        }
+
+        free(pass.blocks);
+        free(pass.deleted);
+        free(pass.shift);
+
+        if (!success || count == 0) {
+            break;
+        }
+    }
+
+    return success;
+}
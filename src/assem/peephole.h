@@ -0,0 +1,64 @@
+#ifndef BBB_PEEPHOLE_H
+#define BBB_PEEPHOLE_H
+
+#include "debug.h"
+#include "table.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The passes are repeated until nothing changes, since removing one pair
+// can make another adjacent.
+#define PEEPHOLE_MAX_PASSES 16
+
+typedef struct peephole_range {
+    uint32_t start;
+    uint32_t length;
+} peephole_range;
+
+// An instruction, and the index of the file it came from in `files`.
+typedef struct peephole_instruction {
+    uint32_t start;
+    uint32_t length;
+    size_t file;
+} peephole_instruction;
+
+// What was saved in each source file.
+typedef struct peephole_file {
+    const char *path;
+    size_t instructions;
+    size_t quads;
+} peephole_file;
+
+// The layout of an assembled program: every range of memory written, the
+// instructions in it, and the addresses set by #org, which never move.
+// Code after an #org slides down as instructions are removed from it, and
+// labels and references in it follow.
+typedef struct peephole {
+    peephole_range *ranges;
+    size_t range_count;
+    size_t range_length;
+
+    peephole_instruction *instructions;
+    size_t instruction_count;
+    size_t instruction_length;
+
+    uint32_t *anchors;
+    size_t anchor_count;
+    size_t anchor_length;
+
+    peephole_file *files;
+    size_t file_count;
+    size_t file_length;
+} peephole;
+
+void peephole_add_range(peephole *p, uint32_t start, uint32_t length);
+void peephole_add_instruction(peephole *p, const char *path, uint32_t start,
+                              uint32_t length);
+void peephole_add_anchor(peephole *p, uint32_t address);
+
+bool peephole_run(peephole *p, uint8_t *data, table *symbols,
+                  debug_builder *debug);
+void peephole_free(peephole *p);
+
+#endif
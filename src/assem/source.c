@@ -0,0 +1,352 @@
+#include "source.h"
+#include "../machine/alloc.h"
+#include "lexer.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FILES_LENGTH 16
+#define INCLUDES_LENGTH 4
+
+static uint32_t source_hash(const char *path) {
+    // 32-bit FNV-1a, as in the symbol table
+    uint32_t hash = 2166136261u;
+
+    for (const char *ch = path; *ch; ch++) {
+        hash = (hash ^ (uint8_t)*ch) * 16777619u;
+    }
+
+    return hash;
+}
+
+source_cache *source_cache_init() {
+    source_cache *c = calloc(1, sizeof(source_cache));
+
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->changed, NULL);
+
+    return c;
+}
+
+static void source_unload(source_file *f) {
+    if (f->mapped) {
+        munmap((void *)f->text, f->length);
+    }
+
+    token_list_free(&f->tokens);
+    free(f->includes);
+
+    f->text = NULL;
+    f->length = 0;
+    f->mapped = false;
+    f->includes = NULL;
+    f->include_count = 0;
+    f->include_length = 0;
+}
+
+static void source_file_free(source_file *f) {
+    if (f) {
+        source_unload(f);
+        free(f->path);
+        free(f);
+    }
+}
+
+static void source_enqueue(source_cache *c, source_file *f) {
+    // Called with the lock held. Each file is queued at most once per load,
+    // so the queue never needs more room than there are files.
+    if (c->queue_tail == c->queue_length) {
+        c->queue = alloc_grow(c->queue, &c->queue_length,
+                              sizeof(source_file *), c->queue_tail + 1,
+                              FILES_LENGTH);
+    }
+
+    c->queue[c->queue_tail++] = f;
+    c->pending++;
+}
+
+static source_file *source_find(source_cache *c, const char *path,
+                                bool *queued) {
+    // Finds the file for a canonical path, adding it if it is new. Files
+    // not yet checked in this load are queued for the workers.
+    uint32_t hash = source_hash(path);
+    source_file *f = NULL;
+
+    pthread_mutex_lock(&c->lock);
+
+    for (size_t i = 0; i < c->file_count; i++) {
+        if (c->files[i]->hash == hash && strcmp(c->files[i]->path, path) == 0) {
+            f = c->files[i];
+            break;
+        }
+    }
+
+    if (!f) {
+        if (c->file_count == c->file_length) {
+            c->files = alloc_grow(c->files, &c->file_length,
+                                  sizeof(source_file *), c->file_count + 1,
+                                  FILES_LENGTH);
+        }
+
+        f = calloc(1, sizeof(source_file));
+        f->path = strdup(path);
+        f->hash = hash;
+        c->files[c->file_count++] = f;
+    }
+
+    *queued = f->generation != c->generation;
+
+    if (*queued) {
+        f->generation = c->generation;
+        source_enqueue(c, f);
+    }
+
+    pthread_mutex_unlock(&c->lock);
+    return f;
+}
+
+static void source_read(source_cache *c, source_file *f) {
+    // Maps and tokenizes the file, unless the copy already cached is still
+    // current.
+    struct stat st;
+    int fd = open(f->path, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+
+        source_unload(f);
+        f->failed = true;
+        return;
+    }
+
+    if (!f->failed && f->text && (size_t)st.st_size == f->size &&
+        st.st_mtim.tv_sec == f->mtime.tv_sec &&
+        st.st_mtim.tv_nsec == f->mtime.tv_nsec) {
+        close(fd);
+        return;
+    }
+
+    source_unload(f);
+    f->failed = false;
+    f->size = st.st_size;
+    f->mtime = st.st_mtim;
+    f->text = "";
+
+    if (st.st_size > 0) {
+        void *text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (text == MAP_FAILED) {
+            f->text = NULL;
+            f->failed = true;
+            close(fd);
+            return;
+        }
+
+        f->text = text;
+        f->length = st.st_size;
+        f->mapped = true;
+    }
+
+    close(fd);
+    lexer_tokenize(&f->tokens, f->text, f->length);
+
+    pthread_mutex_lock(&c->lock);
+    c->reads++;
+    pthread_mutex_unlock(&c->lock);
+}
+
+static source_file *source_include(source_cache *c, source_file *from,
+                                   token *name) {
+    // Include paths are relative to the including file.
+    char path[PATH_MAX];
+    char resolved[PATH_MAX];
+    const char *slash = strrchr(from->path, '/');
+    int dir = slash ? (int)(slash - from->path) : 0;
+    int length;
+
+    if (name->start[0] == '/' || !slash) {
+        length = snprintf(path, sizeof(path), "%.*s", (int)name->length,
+                          name->start);
+    } else {
+        length = snprintf(path, sizeof(path), "%.*s/%.*s", dir, from->path,
+                          (int)name->length, name->start);
+    }
+
+    if (length >= (int)sizeof(path) || !realpath(path, resolved)) {
+        return NULL;
+    }
+
+    bool queued;
+    return source_find(c, resolved, &queued);
+}
+
+static void source_resolve(source_cache *c, source_file *f) {
+    // Finds the file named by each #inc line, queueing any that have not
+    // been checked yet.
+    token_list *list = &f->tokens;
+
+    free(f->includes);
+    f->includes = NULL;
+    f->include_count = 0;
+    f->include_length = 0;
+
+    for (size_t i = 0; i < list->line_count; i++) {
+        token *t = &list->tokens[list->lines[i].first];
+
+        if (!token_equal(t, "#inc")) {
+            continue;
+        }
+
+        f->includes = alloc_grow(f->includes, &f->include_length,
+                                 sizeof(source_file *), f->include_count + 1,
+                                 INCLUDES_LENGTH);
+        f->includes[f->include_count++] =
+            list->lines[i].count > 1 ? source_include(c, f, t + 1) : NULL;
+    }
+}
+
+static void *source_worker(void *arg) {
+    source_cache *c = (source_cache *)arg;
+
+    pthread_mutex_lock(&c->lock);
+
+    for (;;) {
+        while (c->queue_head == c->queue_tail && c->pending > 0) {
+            pthread_cond_wait(&c->changed, &c->lock);
+        }
+
+        if (c->queue_head == c->queue_tail) {
+            break;
+        }
+
+        source_file *f = c->queue[c->queue_head++];
+        pthread_mutex_unlock(&c->lock);
+
+        source_read(c, f);
+
+        if (!f->failed) {
+            source_resolve(c, f);
+        }
+
+        pthread_mutex_lock(&c->lock);
+        c->pending--;
+        pthread_cond_broadcast(&c->changed);
+    }
+
+    pthread_mutex_unlock(&c->lock);
+    return NULL;
+}
+
+static void source_drain(source_cache *c) {
+    // Tokenizes every queued file, and every file they include, in
+    // parallel. Threads are only started if there is more than one file.
+    pthread_t threads[SOURCE_MAX_WORKERS];
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t count = cores < 1                    ? 1
+                   : cores > SOURCE_MAX_WORKERS ? SOURCE_MAX_WORKERS
+                                                : (size_t)cores;
+
+    if (c->pending == 0) {
+        return;
+    }
+
+    if (c->pending == 1) {
+        // The root file is read here, and workers are only worth starting
+        // if it includes anything.
+        source_file *f = c->queue[c->queue_head++];
+
+        source_read(c, f);
+
+        if (!f->failed) {
+            source_resolve(c, f);
+        }
+
+        c->pending--;
+
+        if (c->pending == 0) {
+            return;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (pthread_create(&threads[i], NULL, source_worker, c) != 0) {
+            count = i;
+            break;
+        }
+    }
+
+    if (count == 0) {
+        source_worker(c);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+static void source_begin(source_cache *c) {
+    c->generation++;
+    c->queue_head = 0;
+    c->queue_tail = 0;
+    c->pending = 0;
+}
+
+source_file *source_cache_load(source_cache *c, const char *path) {
+    // Loads a file and everything it includes.
+    char resolved[PATH_MAX];
+    bool queued;
+
+    if (!realpath(path, resolved)) {
+        return NULL;
+    }
+
+    source_begin(c);
+    source_file *f = source_find(c, resolved, &queued);
+    source_drain(c);
+
+    return f->failed ? NULL : f;
+}
+
+source_file *source_cache_load_text(source_cache *c, const char *name,
+                                    const char *text, size_t length) {
+    // Loads source text that is already in memory. Its includes are looked
+    // up relative to `name`. The text is not cached, and the returned file
+    // is only valid until the next call.
+    source_file_free(c->text);
+    source_begin(c);
+
+    source_file *f = c->text = calloc(1, sizeof(source_file));
+    f->path = strdup(name);
+    f->text = text;
+    f->length = length;
+    f->generation = c->generation;
+
+    lexer_tokenize(&f->tokens, text, length);
+    source_resolve(c, f);
+    source_drain(c);
+
+    return f;
+}
+
+void source_cache_free(source_cache *c) {
+    for (size_t i = 0; i < c->file_count; i++) {
+        source_file_free(c->files[i]);
+    }
+
+    source_file_free(c->text);
+    pthread_mutex_destroy(&c->lock);
+    pthread_cond_destroy(&c->changed);
+    free(c->files);
+    free(c->queue);
+    free(c);
+}
@@ -0,0 +1,71 @@
+#ifndef BBB_SOURCE_H
+#define BBB_SOURCE_H
+
+#include "lexer.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define SOURCE_MAX_WORKERS 8
+#define SOURCE_MAX_DEPTH 64
+
+// A source file and the files it includes. Files are mapped rather than
+// read, and tokens point into the mapping. `includes` holds one entry per
+// #inc line, in order, or NULL where the file could not be found.
+typedef struct source_file {
+    char *path;
+    uint32_t hash;
+    struct timespec mtime;
+    size_t size;
+
+    const char *text;
+    size_t length;
+    bool mapped;
+    bool failed;
+    token_list tokens;
+
+    struct source_file **includes;
+    size_t include_count;
+    size_t include_length;
+
+    // The load that last checked the file, and whether the assembler is
+    // currently inside it (to catch include cycles).
+    uint64_t generation;
+    bool active;
+} source_file;
+
+// Files are cached by canonical path. A later load only reads a file again
+// if its modification time or size has changed, so the same cache can be
+// used to assemble several programs that share headers.
+typedef struct source_cache {
+    source_file **files;
+    size_t file_count;
+    size_t file_length;
+
+    // Files waiting to be tokenized, and the number of files queued or being
+    // tokenized, for the worker threads.
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    source_file **queue;
+    size_t queue_head;
+    size_t queue_tail;
+    size_t queue_length;
+    size_t pending;
+
+    // Source text loaded from memory rather than from a file. It is not
+    // cached, so only the latest one is kept.
+    source_file *text;
+
+    uint64_t generation;
+    size_t reads;
+} source_cache;
+
+source_cache *source_cache_init();
+source_file *source_cache_load(source_cache *c, const char *path);
+source_file *source_cache_load_text(source_cache *c, const char *name,
+                                    const char *text, size_t length);
+void source_cache_free(source_cache *c);
+
+#endif
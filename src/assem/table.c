@@ -9,6 +9,10 @@
 #define SYMS_LENGTH 64
 #define REFS_LENGTH 128
 #define LABELS_LENGTH 1024
+#define INDEX_LENGTH 128
+
+// Keep the index at most half full so probe sequences stay short.
+#define INDEX_FULL(t) ((t)->index_count * 2 >= (t)->index_length)
 
 table *table_init() {
     table *t = calloc(1, sizeof(table));
@@ -25,6 +29,9 @@ table *table_init() {
     t->labels = calloc(LABELS_LENGTH, sizeof(char));
     t->labels_end = t->labels;
 
+    t->index_length = INDEX_LENGTH;
+    t->index = calloc(INDEX_LENGTH, sizeof(table_entry));
+
     return t;
 }
 
@@ -32,7 +39,7 @@ void table_resize_syms(table *t, size_t offset) {
     symbol *new_syms = realloc(t->syms, t->syms_length * 2 * sizeof(symbol));
 
     if (!new_syms) {
-        fprintf(stderr, "error: could not allocate storage");
+        fprintf(stderr, "error: could not allocate storage\n");
         exit(EXIT_FAILURE);
     }
 
@@ -49,7 +56,7 @@ void table_resize_refs(table *t, size_t offset) {
         realloc(t->refs, t->refs_length * 2 * sizeof(reference));
 
     if (!new_refs) {
-        fprintf(stderr, "error: could not allocate storage");
+        fprintf(stderr, "error: could not allocate storage\n");
         exit(EXIT_FAILURE);
     }
 
@@ -63,45 +70,131 @@ void table_resize_refs(table *t, size_t offset) {
 }
 
 void table_resize_labels(table *t, size_t offset) {
-    char *new_labels = realloc(t->labels, t->labels_length * 2 * sizeof(char));
+    // Symbols and references point into the label storage, so they have to
+    // follow it to its new location.
+    char *new_labels = malloc(t->labels_length * 2 * sizeof(char));
 
     if (!new_labels) {
-        fprintf(stderr, "error: could not allocate storage");
+        fprintf(stderr, "error: could not allocate storage\n");
         exit(EXIT_FAILURE);
     }
 
-    if (new_labels != t->labels) {
-        t->labels = new_labels;
-        t->labels_end = t->labels + offset;
+    memcpy(new_labels, t->labels, offset);
+
+    for (symbol *s = t->syms; s < t->syms_end; s++) {
+        if (s->label) {
+            s->label = new_labels + (s->label - t->labels);
+        }
     }
 
+    for (reference *r = t->refs; r < t->refs_end; r++) {
+        if (r->label) {
+            r->label = new_labels + (r->label - t->labels);
+        }
+    }
+
+    free(t->labels);
+    t->labels = new_labels;
     t->labels_length = t->labels_length * 2;
     t->labels_end = t->labels + offset;
 }
 
-char *table_label_find(table *t, char *label) {
-    for (char *l = t->labels; l < t->labels_end; l += strlen(l) + 1) {
-        if (strcmp(l, label) == 0) {
-            return l;
+static size_t table_hash(const char *label, size_t length) {
+    // 64-bit FNV-1a
+    uint64_t hash = 0xCBF29CE484222325;
+
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t)label[i]) * 0x100000001B3;
+    }
+
+    return hash;
+}
+
+static table_entry *table_entry_find(table *t, const char *label,
+                                     size_t length) {
+    // Returns the entry for the label, or the empty slot where it belongs.
+    size_t mask = t->index_length - 1;
+
+    for (size_t i = table_hash(label, length) & mask;; i = (i + 1) & mask) {
+        table_entry *e = &t->index[i];
+
+        if (!e->label) {
+            return e;
+        }
+
+        char *l = t->labels + e->label - 1;
+
+        if (strncmp(l, label, length) == 0 && l[length] == '\0') {
+            return e;
         }
     }
+}
+
+void table_resize_index(table *t) {
+    table_entry *old_index = t->index;
+    size_t old_length = t->index_length;
+
+    t->index_length = old_length * 2;
+    t->index = calloc(t->index_length, sizeof(table_entry));
 
-    return NULL;
+    if (!t->index) {
+        fprintf(stderr, "error: could not allocate storage\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < old_length; i++) {
+        if (old_index[i].label) {
+            char *label = t->labels + old_index[i].label - 1;
+            *table_entry_find(t, label, strlen(label)) = old_index[i];
+        }
+    }
+
+    free(old_index);
 }
 
-char *table_label_push(table *t, char *label) {
-    size_t len = strlen(label);
+char *table_label_find(table *t, char *label) {
+    table_entry *e = table_entry_find(t, label, strlen(label));
+    return e->label ? t->labels + e->label - 1 : NULL;
+}
+
+static char *table_label_push_n(table *t, const char *label, size_t length) {
     size_t offset = t->labels_end - t->labels;
 
-    if (offset + len > t->labels_length) {
+    while (offset + length + 1 > t->labels_length) {
         table_resize_labels(t, offset);
     }
 
     char *label_start = t->labels_end;
-    t->labels_end = stpcpy(t->labels_end, label) + 1;
+    memcpy(label_start, label, length);
+    label_start[length] = '\0';
+    t->labels_end += length + 1;
     return label_start;
 }
 
+char *table_label_push(table *t, char *label) {
+    return table_label_push_n(t, label, strlen(label));
+}
+
+static table_entry *table_label_intern(table *t, const char *label,
+                                       size_t length) {
+    // Find the label's entry, adding the label if it is new.
+    table_entry *e = table_entry_find(t, label, length);
+
+    if (!e->label) {
+        char *loc = table_label_push_n(t, label, length);
+
+        if (INDEX_FULL(t)) {
+            table_resize_index(t);
+            e = table_entry_find(t, label, length);
+        }
+
+        e->label = loc - t->labels + 1;
+        t->index_count++;
+    }
+
+    return e;
+}
+
 void table_symbol_push(table *t, symbol *s) {
     size_t offset = t->syms_end - t->syms;
 
@@ -131,45 +224,55 @@ reference *table_ref_pop(table *t) {
 }
 
 void table_ref_add(table *t, char *label, uint8_t *offset) {
-    char *loc = table_label_find(t, label);
+    table_ref_add_n(t, label, strlen(label), offset);
+}
 
-    if (!loc) {
-        loc = table_label_push(t, label);
-    }
+void table_ref_add_n(table *t, const char *label, size_t length,
+                     uint8_t *offset) {
+    table_entry *e = table_label_intern(t, label, length);
 
-    reference r = {.offset = offset, .label = loc};
+    reference r = {.offset = offset, .label = t->labels + e->label - 1};
     table_ref_push(t, &r);
 }
 
 void table_symbol_define(table *t, char *label, size_t addr) {
-    char *loc = table_label_find(t, label);
+    table_symbol_define_n(t, label, strlen(label), addr);
+}
 
-    if (!loc) {
-        loc = table_label_push(t, label);
-    }
+void table_symbol_define_n(table *t, const char *label, size_t length,
+                           size_t addr) {
+    table_entry *e = table_label_intern(t, label, length);
 
-    symbol s = {.label = loc, .address = addr};
+    symbol s = {.label = t->labels + e->label - 1, .address = addr};
     table_symbol_push(t, &s);
-}
-
-symbol *table_symbol_lookup(table *t, char *label) {
-    char *loc = table_label_find(t, label);
 
-    for (symbol *s = t->syms; s < t->syms_end; s++) {
-        if (s && s->label == loc) {
-            return s;
-        }
+    // Lookups find the first definition of a label.
+    if (!e->symbol) {
+        e->symbol = t->syms_end - t->syms;
     }
+}
 
-    return NULL;
+symbol *table_symbol_lookup(table *t, char *label) {
+    table_entry *e = table_entry_find(t, label, strlen(label));
+    return e->symbol ? t->syms + e->symbol - 1 : NULL;
 }
 
 void table_symbol_del(table *t, char *label) {
-    char *loc = table_label_find(t, label);
+    table_entry *e = table_entry_find(t, label, strlen(label));
 
-    for (symbol *s = t->syms; s < t->syms_end; s++) {
-        if (s && s->label == loc) {
-            s->label = NULL;
+    if (!e->symbol) {
+        return;
+    }
+
+    symbol *deleted = t->syms + e->symbol - 1;
+    deleted->label = NULL;
+    e->symbol = 0;
+
+    // If the label was defined more than once, the next definition takes
+    // over.
+    for (symbol *s = deleted + 1; s < t->syms_end; s++) {
+        if (s->label == t->labels + e->label - 1) {
+            e->symbol = s - t->syms + 1;
             return;
         }
     }
@@ -235,9 +338,20 @@ void table_snprintf(table *t, char *str, size_t n) {
     snprintf(str, n, "\n");
 }
 
+void table_clear(table *t) {
+    // Empties the table but keeps its storage, so it can be filled again
+    // without allocating.
+    t->syms_end = t->syms;
+    t->refs_end = t->refs;
+    t->labels_end = t->labels;
+    memset(t->index, 0, t->index_length * sizeof(table_entry));
+    t->index_count = 0;
+}
+
 void table_free(table *t) {
     free(t->syms);
     free(t->refs);
     free(t->labels);
+    free(t->index);
     free(t);
 }
@@ -15,6 +15,14 @@ typedef struct reference {
     char *label;
 } reference;
 
+// An entry in the label index. Both fields are one-based so that a zeroed
+// entry is empty: `label` is the offset of the interned string in `labels`
+// and `symbol` the index of the label's first live definition in `syms`.
+typedef struct table_entry {
+    size_t label;
+    size_t symbol;
+} table_entry;
+
 typedef struct table {
     symbol *syms;
     symbol *syms_end;
@@ -27,18 +35,29 @@ typedef struct table {
     char *labels;
     char *labels_end;
     size_t labels_length;
+
+    // Open-addressed hash index from label to entry, with linear probing.
+    // The length is always a power of two.
+    table_entry *index;
+    size_t index_length;
+    size_t index_count;
 } table;
 
 table *table_init();
 
 void table_symbol_define(table *t, char *label, size_t addr);
+void table_symbol_define_n(table *t, const char *label, size_t length,
+                           size_t addr);
 symbol *table_symbol_lookup(table *t, char *label);
 void table_symbol_del(table *t, char *label);
 
 void table_ref_push(table *t, reference *r);
 reference *table_ref_pop(table *t);
 void table_ref_add(table *t, char *label, uint8_t *offset);
+void table_ref_add_n(table *t, const char *label, size_t length,
+                     uint8_t *offset);
 
+void table_clear(table *t);
 void table_print(table *t);
 void table_snprintf(table *t, char *s, size_t n);
 void table_free(table *t);
@@ -0,0 +1,236 @@
+#ifndef BBB_BENCH_H
+#define BBB_BENCH_H
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "../machine/perf.h"
+
+// Timing and reporting shared by the benchmarks. Every benchmark is a body
+// that does some work and returns how many units it did: instructions,
+// lines or programs. It is run `warmup` times untimed and then `repeat`
+// times timed, and the time per unit of each timed run is summarized.
+//
+// Results are printed as a table and, with --csv, appended to a file with a
+// row per benchmark, so runs from different commits can be compared. Where
+// the host's hardware counters can be read, each run is also counted with
+// them, so that a difference in speed comes with the reason for it.
+
+#define BENCH_WARMUP 1
+#define BENCH_REPEAT 5
+#define BENCH_MAX_REPEAT 100
+
+#define BENCH_USAGE_STRING                                                     \
+    "usage: %s [--warmup N] [--repeat N] [--csv FILE] [FILTER]\n"
+
+typedef uint64_t (*bench_body)(void *context);
+
+typedef struct bench_options {
+    size_t warmup;
+    size_t repeat;
+    const char *filter;
+    FILE *csv;
+    bool perf;
+    perf_counters counters;
+} bench_options;
+
+// Nanoseconds and host cycles per unit of work, over the timed runs. Cycles
+// are counted with the time stamp counter where there is one, which ticks
+// at a fixed rate rather than with the core clock, and are 0 elsewhere.
+// `events` are the mean hardware counts per unit, where they were counted.
+typedef struct bench_result {
+    uint64_t units;
+    double min;
+    double median;
+    double mean;
+    double stddev;
+    double cycles;
+    double events[PERF_EVENT_COUNT];
+} bench_result;
+
+static inline double bench_seconds(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static inline uint64_t bench_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static inline bool bench_parse(int argc, char *argv[], bench_options *o) {
+    // Reads the options every benchmark takes. Returns false, having printed
+    // the usage, if they are not valid.
+    *o = (bench_options){.warmup = BENCH_WARMUP, .repeat = BENCH_REPEAT};
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+            o->warmup = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            o->repeat = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+            if (!(o->csv = fopen(argv[++i], "a"))) {
+                fprintf(stderr, "error: could not open '%s'\n", argv[i]);
+                return false;
+            }
+        } else if (argv[i][0] != '-' && !o->filter) {
+            o->filter = argv[i];
+        } else {
+            fprintf(stderr, BENCH_USAGE_STRING, argv[0]);
+            return false;
+        }
+    }
+
+    if (o->repeat == 0 || o->repeat > BENCH_MAX_REPEAT) {
+        fprintf(stderr, "error: --repeat must be from 1 to %d\n",
+                BENCH_MAX_REPEAT);
+        return false;
+    }
+
+    if (!(o->perf = perf_open(&o->counters) > 0)) {
+        fprintf(stderr, "note: hardware counters are not available\n");
+    }
+
+    if (o->csv && ftell(o->csv) == 0) {
+        fprintf(o->csv, "suite,name,unit,units,repeat,min_ns,median_ns,"
+                        "mean_ns,stddev_ns,millions_per_second,tsc_cycles");
+
+        for (size_t e = 0; e < PERF_EVENT_COUNT; e++) {
+            fprintf(o->csv, ",%s", perf_event_names[e]);
+        }
+
+        fprintf(o->csv, "\n");
+    }
+
+    printf("%-8s %-28s %12s %10s %8s %10s %9s", "suite", "name", "units",
+           "ns/unit", "stddev", "M/s", "tsc");
+
+    for (size_t e = 0; o->perf && e < PERF_EVENT_COUNT; e++) {
+        printf(" %13s", perf_event_names[e]);
+    }
+
+    printf("\n");
+    return true;
+}
+
+static inline void bench_finish(bench_options *o) {
+    perf_close(&o->counters);
+
+    if (o->csv) {
+        fclose(o->csv);
+    }
+}
+
+static inline int bench_compare(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static inline bool bench_run(bench_options *o, const char *suite,
+                             const char *name, const char *unit,
+                             bench_body body, void *context,
+                             bench_result *result) {
+    // Runs one benchmark unless the filter leaves it out, and reports it.
+    // Returns false if it was left out.
+    char full[128];
+    double ns[BENCH_MAX_REPEAT];
+    double cycles = 0;
+    bench_result r = {0};
+
+    snprintf(full, sizeof(full), "%s/%s", suite, name);
+
+    if (o->filter && !strstr(full, o->filter)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < o->warmup; i++) {
+        body(context);
+    }
+
+    for (size_t i = 0; i < o->repeat; i++) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        perf_start(&o->counters);
+        uint64_t first = bench_cycles();
+        uint64_t units = body(context);
+        uint64_t last = bench_cycles();
+        perf_stop(&o->counters);
+        double seconds = bench_seconds(&start);
+
+        units = units ? units : 1;
+        ns[i] = seconds * 1e9 / units;
+        cycles += (double)(last - first) / units;
+        r.units = units;
+        r.mean += ns[i] / o->repeat;
+
+        for (size_t e = 0; e < PERF_EVENT_COUNT; e++) {
+            r.events[e] += (double)o->counters.values[e] / units / o->repeat;
+        }
+    }
+
+    qsort(ns, o->repeat, sizeof(double), bench_compare);
+
+    for (size_t i = 0; i < o->repeat; i++) {
+        r.stddev += (ns[i] - r.mean) * (ns[i] - r.mean) / o->repeat;
+    }
+
+    r.min = ns[0];
+    r.median = o->repeat % 2 ? ns[o->repeat / 2]
+                             : (ns[o->repeat / 2 - 1] + ns[o->repeat / 2]) / 2;
+    r.stddev = sqrt(r.stddev);
+    r.cycles = cycles / o->repeat;
+
+    printf("%-8s %-28s %12" PRIu64 " %10.2f %8.2f %10.2f %9.2f", suite, name,
+           r.units, r.median, r.stddev, 1e3 / r.median, r.cycles);
+
+    for (size_t e = 0; o->perf && e < PERF_EVENT_COUNT; e++) {
+        if (perf_available(&o->counters, e)) {
+            printf(" %13.4f", r.events[e]);
+        } else {
+            printf(" %13s", "-");
+        }
+    }
+
+    printf("\n");
+
+    if (o->csv) {
+        fprintf(o->csv,
+                "%s,%s,%s,%" PRIu64 ",%zu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f", suite,
+                name, unit, r.units, o->repeat, r.min, r.median, r.mean,
+                r.stddev, 1e3 / r.median, r.cycles);
+
+        // Events the host could not count are left empty.
+        for (size_t e = 0; e < PERF_EVENT_COUNT; e++) {
+            if (perf_available(&o->counters, e)) {
+                fprintf(o->csv, ",%.4f", r.events[e]);
+            } else {
+                fprintf(o->csv, ",");
+            }
+        }
+
+        fprintf(o->csv, "\n");
+    }
+
+    if (result) {
+        *result = r;
+    }
+
+    return true;
+}
+
+#endif
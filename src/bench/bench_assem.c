@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../assem/assem.h"
+#include "../assem/lexer.h"
+#include "bench.h"
+
+// Assembler throughput benchmark: a synthetic multi-megabyte program made of
+// the kinds of lines found in the examples, with comments, labels, and every
+// operand form.
+
+#define SOURCE_LINES 200000
+#define LINES_PER_ORIGIN 2048
+#define TINY_PROGRAMS 20000
+
+// A program of the size property-based tests generate by the million.
+static const char tiny[] = "START: MOV 0x1 %a\nADD %a %b\nJMP NZ .START\n";
+
+static const char *lines[] = {
+    "    MOV 0x1 %a          ( - Load the counter.                             )\n",
+    "    ADD %a %b\n",
+    "    MOV @F000 %c        ( - Read the status quad.                         )\n",
+    "    PSH %a\n",
+    "    POP %b\n",
+    "    MOV 0x00FF %sp\n",
+    "    JMP NZ .LOOP        ( - Repeat until zero.                            )\n",
+    "( A comment on a line of its own.                                          )\n",
+    "\n",
+};
+
+#define LINE_KINDS (sizeof(lines) / sizeof(lines[0]))
+
+static char *bench_program(size_t count, size_t *size) {
+    size_t capacity = count * 96 + 64;
+    char *prog = malloc(capacity);
+    char *p = prog;
+
+    p += sprintf(p, "LOOP:\n");
+
+    for (size_t i = 0; i < count; i++) {
+        if (i % LINES_PER_ORIGIN == 0) {
+            p += sprintf(p, "#org 0100\n");
+        }
+
+        p += sprintf(p, "%s", lines[i % LINE_KINDS]);
+    }
+
+    *size = p - prog;
+    return prog;
+}
+
+typedef struct bench_source {
+    char *prog;
+    size_t size;
+    size_t lines;
+} bench_source;
+
+static uint64_t bench_lex(void *context) {
+    // Lexing alone, for comparison with the whole assembler.
+    bench_source *b = context;
+    size_t tokens = 0;
+    lexer lx;
+    token t;
+
+    lexer_init(&lx, b->prog, b->size);
+
+    do {
+        while (lexer_next(&lx, &t)) {
+            tokens++;
+        }
+    } while (lexer_next_line(&lx));
+
+    return tokens ? b->lines : 0;
+}
+
+static uint64_t bench_assemble(void *context) {
+    bench_source *b = context;
+    memory *mem = build_image("bench", b->prog);
+
+    if (!mem) {
+        exit(EXIT_FAILURE);
+    }
+
+    memory_free(mem);
+    return b->lines;
+}
+
+static uint64_t bench_build_tiny(void *context) {
+    // Tiny programs, each built into a fresh image.
+    for (size_t i = 0; i < TINY_PROGRAMS; i++) {
+        memory_free(build_image("bench", tiny));
+    }
+
+    return TINY_PROGRAMS;
+}
+
+static uint64_t bench_run_tiny(void *context) {
+    // Tiny programs assembled into the same memory by one reused assembler.
+    assembler *a = assembler_init();
+    memory *mem = memory_init(64 * 1024);
+
+    for (size_t i = 0; i < TINY_PROGRAMS; i++) {
+        if (!assembler_run(a, tiny, sizeof(tiny) - 1, mem, NULL)) {
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    memory_free(mem);
+    assembler_free(a);
+    return TINY_PROGRAMS;
+}
+
+int main(int argc, char *argv[]) {
+    bench_options o;
+    bench_source source = {.lines = SOURCE_LINES};
+
+    if (!bench_parse(argc, argv, &o)) {
+        return EXIT_FAILURE;
+    }
+
+    source.prog = bench_program(source.lines, &source.size);
+    bench_run(&o, "assem", "lex", "line", bench_lex, &source, NULL);
+    bench_run(&o, "assem", "assemble", "line", bench_assemble, &source, NULL);
+    bench_run(&o, "assem", "build_image tiny", "program", bench_build_tiny,
+              NULL, NULL);
+    bench_run(&o, "assem", "assembler_run tiny", "program", bench_run_tiny,
+              NULL, NULL);
+
+    free(source.prog);
+    bench_finish(&o);
+    return EXIT_SUCCESS;
+}
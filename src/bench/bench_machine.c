@@ -0,0 +1,347 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../assem/assem.h"
+#include "../machine/cpu.h"
+#include "../machine/isa.h"
+#include "bench.h"
+
+// Emulator speed benchmark: every opcode with every class of operand it
+// takes, the example programs run without the simulator, and larger kernels
+// written for the purpose. Each runs a fixed number of instructions per
+// repetition, and is reported per instruction executed.
+
+#define BENCH_OPCODE_INSTRUCTIONS (1 << 20)
+#define BENCH_WORKLOAD_INSTRUCTIONS (1 << 22)
+#define BENCH_EXAMPLES "examples"
+
+// Copies of the measured instruction in each pass of an opcode loop. The
+// loop also resets the stack pointer and jumps back, two instructions that
+// every opcode pays for alike.
+#define BENCH_COPIES 32
+#define BENCH_PROGRAM_LENGTH 4096
+
+// Code starts at 0400 with the stack at 0100 below it, and IX points at the
+// memory operands at 1000.
+static const char bench_vectors[] = "#data 0400 0100 0000 1000 0000\n"
+                                    "#org 0400\n"
+                                    "LOOP:\n";
+
+static const char bench_loop[] = "MOV 0x0100 %sp\n"
+                                 "JMP T .LOOP\n";
+
+typedef struct bench_operand {
+    const char *name;
+    const char *text;
+} bench_operand;
+
+static const bench_operand bench_sources[] = {
+    {"reg", "%c"},         {"const", "0x3"}, {"direct", "@1000"},
+    {"indexed", "*0004"}, {"wide", "%ta"},
+};
+
+static const bench_operand bench_destinations[] = {
+    {"reg", "%b"},
+    {"direct", "@1008"},
+    {"indexed", "*000C"},
+    {"wide", "%ta"},
+};
+
+#define BENCH_SOURCES (sizeof(bench_sources) / sizeof(bench_sources[0]))
+#define BENCH_DESTINATIONS                                                     \
+    (sizeof(bench_destinations) / sizeof(bench_destinations[0]))
+
+// Bubble sorts 16 quads that start in descending order, then refills them.
+static const char bench_sort[] = "#data 0020 0100 0000 0000 0000\n"
+                                 "#org 0020\n"
+                                 "START: MOV 0x1000 %ix\n"
+                                 "    MOV 0xF %a\n"
+                                 "    MOV 0x0 %c\n"
+                                 "FILL: MOV %a *0000\n"
+                                 "    INC %ix\n"
+                                 "    DEC %a\n"
+                                 "    DEC %c\n"
+                                 "    JMP NZ .FILL\n"
+                                 "    MOV 0x0 %b\n"
+                                 "PASS: MOV 0x1000 %ix\n"
+                                 "    MOV 0xF %c\n"
+                                 "STEP: MOV *0000 %d\n"
+                                 "    MOV *0001 %e\n"
+                                 "    CMP %d %e\n"
+                                 "    JMP NN .NEXT\n"
+                                 "    MOV %e *0000\n"
+                                 "    MOV %d *0001\n"
+                                 "NEXT: INC %ix\n"
+                                 "    DEC %c\n"
+                                 "    JMP NZ .STEP\n"
+                                 "    DEC %b\n"
+                                 "    JMP NZ .PASS\n"
+                                 "    JMP T .START\n";
+
+// Adds one 8-digit BCD number to another, a digit at a time with a decimal
+// carry, over and over.
+static const char bench_bcd[] = "#data 0020 0100 0000 0000 0000\n"
+                                "#org 1000\n"
+                                "#data 0000 0000 0192 8374\n"
+                                "#org 0020\n"
+                                "START: MOV 0x1007 %ix\n"
+                                "    MOV 0x8 %c\n"
+                                "    XOR %f %f\n"
+                                "DIGIT: MOV *0000 %a\n"
+                                "    AND 0xB %s0\n"
+                                "    ADD %f %a\n"
+                                "    AND 0xB %s0\n"
+                                "    ADD *0008 %a\n"
+                                "    XOR %f %f\n"
+                                "    JMP C .ADJUST\n"
+                                "    CMP 0x9 %a\n"
+                                "    JMP N .STORE\n"
+                                "    JMP Z .STORE\n"
+                                "ADJUST: AND 0xB %s0\n"
+                                "    ADD 0x6 %a\n"
+                                "    MOV 0x1 %f\n"
+                                "STORE: MOV %a *0000\n"
+                                "    DEC %ix\n"
+                                "    DEC %c\n"
+                                "    JMP NZ .DIGIT\n"
+                                "    JMP T .START\n";
+
+// Copies 256 quads from 1000 to 2000, over and over.
+static const char bench_memcpy[] = "#data 0020 0100 0000 0000 0000\n"
+                                   "#org 1000\n"
+                                   "#data 0123 4567 89AB CDEF\n"
+                                   "#org 0020\n"
+                                   "START: MOV 0x1000 %ix\n"
+                                   "COPY: MOV *0000 %a\n"
+                                   "    MOV %a *1000\n"
+                                   "    INC %ix\n"
+                                   "    CMP 0x1100 %ix\n"
+                                   "    JMP NZ .COPY\n"
+                                   "    JMP T .START\n";
+
+typedef struct bench_kernel {
+    const char *name;
+    const char *prog;
+} bench_kernel;
+
+static const bench_kernel bench_kernels[] = {
+    {"sort", bench_sort},
+    {"bcd", bench_bcd},
+    {"memcpy", bench_memcpy},
+};
+
+typedef struct bench_machine {
+    machine *m;
+    uint32_t instructions;
+} bench_machine;
+
+static uint64_t bench_execute(void *context) {
+    // Runs the machine for the benchmark's instructions, restarting it from
+    // its reset vectors whenever it halts. Memory is left as it was.
+    bench_machine *b = context;
+    uint64_t executed = 0;
+
+    while (executed < b->instructions) {
+        executed += machine_run_quantum(b->m, b->instructions - executed);
+
+        if (b->m->flags & FLAG_HALT) {
+            machine_reset(b->m);
+            machine_start(b->m);
+        }
+    }
+
+    return executed;
+}
+
+static void bench_measure(bench_options *o, const char *suite,
+                          const char *name, machine *m,
+                          uint32_t instructions) {
+    bench_machine b = {m, instructions};
+
+    machine_reset(m);
+    machine_start(m);
+    bench_run(o, suite, name, "instr", bench_execute, &b, NULL);
+}
+
+static bool bench_assemble(assembler *a, machine *m, const char *prog) {
+    return assembler_run(a, prog, strlen(prog), m->memory, NULL);
+}
+
+static void bench_opcode(bench_options *o, assembler *a, machine *m,
+                         const char *name, const char *instr,
+                         const char *test) {
+    // Measures a loop of copies of one instruction. With a `test`, the
+    // instruction is a jump or call on that condition to the next copy.
+    // Combinations of operands that do not assemble, or that halt the
+    // machine, are skipped.
+    char prog[BENCH_PROGRAM_LENGTH];
+    size_t n = snprintf(prog, sizeof(prog), "%s", bench_vectors);
+
+    for (size_t i = 0; i < BENCH_COPIES; i++) {
+        if (test) {
+            n += snprintf(prog + n, sizeof(prog) - n, "L%zu: %s %s .L%zu\n",
+                          i, instr, test, i + 1);
+        } else {
+            n += snprintf(prog + n, sizeof(prog) - n, "%s\n", instr);
+        }
+    }
+
+    snprintf(prog + n, sizeof(prog) - n, "L%d:\n%s", BENCH_COPIES,
+             bench_loop);
+
+    if (!bench_assemble(a, m, prog)) {
+        return;
+    }
+
+    machine_reset(m);
+    machine_start(m);
+    machine_run_quantum(m, BENCH_COPIES * 4);
+
+    if (m->flags & FLAG_HALT) {
+        return;
+    }
+
+    bench_measure(o, "opcode", name, m, BENCH_OPCODE_INSTRUCTIONS);
+}
+
+static void bench_opcodes(bench_options *o, assembler *a, machine *m) {
+    char name[64];
+    char instr[64];
+
+    for (size_t op = 0; op < ISA_OPCODE_COUNT; op++) {
+        const char *mnemonic = isa_opcodes[op].name;
+
+        switch (isa_opcodes[op].form) {
+        case FORM_NONE:
+            bench_opcode(o, a, m, mnemonic, mnemonic, NULL);
+            break;
+        case FORM_DEST:
+            for (size_t d = 0; d < BENCH_DESTINATIONS; d++) {
+                snprintf(name, sizeof(name), "%s %s", mnemonic,
+                         bench_destinations[d].name);
+                snprintf(instr, sizeof(instr), "%s %s", mnemonic,
+                         bench_destinations[d].text);
+                bench_opcode(o, a, m, name, instr, NULL);
+            }
+            break;
+        case FORM_SRC:
+            for (size_t s = 0; s < BENCH_SOURCES; s++) {
+                snprintf(name, sizeof(name), "%s %s", mnemonic,
+                         bench_sources[s].name);
+                snprintf(instr, sizeof(instr), "%s %s", mnemonic,
+                         bench_sources[s].text);
+                bench_opcode(o, a, m, name, instr, NULL);
+            }
+            break;
+        case FORM_SRC_DEST:
+            for (size_t s = 0; s < BENCH_SOURCES; s++) {
+                for (size_t d = 0; d < BENCH_DESTINATIONS; d++) {
+                    snprintf(name, sizeof(name), "%s %s %s", mnemonic,
+                             bench_sources[s].name,
+                             bench_destinations[d].name);
+                    snprintf(instr, sizeof(instr), "%s %s %s", mnemonic,
+                             bench_sources[s].text,
+                             bench_destinations[d].text);
+                    bench_opcode(o, a, m, name, instr, NULL);
+                }
+            }
+            break;
+        case FORM_TEST:
+            // Jumps to the next copy that are all taken, and that are never
+            // taken. Calls leave their return address on the stack, which
+            // the loop resets.
+            snprintf(name, sizeof(name), "%s taken", mnemonic);
+            bench_opcode(o, a, m, name, mnemonic, "T");
+            snprintf(name, sizeof(name), "%s not-taken", mnemonic);
+            bench_opcode(o, a, m, name, mnemonic, "F");
+            break;
+        }
+    }
+}
+
+static void bench_workload(bench_options *o, machine *m, memory *image,
+                           const char *name) {
+    memcpy(m->memory->data, image->data, image->size);
+    bench_measure(o, "workload", name, m, BENCH_WORKLOAD_INSTRUCTIONS);
+}
+
+static int bench_compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void bench_examples(bench_options *o, machine *m, const char *dir) {
+    // The example programs, in name order, without the simulator's display
+    // or keypad. Programs that halt are restarted with their memory as they
+    // left it, so a short program is measured over many runs.
+    char *names[256];
+    size_t count = 0;
+    DIR *d = opendir(dir);
+
+    if (!d) {
+        fprintf(stderr, "warning: no examples in '%s'\n", dir);
+        return;
+    }
+
+    for (struct dirent *e; (e = readdir(d)) && count < 256;) {
+        size_t length = strlen(e->d_name);
+
+        if (length > 4 && strcmp(e->d_name + length - 4, ".bbb") == 0) {
+            names[count++] = strdup(e->d_name);
+        }
+    }
+
+    closedir(d);
+    qsort(names, count, sizeof(char *), bench_compare_names);
+
+    for (size_t i = 0; i < count; i++) {
+        char path[512];
+        char name[64];
+        source_cache *cache = source_cache_init();
+
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        snprintf(name, sizeof(name), "%.*s", (int)strlen(names[i]) - 4,
+                 names[i]);
+        memory *image = build_file(cache, &(build_options){0}, path);
+
+        if (image) {
+            bench_workload(o, m, image, name);
+            memory_free(image);
+        }
+
+        source_cache_free(cache);
+        free(names[i]);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    bench_options o;
+
+    if (!bench_parse(argc, argv, &o)) {
+        return EXIT_FAILURE;
+    }
+
+    assembler *a = assembler_init();
+    machine *m = machine_init(CPU_MAX_ADDRESS);
+
+    bench_opcodes(&o, a, m);
+    bench_examples(&o, m, BENCH_EXAMPLES);
+
+    for (size_t i = 0; i < sizeof(bench_kernels) / sizeof(bench_kernels[0]);
+         i++) {
+        if (!bench_assemble(a, m, bench_kernels[i].prog)) {
+            fprintf(stderr, "error: kernel '%s' did not assemble\n",
+                    bench_kernels[i].name);
+            return EXIT_FAILURE;
+        }
+
+        bench_measure(&o, "workload", bench_kernels[i].name, m,
+                      BENCH_WORKLOAD_INSTRUCTIONS);
+    }
+
+    machine_free(m);
+    assembler_free(a);
+    bench_finish(&o);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../assem/assem.h"
+#include "../assem/table.h"
+#include "bench.h"
+
+// Symbol table benchmark: a synthetic program with a large number of labels,
+// each defined once and referenced once from elsewhere in the program.
+
+#define LABEL_COUNT 100000
+#define LABELS_PER_ORIGIN 8192
+
+static char *bench_program(size_t labels) {
+    // Every label is followed by a jump to another label, so resolving the
+    // program looks up each label once. The origin is reset every so often
+    // to keep the image inside the address space.
+    size_t size = labels * 40 + 1;
+    char *prog = malloc(size);
+    char *p = prog;
+
+    for (size_t i = 0; i < labels; i++) {
+        if (i % LABELS_PER_ORIGIN == 0) {
+            p += sprintf(p, "#org 0100\n");
+        }
+
+        p += sprintf(p, "L%zu: JMP T .L%zu\n", i, (i * 7919) % labels);
+    }
+
+    return prog;
+}
+
+static uint64_t bench_table(void *context) {
+    // Defines every label, then looks each one up once.
+    char label[32];
+    table *t = table_init();
+
+    for (size_t i = 0; i < LABEL_COUNT; i++) {
+        snprintf(label, sizeof(label), "L%zu", i);
+        table_symbol_define(t, label, i);
+    }
+
+    for (size_t i = 0; i < LABEL_COUNT; i++) {
+        snprintf(label, sizeof(label), "L%zu", (i * 7919) % LABEL_COUNT);
+
+        if (!table_symbol_lookup(t, label)) {
+            fprintf(stderr, "error: label '%s' went missing\n", label);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    table_free(t);
+    return LABEL_COUNT;
+}
+
+static uint64_t bench_assemble(void *context) {
+    memory *mem = build_image("bench", context);
+
+    if (!mem) {
+        exit(EXIT_FAILURE);
+    }
+
+    memory_free(mem);
+    return LABEL_COUNT;
+}
+
+int main(int argc, char *argv[]) {
+    bench_options o;
+
+    if (!bench_parse(argc, argv, &o)) {
+        return EXIT_FAILURE;
+    }
+
+    char *prog = bench_program(LABEL_COUNT);
+    bench_run(&o, "table", "define and look up", "label", bench_table, NULL,
+              NULL);
+    bench_run(&o, "table", "assemble", "label", bench_assemble, prog, NULL);
+
+    free(prog);
+    bench_finish(&o);
+    return EXIT_SUCCESS;
+}
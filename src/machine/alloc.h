@@ -0,0 +1,47 @@
+#ifndef BBB_ALLOC_H
+#define BBB_ALLOC_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Storage for the arrays the tools build up as they go. None of them can do
+// anything useful without the memory, so running out is reported and exits
+// rather than returning NULL.
+
+static inline void *alloc_grow(void *data, size_t *length, size_t size,
+                               size_t needed, size_t initial) {
+    // Makes room for at least `needed` elements of `size` bytes, doubling
+    // `*length` from `initial`. Returns the array, which may have moved.
+    if (needed <= *length) {
+        return data;
+    }
+
+    while (*length < needed) {
+        *length = *length ? *length * 2 : initial;
+    }
+
+    void *grown = realloc(data, *length * size);
+
+    if (!grown) {
+        fprintf(stderr, "error: could not allocate storage\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return grown;
+}
+
+static inline void *alloc_array(size_t count, size_t size) {
+    // Zeroed room for `count` elements of `size` bytes. An empty array still
+    // gets an element, so that it can be freed like any other.
+    void *data = calloc(count ? count : 1, size);
+
+    if (!data) {
+        fprintf(stderr, "error: could not allocate storage\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return data;
+}
+
+#endif
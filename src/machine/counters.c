@@ -0,0 +1,101 @@
+#include "counters.h"
+#include "lattice.h"
+#include <stdint.h>
+#include <stdio.h>
+
+static const char *direction_names[] = {"north", "east", "south", "west"};
+
+mailbox_counters counters_mailbox(lattice *l, size_t node, Direction d) {
+    mailbox_counters counters = {0};
+    size_t side;
+    link_counters *c = lattice_traffic(l, node, d, &side);
+
+    if (c != NULL) {
+        counters.out = c->quads[side];
+        counters.stalls = c->stalls[side];
+        counters.in = c->quads[!side];
+        counters.high_water = c->high_water[!side];
+    }
+
+    return counters;
+}
+
+void counters_write_header(FILE *out, CountersFormat format) {
+    // JSON snapshots are written one object per line and need no header.
+    if (format != COUNTERS_CSV) {
+        return;
+    }
+
+    fprintf(out, "quanta,row,column,retired,idle,interrupts");
+
+    for (Direction d = DIRECTION_NORTH; d < DIRECTION_COUNT; d++) {
+        fprintf(out, ",%s_in,%s_out,%s_high_water,%s_stalls",
+                direction_names[d], direction_names[d], direction_names[d],
+                direction_names[d]);
+    }
+
+    fprintf(out, "\n");
+}
+
+static void counters_write_csv(lattice *l, FILE *out) {
+    for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+        node_counters *c = &l->counters[i];
+
+        fprintf(out, "%llu,%zu,%zu,%llu,%llu,%llu",
+                (unsigned long long)l->quanta, i / LATTICE_COLUMNS,
+                i % LATTICE_COLUMNS, (unsigned long long)c->retired,
+                (unsigned long long)c->idle,
+                (unsigned long long)c->interrupts);
+
+        for (Direction d = DIRECTION_NORTH; d < DIRECTION_COUNT; d++) {
+            mailbox_counters m = counters_mailbox(l, i, d);
+
+            fprintf(out, ",%llu,%llu,%u,%llu", (unsigned long long)m.in,
+                    (unsigned long long)m.out, m.high_water,
+                    (unsigned long long)m.stalls);
+        }
+
+        fprintf(out, "\n");
+    }
+}
+
+static void counters_write_json(lattice *l, FILE *out) {
+    fprintf(out, "{\"quanta\":%llu,\"quantum\":%u,\"nodes\":[",
+            (unsigned long long)l->quanta, l->quantum);
+
+    for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+        node_counters *c = &l->counters[i];
+
+        fprintf(out,
+                "%s{\"row\":%zu,\"column\":%zu,\"retired\":%llu,"
+                "\"idle\":%llu,\"interrupts\":%llu,\"mailboxes\":{",
+                i ? "," : "", i / LATTICE_COLUMNS, i % LATTICE_COLUMNS,
+                (unsigned long long)c->retired, (unsigned long long)c->idle,
+                (unsigned long long)c->interrupts);
+
+        for (Direction d = DIRECTION_NORTH; d < DIRECTION_COUNT; d++) {
+            mailbox_counters m = counters_mailbox(l, i, d);
+
+            fprintf(out,
+                    "%s\"%s\":{\"in\":%llu,\"out\":%llu,\"high_water\":%u,"
+                    "\"stalls\":%llu}",
+                    d ? "," : "", direction_names[d], (unsigned long long)m.in,
+                    (unsigned long long)m.out, m.high_water,
+                    (unsigned long long)m.stalls);
+        }
+
+        fprintf(out, "}}");
+    }
+
+    fprintf(out, "]}\n");
+}
+
+void counters_write(lattice *l, FILE *out, CountersFormat format) {
+    if (format == COUNTERS_JSON) {
+        counters_write_json(l, out);
+    } else {
+        counters_write_csv(l, out);
+    }
+
+    fflush(out);
+}
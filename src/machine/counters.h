@@ -0,0 +1,25 @@
+#ifndef BBB_COUNTERS_H
+#define BBB_COUNTERS_H
+
+#include "lattice.h"
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum { COUNTERS_CSV, COUNTERS_JSON } CountersFormat;
+
+// The traffic through one of a node's mailbox pairs, seen from the node:
+// quads received and sent, the most quads ever waiting in its inbox, and
+// exchanges that could not empty its outbox.
+typedef struct mailbox_counters {
+    uint64_t in;
+    uint64_t out;
+    uint64_t stalls;
+    uint8_t high_water;
+} mailbox_counters;
+
+mailbox_counters counters_mailbox(lattice *l, size_t node, Direction d);
+
+void counters_write_header(FILE *out, CountersFormat format);
+void counters_write(lattice *l, FILE *out, CountersFormat format);
+
+#endif
@@ -1,5 +1,6 @@
 #include "cpu.h"
 #include "io.h"
+#include "isa.h"
 #include "memory.h"
 #include <stdbool.h>
 #include <stdint.h>
@@ -24,6 +25,7 @@ extern inline void machine_instr_execute(machine *m);
 
 extern inline void machine_interrupt_check(machine *m);
 void machine_call_update(machine *m);
+bool machine_call_wait(machine *m);
 void machine_call_teardown(machine *m);
 
 static inline uint16_t machine_get_value(machine *m, Register src,
@@ -32,8 +34,10 @@ static inline uint16_t machine_get_value(machine *m, Register src,
     case REGISTER_CV:
         return src_ext;
     case REGISTER_MD:
+        m->last_load = src_ext;
         return memory_read(m->memory, src_ext);
     case REGISTER_MX:
+        m->last_load = (m->ix - m->memory->data) + src_ext;
         return memory_read_indexed(m->memory, m->ix, src_ext);
     case REGISTER_PC:
         return m->pc - m->memory->data;
@@ -51,7 +55,40 @@ static inline uint16_t machine_get_value(machine *m, Register src,
     case REGISTER_S1:
         return m->flags >> 4;
     default:
-        return m->registers[src];
+        // Only the general purpose registers are left, unless the operand
+        // did not come from a decoded instruction.
+        return src <= REGISTER_F ? m->registers[src] : 0;
+    }
+}
+
+static void machine_timer_latch(machine *m) {
+    // Written straight to memory, like the keypad map, so that latching the
+    // timer is not counted as the program's own stores.
+    if (m->memory->size < CPU_TIMER_RETIRED + CPU_TIMER_QUADS) {
+        return;
+    }
+
+    for (size_t i = 0; i < CPU_TIMER_QUADS; i++) {
+        size_t shift = (CPU_TIMER_QUADS - 1 - i) * 4;
+        m->memory->data[CPU_TIMER_CYCLES + i] = (m->cycles >> shift) & 0xF;
+        m->memory->data[CPU_TIMER_RETIRED + i] = (m->retired >> shift) & 0xF;
+    }
+}
+
+static void machine_control(machine *m, uint16_t address) {
+    // Stores to the control registers of the I/O page. Waiting sets the halt
+    // flag too, which stops every run loop without a check of its own, and
+    // machine_wake clears it again.
+    switch (address) {
+    case CPU_TIMER_LATCH:
+        machine_timer_latch(m);
+        break;
+    case CPU_WAIT:
+        m->status = STATE_WAIT;
+        m->flags |= FLAG_HALT;
+        break;
+    default:
+        break;
     }
 }
 
@@ -62,10 +99,14 @@ static inline void machine_set_value(machine *m, Register dst, uint16_t dst_ext,
         m->flags |= FLAG_HALT;
         break;
     case REGISTER_MD:
+        m->stores++;
         memory_write(m->memory, dst_ext, value & 0xF);
+        machine_control(m, dst_ext);
         break;
     case REGISTER_MX:
+        m->stores++;
         memory_write_indexed(m->memory, m->ix, dst_ext, value & 0xF);
+        machine_control(m, m->ix - m->memory->data + dst_ext);
         break;
     case REGISTER_PC:
         m->pc = (m->memory->data + value);
@@ -90,13 +131,15 @@ static inline void machine_set_value(machine *m, Register dst, uint16_t dst_ext,
                    ((value << 4) & (FLAG_HALT | FLAG_INTERRUPT));
         break;
     default:
-        m->registers[dst] = value & 0xF;
+        if (dst <= REGISTER_F) {
+            m->registers[dst] = value & 0xF;
+        }
         break;
     }
 }
 
 machine *machine_init(size_t size) {
-    machine *m = malloc(sizeof(machine));
+    machine *m = calloc(1, sizeof(machine));
     m->memory = memory_init(size);
     machine_reset(m);
     return m;
@@ -123,22 +166,70 @@ void machine_reset(machine *m) {
     m->status = STATE_HALT;
     m->pc = m->sp = m->iv = m->ix = m->ta = m->memory->data;
     m->flags = FLAG_TRUE;
+    m->retired = m->cycles = 0;
 
     for (uint8_t i = 0; i < CPU_REGISTER_COUNT; i++) {
         m->registers[i] = 0;
     }
 }
 
+bool machine_call_wait(machine *m) {
+    // Puts a waiting machine to sleep until its interrupt may have been
+    // raised. Without a callback nothing could raise it, so waiting is the
+    // same as halting. Returns whether the machine woke.
+    if (m->status != STATE_WAIT || m->event_wait == NULL) {
+        return false;
+    }
+
+    m->event_wait(m);
+    return machine_wake(m);
+}
+
 void machine_run(machine *m) {
     machine_call_update(m);
-    while (!(m->flags & FLAG_HALT)) {
+
+    do {
+        while (!(m->flags & FLAG_HALT)) {
+            machine_instr_fetch(m);
+            machine_instr_decode(m);
+            machine_instr_execute(m);
+            machine_call_update(m);
+            machine_interrupt_check(m);
+        }
+    } while (machine_call_wait(m));
+
+    machine_call_update(m);
+}
+
+uint32_t machine_run_quantum(machine *m, uint32_t count) {
+    // Execute at most `count` instructions, stopping early if the machine
+    // halts. Returns the number of instructions that were executed.
+    uint32_t executed = 0;
+
+    while (executed < count && !(m->flags & FLAG_HALT)) {
         machine_instr_fetch(m);
         machine_instr_decode(m);
         machine_instr_execute(m);
         machine_call_update(m);
         machine_interrupt_check(m);
+        executed++;
     }
-    machine_call_update(m);
+
+    return executed;
+}
+
+bool machine_wake(machine *m) {
+    // Resumes a machine that is waiting for an interrupt, once the interrupt
+    // flag is raised, and takes the interrupt unless it is masked. Returns
+    // whether the machine woke.
+    if (m->status != STATE_WAIT || !(m->flags & FLAG_INTERRUPT)) {
+        return false;
+    }
+
+    m->status = STATE_RUN;
+    m->flags &= ~FLAG_HALT;
+    machine_interrupt_check(m);
+    return true;
 }
 
 void machine_call_update(machine *m) {
@@ -158,6 +249,8 @@ inline void machine_interrupt_check(machine *m) {
         return;
     } else {
         m->int_mask = true;
+        m->interrupts++;
+        m->cycles += ISA_INTERRUPT_CYCLES;
         uint16_t dest = m->iv - m->memory->data;
 
         uint16_t pc = m->pc - m->memory->data;
@@ -174,19 +267,22 @@ extern inline void machine_instr_fetch(machine *m) {
 }
 
 extern inline void machine_instr_decode(machine *m) {
-    switch (m->instr) {
-    case NOP: {
+    // Operands are read according to the opcode's form in the instruction
+    // set table, which the assembler also uses to write them. The cost of
+    // the instruction is worked out along the way, from the same tables and
+    // the number of quads read.
+    const uint8_t *start = m->pc - 1;
+    uint8_t cost = isa_opcodes[m->instr].cycles;
+
+    switch (isa_opcodes[m->instr].form) {
+    case FORM_NONE: {
         break;
     }
-    case ADD:
-    case SUB:
-    case AND:
-    case OR:
-    case XOR:
-    case CMP:
-    case MOV: {
+    case FORM_SRC_DEST: {
         m->src = (Register)READ_NEXT(m->pc);
         m->dst = (Register)READ_NEXT(m->pc);
+        cost += isa_operand_cycles[m->src & 0xF] +
+                isa_operand_cycles[m->dst & 0xF];
 
         switch (m->src) {
         case REGISTER_CV: {
@@ -224,12 +320,9 @@ extern inline void machine_instr_decode(machine *m) {
         break;
     }
 
-    case INC:
-    case DEC:
-    case RLC:
-    case RRC:
-    case POP: {
+    case FORM_DEST: {
         m->dst = (Register)READ_NEXT(m->pc);
+        cost += isa_operand_cycles[m->dst & 0xF];
 
         switch (m->dst) {
         case REGISTER_CV: {
@@ -248,8 +341,7 @@ extern inline void machine_instr_decode(machine *m) {
         break;
     }
 
-    case JMP:
-    case JSR: {
+    case FORM_TEST: {
         // Note: the DST nybble in a JMP or JSR instruction
         // contains the type of jump to be executed
         m->dst = READ_NEXT(m->pc);
@@ -257,8 +349,9 @@ extern inline void machine_instr_decode(machine *m) {
         break;
     }
 
-    case PSH: {
+    case FORM_SRC: {
         m->src = READ_NEXT(m->pc);
+        cost += isa_operand_cycles[m->src & 0xF];
 
         switch (m->src) {
         case REGISTER_CV: {
@@ -277,15 +370,21 @@ extern inline void machine_instr_decode(machine *m) {
         break;
     }
     }
+
+    m->cost = cost + (m->pc - start);
 }
 
 extern inline void machine_instr_execute(machine *m) {
     // There are cases where the instruction decode step will set the halt flag
-    // and we want execution to stop completely
+    // and we want execution to stop completely. Such an instruction is not
+    // retired.
     if (m->flags & FLAG_HALT) {
         return;
     }
 
+    m->retired++;
+    m->cycles += m->cost;
+
     switch (m->instr) {
     case NOP: {
         break;
@@ -2,13 +2,24 @@
 #define BBB_CPU_H
 
 #include "memory.h"
+#include <stdbool.h>
 #include <stdint.h>
 
 #define CPU_MAX_ADDRESS 64 * 1024
 #define CPU_REGISTER_COUNT 6
 
+// The timer in the I/O page. A store to the latch copies the cycle and
+// retired instruction counters into their registers, 16 quads each with the
+// most significant first, so a program reads both from the same moment.
+// A store to the wait register stops the CPU until an interrupt.
+#define CPU_TIMER_LATCH 0xFE00
+#define CPU_WAIT 0xFE01
+#define CPU_TIMER_CYCLES 0xFE10
+#define CPU_TIMER_RETIRED 0xFE20
+#define CPU_TIMER_QUADS 16
+
 typedef struct machine machine;
-typedef enum { STATE_RUN, STATE_HALT } MachineState;
+typedef enum { STATE_RUN, STATE_HALT, STATE_WAIT } MachineState;
 typedef void (*MachineEvent)(machine *m);
 
 typedef enum {
@@ -89,13 +100,30 @@ typedef struct machine {
     Register dst;
     uint16_t src_ext;
     uint16_t dst_ext;
+    uint8_t cost;
+
+    // Instructions retired and cycles taken since the machine was reset. An
+    // instruction costs the cycles of its opcode and memory operands in the
+    // instruction set tables, plus one for each quad of its encoding.
+    uint64_t retired;
+    uint64_t cycles;
 
     // Internal state for interrupt masking
     bool int_mask;
 
-    // Callbacks for simulator I/O
+    // Activity for the lattice scheduler, which resets it before each
+    // quantum: the number of stores through the MD and MX registers (stack
+    // traffic is not counted), the address of the most recent load, and the
+    // number of interrupts taken.
+    uint32_t stores;
+    uint16_t last_load;
+    uint32_t interrupts;
+
+    // Callbacks for simulator I/O. `event_wait` is called when the machine
+    // waits for an interrupt, and returns once it may have been raised.
     MachineEvent event_setup;
     MachineEvent event_update;
+    MachineEvent event_wait;
     MachineEvent event_teardown;
 
     // And finally, a pointer to the machine's memory.
@@ -109,6 +137,8 @@ void machine_pause(machine *mach);
 void machine_halt(machine *mach);
 void machine_reset(machine *mach);
 void machine_run(machine *mach);
+uint32_t machine_run_quantum(machine *mach, uint32_t count);
+bool machine_wake(machine *mach);
 
 void machine_free(machine *mach);
 
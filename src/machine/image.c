@@ -0,0 +1,212 @@
+#include "image.h"
+#include "memory.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define IMAGE_HEADER_SIZE (4 * (3 + IMAGE_VECTOR_COUNT))
+
+static bool image_put(FILE *out, uint32_t value) {
+    uint8_t bytes[4] = {value, value >> 8, value >> 16, value >> 24};
+    return fwrite(bytes, 1, 4, out) == 4;
+}
+
+static uint32_t image_get(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint16_t image_vector(memory *mem, size_t address) {
+    // Vectors are stored a quad per nibble, most significant first.
+    uint16_t value = 0;
+
+    for (size_t i = 0; i < 4; i++) {
+        value = value << 4 | (memory_read(mem, address + i) & 0xF);
+    }
+
+    return value;
+}
+
+static size_t image_segment_end(memory *mem, size_t start) {
+    // A segment runs until the next zero run of IMAGE_SEGMENT_GAP quads.
+    size_t end = start;
+
+    for (size_t i = start; i < mem->size && i - end < IMAGE_SEGMENT_GAP;
+         i++) {
+        if (mem->data[i]) {
+            end = i + 1;
+        }
+    }
+
+    return end;
+}
+
+bool image_write(FILE *out, memory *mem) {
+    // Segments are found from what is in memory, so every way of building
+    // an image writes the same file for the same program.
+    uint32_t count = 0;
+
+    for (size_t i = 0; i < mem->size; i++) {
+        if (mem->data[i]) {
+            i = image_segment_end(mem, i);
+            count++;
+        }
+    }
+
+    bool success = fwrite("BBBI", 1, 4, out) == 4 &&
+                   image_put(out, IMAGE_VERSION);
+
+    for (size_t i = 0; success && i < IMAGE_VECTOR_COUNT; i++) {
+        success = image_put(out, image_vector(mem, i * 4));
+    }
+
+    success = success && image_put(out, count);
+
+    for (size_t i = 0; success && i < mem->size; i++) {
+        if (!mem->data[i]) {
+            continue;
+        }
+
+        size_t end = image_segment_end(mem, i);
+        success = image_put(out, i) && image_put(out, end - i);
+
+        for (; success && i < end; i += 2) {
+            uint8_t low = i + 1 < end ? mem->data[i + 1] & 0xF : 0;
+            success = fputc((mem->data[i] & 0xF) << 4 | low, out) != EOF;
+        }
+    }
+
+    return success;
+}
+
+static bool image_unpack(const uint8_t *data, size_t length, memory *mem,
+                         image_header *header) {
+    // The whole image is checked before memory is touched.
+    if (length < IMAGE_HEADER_SIZE) {
+        return false;
+    }
+
+    header->version = image_get(data + 4);
+
+    for (size_t i = 0; i < IMAGE_VECTOR_COUNT; i++) {
+        header->vectors[i] = image_get(data + 8 + i * 4);
+    }
+
+    header->segment_count = image_get(data + IMAGE_HEADER_SIZE - 4);
+
+    if (header->version != IMAGE_VERSION) {
+        return false;
+    }
+
+    size_t at = IMAGE_HEADER_SIZE;
+
+    for (uint32_t i = 0; i < header->segment_count; i++) {
+        if (length - at < 8) {
+            return false;
+        }
+
+        size_t origin = image_get(data + at);
+        size_t quads = image_get(data + at + 4);
+        size_t bytes = (quads + 1) / 2;
+
+        if (origin > mem->size || quads > mem->size - origin ||
+            bytes > length - at - 8) {
+            return false;
+        }
+
+        at += 8 + bytes;
+    }
+
+    if (at != length) {
+        return false;
+    }
+
+    memset(mem->data, 0, mem->size);
+    at = IMAGE_HEADER_SIZE;
+
+    for (uint32_t i = 0; i < header->segment_count; i++) {
+        size_t origin = image_get(data + at);
+        size_t quads = image_get(data + at + 4);
+        const uint8_t *packed = data + at + 8;
+        uint8_t *quad = mem->data + origin;
+
+        for (size_t j = 0; j < quads / 2; j++) {
+            *quad++ = packed[j] >> 4;
+            *quad++ = packed[j] & 0xF;
+        }
+
+        if (quads & 1) {
+            *quad = packed[quads / 2] >> 4;
+        }
+
+        at += 8 + (quads + 1) / 2;
+    }
+
+    return true;
+}
+
+bool image_load(const char *path, memory *mem, image_header *header) {
+    // Loads a sparse or flat image into memory. The file is mapped, and
+    // segments are unpacked straight from the mapping. `header` may be NULL;
+    // for a flat image it is filled in from memory with a version of 0.
+    image_header ignored;
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    bool valid = false;
+
+    if (!header) {
+        header = &ignored;
+    }
+
+    if (fd < 0) {
+        return false;
+    }
+
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+
+    const uint8_t *data = NULL;
+    size_t length = st.st_size;
+
+    if (length > 0) {
+        void *mapped = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        data = mapped == MAP_FAILED ? NULL : mapped;
+    }
+
+    close(fd);
+
+    if (length > 0 && !data) {
+        return false;
+    }
+
+    if (length >= 4 && memcmp(data, "BBBI", 4) == 0) {
+        valid = image_unpack(data, length, mem, header);
+    } else if (length <= mem->size) {
+        memset(mem->data, 0, mem->size);
+
+        if (length > 0) {
+            memcpy(mem->data, data, length);
+        }
+
+        *header = (image_header){0};
+
+        for (size_t i = 0; i < IMAGE_VECTOR_COUNT; i++) {
+            header->vectors[i] = image_vector(mem, i * 4);
+        }
+
+        valid = true;
+    }
+
+    if (data) {
+        munmap((void *)data, length);
+    }
+
+    return valid;
+}
@@ -0,0 +1,32 @@
+#ifndef BBB_IMAGE_H
+#define BBB_IMAGE_H
+
+#include "memory.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define IMAGE_VERSION 1
+
+// The reset vectors read by machine_start, in order: PC, SP, IV, IX, TA.
+#define IMAGE_VECTOR_COUNT 5
+
+// Zero runs shorter than this are kept inside a segment rather than ending
+// it, since a segment header takes as much room as this many packed quads.
+#define IMAGE_SEGMENT_GAP 16
+
+// A sparse image starts with "BBBI", a version, the reset vectors and the
+// number of segments, each a little-endian 32-bit word. Each segment is its
+// origin and length in quads followed by the quads packed two to a byte,
+// high nibble first. Memory outside the segments is zero. Anything that
+// does not start with the magic is a legacy flat image of one quad per byte.
+typedef struct image_header {
+    uint32_t version;
+    uint16_t vectors[IMAGE_VECTOR_COUNT];
+    uint32_t segment_count;
+} image_header;
+
+bool image_write(FILE *out, memory *mem);
+bool image_load(const char *path, memory *mem, image_header *header);
+
+#endif
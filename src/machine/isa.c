@@ -0,0 +1,158 @@
+#include "isa.h"
+#include "cpu.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+// Executing takes a cycle, and a call another four to push its return
+// address. NOP does nothing once it is read.
+const isa_opcode isa_opcodes[ISA_OPCODE_COUNT] = {
+    [NOP] = {"NOP", FORM_NONE, 0},     [INC] = {"INC", FORM_DEST, 1},
+    [DEC] = {"DEC", FORM_DEST, 1},     [ADD] = {"ADD", FORM_SRC_DEST, 1},
+    [SUB] = {"SUB", FORM_SRC_DEST, 1}, [RLC] = {"RLC", FORM_DEST, 1},
+    [RRC] = {"RRC", FORM_DEST, 1},     [AND] = {"AND", FORM_SRC_DEST, 1},
+    [OR] = {"OR", FORM_SRC_DEST, 1},   [XOR] = {"XOR", FORM_SRC_DEST, 1},
+    [CMP] = {"CMP", FORM_SRC_DEST, 1}, [PSH] = {"PSH", FORM_SRC, 1},
+    [POP] = {"POP", FORM_DEST, 1},     [JMP] = {"JMP", FORM_TEST, 1},
+    [JSR] = {"JSR", FORM_TEST, 5},     [MOV] = {"MOV", FORM_SRC_DEST, 1}};
+
+// Registers are read and written within the cycle of the opcode, while a
+// memory operand takes a cycle of its own to access.
+const uint8_t isa_operand_cycles[REGISTER_MX + 1] = {[REGISTER_MD] = 1,
+                                                     [REGISTER_MX] = 1};
+
+const char *const isa_registers[ISA_REGISTER_COUNT] = {
+    [REGISTER_A] = "a",   [REGISTER_B] = "b",   [REGISTER_C] = "c",
+    [REGISTER_D] = "d",   [REGISTER_E] = "e",   [REGISTER_F] = "f",
+    [REGISTER_S0] = "s0", [REGISTER_S1] = "s1", [REGISTER_PC] = "pc",
+    [REGISTER_SP] = "sp", [REGISTER_IV] = "iv", [REGISTER_IX] = "ix",
+    [REGISTER_TA] = "ta"};
+
+// The flags in bit order, as in the Flag enum.
+const char isa_conditions[ISA_CONDITION_COUNT + 1] = "NZCOIHFT";
+
+// Each lookup picks the only candidate for a name from its length and a
+// character or two, then compares the whole name against the table above.
+// That keeps the table the single definition of every name, and a typo in
+// one of the switches can only make a name unrecognizable, never wrong.
+
+static inline int isa_match(const char *entry, const char *name,
+                            size_t length, int index) {
+    if (strncmp(entry, name, length) != 0 || entry[length] != '\0') {
+        return -1;
+    }
+
+    return index;
+}
+
+static int isa_opcode_candidate(const char *name, size_t length) {
+    if (length == 2) {
+        return OR;
+    } else if (length != 3) {
+        return -1;
+    }
+
+    switch (name[0]) {
+    case 'A':
+        return name[1] == 'D' ? ADD : AND;
+    case 'C':
+        return CMP;
+    case 'D':
+        return DEC;
+    case 'I':
+        return INC;
+    case 'J':
+        return name[2] == 'P' ? JMP : JSR;
+    case 'M':
+        return MOV;
+    case 'N':
+        return NOP;
+    case 'P':
+        return name[1] == 'S' ? PSH : POP;
+    case 'R':
+        return name[1] == 'L' ? RLC : RRC;
+    case 'S':
+        return SUB;
+    case 'X':
+        return XOR;
+    default:
+        return -1;
+    }
+}
+
+int isa_opcode_lookup(const char *name, size_t length) {
+    int opcode = isa_opcode_candidate(name, length);
+    return opcode < 0 ? -1
+                      : isa_match(isa_opcodes[opcode].name, name, length,
+                                  opcode);
+}
+
+static int isa_register_candidate(const char *name, size_t length) {
+    if (length == 1) {
+        return name[0] >= 'a' && name[0] <= 'f' ? REGISTER_A + name[0] - 'a'
+                                                : -1;
+    } else if (length != 2) {
+        return -1;
+    }
+
+    switch (name[0]) {
+    case 'i':
+        return name[1] == 'v' ? REGISTER_IV : REGISTER_IX;
+    case 'p':
+        return REGISTER_PC;
+    case 's':
+        return name[1] == '0'   ? REGISTER_S0
+               : name[1] == '1' ? REGISTER_S1
+                                : REGISTER_SP;
+    case 't':
+        return REGISTER_TA;
+    default:
+        return -1;
+    }
+}
+
+int isa_register_lookup(const char *name, size_t length) {
+    int reg = isa_register_candidate(name, length);
+    return reg < 0 ? -1 : isa_match(isa_registers[reg], name, length, reg);
+}
+
+static int isa_flag_candidate(char flag) {
+    switch (flag) {
+    case 'N':
+        return 0;
+    case 'Z':
+        return 1;
+    case 'C':
+        return 2;
+    case 'O':
+        return 3;
+    case 'I':
+        return 4;
+    case 'H':
+        return 5;
+    case 'F':
+        return 6;
+    case 'T':
+        return 7;
+    default:
+        return -1;
+    }
+}
+
+int isa_condition_lookup(const char *name, size_t length) {
+    // The high bit of the nibble is set when the condition is not negated.
+    bool negated = length == 2 && name[0] == 'N';
+
+    if (length != 1 && !negated) {
+        return -1;
+    }
+
+    char flag = name[length - 1];
+    int bit = isa_flag_candidate(flag);
+
+    if (bit < 0 || isa_conditions[bit] != flag) {
+        return -1;
+    }
+
+    return (negated ? 0x0 : 0x8) | bit;
+}
@@ -0,0 +1,52 @@
+#ifndef BBB_ISA_H
+#define BBB_ISA_H
+
+#include "cpu.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define ISA_OPCODE_COUNT 16
+#define ISA_CONDITION_COUNT 8
+
+// Registers CV, MD, and MX are implied by the operand syntax and have no
+// names of their own.
+#define ISA_REGISTER_COUNT REGISTER_CV
+
+// The operands that follow an opcode. The decoder reads instructions by
+// form, and the assembler parses them the same way.
+typedef enum {
+    FORM_NONE,     // No operands
+    FORM_DEST,     // A destination
+    FORM_SRC,      // A source
+    FORM_SRC_DEST, // A source followed by a destination
+    FORM_TEST      // A condition followed by an address
+} OperandForm;
+
+// `cycles` is what an opcode takes beyond reading its encoding, one cycle
+// per quad, and accessing its memory operands.
+typedef struct isa_opcode {
+    const char *name;
+    OperandForm form;
+    uint8_t cycles;
+} isa_opcode;
+
+// Cycles to enter an interrupt, which pushes the program counter, and the
+// most any one instruction takes: an opcode with two memory operands.
+#define ISA_INTERRUPT_CYCLES 4
+#define ISA_MAX_CYCLES 14
+
+// The instruction set, indexed by Opcode, Register, and the bit of the flags
+// register a condition tests.
+extern const isa_opcode isa_opcodes[ISA_OPCODE_COUNT];
+extern const char *const isa_registers[ISA_REGISTER_COUNT];
+extern const char isa_conditions[ISA_CONDITION_COUNT + 1];
+extern const uint8_t isa_operand_cycles[REGISTER_MX + 1];
+
+// Lookups take names that are not NUL-terminated and return -1 for unknown
+// names. A condition is the flag letter, optionally preceded by 'N' to
+// negate it, and is returned as the nibble encoded in JMP and JSR.
+int isa_opcode_lookup(const char *name, size_t length);
+int isa_register_lookup(const char *name, size_t length);
+int isa_condition_lookup(const char *name, size_t length);
+
+#endif
@@ -0,0 +1,927 @@
+#include "lattice.h"
+#include "cpu.h"
+#include "memory.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAILBOX(m, base, d) ((m)->memory->data + (base) + (d) * MAILBOX_SIZE)
+#define OPPOSITE(d) (((d) + 2) % DIRECTION_COUNT)
+#define SLOT(i) ((i) % LATTICE_NODE_COUNT)
+#define NOT_HALTED UINT64_MAX
+
+// Quanta for mail to cross the lattice, since neighbouring clocks are never
+// more than one quantum apart.
+#define LATTICE_CROSSING (LATTICE_ROWS + LATTICE_COLUMNS)
+
+static void *lattice_worker_main(void *arg);
+
+static const char *direction_names[] = {"north", "east", "south", "west"};
+
+static void deque_init(deque *q) {
+    pthread_mutex_init(&q->lock, NULL);
+    q->top = q->bottom = 0;
+}
+
+static void deque_push(deque *q, uint8_t node) {
+    pthread_mutex_lock(&q->lock);
+    q->nodes[SLOT(q->bottom++)] = node;
+    pthread_mutex_unlock(&q->lock);
+}
+
+static bool deque_pop(deque *q, uint8_t *node) {
+    bool found = false;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->bottom > q->top) {
+        *node = q->nodes[SLOT(--q->bottom)];
+        found = true;
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    return found;
+}
+
+static bool deque_steal(deque *q, uint8_t *node) {
+    bool found = false;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->bottom > q->top) {
+        *node = q->nodes[SLOT(q->top++)];
+        found = true;
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    return found;
+}
+
+static void deque_clear(deque *q) {
+    pthread_mutex_lock(&q->lock);
+    q->top = q->bottom = 0;
+    pthread_mutex_unlock(&q->lock);
+}
+
+lattice *lattice_init(size_t worker_count) {
+    // The counters are cache-line aligned, so the lattice has to be too.
+    lattice *l = aligned_alloc(LATTICE_CACHE_LINE, sizeof(lattice));
+    memset(l, 0, sizeof(lattice));
+
+    if (worker_count < 1) {
+        worker_count = 1;
+    } else if (worker_count > LATTICE_MAX_WORKERS) {
+        worker_count = LATTICE_MAX_WORKERS;
+    }
+
+    for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+        l->nodes[i] = machine_init(CPU_MAX_ADDRESS);
+    }
+
+    l->quantum = LATTICE_QUANTUM;
+    l->detect = true;
+    l->worker_count = worker_count;
+
+    for (size_t i = 0; i < worker_count; i++) {
+        l->workers[i].lattice = l;
+        l->workers[i].index = i;
+        deque_init(&l->workers[i].queue);
+    }
+
+    for (size_t i = 0; i < LATTICE_NODE_COUNT * 2; i++) {
+        pthread_mutex_init(&l->links[i].lock, NULL);
+    }
+
+    return l;
+}
+
+void lattice_load(lattice *l, size_t node, uint8_t *image, size_t size) {
+    machine *m = l->nodes[node];
+
+    if (size > m->memory->size) {
+        size = m->memory->size;
+    }
+
+    memcpy(m->memory->data, image, size);
+    memory_write(m->memory, LATTICE_NODE_ROW, node / LATTICE_COLUMNS);
+    memory_write(m->memory, LATTICE_NODE_COLUMN, node % LATTICE_COLUMNS);
+}
+
+void lattice_start(lattice *l) {
+    for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+        machine_start(l->nodes[i]);
+    }
+}
+
+static bool lattice_neighbor_index(size_t node, Direction d, size_t *other) {
+    size_t row = node / LATTICE_COLUMNS;
+    size_t col = node % LATTICE_COLUMNS;
+
+    switch (d) {
+    case DIRECTION_NORTH:
+        *other = node - LATTICE_COLUMNS;
+        return row > 0;
+    case DIRECTION_EAST:
+        *other = node + 1;
+        return col < LATTICE_COLUMNS - 1;
+    case DIRECTION_SOUTH:
+        *other = node + LATTICE_COLUMNS;
+        return row < LATTICE_ROWS - 1;
+    case DIRECTION_WEST:
+        *other = node - 1;
+        return col > 0;
+    default:
+        return false;
+    }
+}
+
+machine *lattice_neighbor(lattice *l, size_t node, Direction d) {
+    size_t other;
+    return lattice_neighbor_index(node, d, &other) ? l->nodes[other] : NULL;
+}
+
+static inline uint8_t mailbox_offset(uint8_t *box, size_t field) {
+    return (box[field] & 0xF) << 4 | (box[field + 1] & 0xF);
+}
+
+static inline void mailbox_set_offset(uint8_t *box, size_t field,
+                                      uint8_t value) {
+    box[field] = (value >> 4) & 0xF;
+    box[field + 1] = value & 0xF;
+}
+
+static lattice_link *lattice_link_for(lattice *l, size_t node, Direction d) {
+    switch (d) {
+    case DIRECTION_NORTH:
+        return &l->links[(node - LATTICE_COLUMNS) * 2 + 1];
+    case DIRECTION_EAST:
+        return &l->links[node * 2];
+    case DIRECTION_SOUTH:
+        return &l->links[node * 2 + 1];
+    case DIRECTION_WEST:
+    default:
+        return &l->links[(node - 1) * 2];
+    }
+}
+
+link_counters *lattice_traffic(lattice *l, size_t node, Direction d,
+                               size_t *side) {
+    size_t other;
+
+    if (!lattice_neighbor_index(node, d, &other)) {
+        return NULL;
+    }
+
+    *side = d == DIRECTION_NORTH || d == DIRECTION_WEST;
+    return &l->traffic[lattice_link_for(l, node, d) - l->links];
+}
+
+static bool lattice_polling(machine *m, Direction *inbox) {
+    // Whether the last load the node made was from the read or write offset
+    // of one of its inboxes, and that inbox is still empty.
+    uint16_t address = m->last_load;
+
+    if (address < MAILBOX_INBOX || address >= MAILBOX_OUTBOX) {
+        return false;
+    }
+
+    uint16_t field = (address - MAILBOX_INBOX) % MAILBOX_SIZE;
+
+    if (field < MAILBOX_READ || field >= MAILBOX_WRITE + 2) {
+        return false;
+    }
+
+    *inbox = (address - MAILBOX_INBOX) / MAILBOX_SIZE;
+    uint8_t *box = MAILBOX(m, MAILBOX_INBOX, *inbox);
+
+    return mailbox_offset(box, MAILBOX_READ) ==
+           mailbox_offset(box, MAILBOX_WRITE);
+}
+
+static void lattice_set_idle(lattice *l, size_t node, bool idle) {
+    lattice_wait *w = &l->waits[node];
+
+    if (w->idle == idle) {
+        return;
+    }
+
+    w->idle = idle;
+
+    if (!idle) {
+        atomic_fetch_sub(&l->idle, 1);
+        return;
+    }
+
+    atomic_fetch_add(&l->idle, 1);
+
+    if (w->state == NODE_WAITING) {
+        atomic_fetch_or(&l->stalled, 1u << node);
+    }
+}
+
+static void lattice_observe(lattice *l, size_t node, uint32_t executed) {
+    // Update the wait state of a node that has just run a quantum. This only
+    // looks at the node itself, so workers can do it in parallel.
+    machine *m = l->nodes[node];
+    lattice_wait *w = &l->waits[node];
+    node_counters *c = &l->counters[node];
+    Direction inbox;
+
+    c->retired += executed;
+    c->interrupts += m->interrupts;
+
+    if (m->flags & FLAG_HALT) {
+        w->state = m->status == STATE_WAIT ? NODE_SLEEPING : NODE_HALTED;
+    } else if (m->stores == 0 && lattice_polling(m, &inbox)) {
+        if (w->state != NODE_WAITING || w->inbox != inbox) {
+            w->stalled = 0;
+        }
+
+        w->state = NODE_WAITING;
+        w->inbox = inbox;
+        w->stalled += executed;
+        c->idle += executed;
+    } else {
+        w->state = NODE_RUNNING;
+        w->stalled = 0;
+    }
+
+    // Mail in another inbox is left for the node to find, so it only counts
+    // as blocked while all of its inboxes are empty.
+    lattice_set_idle(l, node,
+                     w->state == NODE_HALTED || w->state == NODE_SLEEPING ||
+                         (w->stalled >= LATTICE_STALL_INSTRUCTIONS &&
+                          !lattice_has_mail(m)));
+}
+
+uint32_t lattice_run_node(lattice *l, size_t node) {
+    // Run one quantum of a node and account for it.
+    machine *m = l->nodes[node];
+    uint32_t executed;
+
+    m->stores = 0;
+    m->last_load = 0;
+    m->interrupts = 0;
+    executed = l->trace ? trace_run_quantum(l->trace, m, node, l->quantum)
+                        : machine_run_quantum(m, l->quantum);
+    lattice_observe(l, node, executed);
+
+    return executed;
+}
+
+bool lattice_has_mail(machine *m) {
+    for (Direction d = DIRECTION_NORTH; d < DIRECTION_COUNT; d++) {
+        uint8_t *box = MAILBOX(m, MAILBOX_INBOX, d);
+
+        if (mailbox_offset(box, MAILBOX_READ) !=
+            mailbox_offset(box, MAILBOX_WRITE)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool lattice_wake(lattice *l, size_t node) {
+    // Wake a sleeping node that has mail in any of its inboxes, raising its
+    // interrupt. Only the thread that runs the node may call this, before
+    // its next quantum. Returns whether the node woke.
+    machine *m = l->nodes[node];
+    lattice_wait *w = &l->waits[node];
+    uint32_t interrupts = m->interrupts;
+
+    if (m->status != STATE_WAIT || !lattice_has_mail(m)) {
+        return false;
+    }
+
+    m->flags |= FLAG_INTERRUPT;
+    machine_wake(m);
+    l->counters[node].interrupts += m->interrupts - interrupts;
+
+    w->state = NODE_RUNNING;
+    w->stalled = 0;
+    lattice_set_idle(l, node, false);
+    return true;
+}
+
+static void lattice_notify(lattice *l, size_t node) {
+    // Mail arriving in any inbox unblocks a waiting node, since the loop it
+    // polls in may check more than the inbox it loaded from last.
+    lattice_wait *w = &l->waits[node];
+
+    if (w->state == NODE_WAITING) {
+        w->state = NODE_RUNNING;
+        w->stalled = 0;
+        lattice_set_idle(l, node, false);
+    }
+}
+
+static bool lattice_deliver(lattice *l, size_t from_node, size_t to_node,
+                            Direction d) {
+    // Move as many quads as will fit from the sender's outbox into the
+    // receiver's inbox on the facing side. Returns whether anything moved.
+    machine *from = l->nodes[from_node];
+    machine *to = l->nodes[to_node];
+    size_t side;
+    link_counters *c = lattice_traffic(l, from_node, d, &side);
+
+    uint8_t *out = MAILBOX(from, MAILBOX_OUTBOX, d);
+    uint8_t *in = MAILBOX(to, MAILBOX_INBOX, OPPOSITE(d));
+
+    uint8_t out_read = mailbox_offset(out, MAILBOX_READ);
+    uint8_t out_write = mailbox_offset(out, MAILBOX_WRITE);
+    uint8_t in_read = mailbox_offset(in, MAILBOX_READ);
+    uint8_t in_write = mailbox_offset(in, MAILBOX_WRITE);
+    uint8_t start = in_write;
+
+    while (out_read != out_write && (uint8_t)(in_write + 1) != in_read) {
+        in[in_write++] = out[out_read++] & 0xF;
+    }
+
+    mailbox_set_offset(out, MAILBOX_READ, out_read);
+    mailbox_set_offset(in, MAILBOX_WRITE, in_write);
+
+    uint8_t waiting = in_write - in_read;
+
+    c->quads[side] += (uint8_t)(in_write - start);
+    c->stalls[side] += out_read != out_write;
+    c->high_water[side] =
+        waiting > c->high_water[side] ? waiting : c->high_water[side];
+
+    return in_write != start;
+}
+
+void lattice_exchange(lattice *l) {
+    size_t other;
+
+    for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+        for (Direction d = DIRECTION_NORTH; d < DIRECTION_COUNT; d++) {
+            if (lattice_neighbor_index(i, d, &other) &&
+                lattice_deliver(l, i, other, d)) {
+                lattice_notify(l, other);
+            }
+        }
+    }
+}
+
+void lattice_detect_start(lattice *l) {
+    // Sets every node's wait state from its machine, as if it had just run.
+    // Halted and sleeping nodes are idle, and everything else is running.
+    atomic_store(&l->idle, 0);
+    atomic_store(&l->stalled, 0);
+    l->cycle = 0;
+    l->outcome = LATTICE_FINISHED;
+
+    for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+        machine *m = l->nodes[i];
+        bool halted = m->flags & FLAG_HALT;
+
+        l->waits[i] = (lattice_wait){0};
+        l->waits[i].state = !halted                   ? NODE_RUNNING
+                            : m->status == STATE_WAIT ? NODE_SLEEPING
+                                                      : NODE_HALTED;
+        lattice_set_idle(l, i, halted);
+    }
+}
+
+void lattice_detect_restore(lattice *l, const lattice_wait *waits,
+                            uint32_t stalled) {
+    // Takes over wait states kept elsewhere, such as in the memory shared by
+    // the processes of a partitioned run, and recounts the idle nodes.
+    size_t idle = 0;
+
+    for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+        l->waits[i] = waits[i];
+        idle += waits[i].idle;
+    }
+
+    atomic_store(&l->idle, idle);
+    atomic_store(&l->stalled, stalled);
+}
+
+static bool lattice_blocked(lattice *l, size_t node) {
+    // Whether an idle node is stuck. One with mail in any of its inboxes
+    // could still read it, or wake on it, so it is not.
+    lattice_wait *w = &l->waits[node];
+
+    return w->idle &&
+           (w->state == NODE_HALTED || !lattice_has_mail(l->nodes[node]));
+}
+
+static bool lattice_cycle(lattice *l, size_t start) {
+    // Follow the wait-for chain from a node that just became idle. Every
+    // waiting node waits on exactly one neighbour, so the chain either comes
+    // back around to the start or ends at a node that is not blocked. If it
+    // runs into a cycle that the start is not part of, that cycle is found
+    // from whichever of its own nodes became idle last.
+    uint32_t chain = 0;
+    size_t node = start;
+
+    do {
+        lattice_wait *w = &l->waits[node];
+
+        if (!lattice_blocked(l, node) || w->state != NODE_WAITING ||
+            chain & 1u << node) {
+            return false;
+        }
+
+        chain |= 1u << node;
+
+        if (!lattice_neighbor_index(node, w->inbox, &node)) {
+            return false;
+        }
+    } while (node != start);
+
+    l->cycle = chain;
+    return true;
+}
+
+bool lattice_deadlocked(lattice *l) {
+    // Returns whether the lattice can make no more progress, and sets its
+    // outcome if so. Call it only while no node is running. Only the chains
+    // of nodes that became idle since the last quantum need to be followed;
+    // any other cycle would have been found already.
+    uint32_t stalled = atomic_exchange(&l->stalled, 0);
+
+    for (size_t i = 0; stalled; i++, stalled >>= 1) {
+        if ((stalled & 1) && lattice_cycle(l, i)) {
+            l->outcome = LATTICE_DEADLOCK;
+            return true;
+        }
+    }
+
+    if (atomic_load(&l->idle) < LATTICE_NODE_COUNT) {
+        return false;
+    }
+
+    for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+        if (!lattice_blocked(l, i)) {
+            return false;
+        }
+    }
+
+    l->outcome = LATTICE_IDLE;
+    return true;
+}
+
+static void lattice_schedule(lattice *l) {
+    // Hand out every node that is still running for the next quantum. The
+    // initial assignment is static; stealing evens out whatever imbalance
+    // halted or idle nodes leave behind.
+    size_t runnable = 0;
+
+    for (size_t i = 0; i < l->worker_count; i++) {
+        deque_clear(&l->workers[i].queue);
+    }
+
+    if (l->max_quanta && l->quanta >= l->max_quanta) {
+        l->outcome = LATTICE_LIMIT;
+        l->done = true;
+        return;
+    }
+
+    // Sleeping nodes are left out like halted ones, until mail wakes them.
+    for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+        lattice_wake(l, i);
+
+        if (!(l->nodes[i]->flags & FLAG_HALT)) {
+            deque_push(&l->workers[runnable++ % l->worker_count].queue, i);
+        }
+    }
+
+    // If some of the nodes that are still running can never make progress,
+    // stop here and leave their wait states for the report.
+    if (runnable && l->detect && lattice_deadlocked(l)) {
+        for (size_t i = 0; i < l->worker_count; i++) {
+            deque_clear(&l->workers[i].queue);
+        }
+
+        runnable = 0;
+    }
+
+    l->done = runnable == 0;
+}
+
+static bool lattice_next(worker *w, uint8_t *node) {
+    lattice *l = w->lattice;
+
+    if (deque_pop(&w->queue, node)) {
+        return true;
+    }
+
+    for (size_t i = 1; i < l->worker_count; i++) {
+        worker *victim = &l->workers[(w->index + i) % l->worker_count];
+
+        if (deque_steal(&victim->queue, node)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void lattice_check_snapshot(lattice *l) {
+    if (atomic_exchange(&l->snapshot, false) && l->event_snapshot != NULL) {
+        l->event_snapshot(l);
+    }
+}
+
+static void *lattice_worker_main(void *arg) {
+    worker *w = (worker *)arg;
+    lattice *l = w->lattice;
+    uint8_t node;
+
+    while (!l->done) {
+        while (lattice_next(w, &node)) {
+            lattice_run_node(l, node);
+        }
+
+        if (pthread_barrier_wait(&l->barrier) ==
+            PTHREAD_BARRIER_SERIAL_THREAD) {
+            lattice_exchange(l);
+            l->quanta++;
+            lattice_schedule(l);
+            lattice_check_snapshot(l);
+        }
+
+        pthread_barrier_wait(&l->barrier);
+    }
+
+    return NULL;
+}
+
+static void lattice_release(worker *w, uint8_t node) {
+    // Drop one of the things the node is waiting for. Whoever drops the last
+    // one makes the node runnable again.
+    if (atomic_fetch_sub(&w->lattice->clocks[node].pending, 1) == 1) {
+        deque_push(&w->queue, node);
+    }
+}
+
+static void lattice_link_arrive(worker *w, uint8_t node, Direction d,
+                                uint64_t epoch) {
+    // Called when `node` has finished quantum `epoch`. If the neighbour
+    // across the link has also arrived there, exchange their mailboxes and
+    // let both of them continue. Otherwise the neighbour does it when it
+    // arrives. A retired link never needs another exchange.
+    lattice *l = w->lattice;
+    lattice_link *link = lattice_link_for(l, node, d);
+    size_t side = d == DIRECTION_NORTH || d == DIRECTION_WEST;
+    size_t other;
+    bool exchanged = false;
+
+    lattice_neighbor_index(node, d, &other);
+    pthread_mutex_lock(&link->lock);
+    link->arrived[side] = epoch;
+
+    if (link->retired) {
+        pthread_mutex_unlock(&link->lock);
+        lattice_release(w, node);
+        return;
+    }
+
+    if (link->arrived[!side] == epoch && link->epoch + 1 == epoch) {
+        lattice_deliver(l, node, other, d);
+        lattice_deliver(l, other, node, OPPOSITE(d));
+        link->epoch = epoch;
+        exchanged = true;
+    }
+
+    pthread_mutex_unlock(&link->lock);
+
+    if (exchanged) {
+        lattice_release(w, node);
+        lattice_release(w, other);
+    }
+}
+
+static bool lattice_quiescent(lattice *l, uint8_t node, uint64_t epoch) {
+    // A halted node has to keep its clock moving for as long as any
+    // neighbour could still send it something. Once every neighbour halted
+    // no later than `epoch`, the last exchange on each link has already
+    // happened and later ones would not move anything.
+    size_t other;
+
+    for (Direction d = DIRECTION_NORTH; d < DIRECTION_COUNT; d++) {
+        if (lattice_neighbor_index(node, d, &other) &&
+            atomic_load(&l->clocks[other].halted_at) > epoch) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool lattice_asleep(lattice *l, uint64_t epoch) {
+    // Whether every node that did not halt is sleeping or blocked for good:
+    // every node has been idle for long enough that any mail sent before
+    // the last one stopped has been delivered, and would have woken or
+    // released its receiver.
+    return atomic_load(&l->idle) == LATTICE_NODE_COUNT &&
+           epoch > atomic_load(&l->stopped_at) + LATTICE_CROSSING;
+}
+
+static void lattice_stopped(lattice *l, uint64_t epoch) {
+    uint64_t last = atomic_load(&l->stopped_at);
+
+    while (last < epoch &&
+           !atomic_compare_exchange_weak(&l->stopped_at, &last, epoch)) {
+    }
+}
+
+static void lattice_retire(worker *w, uint8_t node) {
+    lattice *l = w->lattice;
+    size_t other;
+
+    for (Direction d = DIRECTION_NORTH; d < DIRECTION_COUNT; d++) {
+        if (!lattice_neighbor_index(node, d, &other)) {
+            continue;
+        }
+
+        lattice_link *link = lattice_link_for(l, node, d);
+        size_t side = d == DIRECTION_NORTH || d == DIRECTION_WEST;
+        bool waiting;
+
+        pthread_mutex_lock(&link->lock);
+        link->retired = true;
+        waiting = link->arrived[!side] == link->epoch + 1;
+        pthread_mutex_unlock(&link->lock);
+
+        if (waiting) {
+            lattice_release(w, other);
+        }
+    }
+
+    atomic_fetch_add(&l->settled, 1);
+}
+
+static void lattice_advance(worker *w, uint8_t node) {
+    lattice *l = w->lattice;
+    lattice_clock *clock = &l->clocks[node];
+    machine *m = l->nodes[node];
+    uint64_t epoch = atomic_load(&clock->epoch);
+
+    if (l->max_quanta && epoch >= l->max_quanta) {
+        atomic_fetch_add(&l->settled, 1);
+        return;
+    }
+
+    // A blocked node only became idle with its inboxes empty, so any mail
+    // in them now was delivered since and releases it.
+    lattice_wake(l, node);
+
+    if (lattice_has_mail(m)) {
+        lattice_notify(l, node);
+    }
+
+    bool idle = l->waits[node].idle;
+
+    if (m->flags & FLAG_HALT) {
+        // A sleeping node counts as running to its neighbours, since mail
+        // could still wake it, until none of them can send any more or
+        // every node is asleep. Then it can never wake, and retires as if
+        // it had halted.
+        bool asleep = m->status == STATE_WAIT && lattice_asleep(l, epoch);
+
+        if (epoch > 0 && (asleep || lattice_quiescent(l, node, epoch))) {
+            if (atomic_load(&clock->halted_at) == NOT_HALTED) {
+                atomic_store(&clock->halted_at, epoch);
+            }
+
+            lattice_retire(w, node);
+            return;
+        }
+    } else if (l->detect && idle && lattice_asleep(l, epoch)) {
+        // A node blocked on an inbox while the whole lattice is idle never
+        // gets any mail either. It retires as if it had halted, and the
+        // lattice ends as idle.
+        atomic_store(&clock->halted_at, epoch);
+        lattice_retire(w, node);
+        return;
+    } else {
+        lattice_run_node(l, node);
+
+        if (m->flags & FLAG_HALT && m->status != STATE_WAIT) {
+            atomic_store(&clock->halted_at, epoch + 1);
+        }
+
+        if (!idle && l->waits[node].idle) {
+            lattice_stopped(l, epoch + 1);
+        }
+    }
+
+    // Wait on every link plus one guard count, so the node cannot be made
+    // runnable before all of its links have been visited.
+    atomic_store(&clock->pending, DIRECTION_COUNT + 1);
+    atomic_store(&clock->epoch, epoch + 1);
+
+    for (Direction d = DIRECTION_NORTH; d < DIRECTION_COUNT; d++) {
+        if (lattice_neighbor(l, node, d)) {
+            lattice_link_arrive(w, node, d, epoch + 1);
+        } else {
+            lattice_release(w, node);
+        }
+    }
+
+    lattice_release(w, node);
+}
+
+static void *lattice_conservative_main(void *arg) {
+    worker *w = (worker *)arg;
+    lattice *l = w->lattice;
+    uint8_t node;
+
+    while (atomic_load(&l->settled) < LATTICE_NODE_COUNT) {
+        // Without a barrier the snapshot is taken while other workers keep
+        // running, so the counters in it may be a quantum apart.
+        if (w->index == 0) {
+            lattice_check_snapshot(l);
+        }
+
+        if (lattice_next(w, &node)) {
+            lattice_advance(w, node);
+        } else {
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+static void lattice_conservative_schedule(lattice *l) {
+    bool runnable = false;
+
+    atomic_store(&l->stopped_at, 0);
+
+    for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+        machine *m = l->nodes[i];
+
+        atomic_store(&l->clocks[i].epoch, 0);
+        atomic_store(&l->clocks[i].pending, 0);
+        atomic_store(&l->clocks[i].halted_at,
+                     m->flags & FLAG_HALT && m->status != STATE_WAIT
+                         ? 0
+                         : NOT_HALTED);
+        runnable |= !(m->flags & FLAG_HALT) ||
+                    (m->status == STATE_WAIT && lattice_has_mail(m));
+    }
+
+    for (size_t i = 0; i < LATTICE_NODE_COUNT * 2; i++) {
+        l->links[i].epoch = 0;
+        l->links[i].arrived[0] = l->links[i].arrived[1] = 0;
+        l->links[i].retired = false;
+    }
+
+    // Like the barrier mode, a lattice with nothing to run never exchanges
+    // any mailboxes.
+    if (!runnable) {
+        atomic_store(&l->settled, LATTICE_NODE_COUNT);
+        return;
+    }
+
+    atomic_store(&l->settled, 0);
+
+    for (size_t i = 0; i < l->worker_count; i++) {
+        deque_clear(&l->workers[i].queue);
+    }
+
+    for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+        deque_push(&l->workers[i % l->worker_count].queue, i);
+    }
+}
+
+void lattice_run(lattice *l) {
+    // The calling thread acts as worker zero.
+    void *(*worker_main)(void *) = lattice_worker_main;
+
+    lattice_detect_start(l);
+
+    if (l->sync == LATTICE_CONSERVATIVE) {
+        worker_main = lattice_conservative_main;
+        lattice_conservative_schedule(l);
+    } else {
+        pthread_barrier_init(&l->barrier, NULL, l->worker_count);
+        lattice_schedule(l);
+    }
+
+    for (size_t i = 1; i < l->worker_count; i++) {
+        pthread_create(&l->workers[i].thread, NULL, worker_main,
+                       &l->workers[i]);
+    }
+
+    worker_main(&l->workers[0]);
+
+    for (size_t i = 1; i < l->worker_count; i++) {
+        pthread_join(l->workers[i].thread, NULL);
+    }
+
+    if (l->sync == LATTICE_CONSERVATIVE) {
+        // Report the furthest any node's clock got, which is the number of
+        // quanta the barrier mode would have run.
+        for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+            uint64_t epoch = atomic_load(&l->clocks[i].epoch);
+            l->quanta = epoch > l->quanta ? epoch : l->quanta;
+        }
+
+        l->outcome = l->max_quanta && l->quanta >= l->max_quanta
+                         ? LATTICE_LIMIT
+                         : LATTICE_FINISHED;
+    } else {
+        pthread_barrier_destroy(&l->barrier);
+    }
+
+    // Nodes still sleeping or running when the lattice stopped for any
+    // reason but the limit could never have made progress.
+    for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+        machine *m = l->nodes[i];
+
+        if (l->outcome == LATTICE_FINISHED &&
+            (m->status == STATE_WAIT || !(m->flags & FLAG_HALT))) {
+            l->outcome = LATTICE_IDLE;
+        }
+    }
+}
+
+static void lattice_print_waits(lattice *l) {
+    if (l->outcome == LATTICE_DEADLOCK) {
+        printf("\ndeadlock: nodes marked * are waiting on each other\n");
+    } else {
+        printf("\nidle: no node is able to make progress\n");
+    }
+
+    printf("NODE  STATE\n");
+
+    for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+        lattice_wait *w = &l->waits[i];
+
+        printf("%zu,%zu %c ", i / LATTICE_COLUMNS, i % LATTICE_COLUMNS,
+               l->cycle & 1u << i ? '*' : ' ');
+
+        switch (w->state) {
+        case NODE_HALTED:
+            printf("halted\n");
+            break;
+        case NODE_SLEEPING:
+            printf("waiting for an interrupt\n");
+            break;
+        case NODE_WAITING:
+            printf("waiting on the %s inbox for %llu instructions\n",
+                   direction_names[w->inbox], (unsigned long long)w->stalled);
+            break;
+        default:
+            printf("running\n");
+            break;
+        }
+    }
+}
+
+void lattice_print(lattice *l) {
+    printf("NODE  PROG STAK INTR INDX TEMP  A B C D E F  HIOCZN\n");
+
+    for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+        machine *m = l->nodes[i];
+        uint8_t *data = m->memory->data;
+
+        printf("%zu,%zu   %04X %04X %04X %04X %04X  ", i / LATTICE_COLUMNS,
+               i % LATTICE_COLUMNS, (uint16_t)(m->pc - data),
+               (uint16_t)(m->sp - data), (uint16_t)(m->iv - data),
+               (uint16_t)(m->ix - data), (uint16_t)(m->ta - data));
+
+        for (size_t r = REGISTER_A; r <= REGISTER_F; r++) {
+            printf("%X ", m->registers[r]);
+        }
+
+        printf(" %c%c%c%c%c%c\n", m->flags & FLAG_HALT ? '1' : '0',
+               m->flags & FLAG_INTERRUPT ? '1' : '0',
+               m->flags & FLAG_OVERFLOW ? '1' : '0',
+               m->flags & FLAG_CARRY ? '1' : '0',
+               m->flags & FLAG_ZERO ? '1' : '0',
+               m->flags & FLAG_NEGATIVE ? '1' : '0');
+    }
+
+    printf("%llu quanta of %u instructions\n", (unsigned long long)l->quanta,
+           l->quantum);
+
+    if (l->outcome == LATTICE_DEADLOCK || l->outcome == LATTICE_IDLE) {
+        lattice_print_waits(l);
+    }
+}
+
+void lattice_free(lattice *l) {
+    for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+        machine_free(l->nodes[i]);
+    }
+
+    for (size_t i = 0; i < l->worker_count; i++) {
+        pthread_mutex_destroy(&l->workers[i].queue.lock);
+    }
+
+    for (size_t i = 0; i < LATTICE_NODE_COUNT * 2; i++) {
+        pthread_mutex_destroy(&l->links[i].lock);
+    }
+
+    free(l);
+}
@@ -0,0 +1,209 @@
+#ifndef BBB_LATTICE_H
+#define BBB_LATTICE_H
+
+#include "cpu.h"
+#include "trace.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LATTICE_ROWS 4
+#define LATTICE_COLUMNS 4
+#define LATTICE_NODE_COUNT (LATTICE_ROWS * LATTICE_COLUMNS)
+#define LATTICE_MAX_WORKERS LATTICE_NODE_COUNT
+#define LATTICE_QUANTUM 1024
+#define LATTICE_CACHE_LINE 64
+
+// Each node has four inboxes followed by four outboxes, one per direction.
+// A mailbox is a 512-quad region that starts with a 256-quad ring buffer,
+// followed by the two-quad read offset and the two-quad write offset. The
+// ring is empty when the offsets are equal and full when the write offset is
+// one behind the read offset.
+#define MAILBOX_INBOX 0xE000
+#define MAILBOX_OUTBOX 0xE800
+#define MAILBOX_SIZE 0x200
+#define MAILBOX_RING_SIZE 0x100
+#define MAILBOX_READ 0x100
+#define MAILBOX_WRITE 0x102
+
+// The node's position in the lattice is written to the I/O page before the
+// node starts so programs can tell themselves apart.
+#define LATTICE_NODE_ROW 0xFFF4
+#define LATTICE_NODE_COLUMN 0xFFF5
+
+typedef enum {
+    DIRECTION_NORTH,
+    DIRECTION_EAST,
+    DIRECTION_SOUTH,
+    DIRECTION_WEST,
+    DIRECTION_COUNT
+} Direction;
+
+// A node that runs this many instructions without storing anything, having
+// last loaded one of the offsets of an empty inbox, is considered blocked on
+// that inbox.
+#define LATTICE_STALL_INSTRUCTIONS 4096
+
+typedef enum { LATTICE_BARRIER, LATTICE_CONSERVATIVE } LatticeSync;
+
+// A node is sleeping while it waits for an interrupt, which mail arriving
+// in any of its inboxes raises.
+typedef enum {
+    NODE_RUNNING,
+    NODE_WAITING,
+    NODE_HALTED,
+    NODE_SLEEPING
+} NodeState;
+
+typedef enum {
+    LATTICE_FINISHED, // Every node halted
+    LATTICE_LIMIT,    // The quanta limit was reached
+    LATTICE_DEADLOCK, // Some nodes are blocked on each other in a cycle
+    LATTICE_IDLE      // No node is running, but not all of them halted
+} LatticeOutcome;
+
+typedef struct lattice lattice;
+typedef void (*LatticeEvent)(lattice *l);
+
+// In conservative mode every node keeps its own clock, counted in quanta.
+// A node may run its next quantum once each of its links has caught up with
+// it, so only neighbours ever wait on each other.
+typedef struct lattice_clock {
+    _Atomic uint64_t epoch;
+    _Atomic uint64_t halted_at;
+    atomic_int pending;
+} lattice_clock;
+
+// A link joins two adjacent nodes. Its epoch is the number of mailbox
+// exchanges performed across it so far, and `arrived` holds the last quantum
+// each side (west or north first) has finished.
+typedef struct lattice_link {
+    pthread_mutex_t lock;
+    uint64_t epoch;
+    uint64_t arrived[2];
+    bool retired;
+} lattice_link;
+
+// The wait state of a node as of its last quantum. A node is idle once it
+// has halted, is sleeping, or has been waiting on the same inbox for long
+// enough.
+typedef struct lattice_wait {
+    NodeState state;
+    Direction inbox;
+    uint64_t stalled;
+    bool idle;
+} lattice_wait;
+
+// Performance counters for a node. Only the worker running the node writes
+// them, and each node's counters get a cache line of their own so workers
+// never contend for one. `idle` counts the instructions spent waiting on an
+// inbox.
+typedef struct node_counters {
+    _Alignas(LATTICE_CACHE_LINE) uint64_t retired;
+    uint64_t idle;
+    uint64_t interrupts;
+} node_counters;
+
+// Mailbox traffic across a link, indexed by the side it was sent from (west
+// or north first): quads moved, the most quads ever waiting in the receiving
+// inbox, and exchanges that left quads behind because that inbox was full.
+typedef struct link_counters {
+    _Alignas(LATTICE_CACHE_LINE) uint64_t quads[2];
+    uint64_t stalls[2];
+    uint8_t high_water[2];
+} link_counters;
+
+// Runnable nodes are kept in a small deque per worker. The owning worker
+// takes nodes from the bottom and idle workers steal from the top.
+typedef struct deque {
+    pthread_mutex_t lock;
+    uint8_t nodes[LATTICE_NODE_COUNT];
+    size_t top;
+    size_t bottom;
+} deque;
+
+typedef struct worker {
+    lattice *lattice;
+    size_t index;
+    pthread_t thread;
+    deque queue;
+} worker;
+
+typedef struct lattice {
+    machine *nodes[LATTICE_NODE_COUNT];
+
+    // Every running node executes exactly `quantum` instructions between
+    // barriers, and mailboxes are only exchanged at the barrier, so the
+    // result does not depend on which worker ran which node.
+    uint32_t quantum;
+    uint64_t quanta;
+    uint64_t max_quanta;
+    bool done;
+
+    size_t worker_count;
+    worker workers[LATTICE_MAX_WORKERS];
+    pthread_barrier_t barrier;
+
+    // Conservative synchronization replaces the global barrier with a clock
+    // per node and a link between each pair of neighbours. The links are
+    // stored once, as the east and south links of each node.
+    LatticeSync sync;
+    lattice_clock clocks[LATTICE_NODE_COUNT];
+    lattice_link links[LATTICE_NODE_COUNT * 2];
+    atomic_size_t settled;
+
+    // The last quantum in which a node became idle. Sleeping nodes, and
+    // nodes blocked on an inbox, keep their clocks moving until every node
+    // is idle and whatever was sent before that has had time to cross the
+    // lattice, after which none of them can ever get mail.
+    _Atomic uint64_t stopped_at;
+
+    // Deadlock detection. Workers update the wait state of the nodes they
+    // run and keep a count of idle nodes. Nodes that just became idle while
+    // waiting are flagged in `stalled`, and with barrier synchronization
+    // only their wait-for chains are followed between quanta. Conservative
+    // synchronization only stops a lattice in which every node is idle: its
+    // nodes are never all stopped at once, so a chain could only be read
+    // while its nodes run, and with mail still crossing its links.
+    bool detect;
+    lattice_wait waits[LATTICE_NODE_COUNT];
+    atomic_size_t idle;
+    atomic_uint stalled;
+    uint32_t cycle;
+    LatticeOutcome outcome;
+
+    // Counters are kept in the same order as the nodes and links. Setting
+    // `snapshot` (which is safe from a signal handler) asks for
+    // `event_snapshot` to be called between quanta.
+    node_counters counters[LATTICE_NODE_COUNT];
+    link_counters traffic[LATTICE_NODE_COUNT * 2];
+    atomic_bool snapshot;
+    LatticeEvent event_snapshot;
+
+    // When set, every instruction a node executes is recorded, tagged with
+    // the node's index, in the ring of the worker that ran it.
+    trace_writer *trace;
+} lattice;
+
+lattice *lattice_init(size_t worker_count);
+
+void lattice_load(lattice *l, size_t node, uint8_t *image, size_t size);
+void lattice_start(lattice *l);
+void lattice_run(lattice *l);
+uint32_t lattice_run_node(lattice *l, size_t node);
+bool lattice_has_mail(machine *m);
+bool lattice_wake(lattice *l, size_t node);
+void lattice_detect_start(lattice *l);
+void lattice_detect_restore(lattice *l, const lattice_wait *waits,
+                            uint32_t stalled);
+bool lattice_deadlocked(lattice *l);
+void lattice_exchange(lattice *l);
+machine *lattice_neighbor(lattice *l, size_t node, Direction d);
+link_counters *lattice_traffic(lattice *l, size_t node, Direction d,
+                               size_t *side);
+
+void lattice_print(lattice *l);
+void lattice_free(lattice *l);
+
+#endif
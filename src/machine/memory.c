@@ -9,6 +9,7 @@ memory *memory_init(size_t size) {
     memory *mem = malloc(sizeof(memory));
     mem->size = size;
     mem->data = calloc(size, sizeof(uint8_t));
+    mem->access = NULL;
     return mem;
 }
 
@@ -17,6 +18,10 @@ uint8_t memory_read(memory *mem, size_t address) {
         return 0;
     }
 
+    if (mem->access) {
+        mem->access->reads[address % MEMORY_ACCESS_SIZE]++;
+    }
+
     return mem->data[address];
 }
 
@@ -27,6 +32,10 @@ uint8_t memory_read_indexed(memory *mem, uint8_t *index, size_t offset) {
         return 0;
     }
 
+    if (mem->access) {
+        mem->access->reads[address % MEMORY_ACCESS_SIZE]++;
+    }
+
     return mem->data[address];
 }
 
@@ -35,6 +44,10 @@ bool memory_write(memory *mem, size_t address, uint8_t value) {
         return false;
     }
 
+    if (mem->access) {
+        mem->access->writes[address % MEMORY_ACCESS_SIZE]++;
+    }
+
     mem->data[address] = value;
     return true;
 };
@@ -47,6 +60,10 @@ bool memory_write_indexed(memory *mem, uint8_t *index, size_t offset,
         return false;
     }
 
+    if (mem->access) {
+        mem->access->writes[address % MEMORY_ACCESS_SIZE]++;
+    }
+
     mem->data[address] = value;
     return true;
 }
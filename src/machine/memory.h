@@ -5,9 +5,21 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#define MEMORY_ACCESS_SIZE (64 * 1024)
+#define MEMORY_PAGE_SIZE 256
+#define MEMORY_PAGE_COUNT (MEMORY_ACCESS_SIZE / MEMORY_PAGE_SIZE)
+
+// The number of times each quad was read and written through the functions
+// below, counted while a memory's `access` is set.
+typedef struct memory_access {
+    uint64_t reads[MEMORY_ACCESS_SIZE];
+    uint64_t writes[MEMORY_ACCESS_SIZE];
+} memory_access;
+
 typedef struct memory {
     size_t size;
     uint8_t *data;
+    memory_access *access;
 } memory;
 
 memory *memory_init(size_t size);
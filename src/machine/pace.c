@@ -0,0 +1,138 @@
+#include "pace.h"
+#include "cpu.h"
+#include "isa.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#define PACE_NANOSECONDS 1000000000ULL
+
+// Puts a waiting machine to sleep in its callback, defined in cpu.c.
+bool machine_call_wait(machine *m);
+
+static uint64_t pace_nanoseconds(uint64_t cycles, uint64_t hz) {
+    // Whole seconds and the rest are converted apart, so that the products
+    // stay within 64 bits.
+    return cycles / hz * PACE_NANOSECONDS +
+           cycles % hz * PACE_NANOSECONDS / hz;
+}
+
+static struct timespec pace_add(struct timespec t, uint64_t nanoseconds) {
+    nanoseconds += t.tv_nsec;
+    t.tv_sec += nanoseconds / PACE_NANOSECONDS;
+    t.tv_nsec = nanoseconds % PACE_NANOSECONDS;
+    return t;
+}
+
+static uint64_t pace_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    int64_t nanoseconds = (int64_t)(now.tv_sec - start->tv_sec) *
+                              (int64_t)PACE_NANOSECONDS +
+                          (now.tv_nsec - start->tv_nsec);
+    return nanoseconds > 0 ? nanoseconds : 0;
+}
+
+void pace_start(pacer *p, machine *m, uint64_t hz) {
+    *p = (pacer){
+        .hz = hz,
+        .batch = hz >= PACE_BATCHES_PER_SECOND ? hz / PACE_BATCHES_PER_SECOND
+                                               : 1,
+        .start_cycles = m->cycles,
+    };
+
+    clock_gettime(CLOCK_MONOTONIC, &p->start);
+}
+
+bool pace_run(pacer *p, machine *m) {
+    // Runs one batch and waits for its deadline. Returns false, without
+    // waiting, once the machine has halted, which includes a machine whose
+    // wait callback found that nothing could wake it any more.
+    uint64_t target = p->start_cycles + (p->batches + 1) * p->batch;
+
+    machine_wake(m);
+
+    while (m->cycles < target && !(m->flags & FLAG_HALT)) {
+        // Runs only as many instructions as surely fit in what is left of
+        // the batch, so that it ends at most one instruction late.
+        uint64_t count = (target - m->cycles) / ISA_MAX_CYCLES;
+        count = count > 0 ? count : 1;
+        machine_run_quantum(m, count < UINT32_MAX ? count : UINT32_MAX);
+    }
+
+    if (m->status == STATE_WAIT && m->cycles < target) {
+        p->idle += target - m->cycles;
+        m->cycles = target;
+    }
+
+    p->batches++;
+
+    if (m->status == STATE_WAIT && !(m->flags & FLAG_INTERRUPT) &&
+        m->event_wait != NULL) {
+        // Nothing changes until the interrupt, so rather than idle through
+        // batch after batch the machine sleeps in its callback. Time slept
+        // past the batch's deadline is made up in whole idle batches,
+        // rounded up so that the schedule stays ahead of the clock.
+        uint64_t deadline = pace_nanoseconds(target - p->start_cycles, p->hz);
+        uint64_t per_batch = pace_nanoseconds(p->batch, p->hz);
+        uint64_t before = pace_since(&p->start);
+
+        machine_call_wait(m);
+
+        uint64_t now = pace_since(&p->start);
+        p->slept += now - before;
+        uint64_t batches =
+            now > deadline ? (now - deadline + per_batch - 1) / per_batch : 0;
+
+        target += batches * p->batch;
+        p->batches += batches;
+        p->idle += batches * p->batch;
+        m->cycles = target;
+    }
+
+    if (m->flags & FLAG_HALT && m->status != STATE_WAIT) {
+        return false;
+    }
+
+    uint64_t deadline = pace_nanoseconds(target - p->start_cycles, p->hz);
+    uint64_t now = pace_since(&p->start);
+
+    if (now < deadline) {
+        struct timespec until = pace_add(p->start, deadline);
+
+        // A signal cuts the sleep short, but the deadline is absolute, so
+        // sleeping again finishes it.
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) ==
+               EINTR) {
+            continue;
+        }
+
+        p->slept += pace_since(&p->start) - now;
+    } else {
+        uint64_t lag = now - deadline;
+
+        p->late++;
+        p->max_lag = lag > p->max_lag ? lag : p->max_lag;
+
+        if (lag > PACE_MAX_LAG_NANOSECONDS) {
+            p->start = pace_add(p->start, lag);
+            p->skipped += lag;
+        }
+    }
+
+    return true;
+}
+
+uint64_t pace_emulated(pacer *p, machine *m) {
+    // Nanoseconds of emulated time since the pacer started.
+    return pace_nanoseconds(m->cycles - p->start_cycles, p->hz);
+}
+
+uint64_t pace_elapsed(pacer *p) {
+    // Nanoseconds of real time since the pacer started, including any time
+    // that was skipped.
+    return pace_since(&p->start) + p->skipped;
+}
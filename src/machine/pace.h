@@ -0,0 +1,50 @@
+#ifndef BBB_PACE_H
+#define BBB_PACE_H
+
+#include "cpu.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+// Batches run per second of emulated time, and the furthest the emulator
+// may fall behind its schedule before it stops trying to catch up.
+#define PACE_BATCHES_PER_SECOND 100
+#define PACE_MAX_LAG_NANOSECONDS 100000000
+
+// Runs a machine at a fixed number of cycles per second of real time. The
+// machine runs a batch of cycles as fast as it can and then sleeps until
+// the moment the batch should have ended, measured from the start on
+// CLOCK_MONOTONIC, so errors in sleeping do not add up.
+//
+// Batches end at fixed cycle counts, so where the program sees the outside
+// world, between batches, depends only on the clock rate and not on the
+// speed of the host. A batch that ends after its deadline is `late`, and
+// the emulator runs the next without sleeping to catch up. When it falls
+// more than PACE_MAX_LAG_NANOSECONDS behind, as when the host is suspended,
+// the schedule is moved forward instead and the time is `skipped`.
+//
+// A machine waiting for an interrupt lets the rest of its batch go by, and
+// its cycles count on as the batch's `idle` cycles. It is woken before the
+// next batch if its interrupt was raised in between. Otherwise, if it has
+// an `event_wait` callback, it sleeps there until the interrupt, and the
+// batches that go by meanwhile count as idle as well.
+typedef struct pacer {
+    uint64_t hz;
+    uint64_t batch;
+    struct timespec start;
+    uint64_t start_cycles;
+
+    uint64_t batches;
+    uint64_t late;
+    uint64_t max_lag;
+    uint64_t slept;
+    uint64_t skipped;
+    uint64_t idle;
+} pacer;
+
+void pace_start(pacer *p, machine *m, uint64_t hz);
+bool pace_run(pacer *p, machine *m);
+uint64_t pace_emulated(pacer *p, machine *m);
+uint64_t pace_elapsed(pacer *p);
+
+#endif
@@ -0,0 +1,338 @@
+#include "partition.h"
+#include "cpu.h"
+#include "lattice.h"
+#include "memory.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define MAILBOX_PAGE MAILBOX_INBOX
+#define MAILBOX_PAGE_SIZE 0x1000
+#define OWNER(node, processes) ((node) * (processes) / LATTICE_NODE_COUNT)
+
+static void futex_wait(_Atomic uint32_t *addr, uint32_t value) {
+    syscall(SYS_futex, addr, FUTEX_WAIT, value, NULL, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t *addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static void snapshot_save(machine *m, lattice_snapshot *s) {
+    uint8_t *data = m->memory->data;
+
+    memcpy(s->registers, m->registers, CPU_REGISTER_COUNT);
+    s->flags = m->flags;
+    s->status = m->status;
+    s->int_mask = m->int_mask;
+    s->pc = m->pc - data;
+    s->sp = m->sp - data;
+    s->iv = m->iv - data;
+    s->ix = m->ix - data;
+    s->ta = m->ta - data;
+}
+
+static void snapshot_restore(machine *m, lattice_snapshot *s) {
+    uint8_t *data = m->memory->data;
+
+    memcpy(m->registers, s->registers, CPU_REGISTER_COUNT);
+    m->flags = s->flags;
+    m->status = s->status;
+    m->int_mask = s->int_mask;
+    m->pc = data + s->pc;
+    m->sp = data + s->sp;
+    m->iv = data + s->iv;
+    m->ix = data + s->ix;
+    m->ta = data + s->ta;
+}
+
+static bool partition_map_node(machine *m, int fd, size_t node) {
+    // Move the node into a page-aligned private mapping and put the shared
+    // mailbox page on top of it.
+    memory *mem = m->memory;
+    uint8_t *data = mmap(NULL, mem->size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    memcpy(data, mem->data, mem->size);
+
+    off_t offset = offsetof(lattice_shared, memory) +
+                   node * CPU_MAX_ADDRESS + MAILBOX_PAGE;
+
+    if (mmap(data + MAILBOX_PAGE, MAILBOX_PAGE_SIZE, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_FIXED, fd, offset) == MAP_FAILED) {
+        return false;
+    }
+
+    m->pc = data + (m->pc - mem->data);
+    m->sp = data + (m->sp - mem->data);
+    m->iv = data + (m->iv - mem->data);
+    m->ix = data + (m->ix - mem->data);
+    m->ta = data + (m->ta - mem->data);
+    mem->data = data;
+
+    return true;
+}
+
+static bool partition_arrive(lattice_shared *s) {
+    // Returns true in the last process to arrive, which must call
+    // partition_release once it has finished the serial part of the quantum.
+    uint32_t generation = atomic_load(&s->generation);
+
+    if (atomic_fetch_add(&s->arrived, 1) + 1 == s->processes) {
+        return true;
+    }
+
+    while (atomic_load(&s->generation) == generation) {
+        futex_wait(&s->generation, generation);
+    }
+
+    return false;
+}
+
+static void partition_release(lattice_shared *s) {
+    atomic_store(&s->arrived, 0);
+    atomic_fetch_add(&s->generation, 1);
+    futex_wake(&s->generation);
+}
+
+static void partition_schedule(lattice *l, lattice_shared *s) {
+    bool running = false;
+
+    // A sleeping node keeps the lattice going only if the exchange just
+    // delivered it mail, which wakes it in the next quantum.
+    for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+        running |= !(s->nodes[i].flags & FLAG_HALT) ||
+                   (s->nodes[i].status == STATE_WAIT &&
+                    lattice_has_mail(l->nodes[i]));
+    }
+
+    s->done = !running || (l->max_quanta && s->quanta >= l->max_quanta);
+
+    if (!s->done && l->detect && lattice_deadlocked(l)) {
+        s->outcome = l->outcome;
+        s->cycle = l->cycle;
+        s->done = true;
+    }
+}
+
+static void partition_publish_waits(lattice *l, lattice_shared *s) {
+    memcpy(s->waits, l->waits, sizeof(s->waits));
+    atomic_store(&s->stalled, atomic_exchange(&l->stalled, 0));
+}
+
+static void partition_worker(lattice *l, lattice_shared *s, int fd,
+                             size_t process) {
+    size_t processes = s->processes;
+
+    // Only count the exchanges this process makes; the parent already has
+    // the rest.
+    memset(l->traffic, 0, sizeof(l->traffic));
+
+    for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+        if (!partition_map_node(l->nodes[i], fd, i)) {
+            perror("error: unable to map mailboxes");
+            _exit(EXIT_FAILURE);
+        }
+    }
+
+    while (!s->done) {
+        lattice_detect_restore(l, s->waits, 0);
+
+        for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+            machine *m = l->nodes[i];
+
+            if (OWNER(i, processes) == process) {
+                lattice_wake(l, i);
+            }
+
+            if (OWNER(i, processes) == process && !(m->flags & FLAG_HALT)) {
+                lattice_run_node(l, i);
+            }
+
+            if (OWNER(i, processes) == process) {
+                snapshot_save(m, &s->nodes[i]);
+                s->waits[i] = l->waits[i];
+            }
+        }
+
+        atomic_fetch_or(&s->stalled, atomic_exchange(&l->stalled, 0));
+
+        if (partition_arrive(s)) {
+            lattice_detect_restore(l, s->waits, atomic_load(&s->stalled));
+            lattice_exchange(l);
+            s->quanta++;
+            partition_schedule(l, s);
+            partition_publish_waits(l, s);
+            partition_release(s);
+        }
+    }
+
+    // Hand the private parts of our nodes' memory back to the parent. The
+    // mailbox page is already shared.
+    for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+        if (OWNER(i, processes) == process) {
+            uint8_t *data = l->nodes[i]->memory->data;
+            size_t tail = MAILBOX_PAGE + MAILBOX_PAGE_SIZE;
+
+            memcpy(s->memory[i], data, MAILBOX_PAGE);
+            memcpy(s->memory[i] + tail, data + tail, CPU_MAX_ADDRESS - tail);
+            s->counters[i] = l->counters[i];
+        }
+    }
+
+    memcpy(s->traffic[process], l->traffic, sizeof(l->traffic));
+
+    _exit(EXIT_SUCCESS);
+}
+
+static void partition_merge_traffic(lattice *l, lattice_shared *s,
+                                    size_t processes) {
+    for (size_t p = 0; p < processes; p++) {
+        for (size_t i = 0; i < LATTICE_NODE_COUNT * 2; i++) {
+            link_counters *from = &s->traffic[p][i];
+            link_counters *to = &l->traffic[i];
+
+            for (size_t side = 0; side < 2; side++) {
+                to->quads[side] += from->quads[side];
+                to->stalls[side] += from->stalls[side];
+
+                if (from->high_water[side] > to->high_water[side]) {
+                    to->high_water[side] = from->high_water[side];
+                }
+            }
+        }
+    }
+}
+
+bool lattice_partition_run(lattice *l, size_t processes) {
+    // Split the lattice into tiles of consecutive nodes (whole rows when the
+    // process count divides the row count) and simulate each tile in its own
+    // process. The lattice must already be started.
+    char name[64];
+    pid_t pids[PARTITION_MAX_PROCESSES];
+    bool success = true;
+
+    if (processes < 1 || processes > PARTITION_MAX_PROCESSES ||
+        MAILBOX_PAGE % sysconf(_SC_PAGESIZE) != 0) {
+        return false;
+    }
+
+    snprintf(name, sizeof(name), "/bbb-lattice-%d", (int)getpid());
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    shm_unlink(name);
+
+    if (ftruncate(fd, sizeof(lattice_shared)) != 0) {
+        close(fd);
+        return false;
+    }
+
+    lattice_shared *s = mmap(NULL, sizeof(lattice_shared),
+                             PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (s == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    s->processes = processes;
+    s->quanta = 0;
+    s->cycle = 0;
+    s->outcome = LATTICE_FINISHED;
+    lattice_detect_start(l);
+
+    for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+        memcpy(s->memory[i], l->nodes[i]->memory->data, CPU_MAX_ADDRESS);
+        snapshot_save(l->nodes[i], &s->nodes[i]);
+    }
+
+    partition_schedule(l, s);
+    partition_publish_waits(l, s);
+    fflush(stdout);
+    fflush(stderr);
+
+    for (size_t p = 0; p < processes; p++) {
+        pids[p] = fork();
+
+        if (pids[p] == 0) {
+            partition_worker(l, s, fd, p);
+        } else if (pids[p] < 0) {
+            // Workers that did start would wait at the barrier forever.
+            for (size_t q = 0; q < p; q++) {
+                kill(pids[q], SIGKILL);
+            }
+            processes = p;
+            success = false;
+            break;
+        }
+    }
+
+    for (size_t p = 0; p < processes; p++) {
+        int status;
+        pid_t pid = wait(&status);
+
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            // One tile failed; the rest of the lattice cannot make progress
+            // without it.
+            fprintf(stderr, "error: lattice worker %d failed\n", (int)pid);
+
+            for (size_t q = 0; q < processes && success; q++) {
+                kill(pids[q], SIGKILL);
+            }
+
+            success = false;
+        }
+    }
+
+    if (success) {
+        for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+            machine *m = l->nodes[i];
+
+            memcpy(m->memory->data, s->memory[i], CPU_MAX_ADDRESS);
+            snapshot_restore(m, &s->nodes[i]);
+            l->counters[i] = s->counters[i];
+        }
+
+        partition_merge_traffic(l, s, processes);
+
+        lattice_detect_restore(l, s->waits, atomic_load(&s->stalled));
+
+        l->quanta = s->quanta;
+        l->cycle = s->cycle;
+        l->outcome = l->max_quanta && l->quanta >= l->max_quanta
+                         ? LATTICE_LIMIT
+                         : s->outcome;
+
+        for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+            if (l->outcome == LATTICE_FINISHED &&
+                l->nodes[i]->status == STATE_WAIT) {
+                l->outcome = LATTICE_IDLE;
+            }
+        }
+    }
+
+    munmap(s, sizeof(lattice_shared));
+    close(fd);
+
+    return success;
+}
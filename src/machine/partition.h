@@ -0,0 +1,61 @@
+#ifndef BBB_PARTITION_H
+#define BBB_PARTITION_H
+
+#include "cpu.h"
+#include "lattice.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PARTITION_MAX_PROCESSES LATTICE_NODE_COUNT
+
+// The register state of a node, as published by the process that runs it.
+typedef struct lattice_snapshot {
+    uint8_t registers[CPU_REGISTER_COUNT];
+    uint8_t flags;
+    MachineState status;
+    bool int_mask;
+    uint16_t pc;
+    uint16_t sp;
+    uint16_t iv;
+    uint16_t ix;
+    uint16_t ta;
+} lattice_snapshot;
+
+// Layout of the shared memory segment. Each node gets a full-size memory
+// slot. While the lattice runs, only the mailbox page of each slot is mapped
+// into the node's memory, so the mailboxes keep exactly the ring layout used
+// in-process and the rest of the node's memory stays private to the process
+// that simulates it. When a process finishes, it copies its nodes' memory
+// into their slots so the parent can collect the final state.
+typedef struct lattice_shared {
+    uint8_t memory[LATTICE_NODE_COUNT][CPU_MAX_ADDRESS];
+    lattice_snapshot nodes[LATTICE_NODE_COUNT];
+
+    // Counters come back the same way as memory. Mailboxes are exchanged by
+    // whichever process reaches the barrier last, so each process hands back
+    // the link counters it collected and the parent adds them up.
+    node_counters counters[LATTICE_NODE_COUNT];
+    link_counters traffic[PARTITION_MAX_PROCESSES][LATTICE_NODE_COUNT * 2];
+
+    // Wait states go through here between quanta, next to the snapshots, so
+    // that whichever process arrives last can run the deadlock detector on
+    // the whole lattice. `stalled` collects the nodes each process flagged.
+    lattice_wait waits[LATTICE_NODE_COUNT];
+    _Atomic uint32_t stalled;
+    uint32_t cycle;
+    LatticeOutcome outcome;
+
+    // Quantum barrier: processes count themselves in with `arrived`, and the
+    // last one to arrive exchanges the mailboxes and bumps `generation`, on
+    // which the others wait with a futex.
+    _Atomic uint32_t arrived;
+    _Atomic uint32_t generation;
+    uint32_t processes;
+    uint64_t quanta;
+    bool done;
+} lattice_shared;
+
+bool lattice_partition_run(lattice *l, size_t processes);
+
+#endif
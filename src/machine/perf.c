@@ -0,0 +1,133 @@
+#include "perf.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+const char *const perf_event_names[PERF_EVENT_COUNT] = {
+    [PERF_CYCLES] = "cycles",
+    [PERF_INSTRUCTIONS] = "instructions",
+    [PERF_BRANCH_MISSES] = "branch-misses",
+    [PERF_L1D_MISSES] = "L1d-misses",
+    [PERF_L1I_MISSES] = "L1i-misses",
+    [PERF_ITLB_MISSES] = "iTLB-misses",
+};
+
+#if defined(__linux__)
+
+// Cache events are a cache, an operation and a result, a byte each.
+#define PERF_CACHE(cache, op, result)                                          \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_##op << 8) |                            \
+     (PERF_COUNT_HW_CACHE_RESULT_##result << 16))
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} perf_events[PERF_EVENT_COUNT] = {
+    [PERF_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    [PERF_INSTRUCTIONS] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    [PERF_BRANCH_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    [PERF_L1D_MISSES] = {PERF_TYPE_HW_CACHE,
+                         PERF_CACHE(PERF_COUNT_HW_CACHE_L1D, READ, MISS)},
+    [PERF_L1I_MISSES] = {PERF_TYPE_HW_CACHE,
+                         PERF_CACHE(PERF_COUNT_HW_CACHE_L1I, READ, MISS)},
+    [PERF_ITLB_MISSES] = {PERF_TYPE_HW_CACHE,
+                          PERF_CACHE(PERF_COUNT_HW_CACHE_ITLB, READ, MISS)},
+};
+
+size_t perf_open(perf_counters *p) {
+    // Each event is opened on its own rather than as a group, so that one
+    // the host lacks does not take the others with it. Returns how many
+    // were opened.
+    size_t opened = 0;
+
+    for (size_t e = 0; e < PERF_EVENT_COUNT; e++) {
+        struct perf_event_attr attr;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = perf_events[e].type;
+        attr.config = perf_events[e].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format =
+            PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        p->fds[e] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        p->values[e] = 0;
+        opened += p->fds[e] >= 0;
+    }
+
+    return opened;
+}
+
+void perf_start(perf_counters *p) {
+    for (size_t e = 0; e < PERF_EVENT_COUNT; e++) {
+        if (p->fds[e] >= 0) {
+            ioctl(p->fds[e], PERF_EVENT_IOC_RESET, 0);
+            ioctl(p->fds[e], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void perf_stop(perf_counters *p) {
+    for (size_t e = 0; e < PERF_EVENT_COUNT; e++) {
+        if (p->fds[e] >= 0) {
+            ioctl(p->fds[e], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+
+    for (size_t e = 0; e < PERF_EVENT_COUNT; e++) {
+        // The value, the time the event was enabled and the time it was
+        // actually counting.
+        uint64_t read_values[3] = {0};
+
+        if (p->fds[e] < 0 ||
+            read(p->fds[e], read_values, sizeof(read_values)) !=
+                sizeof(read_values)) {
+            p->values[e] = 0;
+        } else if (read_values[2] > 0 && read_values[2] < read_values[1]) {
+            p->values[e] = (double)read_values[0] * read_values[1] /
+                           read_values[2];
+        } else {
+            p->values[e] = read_values[0];
+        }
+    }
+}
+
+#else
+
+size_t perf_open(perf_counters *p) {
+    for (size_t e = 0; e < PERF_EVENT_COUNT; e++) {
+        p->fds[e] = -1;
+        p->values[e] = 0;
+    }
+
+    return 0;
+}
+
+void perf_start(perf_counters *p) {}
+
+void perf_stop(perf_counters *p) {}
+
+#endif
+
+bool perf_available(perf_counters *p, PerfEvent e) { return p->fds[e] >= 0; }
+
+void perf_close(perf_counters *p) {
+    for (size_t e = 0; e < PERF_EVENT_COUNT; e++) {
+        if (p->fds[e] >= 0) {
+            close(p->fds[e]);
+            p->fds[e] = -1;
+        }
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef BBB_PERF_H
+#define BBB_PERF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Hardware events of the host, counted for the calling thread in user space
+// only, so that time spent in the kernel, such as writing to the terminal,
+// is left out.
+typedef enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_BRANCH_MISSES,
+    PERF_L1D_MISSES,
+    PERF_L1I_MISSES,
+    PERF_ITLB_MISSES,
+    PERF_EVENT_COUNT
+} PerfEvent;
+
+// The counters that could be opened, with -1 for those that could not,
+// such as every one of them in a virtual machine without a PMU. `values`
+// holds the counts between the last perf_start and perf_stop, scaled up
+// when the kernel had to share the hardware between events.
+typedef struct perf_counters {
+    int fds[PERF_EVENT_COUNT];
+    uint64_t values[PERF_EVENT_COUNT];
+} perf_counters;
+
+extern const char *const perf_event_names[PERF_EVENT_COUNT];
+
+size_t perf_open(perf_counters *p);
+bool perf_available(perf_counters *p, PerfEvent e);
+void perf_start(perf_counters *p);
+void perf_stop(perf_counters *p);
+void perf_close(perf_counters *p);
+
+#endif
@@ -0,0 +1,301 @@
+#include "profile.h"
+#include "alloc.h"
+#include "cpu.h"
+#include "isa.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define PROFILE_ARRAY_LENGTH 64
+
+// The steps of the run loop, defined in cpu.c.
+void machine_instr_fetch(machine *m);
+void machine_instr_decode(machine *m);
+void machine_instr_execute(machine *m);
+void machine_interrupt_check(machine *m);
+void machine_call_update(machine *m);
+
+static inline bool profile_condition(machine *m) {
+    // The test JMP and JSR make of the flags, read before they execute.
+    return (m->flags & (1 << (m->dst & 7))) ==
+           (((m->dst & 8) >> 3) << (m->dst & 7));
+}
+
+static uint32_t callgraph_node_add(callgraph *c, uint32_t parent,
+                                   uint16_t entry) {
+    c->nodes = alloc_grow(c->nodes, &c->node_length, sizeof(callgraph_node),
+                          c->node_count + 1, PROFILE_ARRAY_LENGTH);
+    uint32_t n = c->node_count++;
+    c->nodes[n] = (callgraph_node){.entry = entry, .parent = parent};
+
+    if (n > 0) {
+        c->nodes[n].sibling = c->nodes[parent].child;
+        c->nodes[parent].child = n;
+    }
+
+    return n;
+}
+
+static void callgraph_call(callgraph *c, uint16_t entry) {
+    c->calls[entry]++;
+
+    if (c->depth == CALLGRAPH_MAX_DEPTH) {
+        c->overflow++;
+        return;
+    }
+
+    uint32_t parent = c->stack[c->depth - 1];
+    uint32_t n = c->nodes[parent].child;
+
+    while (n && c->nodes[n].entry != entry) {
+        n = c->nodes[n].sibling;
+    }
+
+    c->stack[c->depth++] = n ? n : callgraph_node_add(c, parent, entry);
+}
+
+static void callgraph_return(callgraph *c) {
+    // A return with nothing left to return from, such as code that pushed
+    // its own address and popped it into PC, keeps the root where it is.
+    if (c->overflow) {
+        c->overflow--;
+    } else if (c->depth > 1) {
+        c->depth--;
+    }
+}
+
+static void profile_stack(uint64_t *counts, uint16_t start, uint16_t end) {
+    // Counts an access to each quad of the stack from start up to end.
+    for (uint16_t a = start; a != end; a++) {
+        counts[a]++;
+    }
+}
+
+static void profile_end_window(profile *p, uint64_t now) {
+    // Finds what changed since the last window ended.
+    bool pages[MEMORY_PAGE_COUNT] = {false};
+    profile_window w = {p->window_start, now - p->window_start, 0, 0};
+
+    if (w.length == 0) {
+        return;
+    }
+
+    for (size_t a = 0; a < MEMORY_ACCESS_SIZE; a++) {
+        uint64_t total = p->access->reads[a] + p->access->writes[a];
+
+        if (total != p->window_last[a]) {
+            p->window_last[a] = total;
+            w.quads++;
+            w.pages += !pages[a / MEMORY_PAGE_SIZE];
+            pages[a / MEMORY_PAGE_SIZE] = true;
+        }
+    }
+
+    p->windows = alloc_grow(p->windows, &p->window_length,
+                            sizeof(profile_window), p->window_count + 1,
+                            PROFILE_ARRAY_LENGTH);
+    p->windows[p->window_count++] = w;
+    p->window_start = now;
+}
+
+profile *profile_init() { return calloc(1, sizeof(profile)); }
+
+uint64_t profile_run(machine *m, profile *p, uint64_t limit) {
+    // The same loop as machine_run, counting every instruction on the way
+    // and following calls and returns when there is a call tree. Counting
+    // is kept out of machine_run itself, so that running without a profile
+    // costs nothing. Stops after `limit` instructions unless it is 0, and
+    // returns the number executed.
+    uint64_t executed = 0;
+    callgraph *c = p->calls;
+
+    memory_access *access = p->access;
+    uint8_t *base = m->memory->data;
+
+    if (c && c->depth == 0) {
+        c->stack[c->depth++] =
+            callgraph_node_add(c, 0, m->pc - m->memory->data);
+    }
+
+    if (access && p->window && !p->window_last) {
+        p->window_last = calloc(MEMORY_ACCESS_SIZE, sizeof(uint64_t));
+        p->window_start = p->instructions;
+    }
+
+    m->memory->access = access;
+    machine_call_update(m);
+
+    while (!(m->flags & FLAG_HALT) && (limit == 0 || executed < limit)) {
+        uint16_t address = m->pc - m->memory->data;
+        uint32_t interrupts = m->interrupts;
+        uint16_t sp = m->sp - base;
+        bool taken = false;
+
+        machine_instr_fetch(m);
+        machine_instr_decode(m);
+
+        p->counts[address]++;
+        p->opcodes[m->instr]++;
+
+        if (m->instr == JMP || m->instr == JSR) {
+            taken = profile_condition(m);
+
+            if (taken) {
+                p->taken[address]++;
+            } else {
+                p->not_taken[address]++;
+            }
+        }
+
+        if (c) {
+            c->nodes[c->stack[c->depth - 1]].self++;
+        }
+
+        machine_instr_execute(m);
+
+        if (c && m->instr == JSR && taken) {
+            callgraph_call(c, m->dst_ext);
+        } else if (c && m->instr == POP && m->dst == REGISTER_PC) {
+            callgraph_return(c);
+        }
+
+        // The stack is reached through SP directly rather than through
+        // memory_read and memory_write, so it is counted here. POP into a
+        // 16-bit register reads four quads.
+        if (access && (m->instr == PSH || (m->instr == JSR && taken))) {
+            profile_stack(access->writes, sp, m->sp - base);
+        } else if (access && m->instr == POP) {
+            bool wide = m->dst >= REGISTER_PC && m->dst <= REGISTER_CV;
+            profile_stack(access->reads, sp - (wide ? 4 : 1), sp);
+        }
+
+        machine_call_update(m);
+        sp = m->sp - base;
+        machine_interrupt_check(m);
+
+        if (m->interrupts != interrupts) {
+            if (c) {
+                callgraph_call(c, m->pc - m->memory->data);
+            }
+
+            if (access) {
+                profile_stack(access->writes, sp, sp + 4);
+            }
+        }
+
+        executed++;
+
+        if (p->window_last &&
+            p->instructions + executed - p->window_start == p->window) {
+            profile_end_window(p, p->instructions + executed);
+        }
+    }
+
+    machine_call_update(m);
+    m->memory->access = NULL;
+    p->instructions += executed;
+
+    if (p->window_last) {
+        profile_end_window(p, p->instructions);
+    }
+
+    return executed;
+}
+
+static uint8_t profile_shade(uint64_t value, uint64_t max) {
+    // Brightness grows with the number of bits in a count, so quads that
+    // are touched a few times still show up next to the hottest ones.
+    size_t bits = 0;
+    size_t max_bits = 0;
+
+    if (value == 0) {
+        return 0;
+    }
+
+    for (; value; value >>= 1) {
+        bits++;
+    }
+
+    for (; max; max >>= 1) {
+        max_bits++;
+    }
+
+    return 55 + 200 * bits / max_bits;
+}
+
+bool profile_write_heat_map(profile *p, const char *path) {
+    // Writes a 256 by 256 binary PPM with a pixel per quad and a row per
+    // page. Writes are red, reads green and executed instructions blue.
+    uint64_t max = 0;
+    FILE *out = fopen(path, "wb");
+
+    if (!out) {
+        return false;
+    }
+
+    for (size_t a = 0; a < MEMORY_ACCESS_SIZE; a++) {
+        max = p->access->reads[a] > max ? p->access->reads[a] : max;
+        max = p->access->writes[a] > max ? p->access->writes[a] : max;
+        max = p->counts[a] > max ? p->counts[a] : max;
+    }
+
+    bool success = fprintf(out, "P6\n%d %d\n255\n", MEMORY_PAGE_SIZE,
+                           MEMORY_PAGE_COUNT) > 0;
+
+    for (size_t a = 0; success && a < MEMORY_ACCESS_SIZE; a++) {
+        uint8_t pixel[3] = {profile_shade(p->access->writes[a], max),
+                            profile_shade(p->access->reads[a], max),
+                            profile_shade(p->counts[a], max)};
+        success = fwrite(pixel, 1, 3, out) == 3;
+    }
+
+    return fclose(out) == 0 && success;
+}
+
+void profile_free(profile *p) {
+    free(p->windows);
+    free(p->window_last);
+    free(p);
+}
+
+callgraph *callgraph_init() { return calloc(1, sizeof(callgraph)); }
+
+void callgraph_totals(callgraph *c, uint64_t *inclusive, uint64_t *exclusive) {
+    // Sums the tree into arrays indexed by entry address. A subroutine's
+    // inclusive count is every instruction executed while it was on the
+    // stack, so recursive calls are only counted at their outermost frame.
+    // Children are always added after their parents, so walking the nodes
+    // backwards sums each subtree before its parent needs it.
+    uint64_t *total = calloc(c->node_count + 1, sizeof(uint64_t));
+
+    for (size_t n = c->node_count; n-- > 0;) {
+        callgraph_node *node = &c->nodes[n];
+        bool outermost = true;
+
+        total[n] += node->self;
+        exclusive[node->entry] += node->self;
+
+        for (uint32_t a = n; a > 0 && outermost;) {
+            a = c->nodes[a].parent;
+            outermost = c->nodes[a].entry != node->entry;
+        }
+
+        if (outermost) {
+            inclusive[node->entry] += total[n];
+        }
+
+        if (n > 0) {
+            total[node->parent] += total[n];
+        }
+    }
+
+    free(total);
+}
+
+void callgraph_free(callgraph *c) {
+    if (c) {
+        free(c->nodes);
+        free(c);
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef BBB_PROFILE_H
+#define BBB_PROFILE_H
+
+#include "cpu.h"
+#include "isa.h"
+#include "memory.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CALLGRAPH_MAX_DEPTH 256
+
+// A subroutine in the call tree, reached through the path of calls from the
+// root to it. The root is node 0, the code the run started in, so 0 also
+// marks a missing child or sibling. `self` is the number of instructions
+// executed in this subroutine on this path, outside its callees.
+typedef struct callgraph_node {
+    uint16_t entry;
+    uint32_t parent;
+    uint32_t child;
+    uint32_t sibling;
+    uint64_t self;
+} callgraph_node;
+
+// A call tree built from a shadow of the guest's call stack. JSR and taking
+// an interrupt push a frame, and POP into PC pops one. `calls` counts the
+// times each entry address was called. Calls deeper than the stack are not
+// followed; they are counted in `overflow` until their matching returns.
+typedef struct callgraph {
+    callgraph_node *nodes;
+    size_t node_count;
+    size_t node_length;
+
+    uint32_t stack[CALLGRAPH_MAX_DEPTH];
+    size_t depth;
+    uint64_t overflow;
+
+    uint64_t calls[CPU_MAX_ADDRESS];
+} callgraph;
+
+// The distinct quads and 256-quad pages read or written during a window of
+// `length` instructions that started at instruction `start`.
+typedef struct profile_window {
+    uint64_t start;
+    uint64_t length;
+    uint32_t quads;
+    uint32_t pages;
+} profile_window;
+
+// Execution counts gathered by profile_run. Addresses are the offset of an
+// instruction's opcode from the start of memory, and index the arrays
+// directly. A JMP or JSR is taken when its condition holds. The call tree
+// is only built when `calls` is set.
+//
+// Memory traffic is only counted when `access` is set: the reads and writes
+// of each quad, including the stack, and with a `window`, the working set
+// of every `window` instructions. A window also ends where a run stops.
+// Instruction fetches are not counted.
+typedef struct profile {
+    uint64_t instructions;
+    uint64_t opcodes[ISA_OPCODE_COUNT];
+    uint64_t counts[CPU_MAX_ADDRESS];
+    uint64_t taken[CPU_MAX_ADDRESS];
+    uint64_t not_taken[CPU_MAX_ADDRESS];
+    callgraph *calls;
+
+    memory_access *access;
+    uint64_t window;
+    profile_window *windows;
+    size_t window_count;
+    size_t window_length;
+    uint64_t window_start;
+    uint64_t *window_last;
+} profile;
+
+profile *profile_init();
+uint64_t profile_run(machine *m, profile *p, uint64_t limit);
+bool profile_write_heat_map(profile *p, const char *path);
+void profile_free(profile *p);
+
+callgraph *callgraph_init();
+void callgraph_totals(callgraph *c, uint64_t *inclusive, uint64_t *exclusive);
+void callgraph_free(callgraph *c);
+
+#endif
@@ -0,0 +1,138 @@
+#include "sample.h"
+#include "cpu.h"
+
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+_Static_assert(ATOMIC_INT_LOCK_FREE == 2,
+               "the sample ring needs lock-free atomics in a signal handler");
+_Static_assert(
+    ATOMIC_POINTER_LOCK_FREE == 2,
+    "the active sampler needs lock-free atomics in a signal handler");
+
+void machine_call_update(machine *m);
+
+// The sampler that SIGPROF records into, and the machine each thread is
+// running, if any. Only one sampler can be started at a time.
+static _Atomic(sampler *) sample_active;
+static _Thread_local machine *volatile sample_machine;
+static struct sigaction sample_previous;
+
+static void sample_signal(int signal) {
+    // Only touches lock-free atomics and plain loads, so it is safe to run
+    // between any two instructions of the interrupted thread. The program
+    // counter is the address being fetched or decoded, which is often just
+    // past the instruction that was executing.
+    sampler *s = atomic_load_explicit(&sample_active, memory_order_acquire);
+    machine *m = sample_machine;
+
+    if (!s) {
+        return;
+    } else if (!m) {
+        atomic_fetch_add_explicit(&s->outside, 1, memory_order_relaxed);
+        return;
+    }
+
+    unsigned head = atomic_load_explicit(&s->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&s->tail, memory_order_acquire);
+
+    if (head - tail == SAMPLE_RING_LENGTH) {
+        atomic_fetch_add_explicit(&s->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    s->ring[head & (SAMPLE_RING_LENGTH - 1)] = m->pc - m->memory->data;
+    atomic_store_explicit(&s->head, head + 1, memory_order_release);
+}
+
+sampler *sample_init() { return calloc(1, sizeof(sampler)); }
+
+bool sample_start(sampler *s, uint32_t rate) {
+    // Interrupts the process `rate` times per second of CPU time it uses.
+    struct sigaction action;
+    struct itimerval timer = {0};
+    long interval = 1000000 / (rate ? rate : 1);
+
+    interval = interval > 0 ? interval : 1;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = sample_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+
+    sampler *expected = NULL;
+
+    if (!atomic_compare_exchange_strong(&sample_active, &expected, s)) {
+        return false;
+    }
+
+    timer.it_interval.tv_sec = interval / 1000000;
+    timer.it_interval.tv_usec = interval % 1000000;
+    timer.it_value = timer.it_interval;
+
+    if (sigaction(SIGPROF, &action, &sample_previous) != 0 ||
+        setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+        atomic_store(&sample_active, NULL);
+        return false;
+    }
+
+    return true;
+}
+
+void sample_stop(sampler *s) {
+    // Stops the timer before the handler goes, so that no SIGPROF arrives
+    // with the default action of ending the process.
+    struct itimerval timer = {0};
+
+    setitimer(ITIMER_PROF, &timer, NULL);
+    sigaction(SIGPROF, &sample_previous, NULL);
+    atomic_store(&sample_active, NULL);
+    sample_drain(s);
+}
+
+void sample_attach(machine *m) { sample_machine = m; }
+
+void sample_drain(sampler *s) {
+    unsigned head = atomic_load_explicit(&s->head, memory_order_acquire);
+    unsigned tail = atomic_load_explicit(&s->tail, memory_order_relaxed);
+
+    for (; tail != head; tail++) {
+        s->counts[s->ring[tail & (SAMPLE_RING_LENGTH - 1)]]++;
+        s->samples++;
+    }
+
+    atomic_store_explicit(&s->tail, tail, memory_order_release);
+}
+
+uint64_t sample_run(sampler *s, machine *m, uint64_t limit) {
+    // Runs a machine with the usual run loop until it halts or, unless
+    // `limit` is 0, has executed `limit` instructions, while it is sampled.
+    // Returns the number of instructions executed.
+    uint64_t executed = 0;
+
+    machine_call_update(m);
+    sample_attach(m);
+
+    while (!(m->flags & FLAG_HALT) && (limit == 0 || executed < limit)) {
+        uint32_t count = SAMPLE_QUANTUM;
+
+        if (limit != 0 && limit - executed < count) {
+            count = limit - executed;
+        }
+
+        executed += machine_run_quantum(m, count);
+        sample_drain(s);
+    }
+
+    sample_attach(NULL);
+    machine_call_update(m);
+    sample_drain(s);
+    return executed;
+}
+
+void sample_free(sampler *s) { free(s); }
@@ -0,0 +1,42 @@
+#ifndef BBB_SAMPLE_H
+#define BBB_SAMPLE_H
+
+#include "cpu.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Samples the signal handler can hold before the run loop drains them, a
+// power of two, and the instructions run between drains.
+#define SAMPLE_RING_LENGTH 4096
+#define SAMPLE_QUANTUM 65536
+
+// A statistical profile taken by interrupting the host with SIGPROF, at a
+// rate of host CPU time, and recording the guest program counter. Nothing
+// is added to the run loop, so the program runs at full speed and any engine
+// that keeps `pc` current can be sampled.
+//
+// The signal handler is the only producer of the ring and the run loop its
+// only consumer, so neither needs a lock. Samples taken while no machine
+// is attached to the interrupted thread are counted as `outside`, and those
+// that find the ring full as `dropped`.
+typedef struct sampler {
+    atomic_uint head;
+    atomic_uint tail;
+    uint16_t ring[SAMPLE_RING_LENGTH];
+    atomic_uint outside;
+    atomic_uint dropped;
+
+    uint64_t samples;
+    uint64_t counts[CPU_MAX_ADDRESS];
+} sampler;
+
+sampler *sample_init();
+bool sample_start(sampler *s, uint32_t rate);
+void sample_stop(sampler *s);
+void sample_attach(machine *m);
+void sample_drain(sampler *s);
+uint64_t sample_run(sampler *s, machine *m, uint64_t limit);
+void sample_free(sampler *s);
+
+#endif
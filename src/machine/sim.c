@@ -1,9 +1,16 @@
+#include "counters.h"
 #include "cpu.h"
 #include "io.h"
+#include "lattice.h"
 #include "memory.h"
+#include "sim.h"
 // #include <stdbool.h>
 // #include <stdint.h>
+#include <errno.h>
+#include <poll.h>
 #include <stdio.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
 // #include <stdlib.h>
 
 uint16_t prev_keymap = 0;
@@ -12,6 +19,11 @@ uint16_t prev_keymap = 0;
 #define E(x) "\e[" #x
 #define E385(x) "\e[38:5:" #x
 #define E0(x) "\e[0;" #x
+#define E485 "\e[48:5:%um"
+
+// Background colors for the heat map, from cold to hot.
+static const uint8_t heat_ramp[] = {17,  18,  19,  20,  21,  57,  93,
+                                    129, 165, 201, 199, 197, 196};
 
 void sim_setup(machine *m) {
     // fprintf(stderr, "Starting up...\n");
@@ -120,6 +132,7 @@ void sim_io(machine *m) {
 
     if (meta == 'q') {
         m->flags |= 0x20; // Set halt flag
+        m->status = STATE_HALT;
         return;
     }
 
@@ -133,3 +146,181 @@ void sim_io(machine *m) {
         m->flags |= FLAG_INTERRUPT;
     }
 }
+
+void sim_wait(machine *m) {
+    // Sleeps until a key is pressed, instead of reading the keypad after
+    // every instruction. A key still held from the last press is released
+    // without waiting, as sim_io would see it on the next instruction.
+    struct pollfd input = {.fd = STDIN_FILENO, .events = POLLIN};
+
+    sim_print(m);
+
+    while (m->status == STATE_WAIT && !(m->flags & FLAG_INTERRUPT)) {
+        int ready = poll(&input, 1, prev_keymap ? 0 : -1);
+        int pending = 0;
+
+        // A signal returns to the caller, which may have been asked to stop,
+        // with the machine still waiting.
+        if (ready < 0 && errno == EINTR) {
+            break;
+        }
+
+        // Input that is ready with nothing to read has ended, and nothing
+        // can wake the machine any more.
+        if (ready < 0 || (ready > 0 &&
+                          (ioctl(STDIN_FILENO, FIONREAD, &pending) != 0 ||
+                           pending == 0))) {
+            m->status = STATE_HALT;
+            break;
+        }
+
+        sim_io(m);
+    }
+
+    sim_print(m);
+}
+
+static void sim_format_count(char *buffer, size_t size, uint64_t count) {
+    const char *suffixes = " KMGTP";
+    double value = count;
+    size_t scale = 0;
+
+    while (value >= 1000 && scale < 5) {
+        value /= 1000;
+        scale++;
+    }
+
+    if (scale == 0) {
+        snprintf(buffer, size, "%llu", (unsigned long long)count);
+    } else {
+        snprintf(buffer, size, "%.1f%c", value, suffixes[scale]);
+    }
+}
+
+static uint64_t sim_heat_value(lattice *l, size_t node, HeatMetric metric) {
+    uint64_t value = 0;
+
+    switch (metric) {
+    case HEAT_IDLE:
+        return l->counters[node].idle;
+    case HEAT_MAIL:
+        for (Direction d = DIRECTION_NORTH; d < DIRECTION_COUNT; d++) {
+            mailbox_counters c = counters_mailbox(l, node, d);
+            value += c.in + c.out;
+        }
+        return value;
+    default:
+        return l->counters[node].retired;
+    }
+}
+
+void sim_print_heat_map(lattice *l, HeatMetric metric) {
+    // Draw the lattice as a grid with each node shaded by one of its
+    // counters, relative to the busiest node.
+    static const char *titles[] = {"instructions retired",
+                                   "instructions idle", "mailbox quads moved"};
+    size_t shades = sizeof(heat_ramp) / sizeof(heat_ramp[0]);
+    uint64_t values[LATTICE_NODE_COUNT];
+    uint64_t max = 0;
+    char text[16];
+
+    for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+        values[i] = sim_heat_value(l, i, metric);
+        max = values[i] > max ? values[i] : max;
+    }
+
+    printf(E385(13m) "╔");
+
+    for (size_t c = 0; c < LATTICE_COLUMNS; c++) {
+        printf("══════════%s", c < LATTICE_COLUMNS - 1 ? "╤" : "╗\n");
+    }
+
+    for (size_t r = 0; r < LATTICE_ROWS; r++) {
+        printf("║");
+
+        for (size_t c = 0; c < LATTICE_COLUMNS; c++) {
+            uint64_t value = values[r * LATTICE_COLUMNS + c];
+            size_t shade = max ? value * (shades - 1) / max : 0;
+
+            sim_format_count(text, sizeof(text), value);
+            printf(E485 E(1m) E385(15m) " %8s " E0(35m) E385(13m) "%s",
+                   heat_ramp[shade], text,
+                   c < LATTICE_COLUMNS - 1 ? "│" : "║\n");
+        }
+
+        if (r < LATTICE_ROWS - 1) {
+            printf("╟");
+
+            for (size_t c = 0; c < LATTICE_COLUMNS; c++) {
+                printf("──────────%s", c < LATTICE_COLUMNS - 1 ? "┼" : "╢\n");
+            }
+        }
+    }
+
+    printf("╚");
+
+    for (size_t c = 0; c < LATTICE_COLUMNS; c++) {
+        printf("══════════%s", c < LATTICE_COLUMNS - 1 ? "╧" : "╝\n");
+    }
+
+    sim_format_count(text, sizeof(text), max);
+    printf(E(0m) "%s, busiest node %s\n", titles[metric], text);
+}
+
+void sim_print_memory_map(memory_access *a) {
+    // Draw the 256 pages of memory as a grid, a row per 4K quads, with each
+    // page shaded by its reads and writes. Shades follow the number of bits
+    // in a count, so lightly used pages stand out from untouched ones.
+    size_t shades = sizeof(heat_ramp) / sizeof(heat_ramp[0]);
+    uint64_t pages[MEMORY_PAGE_COUNT] = {0};
+    uint64_t max = 0;
+    size_t busiest = 0;
+    size_t max_bits = 0;
+    char text[16];
+
+    for (size_t i = 0; i < MEMORY_ACCESS_SIZE; i++) {
+        pages[i / MEMORY_PAGE_SIZE] += a->reads[i] + a->writes[i];
+    }
+
+    for (size_t p = 0; p < MEMORY_PAGE_COUNT; p++) {
+        if (pages[p] > max) {
+            max = pages[p];
+            busiest = p;
+        }
+    }
+
+    for (uint64_t m = max; m; m >>= 1) {
+        max_bits++;
+    }
+
+    printf(E385(13m) "      ╔════════════════════════════════════════════════╗\n");
+
+    for (size_t r = 0; r < MEMORY_PAGE_COUNT / 16; r++) {
+        printf(E(0m) "%04zX  " E385(13m) "║", r * 16 * MEMORY_PAGE_SIZE);
+
+        for (size_t c = 0; c < 16; c++) {
+            uint64_t value = pages[r * 16 + c];
+            size_t bits = 0;
+
+            for (; value; value >>= 1) {
+                bits++;
+            }
+
+            if (bits == 0) {
+                printf(E0(35m) E385(11m) " · ");
+            } else {
+                printf(E485 E(1m) E385(15m) " %02zX" E0(35m),
+                       heat_ramp[(bits - 1) * (shades - 1) /
+                                 (max_bits > 1 ? max_bits - 1 : 1)],
+                       r * 16 + c);
+            }
+        }
+
+        printf(E385(13m) "║\n");
+    }
+
+    printf("      ╚════════════════════════════════════════════════╝\n");
+    sim_format_count(text, sizeof(text), max);
+    printf(E(0m) "memory accesses per page, busiest page %02zX with %s\n",
+           busiest, text);
+}
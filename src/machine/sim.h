@@ -2,9 +2,16 @@
 #define BBB_SIM_H
 
 #include "cpu.h"
+#include "lattice.h"
+
+typedef enum { HEAT_RETIRED, HEAT_IDLE, HEAT_MAIL } HeatMetric;
 
 void sim_setup(machine *m);
 void sim_print(machine *m);
 void sim_io(machine *m);
+void sim_wait(machine *m);
+
+void sim_print_heat_map(lattice *l, HeatMetric metric);
+void sim_print_memory_map(memory_access *a);
 
 #endif
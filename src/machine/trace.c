@@ -0,0 +1,353 @@
+#include "trace.h"
+#include "cpu.h"
+#include "isa.h"
+#include "memory.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// How long the drain thread sleeps when every ring is empty.
+#define TRACE_DRAIN_NANOSECONDS 100000
+
+// The steps of the run loop, defined in cpu.c.
+void machine_instr_fetch(machine *m);
+void machine_instr_decode(machine *m);
+void machine_instr_execute(machine *m);
+void machine_interrupt_check(machine *m);
+void machine_call_update(machine *m);
+bool machine_call_wait(machine *m);
+
+// The ring of the calling thread, and the writer it belongs to. Writers are
+// told apart by an id that is never reused, rather than by their address.
+static _Thread_local uint64_t trace_local_id;
+static _Thread_local trace_ring *trace_local_ring;
+static atomic_uint_fast64_t trace_next_id = 1;
+
+static trace_ring *trace_thread_ring(trace_writer *w) {
+    if (trace_local_id == w->id) {
+        return trace_local_ring;
+    }
+
+    pthread_mutex_lock(&w->lock);
+    size_t n = atomic_load(&w->ring_count);
+    trace_ring *r =
+        n < TRACE_MAX_RINGS
+            ? aligned_alloc(_Alignof(trace_ring), sizeof(trace_ring))
+            : NULL;
+
+    if (!r) {
+        fprintf(stderr, "error: could not allocate a trace ring\n");
+        exit(EXIT_FAILURE);
+    }
+
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    w->rings[n] = r;
+    atomic_store_explicit(&w->ring_count, n + 1, memory_order_release);
+    pthread_mutex_unlock(&w->lock);
+
+    trace_local_id = w->id;
+    trace_local_ring = r;
+    return r;
+}
+
+static bool trace_write_all(int fd, const void *data, size_t length) {
+    const uint8_t *p = data;
+
+    while (length > 0) {
+        ssize_t written = write(fd, p, length);
+
+        if (written < 0 && errno == EINTR) {
+            continue;
+        } else if (written <= 0) {
+            return false;
+        }
+
+        p += written;
+        length -= written;
+    }
+
+    return true;
+}
+
+static size_t trace_drain(trace_writer *w, trace_ring *r) {
+    // Writes everything published to a ring, at most two writes, since the
+    // records may wrap around its end. After a write fails the records are
+    // dropped, so that threads waiting on the ring are not stuck forever.
+    uint64_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    uint64_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    size_t drained = head - tail;
+
+    while (tail < head) {
+        size_t start = tail & (TRACE_RING_RECORDS - 1);
+        size_t count = head - tail;
+
+        if (count > TRACE_RING_RECORDS - start) {
+            count = TRACE_RING_RECORDS - start;
+        }
+
+        if (!w->failed && !trace_write_all(w->fd, &r->records[start],
+                                           count * sizeof(trace_record))) {
+            w->failed = true;
+        }
+
+        tail += count;
+        atomic_store_explicit(&r->tail, tail, memory_order_release);
+    }
+
+    return drained;
+}
+
+static void *trace_drain_main(void *arg) {
+    trace_writer *w = (trace_writer *)arg;
+    struct timespec pause = {0, TRACE_DRAIN_NANOSECONDS};
+
+    for (;;) {
+        // Whatever was published before the writer was stopped is drained
+        // by the pass that sees the stop.
+        bool stop = atomic_load(&w->stop);
+        size_t count =
+            atomic_load_explicit(&w->ring_count, memory_order_acquire);
+        size_t drained = 0;
+
+        for (size_t i = 0; i < count; i++) {
+            drained += trace_drain(w, w->rings[i]);
+        }
+
+        if (drained == 0 && stop) {
+            break;
+        } else if (drained == 0) {
+            nanosleep(&pause, NULL);
+        }
+    }
+
+    return NULL;
+}
+
+trace_writer *trace_open(const char *path) {
+    uint32_t header[TRACE_HEADER_SIZE / 4] = {0, TRACE_VERSION,
+                                              sizeof(trace_record), 0};
+    trace_writer *w = calloc(1, sizeof(trace_writer));
+
+    memcpy(header, "BBBT", 4);
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (w->fd < 0 || !trace_write_all(w->fd, header, sizeof(header))) {
+        if (w->fd >= 0) {
+            close(w->fd);
+        }
+
+        free(w);
+        return NULL;
+    }
+
+    w->id = atomic_fetch_add(&trace_next_id, 1);
+    pthread_mutex_init(&w->lock, NULL);
+
+    if (pthread_create(&w->thread, NULL, trace_drain_main, w) != 0) {
+        pthread_mutex_destroy(&w->lock);
+        close(w->fd);
+        free(w);
+        return NULL;
+    }
+
+    return w;
+}
+
+bool trace_close(trace_writer *w) {
+    // Stops the drain thread once every ring is empty. Nothing may still
+    // be tracing into the writer.
+    atomic_store(&w->stop, true);
+    pthread_join(w->thread, NULL);
+
+    // The file is closed even after a failed write.
+    bool closed = close(w->fd) == 0;
+    bool success = !w->failed && closed;
+
+    for (size_t i = 0; i < w->ring_count; i++) {
+        free(w->rings[i]);
+    }
+
+    pthread_mutex_destroy(&w->lock);
+    free(w);
+    return success;
+}
+
+static uint64_t trace_wait(trace_ring *r, uint64_t head) {
+    // Waits for the drain thread to make room in a full ring.
+    uint64_t tail;
+
+    atomic_store_explicit(&r->head, head, memory_order_release);
+
+    while (head - (tail = atomic_load_explicit(
+                       &r->tail, memory_order_acquire)) ==
+           TRACE_RING_RECORDS) {
+        sched_yield();
+    }
+
+    return tail;
+}
+
+static uint16_t trace_value(machine *m) {
+    // What the instruction left in its destination, read without touching
+    // the load and store activity the lattice watches.
+    uint8_t *base = m->memory->data;
+
+    switch (m->instr) {
+    case NOP:
+    case CMP:
+        return 0;
+    case JMP:
+    case JSR:
+        return m->pc - base;
+    case PSH:
+        return m->sp - base;
+    default:
+        break;
+    }
+
+    switch (m->dst) {
+    case REGISTER_CV:
+        return 0;
+    case REGISTER_MD:
+        return memory_read(m->memory, m->dst_ext);
+    case REGISTER_MX:
+        return memory_read_indexed(m->memory, m->ix, m->dst_ext);
+    case REGISTER_PC:
+        return m->pc - base;
+    case REGISTER_SP:
+        return m->sp - base;
+    case REGISTER_IV:
+        return m->iv - base;
+    case REGISTER_IX:
+        return m->ix - base;
+    case REGISTER_TA:
+        return m->ta - base;
+    case REGISTER_S0:
+        return m->flags & MASK_REGISTER_S0;
+    case REGISTER_S1:
+        return m->flags >> 4;
+    default:
+        return m->registers[m->dst];
+    }
+}
+
+uint32_t trace_run_quantum(trace_writer *w, machine *m, uint8_t node,
+                           uint32_t count) {
+    // The same loop as machine_run_quantum, recording every instruction in
+    // the calling thread's ring. Records are published to the drain thread
+    // once per call, or sooner when the ring fills.
+    trace_ring *r = trace_thread_ring(w);
+    uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    uint32_t sequence = w->sequence[node];
+    uint32_t executed = 0;
+
+    while (executed < count && !(m->flags & FLAG_HALT)) {
+        uint16_t pc = m->pc - m->memory->data;
+
+        if (head - tail == TRACE_RING_RECORDS) {
+            tail = trace_wait(r, head);
+        }
+
+        machine_instr_fetch(m);
+        machine_instr_decode(m);
+        machine_instr_execute(m);
+
+        r->records[head++ & (TRACE_RING_RECORDS - 1)] = (trace_record){
+            .sequence = sequence++,
+            .pc = pc,
+            .value = trace_value(m),
+            .src_ext = m->src_ext,
+            .dst_ext = m->dst_ext,
+            .instr = m->instr,
+            .operands = (m->src & 0xF) << 4 | (m->dst & 0xF),
+            .flags = m->flags,
+            .node = node,
+        };
+
+        machine_call_update(m);
+        machine_interrupt_check(m);
+        executed++;
+    }
+
+    atomic_store_explicit(&r->head, head, memory_order_release);
+    w->sequence[node] = sequence;
+    return executed;
+}
+
+void trace_run(trace_writer *w, machine *m) {
+    // Runs a machine until it halts, like machine_run, tracing it as node 0.
+    // A machine that waits for an interrupt sleeps in its wait callback, and
+    // the interrupt that wakes it is taken before the next record.
+    machine_call_update(m);
+
+    do {
+        while (!(m->flags & FLAG_HALT)) {
+            trace_run_quantum(w, m, 0, TRACE_BATCH);
+        }
+    } while (machine_call_wait(m));
+
+    machine_call_update(m);
+}
+
+bool trace_load(const char *path, trace_file *f) {
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+
+    *f = (trace_file){0};
+
+    if (fd < 0) {
+        return false;
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_size < TRACE_HEADER_SIZE) {
+        close(fd);
+        return false;
+    }
+
+    void *mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+
+    uint32_t header[TRACE_HEADER_SIZE / 4];
+    size_t length = st.st_size - TRACE_HEADER_SIZE;
+
+    f->data = mapped;
+    f->length = st.st_size;
+    memcpy(header, mapped, sizeof(header));
+
+    if (memcmp(mapped, "BBBT", 4) != 0 || header[1] != TRACE_VERSION ||
+        header[2] != sizeof(trace_record) ||
+        length % sizeof(trace_record) != 0) {
+        trace_unload(f);
+        return false;
+    }
+
+    f->records = (const trace_record *)(f->data + TRACE_HEADER_SIZE);
+    f->count = length / sizeof(trace_record);
+    return true;
+}
+
+void trace_unload(trace_file *f) {
+    if (f->data) {
+        munmap((void *)f->data, f->length);
+    }
+
+    *f = (trace_file){0};
+}
@@ -0,0 +1,91 @@
+#ifndef BBB_TRACE_H
+#define BBB_TRACE_H
+
+#include "cpu.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACE_VERSION 1
+#define TRACE_HEADER_SIZE 16
+
+// Records per ring, a power of two, and the most threads that can trace
+// into one file.
+#define TRACE_RING_RECORDS (1 << 16)
+#define TRACE_MAX_RINGS 32
+
+// Instructions traced between publishing records to the drain thread.
+#define TRACE_BATCH 4096
+
+// One executed instruction. `sequence` numbers the instructions of each node
+// from 0, `operands` holds the source register in the high nibble and the
+// destination (or the condition of a JMP or JSR) in the low one, and
+// `flags` are those after the instruction. `value` is what the instruction
+// left in its destination: the program counter for JMP and JSR, the stack
+// pointer for PSH, and 0 for NOP and CMP.
+typedef struct trace_record {
+    uint32_t sequence;
+    uint16_t pc;
+    uint16_t value;
+    uint16_t src_ext;
+    uint16_t dst_ext;
+    uint8_t instr;
+    uint8_t operands;
+    uint8_t flags;
+    uint8_t node;
+} trace_record;
+
+// A ring of records filled by one thread and emptied by the drain thread.
+// Only the producer moves `head` and only the drain thread moves `tail`, so
+// neither needs a lock. Each gets a cache line of its own.
+typedef struct trace_ring {
+    _Alignas(64) _Atomic uint64_t head;
+    _Alignas(64) _Atomic uint64_t tail;
+    _Alignas(64) trace_record records[TRACE_RING_RECORDS];
+} trace_ring;
+
+// Writes the records of every thread that traces to one file. Each thread
+// gets its own ring the first time it traces, and a background thread
+// drains the rings to the file with large sequential writes. When a ring
+// is full its thread waits for the drain, so no record is ever lost.
+typedef struct trace_writer {
+    int fd;
+    uint64_t id;
+    pthread_t thread;
+    atomic_bool stop;
+    bool failed;
+
+    pthread_mutex_t lock;
+    trace_ring *rings[TRACE_MAX_RINGS];
+    _Atomic size_t ring_count;
+
+    // The next sequence number of each node, which only the thread running
+    // the node touches.
+    uint32_t sequence[UINT8_MAX + 1];
+} trace_writer;
+
+// A trace file, mapped for reading. A trace starts with "BBBT", the
+// version, the size of a record and a reserved word, each a 32-bit word in
+// the byte order of the host that wrote it, followed by the records as they
+// were drained. A node's records are in order within each ring, but a node
+// that moved between threads can have its records out of order in the file.
+typedef struct trace_file {
+    const uint8_t *data;
+    size_t length;
+    const trace_record *records;
+    size_t count;
+} trace_file;
+
+trace_writer *trace_open(const char *path);
+bool trace_close(trace_writer *w);
+
+uint32_t trace_run_quantum(trace_writer *w, machine *m, uint8_t node,
+                           uint32_t count);
+void trace_run(trace_writer *w, machine *m);
+
+bool trace_load(const char *path, trace_file *f);
+void trace_unload(trace_file *f);
+
+#endif
@@ -1,18 +1,84 @@
 // #include <unistd.h>
 #include "assem/assem.h"
+#include "assem/link.h"
+#include "assem/object.h"
+#include "machine/alloc.h"
+#include "machine/counters.h"
 #include "machine/cpu.h"
+#include "machine/image.h"
+#include "machine/lattice.h"
+#include "machine/pace.h"
+#include "machine/partition.h"
+#include "machine/perf.h"
+#include "machine/profile.h"
+#include "machine/sample.h"
 #include "machine/sim.h"
+#include "machine/trace.h"
+#include <inttypes.h>
 #include <memory.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
 
 #define MAX_ADDRESS (64 * 1024)
 #define BUFFER_SIZE 1024
 #define USAGE_STRING                                                           \
-    "usage: %s assemble SOURCE_FILE IMAGE\n       %s inspect IMAGE\n       "   \
-    "%s run IMAGE\n"
+    "usage: %s assemble [OPTIONS] SOURCE_FILE IMAGE\n"                         \
+    "       %s link [--map FILE] IMAGE OBJECT...\n"                            \
+    "       %s inspect IMAGE\n       %s run [OPTIONS] IMAGE\n"                 \
+    "       %s addr2line IMAGE ADDRESS...\n"                                   \
+    "       %s profile [OPTIONS] IMAGE\n"                                      \
+    "       %s run-lattice [OPTIONS] IMAGE...\n"                               \
+    "       %s trace-dump [--node N] FILE\n"
+#define ASSEMBLE_USAGE_STRING                                                  \
+    "usage: %s assemble [--cache DIR] [--inspect] [-O] [-g] SOURCE IMAGE\n"    \
+    "       %s assemble -c [--cache DIR] SOURCE OBJECT\n"
+#define PROFILE_USAGE_STRING                                                   \
+    "usage: %s profile [--limit N] [--top N] [--folded FILE] "                 \
+    "[--memory WINDOW]\n"                                                      \
+    "       [--heat-map FILE] IMAGE\n"                                         \
+    "       %s profile --sample RATE [--limit N] [--top N] IMAGE\n"
+#define PROFILE_TOP 20
+#define PROFILE_WINDOW 65536
+#define RUN_USAGE_STRING                                                       \
+    "usage: %s run [--trace FILE | --perf-stats | --clock HZ] IMAGE\n"
+#define RUN_PERF_QUANTUM 65536
+#define RUN_MAX_CLOCK 1000000000
+#define LINK_USAGE_STRING "usage: %s link [--map FILE] IMAGE OBJECT...\n"
+#define LATTICE_USAGE_STRING                                                   \
+    "usage: %s run-lattice [--threads N] [--quanta N] "                        \
+    "[--sync barrier|conservative] [--partition N]\n"                      \
+    "       [--counters FILE] [--heat-map retired|idle|mail] "                 \
+    "[--trace FILE] IMAGE...\n"
+
+typedef struct lattice_options {
+    size_t threads;
+    uint64_t quanta;
+    LatticeSync sync;
+    size_t partition;
+    char *counters_path;
+    bool heat_map;
+    HeatMetric heat_metric;
+    char *trace_path;
+} lattice_options;
+
+typedef struct profile_options {
+    uint64_t limit;
+    size_t top;
+    char *folded_path;
+    uint64_t window;
+    char *heat_map_path;
+    uint32_t sample_rate;
+} profile_options;
+
+// Counter snapshots requested with SIGUSR1 are appended to the counters file.
+static lattice *running_lattice = NULL;
+static FILE *counters_file = NULL;
+static CountersFormat counters_format = COUNTERS_CSV;
 
 void bbb_event_update(machine *m) {
     sim_print(m);
@@ -21,37 +87,317 @@ void bbb_event_update(machine *m) {
 
 void bbb_event_setup(machine *m) { sim_setup(m); }
 
-int bbb_assemble(char *source_name, FILE *source, FILE *image) {
-    if (fseek(source, 0L, SEEK_END) != 0) {
-        fprintf(stderr, "error: unable to determine source file size\n");
+void bbb_event_wait(machine *m) { sim_wait(m); }
+
+void bbb_event_snapshot(lattice *l) {
+    counters_write(l, counters_file, counters_format);
+}
+
+static void bbb_request_snapshot(int signal) {
+    atomic_store(&running_lattice->snapshot, true);
+}
+
+// An address and its execution count, for sorting the profile report.
+typedef struct profile_row {
+    uint16_t address;
+    uint64_t count;
+} profile_row;
+
+static int bbb_compare_rows(const void *a, const void *b) {
+    // Hottest first, and in address order among equals.
+    const profile_row *x = a;
+    const profile_row *y = b;
+
+    if (x->count != y->count) {
+        return x->count > y->count ? -1 : 1;
+    }
+
+    return x->address - y->address;
+}
+
+static const char *bbb_symbol(debug_info *info, uint16_t address,
+                              char *buffer, size_t length) {
+    // Names an address by its closest label, or by the address itself.
+    const char *label = NULL;
+    uint32_t offset = 0;
+
+    if (info->data) {
+        label = debug_find_symbol(info, address, &offset);
+    }
+
+    if (!label) {
+        snprintf(buffer, length, "%04X", address);
+    } else if (offset > 0) {
+        snprintf(buffer, length, "%s+%u", label, offset);
+    } else {
+        snprintf(buffer, length, "%s", label);
+    }
+
+    return buffer;
+}
+
+static void bbb_print_location(debug_info *info, uint16_t address) {
+    const char *file;
+    const char *label;
+    uint32_t line;
+    uint32_t offset;
+
+    if (!info->data) {
+        return;
+    }
+
+    if (debug_find_line(info, address, &file, &line)) {
+        printf("  %s:%u", file, line);
+    }
+
+    if ((label = debug_find_symbol(info, address, &offset))) {
+        printf("  %s+%u", label, offset);
+    }
+}
+
+static bool bbb_fragments(char *cache_dir, fragment_cache **fragments) {
+    // Fragments are only cached when a cache directory is given.
+    *fragments = NULL;
+
+    if (cache_dir) {
+        *fragments = fragment_cache_init(cache_dir);
+
+        if (!*fragments) {
+            fprintf(stderr, "error: unable to use cache directory '%s'\n",
+                    cache_dir);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void bbb_fragments_free(fragment_cache *fragments) {
+    if (fragments) {
+        printf("cache: %zu fragments reused, %zu assembled\n",
+               fragments->hits, fragments->misses);
+        fragment_cache_free(fragments);
+    }
+}
+
+int bbb_assemble(char *source_name, char *cache_dir, bool optimize,
+                 char *debug_path, FILE *image) {
+    // The source and everything it includes are mapped and tokenized by the
+    // cache. With a cache directory, only fragments of source that changed
+    // since they were last assembled are assembled again. With a debug path,
+    // the source line of every address and the symbols are written there.
+    source_cache *cache = source_cache_init();
+    peephole optimizer = {0};
+    debug_builder debug = {0};
+    build_options options = {.peephole = optimize ? &optimizer : NULL,
+                             .debug = debug_path ? &debug : NULL};
+    int status = EXIT_SUCCESS;
+
+    if (!bbb_fragments(cache_dir, &options.fragments)) {
+        source_cache_free(cache);
         return EXIT_FAILURE;
     }
 
-    size_t src_size = ftell(source);
-    fseek(source, 0L, SEEK_SET);
-    fseek(image, 0L, SEEK_SET);
+    memory *mem = build_file(cache, &options, source_name);
 
-    char *prog = calloc(src_size + 1, sizeof(char));
-    fread(prog, sizeof(char), src_size, source);
-    memory *mem = build_image(source_name, prog);
+    for (size_t i = 0; mem && i < optimizer.file_count; i++) {
+        printf("optimized %s: %zu instructions, %zu quads saved\n",
+               optimizer.files[i].path, optimizer.files[i].instructions,
+               optimizer.files[i].quads);
+    }
+
+    fseek(image, 0L, SEEK_SET);
 
     if (mem) {
-        fwrite(mem->data, mem->size, 1, image);
+        image_write(image, mem);
         fflush(image);
-        free(prog);
-
-        return EXIT_SUCCESS;
+        memory_free(mem);
     } else {
         fprintf(stderr, "error: unable to build image\n");
+        status = EXIT_FAILURE;
+    }
+
+    if (mem && debug_path && !debug_write(debug_path, &debug)) {
+        fprintf(stderr, "error: could not write the debug file '%s'\n",
+                debug_path);
+        status = EXIT_FAILURE;
+    }
+
+    bbb_fragments_free(options.fragments);
+    peephole_free(&optimizer);
+    debug_builder_free(&debug);
+    source_cache_free(cache);
+    return status;
+}
+
+int bbb_assemble_object(char *source_name, char *cache_dir,
+                        char *object_path) {
+    // Assembles a source into a relocatable object for `bbb link`.
+    source_cache *cache = source_cache_init();
+    fragment_cache *fragments;
+    int status = EXIT_SUCCESS;
+    object obj;
+
+    if (!bbb_fragments(cache_dir, &fragments)) {
+        source_cache_free(cache);
         return EXIT_FAILURE;
     }
+
+    if (!build_object(cache, fragments, source_name, &obj)) {
+        fprintf(stderr, "error: unable to build object\n");
+        status = EXIT_FAILURE;
+    } else {
+        if (!object_write(object_path, &obj)) {
+            fprintf(stderr, "error: could not write the object file '%s'\n",
+                    object_path);
+            status = EXIT_FAILURE;
+        }
+
+        object_free(&obj);
+    }
+
+    bbb_fragments_free(fragments);
+    source_cache_free(cache);
+    return status;
+}
+
+int bbb_link(char *image_path, char *map_path, char **object_paths,
+             int object_count) {
+    // Objects are read, placed and linked into a single image.
+    object *objects = calloc(object_count, sizeof(object));
+    link_map map = {0};
+    memory *mem = NULL;
+    int status = EXIT_FAILURE;
+    int loaded = 0;
+
+    if (map_path && !link_map_load(&map, map_path)) {
+        free(objects);
+        return EXIT_FAILURE;
+    }
+
+    for (; loaded < object_count; loaded++) {
+        if (!object_read(object_paths[loaded], &objects[loaded])) {
+            fprintf(stderr, "error: '%s' is not a valid object file\n",
+                    object_paths[loaded]);
+            break;
+        }
+    }
+
+    if (loaded == object_count) {
+        mem = link_objects(objects, object_paths, object_count, &map);
+    }
+
+    if (mem) {
+        FILE *image = fopen(image_path, "wb");
+
+        if (image && image_write(image, mem)) {
+            status = EXIT_SUCCESS;
+        } else {
+            fprintf(stderr, "error: could not write the image file '%s'\n",
+                    image_path);
+        }
+
+        if (image) {
+            fclose(image);
+        }
+
+        memory_free(mem);
+    } else if (loaded == object_count) {
+        fprintf(stderr, "error: unable to link image\n");
+    }
+
+    for (int i = 0; i < loaded; i++) {
+        object_free(&objects[i]);
+    }
+
+    free(objects);
+    link_map_free(&map);
+    return status;
+}
+
+int bbb_addr2line(char *image_path, char **addresses, int count) {
+    // Prints the source line and closest label of each address, from the
+    // debug file written next to the image by `assemble -g`.
+    char debug_path[BUFFER_SIZE];
+    debug_info info;
+
+    snprintf(debug_path, sizeof(debug_path), "%s" DEBUG_EXTENSION,
+             image_path);
+
+    if (!debug_load(debug_path, &info)) {
+        fprintf(stderr, "error: could not load the debug file '%s'\n",
+                debug_path);
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 0; i < count; i++) {
+        char *end;
+        unsigned long address = strtoul(addresses[i], &end, 16);
+        const char *file;
+        const char *label;
+        uint32_t line;
+        uint32_t offset;
+
+        if (*end != '\0' || end == addresses[i]) {
+            fprintf(stderr, "error: '%s' is not a hex address\n",
+                    addresses[i]);
+            debug_unload(&info);
+            return EXIT_FAILURE;
+        }
+
+        printf("%04lX ", address);
+
+        if (debug_find_line(&info, address, &file, &line)) {
+            printf("%s:%u", file, line);
+        } else {
+            printf("??");
+        }
+
+        if ((label = debug_find_symbol(&info, address, &offset))) {
+            printf(" %s+%u", label, offset);
+        }
+
+        printf("\n");
+    }
+
+    debug_unload(&info);
+    return EXIT_SUCCESS;
 }
 
 int bbb_inspect(char *image_name) {
+    // Sparse images are unpacked to a temporary flat image first, so both
+    // kinds are shown a quad per byte.
     FILE *pipe;
     char buffer[BUFFER_SIZE];
     char command[BUFFER_SIZE];
+    char flat_name[] = "/tmp/bbb-inspect-XXXXXX";
+    memory *mem = memory_init(MAX_ADDRESS);
+    image_header header;
 
+    if (!image_load(image_name, mem, &header)) {
+        fprintf(stderr, "error: could not load the image file '%s'\n",
+                image_name);
+        memory_free(mem);
+        return EXIT_FAILURE;
+    }
+
+    if (header.version != 0) {
+        int fd = mkstemp(flat_name);
+        FILE *flat = fd >= 0 ? fdopen(fd, "wb") : NULL;
+
+        if (!flat || fwrite(mem->data, mem->size, 1, flat) != 1) {
+            perror("error: unable to unpack the image");
+            memory_free(mem);
+            return EXIT_FAILURE;
+        }
+
+        fclose(flat);
+        image_name = flat_name;
+    }
+
+    memory_free(mem);
+
+    int status = EXIT_SUCCESS;
     int len = snprintf(
         command, BUFFER_SIZE,
         "hexdump -C %s | sed 's/ 0/ /g' | sed 'y/abcdef/ABCDEF/'", image_name);
@@ -59,100 +405,876 @@ int bbb_inspect(char *image_name) {
     // Check if the command was truncated.
     if (len >= sizeof(command)) {
         perror("error: command length exceeds buffer size.");
+        status = EXIT_FAILURE;
+    } else if ((pipe = popen(command, "r")) == NULL) {
+        perror("error: unable to execute shell command");
+        status = EXIT_FAILURE;
+    } else {
+        while (fgets(buffer, sizeof(buffer), pipe) != NULL) {
+            printf("%s", buffer);
+        }
+
+        pclose(pipe);
+    }
+
+    if (image_name == flat_name) {
+        remove(flat_name);
+    }
+
+    return status;
+}
+
+static trace_writer *bbb_trace_open(char *trace_path) {
+    trace_writer *trace = trace_open(trace_path);
+
+    if (!trace) {
+        fprintf(stderr, "error: could not open the trace file '%s'\n",
+                trace_path);
+    }
+
+    return trace;
+}
+
+static bool bbb_trace_close(trace_writer *trace, char *trace_path) {
+    if (!trace_close(trace)) {
+        fprintf(stderr, "error: could not write the trace file '%s'\n",
+                trace_path);
+        return false;
+    }
+
+    return true;
+}
+
+static volatile sig_atomic_t bbb_stop_requested;
+
+static void bbb_request_stop(int signal) { bbb_stop_requested = 1; }
+
+static void bbb_run_perf(machine *m) {
+    // Runs a machine without the simulator, which would otherwise dominate
+    // the counts, until it halts or is interrupted, and reports the host's
+    // hardware events per instruction emulated.
+    perf_counters counters;
+    struct timespec start;
+    struct timespec end;
+    uint64_t executed = 0;
+
+    if (perf_open(&counters) == 0) {
+        fprintf(stderr, "warning: hardware counters are not available\n");
+    }
+
+    signal(SIGINT, bbb_request_stop);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    perf_start(&counters);
+
+    while (!bbb_stop_requested && !(m->flags & FLAG_HALT)) {
+        executed += machine_run_quantum(m, RUN_PERF_QUANTUM);
+    }
+
+    perf_stop(&counters);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    signal(SIGINT, SIG_DFL);
+
+    double seconds =
+        (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    double per = executed ? executed : 1;
+
+    // Without the simulator nothing could raise the interrupt a waiting
+    // program sleeps for, so waiting ends the run like halting does.
+    printf("%" PRIu64 " instructions in %.3f s, %.1f MIPS, %.2f ns each%s\n",
+           executed, seconds, executed / seconds / 1e6, seconds * 1e9 / per,
+           m->status == STATE_WAIT ? " (waiting for an interrupt)"
+           : m->flags & FLAG_HALT  ? ""
+                                   : " (interrupted)");
+    printf("%" PRIu64 " guest cycles, %.2f per instruction\n", m->cycles,
+           m->cycles / per);
+    printf("%16s %12s  event\n", "count", "per instr");
+
+    for (size_t e = 0; e < PERF_EVENT_COUNT; e++) {
+        if (perf_available(&counters, e)) {
+            printf("%16" PRIu64 " %12.4f  %s\n", counters.values[e],
+                   counters.values[e] / per, perf_event_names[e]);
+        } else {
+            printf("%16s %12s  %s (not supported)\n", "-", "-",
+                   perf_event_names[e]);
+        }
+    }
+
+    if (perf_available(&counters, PERF_CYCLES) &&
+        perf_available(&counters, PERF_INSTRUCTIONS) &&
+        counters.values[PERF_CYCLES] > 0) {
+        printf("%.2f host instructions per cycle\n",
+               (double)counters.values[PERF_INSTRUCTIONS] /
+                   counters.values[PERF_CYCLES]);
+    }
+
+    perf_close(&counters);
+}
+
+static void bbb_run_clock(machine *m, uint64_t hz) {
+    // Runs the simulator at `hz` cycles per second until the machine halts
+    // or is interrupted. The display and keypad are updated between batches
+    // rather than after every instruction, which would tie the speed of the
+    // program to that of the terminal.
+    pacer p;
+
+    signal(SIGINT, bbb_request_stop);
+    machine_start(m);
+    pace_start(&p, m, hz);
+    bbb_event_update(m);
+
+    while (!bbb_stop_requested && pace_run(&p, m)) {
+        bbb_event_update(m);
+    }
+
+    bbb_event_update(m);
+    signal(SIGINT, SIG_DFL);
+
+    double emulated = pace_emulated(&p, m) / 1e9;
+    double elapsed = pace_elapsed(&p) / 1e9;
+
+    printf("%.3f s emulated at %" PRIu64 " Hz in %.3f s, drift %+.1f ms%s\n",
+           emulated, hz, elapsed, (elapsed - emulated) * 1e3,
+           m->flags & FLAG_HALT && m->status != STATE_WAIT
+               ? ""
+               : " (interrupted)");
+    printf("%" PRIu64 " batches, %" PRIu64 " late (%.1f%%), at most %.1f ms "
+           "behind; slept %.1f%% of the time\n",
+           p.batches, p.late, p.batches ? 100.0 * p.late / p.batches : 0.0,
+           p.max_lag / 1e6, elapsed > 0 ? p.slept / 1e7 / elapsed : 0.0);
+
+    if (p.idle) {
+        printf("%" PRIu64 " cycles (%.1f%%) waiting for an interrupt\n",
+               p.idle, 100.0 * p.idle / (m->cycles - p.start_cycles));
+    }
+
+    if (p.skipped) {
+        printf("%.1f ms skipped after falling too far behind\n",
+               p.skipped / 1e6);
+    }
+}
+
+int bbb_run(char *image_path, char *trace_path, bool perf_stats,
+            uint64_t clock_hz) {
+    // Images may be sparse or flat. With a trace path, every instruction is
+    // recorded there. With perf stats, the program runs without the
+    // simulator and is measured instead. With a clock rate, the simulator
+    // runs at that many cycles per second.
+    machine *m = machine_init(MAX_ADDRESS);
+    trace_writer *trace = NULL;
+    int status = EXIT_SUCCESS;
+
+    if (!image_load(image_path, m->memory, NULL)) {
+        fprintf(stderr, "error: could not load the image file '%s'\n",
+                image_path);
+        machine_free(m);
         return EXIT_FAILURE;
     }
 
-    pipe = popen(command, "r");
+    if (trace_path && !(trace = bbb_trace_open(trace_path))) {
+        machine_free(m);
+        return EXIT_FAILURE;
+    }
 
-    if (pipe == NULL) {
-        perror("error: unable to execute shell command");
+    if (perf_stats) {
+        machine_start(m);
+        bbb_run_perf(m);
+        machine_free(m);
+        return status;
+    }
+
+    m->event_setup = bbb_event_setup;
+    m->event_wait = bbb_event_wait;
+
+    if (clock_hz) {
+        bbb_run_clock(m, clock_hz);
+        machine_free(m);
+        return status;
+    }
+
+    m->event_update = bbb_event_update;
+    machine_start(m);
+
+    if (trace) {
+        trace_run(trace, m);
+        status = bbb_trace_close(trace, trace_path) ? status : EXIT_FAILURE;
+    } else {
+        machine_run(m);
+    }
+
+    machine_free(m);
+    return status;
+}
+
+static void bbb_format_operand(char *buffer, size_t length, Register r,
+                               uint16_t ext) {
+    // Operands are written the way the assembler reads them.
+    if (r < REGISTER_CV) {
+        snprintf(buffer, length, " %%%s", isa_registers[r]);
+    } else if (r == REGISTER_CV) {
+        snprintf(buffer, length, " 0x%X", ext);
+    } else if (r == REGISTER_MD) {
+        snprintf(buffer, length, " @%04X", ext);
+    } else {
+        snprintf(buffer, length, " *%04X", ext);
+    }
+}
+
+static void bbb_format_record(char *buffer, size_t length,
+                              const trace_record *t) {
+    Register src = t->operands >> 4;
+    Register dst = t->operands & 0xF;
+    char first[16] = "";
+    char second[16] = "";
+
+    switch (isa_opcodes[t->instr & 0xF].form) {
+    case FORM_NONE:
+        break;
+    case FORM_DEST:
+        bbb_format_operand(first, sizeof(first), dst, t->dst_ext);
+        break;
+    case FORM_SRC:
+        bbb_format_operand(first, sizeof(first), src, t->src_ext);
+        break;
+    case FORM_SRC_DEST:
+        bbb_format_operand(first, sizeof(first), src, t->src_ext);
+        bbb_format_operand(second, sizeof(second), dst, t->dst_ext);
+        break;
+    case FORM_TEST:
+        snprintf(first, sizeof(first), " %s%c", dst & 8 ? "" : "N",
+                 isa_conditions[dst & 7]);
+        snprintf(second, sizeof(second), " @%04X", t->dst_ext);
+        break;
+    }
+
+    snprintf(buffer, length, "%s%s%s", isa_opcodes[t->instr & 0xF].name,
+             first, second);
+}
+
+static int bbb_compare_records(const void *a, const void *b) {
+    const trace_record *x = *(const trace_record *const *)a;
+    const trace_record *y = *(const trace_record *const *)b;
+
+    return (x->sequence > y->sequence) - (x->sequence < y->sequence);
+}
+
+int bbb_trace_dump(char *trace_path, int node) {
+    // Prints the records of a trace, or of one node in the order it ran
+    // them, one instruction per line.
+    trace_file f;
+    char text[64];
+
+    if (!trace_load(trace_path, &f)) {
+        fprintf(stderr, "error: could not load the trace file '%s'\n",
+                trace_path);
         return EXIT_FAILURE;
     }
 
-    while (fgets(buffer, sizeof(buffer), pipe) != NULL) {
-        printf("%s", buffer);
+    const trace_record **records = alloc_array(f.count, sizeof(trace_record *));
+    size_t count = 0;
+
+    for (size_t i = 0; i < f.count; i++) {
+        if (node < 0 || f.records[i].node == node) {
+            records[count++] = &f.records[i];
+        }
+    }
+
+    if (node >= 0) {
+        qsort(records, count, sizeof(trace_record *), bbb_compare_records);
     }
 
-    pclose(pipe);
+    printf("node    sequence  addr  %-24s  value  flags\n", "instruction");
+
+    for (size_t i = 0; i < count; i++) {
+        const trace_record *t = records[i];
+
+        bbb_format_record(text, sizeof(text), t);
+        printf("%4u  %10u  %04X  %-24s  %04X  %02X\n", t->node, t->sequence,
+               t->pc, text, t->value, t->flags);
+    }
 
+    free(records);
+    trace_unload(&f);
     return EXIT_SUCCESS;
 }
 
-int bbb_run(FILE *image) {
-    if (fseek(image, 0L, SEEK_END) != 0) {
-        fprintf(stderr, "error: unable to determine image size\n");
+static void bbb_print_calls(debug_info *info, callgraph *c,
+                            uint64_t instructions, size_t top) {
+    // Prints the subroutines with the most instructions executed inside
+    // them, including in their callees.
+    uint64_t *inclusive = calloc(CPU_MAX_ADDRESS, sizeof(uint64_t));
+    uint64_t *exclusive = calloc(CPU_MAX_ADDRESS, sizeof(uint64_t));
+    profile_row *rows = malloc(CPU_MAX_ADDRESS * sizeof(profile_row));
+    char name[BUFFER_SIZE];
+    size_t count = 0;
+
+    callgraph_totals(c, inclusive, exclusive);
+
+    for (uint32_t a = 0; a < CPU_MAX_ADDRESS; a++) {
+        if (inclusive[a]) {
+            rows[count++] = (profile_row){a, inclusive[a]};
+        }
+    }
+
+    qsort(rows, count, sizeof(profile_row), bbb_compare_rows);
+    printf("\n      calls   inclusive       %%   exclusive       %%  "
+           "subroutine\n");
+
+    for (size_t i = 0; i < count && i < top; i++) {
+        uint16_t a = rows[i].address;
+
+        printf("%11" PRIu64 " %11" PRIu64 "  %5.1f%% %11" PRIu64
+               "  %5.1f%%  %s\n",
+               c->calls[a], inclusive[a], 100.0 * inclusive[a] / instructions,
+               exclusive[a], 100.0 * exclusive[a] / instructions,
+               bbb_symbol(info, a, name, sizeof(name)));
+    }
+
+    free(rows);
+    free(exclusive);
+    free(inclusive);
+}
+
+static bool bbb_write_folded(debug_info *info, callgraph *c, char *path) {
+    // Writes a line for each path through the call tree that executed
+    // instructions itself: the subroutines from the root down, separated
+    // by semicolons, and the count.
+    FILE *out = fopen(path, "w");
+    uint32_t *stack = alloc_array(c->node_count, sizeof(uint32_t));
+    char name[BUFFER_SIZE];
+
+    for (size_t n = 0; out && n < c->node_count; n++) {
+        size_t depth = 0;
+
+        if (c->nodes[n].self == 0) {
+            continue;
+        }
+
+        for (uint32_t a = n; a > 0; a = c->nodes[a].parent) {
+            stack[depth++] = a;
+        }
+
+        fputs(bbb_symbol(info, c->nodes[0].entry, name, sizeof(name)), out);
+
+        while (depth > 0) {
+            fprintf(out, ";%s",
+                    bbb_symbol(info, c->nodes[stack[--depth]].entry, name,
+                               sizeof(name)));
+        }
+
+        fprintf(out, " %" PRIu64 "\n", c->nodes[n].self);
+    }
+
+    free(stack);
+    return out && fclose(out) == 0;
+}
+
+static void bbb_print_memory(profile *p, size_t top) {
+    // Prints the busiest pages, the working set of each window, and a map
+    // of every page.
+    memory_access *a = p->access;
+    uint64_t reads[MEMORY_PAGE_COUNT] = {0};
+    uint64_t writes[MEMORY_PAGE_COUNT] = {0};
+    profile_row rows[MEMORY_PAGE_COUNT];
+    size_t count = 0;
+    uint32_t peak = 0;
+
+    for (size_t i = 0; i < MEMORY_ACCESS_SIZE; i++) {
+        reads[i / MEMORY_PAGE_SIZE] += a->reads[i];
+        writes[i / MEMORY_PAGE_SIZE] += a->writes[i];
+    }
+
+    for (size_t page = 0; page < MEMORY_PAGE_COUNT; page++) {
+        if (reads[page] + writes[page]) {
+            rows[count++] = (profile_row){page, reads[page] + writes[page]};
+        }
+    }
+
+    qsort(rows, count, sizeof(profile_row), bbb_compare_rows);
+    printf("\n      reads      writes  page\n");
+
+    for (size_t i = 0; i < count && i < top; i++) {
+        uint16_t page = rows[i].address;
+        printf("%11" PRIu64 " %11" PRIu64 "  %04X\n", reads[page],
+               writes[page], page * MEMORY_PAGE_SIZE);
+    }
+
+    for (size_t i = 0; i < p->window_count; i++) {
+        peak = p->windows[i].quads > peak ? p->windows[i].quads : peak;
+    }
+
+    printf("\n%zu windows of %" PRIu64 " instructions, at most %u quads\n",
+           p->window_count, p->window, peak);
+    printf("      start      length   quads  pages\n");
+
+    for (size_t i = 0; i < p->window_count && i < top; i++) {
+        profile_window *w = &p->windows[i];
+        printf("%11" PRIu64 " %11" PRIu64 " %7u %6u\n", w->start, w->length,
+               w->quads, w->pages);
+    }
+
+    if (p->window_count > top) {
+        printf("        ... %zu more\n", p->window_count - top);
+    }
+
+    printf("\n");
+    sim_print_memory_map(a);
+}
+
+static void bbb_print_samples(debug_info *info, sampler *s, size_t top) {
+    // With debug information, the samples of each source line are merged
+    // into the first address of the line that was sampled, since samples
+    // can land anywhere in an instruction. Labels get a table of their own.
+    profile_row *rows = malloc(CPU_MAX_ADDRESS * sizeof(profile_row));
+    uint64_t *labels = info->data ? calloc(CPU_MAX_ADDRESS, sizeof(uint64_t))
+                                  : NULL;
+    const char *last_file = NULL;
+    uint32_t last_line = 0;
+    size_t count = 0;
+
+    for (uint32_t a = 0; a < CPU_MAX_ADDRESS; a++) {
+        const char *file = NULL;
+        uint32_t line = 0;
+        uint32_t offset;
+
+        if (!s->counts[a]) {
+            continue;
+        }
+
+        if (labels && debug_find_symbol(info, a, &offset)) {
+            labels[a - offset] += s->counts[a];
+        }
+
+        if (info->data && debug_find_line(info, a, &file, &line) &&
+            count > 0 && file == last_file && line == last_line) {
+            rows[count - 1].count += s->counts[a];
+            continue;
+        }
+
+        rows[count++] = (profile_row){a, s->counts[a]};
+        last_file = file;
+        last_line = line;
+    }
+
+    qsort(rows, count, sizeof(profile_row), bbb_compare_rows);
+    printf("    samples       %%  addr\n");
+
+    for (size_t i = 0; i < count && i < top; i++) {
+        printf("%11" PRIu64 "  %5.1f%%  %04X", rows[i].count,
+               100.0 * rows[i].count / s->samples, rows[i].address);
+        bbb_print_location(info, rows[i].address);
+        printf("\n");
+    }
+
+    if (labels) {
+        count = 0;
+
+        for (uint32_t a = 0; a < CPU_MAX_ADDRESS; a++) {
+            if (labels[a]) {
+                rows[count++] = (profile_row){a, labels[a]};
+            }
+        }
+
+        qsort(rows, count, sizeof(profile_row), bbb_compare_rows);
+        printf("\n    samples       %%  label\n");
+
+        for (size_t i = 0; i < count && i < top; i++) {
+            uint32_t offset;
+            printf("%11" PRIu64 "  %5.1f%%  %s\n", rows[i].count,
+                   100.0 * rows[i].count / s->samples,
+                   debug_find_symbol(info, rows[i].address, &offset));
+        }
+    }
+
+    free(labels);
+    free(rows);
+}
+
+static int bbb_profile_sample(char *image_path, profile_options *options) {
+    // Runs an image with the usual run loop while SIGPROF samples where it
+    // is, and prints where the samples landed.
+    char debug_path[BUFFER_SIZE];
+    struct timespec start;
+    struct timespec end;
+    debug_info info;
+    machine *m = machine_init(MAX_ADDRESS);
+    sampler *s = sample_init();
+
+    if (!image_load(image_path, m->memory, NULL)) {
+        fprintf(stderr, "error: could not load the image file '%s'\n",
+                image_path);
+        sample_free(s);
+        machine_free(m);
         return EXIT_FAILURE;
     }
 
-    size_t img_size = ftell(image);
+    snprintf(debug_path, sizeof(debug_path), "%s" DEBUG_EXTENSION,
+             image_path);
+    debug_load(debug_path, &info);
+    machine_start(m);
 
-    if (img_size > MAX_ADDRESS) {
-        fprintf(stderr, "error: machine image is too big\n");
+    if (!sample_start(s, options->sample_rate)) {
+        fprintf(stderr, "error: could not start the sampling timer\n");
+        debug_unload(&info);
+        sample_free(s);
+        machine_free(m);
         return EXIT_FAILURE;
     }
 
-    fseek(image, 0L, SEEK_SET);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t executed = sample_run(s, m, options->limit);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    sample_stop(s);
+
+    double seconds =
+        (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    // The kernel may deliver fewer samples than asked for, at most one per
+    // tick of its clock, so the rate achieved is shown too.
+    printf("%" PRIu64 " samples, %.0f per second, over %" PRIu64
+           " instructions in %.3f s%s\n",
+           s->samples, s->samples / seconds, executed, seconds,
+           m->flags & FLAG_HALT ? "" : " (stopped at the limit)");
+
+    if (atomic_load(&s->outside) || atomic_load(&s->dropped)) {
+        printf("%u samples outside the program, %u dropped\n",
+               atomic_load(&s->outside), atomic_load(&s->dropped));
+    }
+
+    printf("\n");
+
+    if (s->samples > 0) {
+        bbb_print_samples(&info, s, options->top);
+    }
 
-    char *prog = calloc(img_size + 1, sizeof(char));
-    fread(prog, sizeof(char), img_size, image);
+    debug_unload(&info);
+    sample_free(s);
+    machine_free(m);
+    return EXIT_SUCCESS;
+}
 
+int bbb_profile(char *image_path, profile_options *options) {
+    // Runs an image without the simulator display or keypad, counting every
+    // instruction, and prints the hottest addresses, the opcodes, the
+    // branches and the subroutines. Addresses are named from the image's
+    // debug file when there is one. With a folded path, the call stacks are
+    // also written there for flame graph tools. With a window, memory
+    // traffic is counted too, and a heat map path gets a picture of it.
+    char debug_path[BUFFER_SIZE];
+    debug_info info;
     machine *m = machine_init(MAX_ADDRESS);
-    memcpy(m->memory->data, prog, img_size);
+    profile *p = profile_init();
+    int status = EXIT_SUCCESS;
 
-    m->event_setup = bbb_event_setup;
-    m->event_update = bbb_event_update;
+    if (!image_load(image_path, m->memory, NULL)) {
+        fprintf(stderr, "error: could not load the image file '%s'\n",
+                image_path);
+        profile_free(p);
+        machine_free(m);
+        return EXIT_FAILURE;
+    }
+
+    size_t top = options->top;
+    p->calls = callgraph_init();
+    p->window = options->window;
+    p->access = p->window ? calloc(1, sizeof(memory_access)) : NULL;
+
+    snprintf(debug_path, sizeof(debug_path), "%s" DEBUG_EXTENSION,
+             image_path);
+    debug_load(debug_path, &info);
 
     machine_start(m);
-    machine_run(m);
+    profile_run(m, p, options->limit);
+
+    profile_row *rows = malloc(CPU_MAX_ADDRESS * sizeof(profile_row));
+    size_t count = 0;
+    size_t branches = 0;
+
+    for (uint32_t a = 0; a < CPU_MAX_ADDRESS; a++) {
+        if (p->counts[a]) {
+            rows[count++] = (profile_row){a, p->counts[a]};
+        }
+    }
+
+    qsort(rows, count, sizeof(profile_row), bbb_compare_rows);
+    printf("%" PRIu64 " instructions at %zu addresses%s\n\n",
+           p->instructions, count,
+           m->flags & FLAG_HALT ? "" : " (stopped at the limit)");
+    printf("      count       %%  addr\n");
+
+    for (size_t i = 0; i < count && i < top; i++) {
+        printf("%11" PRIu64 "  %5.1f%%  %04X", rows[i].count,
+               100.0 * rows[i].count / p->instructions, rows[i].address);
+        bbb_print_location(&info, rows[i].address);
+        printf("\n");
+    }
+
+    printf("\n      count       %%  opcode\n");
+
+    for (Opcode op = NOP; op <= MOV; op++) {
+        if (p->opcodes[op]) {
+            printf("%11" PRIu64 "  %5.1f%%  %s\n", p->opcodes[op],
+                   100.0 * p->opcodes[op] / p->instructions,
+                   isa_opcodes[op].name);
+        }
+    }
+
+    printf("\n      taken   not taken  addr\n");
+
+    for (size_t i = 0; i < count && branches < top; i++) {
+        uint16_t a = rows[i].address;
+
+        if (p->taken[a] || p->not_taken[a]) {
+            printf("%11" PRIu64 " %11" PRIu64 "  %04X", p->taken[a],
+                   p->not_taken[a], a);
+            bbb_print_location(&info, a);
+            printf("\n");
+            branches++;
+        }
+    }
+
+    bbb_print_calls(&info, p->calls, p->instructions, top);
+
+    if (p->access) {
+        bbb_print_memory(p, top);
+    }
+
+    if (options->folded_path &&
+        !bbb_write_folded(&info, p->calls, options->folded_path)) {
+        fprintf(stderr, "error: could not write the folded stacks '%s'\n",
+                options->folded_path);
+        status = EXIT_FAILURE;
+    }
+
+    if (options->heat_map_path &&
+        !profile_write_heat_map(p, options->heat_map_path)) {
+        fprintf(stderr, "error: could not write the heat map '%s'\n",
+                options->heat_map_path);
+        status = EXIT_FAILURE;
+    }
+
+    free(p->access);
+    free(rows);
+    debug_unload(&info);
+    callgraph_free(p->calls);
+    profile_free(p);
     machine_free(m);
+    return status;
+}
+
+int bbb_run_lattice(char **image_paths, int image_count,
+                    lattice_options *options) {
+    // Either a single image is loaded into every node or one image is given
+    // per node in row-major order.
+    if (image_count != 1 && image_count != LATTICE_NODE_COUNT) {
+        fprintf(stderr, "error: expected 1 or %d images, found %d\n",
+                LATTICE_NODE_COUNT, image_count);
+        return EXIT_FAILURE;
+    }
+
+    lattice *l = lattice_init(options->threads);
+    l->max_quanta = options->quanta;
+    l->sync = options->sync;
+
+    memory *image = memory_init(MAX_ADDRESS);
+
+    for (int i = 0; i < image_count; i++) {
+        if (!image_load(image_paths[i], image, NULL)) {
+            fprintf(stderr, "error: could not load the image file '%s'\n",
+                    image_paths[i]);
+            memory_free(image);
+            lattice_free(l);
+            return EXIT_FAILURE;
+        }
+
+        if (image_count == 1) {
+            for (size_t n = 0; n < LATTICE_NODE_COUNT; n++) {
+                lattice_load(l, n, image->data, image->size);
+            }
+        } else {
+            lattice_load(l, i, image->data, image->size);
+        }
+    }
+
+    memory_free(image);
+    lattice_start(l);
+
+    // The counters file is opened once the images are loaded, so that a bad
+    // image leaves nothing open.
+    if (options->counters_path) {
+        size_t length = strlen(options->counters_path);
+
+        counters_file = fopen(options->counters_path, "w");
+        counters_format = length > 5 && strcmp(options->counters_path +
+                                                    length - 5,
+                                                ".json") == 0
+                              ? COUNTERS_JSON
+                              : COUNTERS_CSV;
+
+        if (!counters_file) {
+            fprintf(stderr, "error: could not open the counters file '%s'\n",
+                    options->counters_path);
+            lattice_free(l);
+            return EXIT_FAILURE;
+        }
+
+        counters_write_header(counters_file, counters_format);
+    }
+
+    if (options->trace_path &&
+        !(l->trace = bbb_trace_open(options->trace_path))) {
+        if (counters_file) {
+            fclose(counters_file);
+        }
+
+        lattice_free(l);
+        return EXIT_FAILURE;
+    }
+
+    if (counters_file) {
+        running_lattice = l;
+        l->event_snapshot = bbb_event_snapshot;
+        signal(SIGUSR1, bbb_request_snapshot);
+    }
+
+    if (options->partition == 0) {
+        lattice_run(l);
+    } else if (!lattice_partition_run(l, options->partition)) {
+        fprintf(stderr, "error: unable to run the partitioned lattice\n");
+
+        if (l->trace) {
+            trace_close(l->trace);
+        }
+
+        if (counters_file) {
+            signal(SIGUSR1, SIG_DFL);
+            fclose(counters_file);
+        }
+
+        lattice_free(l);
+        return EXIT_FAILURE;
+    }
+
+    bool traced = !l->trace || bbb_trace_close(l->trace, options->trace_path);
+
+    lattice_print(l);
+
+    if (options->heat_map) {
+        sim_print_heat_map(l, options->heat_metric);
+    }
+
+    if (counters_file) {
+        signal(SIGUSR1, SIG_DFL);
+        counters_write(l, counters_file, counters_format);
+        fclose(counters_file);
+    }
+
+    // A lattice that stopped because it could make no more progress is
+    // reported as a failure.
+    int status = !traced || l->outcome == LATTICE_DEADLOCK ||
+                         l->outcome == LATTICE_IDLE
+                     ? EXIT_FAILURE
+                     : EXIT_SUCCESS;
 
-    return 0;
+    lattice_free(l);
+    return status;
 }
 
 int main(int argc, char *argsv[]) {
     int status = EXIT_FAILURE;
 
-    if (argc <= 2 || argc >= 6) {
-        fprintf(stderr, USAGE_STRING, argsv[0], argsv[0], argsv[0]);
+    if (argc <= 2) {
+        fprintf(stderr, USAGE_STRING, argsv[0], argsv[0], argsv[0], argsv[0],
+                argsv[0], argsv[0], argsv[0], argsv[0]);
         return EXIT_FAILURE;
     }
 
     if (strcmp(argsv[1], "assemble") == 0) {
-        if (argc < 4 || argc > 5) {
-            fprintf(stderr, "usage: %s assemble SOURCE IMAGE\n", argsv[0]);
+        char *src_path = NULL;
+        char *image_path = NULL;
+        char *cache_dir = NULL;
+        bool inspect = false;
+        bool object = false;
+        bool optimize = false;
+        bool debug = false;
+
+        for (int i = 2; i < argc; i++) {
+            if (strcmp(argsv[i], "--inspect") == 0 ||
+                strcmp(argsv[i], "-i") == 0) {
+                inspect = true;
+            } else if (strcmp(argsv[i], "-c") == 0) {
+                object = true;
+            } else if (strcmp(argsv[i], "-O") == 0) {
+                optimize = true;
+            } else if (strcmp(argsv[i], "-g") == 0) {
+                debug = true;
+            } else if (strcmp(argsv[i], "--cache") == 0 && i + 1 < argc) {
+                cache_dir = argsv[++i];
+            } else if (!src_path) {
+                src_path = argsv[i];
+            } else if (!image_path) {
+                image_path = argsv[i];
+            } else {
+                src_path = NULL;
+                break;
+            }
+        }
+
+        if (!src_path || !image_path ||
+            (object && (inspect || optimize || debug))) {
+            fprintf(stderr, ASSEMBLE_USAGE_STRING, argsv[0], argsv[0]);
             return EXIT_FAILURE;
         }
 
-        char *src_path = argsv[2];
-        char *image_path = argsv[3];
+        if (object) {
+            return bbb_assemble_object(src_path, cache_dir, image_path);
+        }
 
         // TODO: validation, etc
-        FILE *source = fopen(src_path, "r");
         FILE *image = fopen(image_path, "wb");
 
-        if (!source) {
-            fprintf(stderr, "error: could not open source file for reading");
-            return EXIT_FAILURE;
-        }
-
         if (!image) {
             fprintf(stderr, "error: could not open image file for writing");
             return EXIT_FAILURE;
         }
 
-        status = bbb_assemble(src_path, source, image);
+        char debug_path[BUFFER_SIZE];
+        snprintf(debug_path, sizeof(debug_path), "%s" DEBUG_EXTENSION,
+                 image_path);
+
+        status = bbb_assemble(src_path, cache_dir, optimize,
+                              debug ? debug_path : NULL, image);
 
-        fclose(source);
         fclose(image);
 
-        if (status == EXIT_SUCCESS && argc == 5) {
-            if (strcmp(argsv[4], "--inspect") == 0 ||
-                strcmp(argsv[4], "-i") == 0) {
-                status = bbb_inspect(image_path);
-            }
+        if (status == EXIT_SUCCESS && inspect) {
+            status = bbb_inspect(image_path);
         }
 
         return status;
+    } else if (strcmp(argsv[1], "link") == 0) {
+        char *map_path = NULL;
+        int arg = 2;
+
+        if (arg < argc - 1 && strcmp(argsv[arg], "--map") == 0) {
+            map_path = argsv[arg + 1];
+            arg += 2;
+        }
+
+        if (argc - arg < 2) {
+            fprintf(stderr, LINK_USAGE_STRING, argsv[0]);
+            return EXIT_FAILURE;
+        }
+
+        return bbb_link(argsv[arg], map_path, &argsv[arg + 1],
+                        argc - arg - 1);
+    } else if (strcmp(argsv[1], "addr2line") == 0) {
+        if (argc < 4) {
+            fprintf(stderr, "usage: %s addr2line IMAGE ADDRESS...\n",
+                    argsv[0]);
+            return EXIT_FAILURE;
+        }
+
+        return bbb_addr2line(argsv[2], &argsv[3], argc - 3);
     } else if (strcmp(argsv[1], "inspect") == 0) {
         if (argc != 3) {
             fprintf(stderr, "usage: %s inspect IMAGE\n", argsv[0]);
@@ -164,26 +1286,157 @@ int main(int argc, char *argsv[]) {
 
         return status;
     } else if (strcmp(argsv[1], "run") == 0) {
-        if (argc != 3) {
-            fprintf(stderr, "usage: %s run IMAGE\n", argsv[0]);
+        char *trace_path = NULL;
+        bool perf_stats = false;
+        uint64_t clock_hz = 0;
+        bool valid = true;
+        int arg = 2;
+
+        for (; arg < argc - 1 && strncmp(argsv[arg], "--", 2) == 0; arg++) {
+            if (strcmp(argsv[arg], "--trace") == 0 && arg < argc - 2) {
+                trace_path = argsv[++arg];
+            } else if (strcmp(argsv[arg], "--perf-stats") == 0) {
+                perf_stats = true;
+            } else if (strcmp(argsv[arg], "--clock") == 0 && arg < argc - 2) {
+                char *end;
+                clock_hz = strtoull(argsv[++arg], &end, 10);
+                valid = valid && *end == '\0' && clock_hz >= 1 &&
+                        clock_hz <= RUN_MAX_CLOCK;
+            } else {
+                break;
+            }
+        }
+
+        if (arg != argc - 1 || !valid ||
+            (trace_path != NULL) + perf_stats + (clock_hz != 0) > 1) {
+            fprintf(stderr, RUN_USAGE_STRING, argsv[0]);
             return EXIT_FAILURE;
         }
 
-        char *image_path = argsv[2];
-        // TODO: validate image path
-        FILE *image = fopen(image_path, "rb");
+        return bbb_run(argsv[arg], trace_path, perf_stats, clock_hz);
+    } else if (strcmp(argsv[1], "trace-dump") == 0) {
+        long node = -1;
+        int arg = 2;
 
-        if (!image) {
-            fprintf(stderr, "error: could not open the image file for reading");
+        if (arg < argc - 1 && strcmp(argsv[arg], "--node") == 0) {
+            node = strtol(argsv[arg + 1], NULL, 10);
+            arg += 2;
+        }
+
+        if (arg != argc - 1 || node < -1 || node > UINT8_MAX) {
+            fprintf(stderr, "usage: %s trace-dump [--node N] FILE\n",
+                    argsv[0]);
             return EXIT_FAILURE;
         }
-        status = bbb_run(image);
 
-        fclose(image);
+        return bbb_trace_dump(argsv[arg], node);
+    } else if (strcmp(argsv[1], "profile") == 0) {
+        profile_options options = {0};
+        long top = PROFILE_TOP;
+        bool valid = true;
+        int arg = 2;
 
-        return status;
+        for (; arg < argc - 1 && strncmp(argsv[arg], "--", 2) == 0; arg += 2) {
+            if (strcmp(argsv[arg], "--limit") == 0) {
+                options.limit = strtoull(argsv[arg + 1], NULL, 10);
+            } else if (strcmp(argsv[arg], "--top") == 0) {
+                top = strtol(argsv[arg + 1], NULL, 10);
+            } else if (strcmp(argsv[arg], "--folded") == 0) {
+                options.folded_path = argsv[arg + 1];
+            } else if (strcmp(argsv[arg], "--memory") == 0) {
+                options.window = strtoull(argsv[arg + 1], NULL, 10);
+            } else if (strcmp(argsv[arg], "--heat-map") == 0) {
+                options.heat_map_path = argsv[arg + 1];
+            } else if (strcmp(argsv[arg], "--sample") == 0) {
+                long rate = strtol(argsv[arg + 1], NULL, 10);
+                options.sample_rate = rate > 0 && rate <= 1000000 ? rate : 0;
+                valid = valid && options.sample_rate > 0;
+            } else {
+                break;
+            }
+        }
+
+        // A heat map needs the memory traffic, counted in the default
+        // windows unless others are asked for.
+        if (options.heat_map_path && options.window == 0) {
+            options.window = PROFILE_WINDOW;
+        }
+
+        // Sampling runs the program uninstrumented, so it cannot be combined
+        // with the options that count every instruction.
+        if (options.sample_rate &&
+            (options.folded_path || options.window || options.heat_map_path)) {
+            valid = false;
+        }
+
+        if (!valid || arg != argc - 1 || top < 1) {
+            fprintf(stderr, PROFILE_USAGE_STRING, argsv[0], argsv[0]);
+            return EXIT_FAILURE;
+        }
+
+        options.top = top;
+        return options.sample_rate ? bbb_profile_sample(argsv[arg], &options)
+                                   : bbb_profile(argsv[arg], &options);
+    } else if (strcmp(argsv[1], "run-lattice") == 0) {
+        lattice_options options = {0};
+        long threads = sysconf(_SC_NPROCESSORS_ONLN);
+        long partition = 0;
+        bool valid = true;
+        int arg = 2;
+
+        for (; arg < argc - 1 && strncmp(argsv[arg], "--", 2) == 0; arg += 2) {
+            if (strcmp(argsv[arg], "--threads") == 0) {
+                threads = strtol(argsv[arg + 1], NULL, 10);
+            } else if (strcmp(argsv[arg], "--quanta") == 0) {
+                options.quanta = strtoull(argsv[arg + 1], NULL, 10);
+            } else if (strcmp(argsv[arg], "--sync") == 0 &&
+                       strcmp(argsv[arg + 1], "barrier") == 0) {
+                options.sync = LATTICE_BARRIER;
+            } else if (strcmp(argsv[arg], "--sync") == 0 &&
+                       strcmp(argsv[arg + 1], "conservative") == 0) {
+                options.sync = LATTICE_CONSERVATIVE;
+            } else if (strcmp(argsv[arg], "--partition") == 0) {
+                partition = strtol(argsv[arg + 1], NULL, 10);
+            } else if (strcmp(argsv[arg], "--counters") == 0) {
+                options.counters_path = argsv[arg + 1];
+            } else if (strcmp(argsv[arg], "--trace") == 0) {
+                options.trace_path = argsv[arg + 1];
+            } else if (strcmp(argsv[arg], "--heat-map") == 0) {
+                static const char *metrics[] = {"retired", "idle", "mail"};
+
+                options.heat_map = true;
+                valid = false;
+
+                for (HeatMetric h = HEAT_RETIRED; h <= HEAT_MAIL; h++) {
+                    if (strcmp(argsv[arg + 1], metrics[h]) == 0) {
+                        options.heat_metric = h;
+                        valid = true;
+                    }
+                }
+            } else {
+                break;
+            }
+        }
+
+        // Partitioned lattices run one tile per process and always use the
+        // barrier synchronization. They cannot be traced, since the trace
+        // is written by a thread of this process.
+        if (!valid || arg >= argc || threads < 1 ||
+            strncmp(argsv[arg], "--", 2) == 0 || partition < 0 ||
+            partition > PARTITION_MAX_PROCESSES ||
+            (partition && options.sync != LATTICE_BARRIER) ||
+            (partition && options.trace_path)) {
+            fprintf(stderr, LATTICE_USAGE_STRING, argsv[0]);
+            return EXIT_FAILURE;
+        }
+
+        options.threads = threads;
+        options.partition = partition;
+
+        return bbb_run_lattice(&argsv[arg], argc - arg, &options);
     }
 
-    fprintf(stderr, USAGE_STRING, argsv[0], argsv[0], argsv[0]);
+    fprintf(stderr, USAGE_STRING, argsv[0], argsv[0], argsv[0], argsv[0],
+            argsv[0], argsv[0], argsv[0], argsv[0]);
     return EXIT_FAILURE;
 }
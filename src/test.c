@@ -4,22 +4,58 @@
 #include "test/test_build.c"
 #include "test/test_cpu.c"
 #include "test/test_cpu_exec.c"
+#include "test/test_debug.c"
+#include "test/test_image.c"
+#include "test/test_isa.c"
+#include "test/test_lattice.c"
+#include "test/test_lexer.c"
+#include "test/test_link.c"
 #include "test/test_memory.c"
+#include "test/test_peephole.c"
+#include "test/test_perf.c"
+#include "test/test_profile.c"
+#include "test/test_sample.c"
+#include "test/test_pace.c"
 #include "test/test_table.c"
+#include "test/test_trace.c"
 
 MunitSuite suites[] = { // Comment here to force formatting
     {(char *)"assem/table: ", assem_table_tests, NULL, 1,
      MUNIT_SUITE_OPTION_NONE},
+    {(char *)"assem/lexer: ", assem_lexer_tests, NULL, 1,
+     MUNIT_SUITE_OPTION_NONE},
     {(char *)"assem/assem: ", assem_assem_tests, NULL, 1,
      MUNIT_SUITE_OPTION_NONE},
     {(char *)"assem/build: ", assem_build_tests, NULL, 1,
      MUNIT_SUITE_OPTION_NONE},
+    {(char *)"assem/link: ", assem_link_tests, NULL, 1,
+     MUNIT_SUITE_OPTION_NONE},
+    {(char *)"assem/peephole: ", assem_peephole_tests, NULL, 1,
+     MUNIT_SUITE_OPTION_NONE},
+    {(char *)"assem/debug: ", assem_debug_tests, NULL, 1,
+     MUNIT_SUITE_OPTION_NONE},
     {(char *)"machine/memory: ", machine_memory_tests, NULL, 1,
      MUNIT_SUITE_OPTION_NONE},
+    {(char *)"machine/isa: ", machine_isa_tests, NULL, 1,
+     MUNIT_SUITE_OPTION_NONE},
+    {(char *)"machine/image: ", machine_image_tests, NULL, 1,
+     MUNIT_SUITE_OPTION_NONE},
     {(char *)"machine/cpu: ", machine_cpu_tests, NULL, 1,
      MUNIT_SUITE_OPTION_NONE},
     {(char *)"machine/cpu_exec: ", machine_cpu_exec_tests, NULL, 1,
      MUNIT_SUITE_OPTION_NONE},
+    {(char *)"machine/lattice: ", machine_lattice_tests, NULL, 1,
+     MUNIT_SUITE_OPTION_NONE},
+    {(char *)"machine/profile: ", machine_profile_tests, NULL, 1,
+     MUNIT_SUITE_OPTION_NONE},
+    {(char *)"machine/trace: ", machine_trace_tests, NULL, 1,
+     MUNIT_SUITE_OPTION_NONE},
+    {(char *)"machine/perf: ", machine_perf_tests, NULL, 1,
+     MUNIT_SUITE_OPTION_NONE},
+    {(char *)"machine/sample: ", machine_sample_tests, NULL, 1,
+     MUNIT_SUITE_OPTION_NONE},
+    {(char *)"machine/pace: ", machine_pace_tests, NULL, 1,
+     MUNIT_SUITE_OPTION_NONE},
     {NULL, NULL, NULL, 0, MUNIT_SUITE_OPTION_NONE}};
 
 static const MunitSuite test_suite = {
@@ -23,6 +23,7 @@ static void *test_assem_setup(const MunitParameter params[], void *fixture) {
 
     c->data_start = f->mem->data;
     c->data = f->mem->data;
+    c->data_end = f->mem->data + f->mem->size;
     c->symbols = table_init();
     c->line = 0;
 
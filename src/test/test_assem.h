@@ -1,6 +1,8 @@
 #ifndef BBB_ASSEM_PVT_H
 #define BBB_ASSEM_PVT_H
 
+#include "../assem/assem.h"
+#include "../assem/lexer.h"
 #include "../assem/table.h"
 #include "../machine/memory.h"
 
@@ -24,21 +26,24 @@ typedef struct context {
     uint8_t *data;
     table *symbols;
     uint32_t line;
+    uint8_t *data_end;
+    assem_diagnostics *diagnostics;
 } context;
 
 bool tokenize(context *ctx, char *line, uint16_t num);
-static inline ParseState parse_directive(context *ctx, char *token);
-static inline ParseState parse_opcode(context *ctx, char *token);
-static inline ParseState parse_condition(context *ctx, char *token);
-static inline ParseState parse_src(context *ctx, char *token, uint16_t *ext,
-                                   char **label);
-static inline ParseState parse_dest(context *ctx, char *token, uint16_t *ext,
-                                    char **label);
-static inline bool parse_register(context *ctx, char *token, uint8_t *reg);
-static inline bool parse_addr(context *ctx, char *token, uint16_t *addr,
-                              char **label);
-static inline bool parse_hex(char *token, uint8_t length, uint16_t *result);
-static inline bool parse_int(char *token, uint16_t *result);
-static inline bool parse_label(char *token);
+static inline ParseState parse_directive(context *ctx, token *t);
+static inline ParseState parse_opcode(context *ctx, token *t);
+static inline ParseState parse_condition(context *ctx, token *t);
+static inline ParseState parse_src(context *ctx, token *t, uint16_t *ext,
+                                   token *label);
+static inline ParseState parse_dest(context *ctx, token *t, uint16_t *ext,
+                                    token *label);
+static inline bool parse_register(context *ctx, token *t, uint8_t *reg);
+static inline bool parse_addr(context *ctx, token *t, uint16_t *addr,
+                              token *label);
+static inline bool parse_hex(const char *s, size_t n, uint8_t length,
+                             uint16_t *result);
+static inline bool parse_int(const char *s, size_t n, uint16_t *result);
+static inline bool parse_label(const char *s, size_t n);
 
 #endif
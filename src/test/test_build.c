@@ -1,8 +1,14 @@
+#include <dirent.h>
+#include <inttypes.h>
 #include <memory.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "../assem/assem.h"
+#include "../assem/source.h"
+#include "../machine/cpu.h"
 #include "../munit/munit.h"
 
 #define ASSEM_MAX_ADDRESS (64 * 1024)
@@ -30,10 +36,386 @@ static MunitResult test_build_image_trivial_case(const MunitParameter params[],
     return MUNIT_OK;
 }
 
+static MunitResult test_build_image_source(const MunitParameter params[],
+                                           void *fixture) {
+    char prog[] = "( A program spread over several lines )\n"
+                  "#org 0020\n"
+                  "START:  MOV 0x1 %a   ( Load a constant )\n"
+                  "\tJMP T .START\r\n";
+    uint8_t expected[] = {MOV, REGISTER_CV, REGISTER_A, 0x1,
+                          JMP, 0xF,         0x0,        0x0,
+                          0x2, 0x0};
+    char copy[sizeof(prog)];
+    memcpy(copy, prog, sizeof(prog));
+
+    memory *m = build_image("", prog);
+
+    munit_assert_not_null(m);
+    munit_assert_memory_equal(sizeof(expected), m->data + 0x20, expected);
+
+    // The source is lexed in place and must be left untouched.
+    munit_assert_string_equal(prog, copy);
+
+    memory_free(m);
+    return MUNIT_OK;
+}
+
+static void write_source(const char *dir, const char *name,
+                         const char *text) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    FILE *f = fopen(path, "w");
+    munit_assert_not_null(f);
+    fputs(text, f);
+    fclose(f);
+}
+
+static MunitResult test_build_file_includes(const MunitParameter params[],
+                                            void *fixture) {
+    char dir[] = "/tmp/bbb-include-XXXXXX";
+    char path[256];
+    char lib[256];
+
+    munit_assert_not_null(mkdtemp(dir));
+    snprintf(lib, sizeof(lib), "%s/lib", dir);
+    munit_assert_int(mkdir(lib, 0700), ==, 0);
+
+    // Both libraries include the same header, relative to themselves.
+    write_source(dir, "main.bbb",
+                 "#inc lib/a.bbb  ( First library )\n"
+                 "#inc lib/b.bbb\n"
+                 "JMP T .A\n");
+    write_source(dir, "lib/a.bbb", "#org 0020\nA:\n#inc common.bbb\n");
+    write_source(dir, "lib/b.bbb", "#inc common.bbb\nINC %a\n");
+    write_source(dir, "lib/common.bbb", "NOP\n");
+
+    uint8_t expected[] = {NOP, NOP, INC, REGISTER_A, JMP,
+                          0xF, 0x0, 0x0, 0x2,        0x0};
+    source_cache *cache = source_cache_init();
+    snprintf(path, sizeof(path), "%s/main.bbb", dir);
+
+    memory *m = build_file(cache, NULL, path);
+    munit_assert_not_null(m);
+    munit_assert_memory_equal(sizeof(expected), m->data + 0x20, expected);
+    memory_free(m);
+
+    // Every file was read once, even though the header is included twice.
+    munit_assert_size(cache->reads, ==, 4);
+
+    // Nothing has changed, so nothing is read again.
+    m = build_file(cache, NULL, path);
+    munit_assert_not_null(m);
+    munit_assert_memory_equal(sizeof(expected), m->data + 0x20, expected);
+    memory_free(m);
+    munit_assert_size(cache->reads, ==, 4);
+
+    // Only the header that changed is read again.
+    write_source(dir, "lib/common.bbb", "NOP\nNOP\n");
+    m = build_file(cache, NULL, path);
+    munit_assert_not_null(m);
+    munit_assert_size(cache->reads, ==, 5);
+    munit_assert_uint8(m->data[0x26], ==, JMP);
+    memory_free(m);
+
+    source_cache_free(cache);
+
+    const char *names[] = {"lib/common.bbb", "lib/b.bbb", "lib/a.bbb",
+                           "main.bbb", "lib", ""};
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        remove(path);
+    }
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_build_file_bad_includes(const MunitParameter params[],
+                                                void *fixture) {
+    char dir[] = "/tmp/bbb-include-XXXXXX";
+    char path[256];
+
+    munit_assert_not_null(mkdtemp(dir));
+    write_source(dir, "loop.bbb", "INC %a\n#inc loop.bbb\n");
+    write_source(dir, "missing.bbb", "INC %a\n#inc nowhere.bbb\nINC %b\n");
+
+    source_cache *cache = source_cache_init();
+
+    // An include that cannot be expanded fails the build, rather than
+    // leaving an image cut short at it.
+    snprintf(path, sizeof(path), "%s/loop.bbb", dir);
+    munit_assert_null(build_file(cache, NULL, path));
+
+    snprintf(path, sizeof(path), "%s/missing.bbb", dir);
+    munit_assert_null(build_file(cache, NULL, path));
+
+    snprintf(path, sizeof(path), "%s/nowhere.bbb", dir);
+    munit_assert_null(build_file(cache, NULL, path));
+
+    source_cache_free(cache);
+
+    snprintf(path, sizeof(path), "%s/loop.bbb", dir);
+    remove(path);
+    snprintf(path, sizeof(path), "%s/missing.bbb", dir);
+    remove(path);
+    remove(dir);
+
+    return MUNIT_OK;
+}
+
+static void assert_builds_equal(memory *a, memory *b) {
+    munit_assert_not_null(a);
+    munit_assert_not_null(b);
+    munit_assert_memory_equal(a->size, a->data, b->data);
+    memory_free(a);
+    memory_free(b);
+}
+
+static void corrupt_fragments(fragment_cache *fragments,
+                              const char *cache_dir, int field) {
+    // Points one field of every cached fragment that has it outside memory.
+    DIR *d = opendir(cache_dir);
+    munit_assert_not_null(d);
+
+    for (struct dirent *e; (e = readdir(d));) {
+        uint64_t hash;
+        uint32_t start;
+        fragment frag;
+
+        if (sscanf(e->d_name, "%16" SCNx64 "-%5" SCNx32 ".frag", &hash,
+                   &start) != 2 ||
+            !fragment_load(fragments, hash, start, &frag)) {
+            continue;
+        }
+
+        if (field == 0) {
+            frag.end = CPU_MAX_ADDRESS + 1;
+        } else if (field == 1 && frag.instruction_count) {
+            frag.instructions[0].length = UINT32_MAX;
+        } else if (field == 2 && frag.ref_count) {
+            frag.refs[0].value = CPU_MAX_ADDRESS - 2;
+        } else {
+            fragment_free(&frag);
+            continue;
+        }
+
+        munit_assert_true(fragment_store(fragments, &frag));
+        fragment_free(&frag);
+    }
+
+    closedir(d);
+}
+
+static MunitResult test_build_file_fragments(const MunitParameter params[],
+                                             void *fixture) {
+    char dir[] = "/tmp/bbb-fragment-XXXXXX";
+    char path[512];
+    char cache_dir[256];
+
+    munit_assert_not_null(mkdtemp(dir));
+    snprintf(cache_dir, sizeof(cache_dir), "%s/cache/nested", dir);
+
+    // Three runs: up to the include, the library, and the rest of main.
+    write_source(dir, "main.bbb",
+                 "#org 0020\nA:\nINC %a\n#inc lib.bbb\nJMP T .B\n");
+    write_source(dir, "lib.bbb", "NOP\nJMP T .A\nB:\n");
+
+    source_cache *cache = source_cache_init();
+    fragment_cache *fragments = fragment_cache_init(cache_dir);
+    build_options options = {.fragments = fragments};
+    munit_assert_not_null(fragments);
+    snprintf(path, sizeof(path), "%s/main.bbb", dir);
+
+    assert_builds_equal(build_file(cache, &options, path),
+                        build_file(cache, NULL, path));
+    munit_assert_size(fragments->hits, ==, 0);
+    munit_assert_size(fragments->misses, ==, 3);
+
+    // A rebuild replays every fragment, including their references.
+    assert_builds_equal(build_file(cache, &options, path),
+                        build_file(cache, NULL, path));
+    munit_assert_size(fragments->hits, ==, 3);
+    munit_assert_size(fragments->misses, ==, 3);
+
+    // Growing the library moves the run after it, but not the one before.
+    write_source(dir, "lib.bbb", "NOP\nNOP\nJMP T .A\nB:\n");
+    assert_builds_equal(build_file(cache, &options, path),
+                        build_file(cache, NULL, path));
+    munit_assert_size(fragments->hits, ==, 4);
+    munit_assert_size(fragments->misses, ==, 5);
+
+    // Fragments that point outside memory are assembled again instead, and
+    // stored afresh: the end of each run, an instruction of each, then a
+    // reference of the two runs that have one.
+    size_t expected[] = {3, 3, 2};
+
+    for (int field = 0; field < 3; field++) {
+        corrupt_fragments(fragments, cache_dir, field);
+
+        size_t hits = fragments->hits;
+        size_t misses = fragments->misses;
+        assert_builds_equal(build_file(cache, &options, path),
+                            build_file(cache, NULL, path));
+        munit_assert_size(fragments->hits, ==, hits + 3 - expected[field]);
+        munit_assert_size(fragments->misses, ==, misses + expected[field]);
+    }
+
+    fragment_cache_free(fragments);
+    source_cache_free(cache);
+
+    DIR *d = opendir(cache_dir);
+    munit_assert_not_null(d);
+
+    for (struct dirent *e; (e = readdir(d));) {
+        if (e->d_name[0] != '.') {
+            snprintf(path, sizeof(path), "%s/%s", cache_dir, e->d_name);
+            remove(path);
+        }
+    }
+
+    closedir(d);
+
+    const char *names[] = {"cache/nested", "cache", "lib.bbb", "main.bbb", ""};
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        remove(path);
+    }
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_assembler_memory(const MunitParameter params[],
+                                         void *fixture) {
+    const char first[] = "#org 0020\nSTART: MOV 0x1 %a\nJMP T .START\n";
+    const char second[] = "INC %b\nJMP T .START\n";
+    uint8_t expected[] = {MOV, REGISTER_CV, REGISTER_A, 0x1, JMP,
+                          0xF, 0x0,         0x0,        0x2, 0x0};
+    uint8_t buffer[0x40];
+    memory out = {.size = sizeof(buffer), .data = buffer};
+    assem_diagnostic items[4];
+    assem_diagnostics diagnostics = {.items = items, .capacity = 4};
+    assembler *a = assembler_init();
+
+    // The output can be any caller's memory, and is cleared before each
+    // program. Labels do not carry over from one program to the next.
+    memset(buffer, 0x5, sizeof(buffer));
+    munit_assert_true(
+        assembler_run(a, first, strlen(first), &out, &diagnostics));
+    munit_assert_memory_equal(sizeof(expected), buffer + 0x20, expected);
+    munit_assert_uint8(buffer[0], ==, 0);
+    munit_assert_size(diagnostics.count, ==, 0);
+
+    munit_assert_false(
+        assembler_run(a, second, strlen(second), &out, &diagnostics));
+    munit_assert_uint8(buffer[0x20], ==, 0);
+    munit_assert_size(diagnostics.count, ==, 1);
+    munit_assert_uint32(items[0].line, ==, 0);
+    munit_assert_string_equal(items[0].message,
+                              "reference to undefined symbol 'START'");
+
+    // A machine's memory is assembled into in place.
+    machine *m = machine_init(ASSEM_MAX_ADDRESS);
+    const char count[] = "MOV 0x5 %a\nINC %a\n";
+
+    munit_assert_true(
+        assembler_run(a, count, strlen(count), m->memory, NULL));
+    machine_reset(m);
+    munit_assert_uint32(machine_run_quantum(m, 2), ==, 2);
+    munit_assert_uint8(m->registers[REGISTER_A], ==, 0x6);
+
+    machine_free(m);
+    assembler_free(a);
+    return MUNIT_OK;
+}
+
+static MunitResult test_assembler_diagnostics(const MunitParameter params[],
+                                              void *fixture) {
+    const char bad[] = "NOP\n  FOO %a\nBAR %b\n";
+    const char big[] = "#org 000E\nMOV 0x1234 %pc\n";
+    uint8_t buffer[0x20];
+    memory out = {.size = 0x10, .data = buffer};
+    assem_diagnostic items[1];
+    assem_diagnostics diagnostics = {.items = items, .capacity = 1};
+    assembler *a = assembler_init();
+
+    // Errors point at the token at fault, and stop assembly.
+    munit_assert_false(
+        assembler_run(a, bad, strlen(bad), &out, &diagnostics));
+    munit_assert_size(diagnostics.count, ==, 1);
+    munit_assert_uint32(items[0].line, ==, 2);
+    munit_assert_uint32(items[0].column, ==, 3);
+    munit_assert_string_equal(items[0].message,
+                              "encountered unrecognized opcode 'FOO'");
+
+    // Nothing is written past the end of the output. Only the first
+    // diagnostic fits, but every one is counted.
+    memset(buffer, 0x5, sizeof(buffer));
+    diagnostics.count = 0;
+    munit_assert_false(
+        assembler_run(a, big, strlen(big), &out, &diagnostics));
+    munit_assert_false(
+        assembler_run(a, big, strlen(big), &out, &diagnostics));
+    munit_assert_size(diagnostics.count, ==, 2);
+    munit_assert_uint32(items[0].line, ==, 2);
+    munit_assert_string_equal(items[0].message,
+                              "program does not fit in memory");
+    munit_assert_uint8(buffer[0xE], ==, MOV);
+    munit_assert_uint8(buffer[0xF], ==, REGISTER_CV);
+    munit_assert_uint8(buffer[0x10], ==, 0x5);
+
+    assembler_free(a);
+    return MUNIT_OK;
+}
+
+static MunitResult test_assembler_truncated(const MunitParameter params[],
+                                            void *fixture) {
+    const char *programs[] = {"MOV 1", "JMP", "MOV 0x1", "PSH", "#org"};
+    const char *messages[] = {"incomplete instruction, expected a destination",
+                              "incomplete instruction, expected a condition",
+                              "incomplete instruction, expected a destination",
+                              "incomplete instruction, expected a source",
+                              "incomplete instruction, expected an address"};
+    uint8_t buffer[0x40];
+    memory out = {.size = sizeof(buffer), .data = buffer};
+    assem_diagnostic items[1];
+    assem_diagnostics diagnostics = {.items = items, .capacity = 1};
+    assembler *a = assembler_init();
+
+    // A line that ends before its instruction does says what was missing,
+    // at the last token it has.
+    for (size_t i = 0; i < sizeof(programs) / sizeof(programs[0]); i++) {
+        diagnostics.count = 0;
+        munit_assert_false(assembler_run(a, programs[i], strlen(programs[i]),
+                                         &out, &diagnostics));
+        munit_assert_size(diagnostics.count, ==, 1);
+        munit_assert_uint32(items[0].line, ==, 1);
+        munit_assert_string_equal(items[0].message, messages[i]);
+    }
+
+    assembler_free(a);
+    return MUNIT_OK;
+}
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-variable"
 static MunitTest assem_build_tests[] = {
     {(char *)"trivial case builds correctly", test_build_image_trivial_case,
      NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"multi-line source builds correctly", test_build_image_source,
+     NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"included files are read once", test_build_file_includes, NULL,
+     NULL, MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"bad includes are reported", test_build_file_bad_includes, NULL,
+     NULL, MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"unchanged fragments are reused", test_build_file_fragments,
+     NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"programs assemble into caller memory", test_assembler_memory,
+     NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"diagnostics are collected", test_assembler_diagnostics, NULL,
+     NULL, MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"truncated instructions are reported", test_assembler_truncated,
+     NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
     {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}};
 #pragma GCC diagnostic pop
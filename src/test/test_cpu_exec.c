@@ -3,6 +3,7 @@
 #include <stdlib.h>
 
 #include "../machine/cpu.h"
+#include "../machine/isa.h"
 #include "../munit/munit.h"
 #include "./test_cpu.h"
 
@@ -3088,6 +3089,109 @@ static MunitResult test_cpu_exec_mov(const MunitParameter params[],
     return MUNIT_OK;
 }
 
+static MunitResult test_cpu_exec_cycles(const MunitParameter params[],
+                                        void *fixture) {
+    machine *m = (machine *)fixture;
+    uint8_t program[] = {
+        NOP,                                                // 1 cycle
+        MOV, REGISTER_CV, REGISTER_A,  0x3,                 // 5 cycles
+        MOV, REGISTER_A,  REGISTER_MD, 0x1, 0x0, 0x0, 0x0,  // 9 cycles
+        MOV, REGISTER_CV, REGISTER_IX, 0xF, 0xE, 0x0, 0x0,  // 8 cycles
+        JSR, 0x7,         0x0,         0x0, 0x0, 0x0,       // 11 cycles
+        MOV, REGISTER_A,  REGISTER_MX, 0x0, 0x0, 0x0, 0x0,  // 9 cycles
+        NOP,
+    };
+    uint64_t cycles[] = {1, 6, 15, 23, 34, 43};
+    memcpy(m->memory->data, program, sizeof(program));
+
+    // Every instruction costs a cycle per quad of its encoding, plus those
+    // of its opcode and memory operands, whether or not a call is taken.
+    for (size_t i = 0; i < sizeof(cycles) / sizeof(cycles[0]); i++) {
+        machine_step(m);
+        munit_assert_uint64(m->retired, ==, i + 1);
+        munit_assert_uint64(m->cycles, ==, cycles[i]);
+    }
+
+    // The store through IX to the timer latch copied the counters, most
+    // significant quad first.
+    for (size_t i = 0; i < CPU_TIMER_QUADS - 2; i++) {
+        munit_assert_uint8(m->memory->data[CPU_TIMER_CYCLES + i], ==, 0);
+        munit_assert_uint8(m->memory->data[CPU_TIMER_RETIRED + i], ==, 0);
+    }
+
+    munit_assert_uint8(m->memory->data[CPU_TIMER_CYCLES + 14], ==, 0x2);
+    munit_assert_uint8(m->memory->data[CPU_TIMER_CYCLES + 15], ==, 0xB);
+    munit_assert_uint8(m->memory->data[CPU_TIMER_RETIRED + 14], ==, 0x0);
+    munit_assert_uint8(m->memory->data[CPU_TIMER_RETIRED + 15], ==, 0x6);
+
+    // Entering an interrupt pushes the program counter.
+    m->flags |= FLAG_INTERRUPT;
+    machine_step(m);
+    munit_assert_uint64(m->retired, ==, 7);
+    munit_assert_uint64(m->cycles, ==, 43 + 1 + ISA_INTERRUPT_CYCLES);
+
+    // An instruction that halts while it is decoded is not retired.
+    machine_reset(m);
+    munit_assert_uint64(m->retired, ==, 0);
+    munit_assert_uint64(m->cycles, ==, 0);
+
+    uint8_t halt[] = {INC, REGISTER_CV};
+    memcpy(m->memory->data, halt, sizeof(halt));
+    machine_step(m);
+    munit_assert_true(m->flags & FLAG_HALT);
+    munit_assert_uint64(m->retired, ==, 0);
+    munit_assert_uint64(m->cycles, ==, 0);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_cpu_exec_wait(const MunitParameter params[],
+                                      void *fixture) {
+    machine *m = (machine *)fixture;
+    uint8_t program[] = {
+        MOV, REGISTER_CV, REGISTER_MD, 0x1, 0xF, 0xE, 0x0, 0x1,
+        NOP,
+    };
+    memcpy(m->memory->data, program, sizeof(program));
+    m->sp = m->memory->data + 0x100;
+    m->iv = m->memory->data + 0x40;
+
+    // A store to the wait register stops the CPU like a halt.
+    machine_step(m);
+    munit_assert_int(m->status, ==, STATE_WAIT);
+    munit_assert_true(m->flags & FLAG_HALT);
+    munit_assert_uint64(m->retired, ==, 1);
+
+    // It stays asleep until the interrupt flag is raised, and running it
+    // executes nothing.
+    munit_assert_false(machine_wake(m));
+    munit_assert_uint32(machine_run_quantum(m, 16), ==, 0);
+    munit_assert_int(m->status, ==, STATE_WAIT);
+
+    // With the interrupt masked, it carries on after the store.
+    m->int_mask = true;
+    m->flags |= FLAG_INTERRUPT;
+    munit_assert_true(machine_wake(m));
+    munit_assert_int(m->status, ==, STATE_RUN);
+    munit_assert_false(m->flags & FLAG_HALT);
+    munit_assert_ptr_equal(m->pc, m->memory->data + 8);
+    munit_assert_uint32(m->interrupts, ==, 0);
+
+    // Otherwise it takes the interrupt, returning to the next instruction.
+    m->pc = m->memory->data;
+    m->int_mask = false;
+    m->flags &= ~FLAG_INTERRUPT;
+    machine_step(m);
+    m->flags |= FLAG_INTERRUPT;
+    munit_assert_true(machine_wake(m));
+    munit_assert_ptr_equal(m->pc, m->memory->data + 0x40);
+    munit_assert_ptr_equal(m->sp, m->memory->data + 0x104);
+    munit_assert_uint8(m->memory->data[0x103], ==, 0x8);
+    munit_assert_uint32(m->interrupts, ==, 1);
+
+    return MUNIT_OK;
+}
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-variable"
 static MunitTest machine_cpu_exec_tests[] = {
@@ -3123,5 +3227,11 @@ static MunitTest machine_cpu_exec_tests[] = {
      test_cpu_exec_tear_down, MUNIT_TEST_OPTION_NONE, NULL},
     {(char *)"MOV executes correctly", test_cpu_exec_mov, test_cpu_exec_setup,
      test_cpu_exec_tear_down, MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"instructions and cycles are counted", test_cpu_exec_cycles,
+     test_cpu_exec_setup, test_cpu_exec_tear_down, MUNIT_TEST_OPTION_NONE,
+     NULL},
+    {(char *)"waiting sleeps until an interrupt", test_cpu_exec_wait,
+     test_cpu_exec_setup, test_cpu_exec_tear_down, MUNIT_TEST_OPTION_NONE,
+     NULL},
     {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}};
 #pragma GCC diagnostic pop
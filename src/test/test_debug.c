@@ -0,0 +1,226 @@
+#include <dirent.h>
+#include <memory.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../assem/assem.h"
+#include "../assem/debug.h"
+#include "../assem/source.h"
+#include "../munit/munit.h"
+
+static void write_debug_file(const char *dir, const char *name,
+                             const char *text) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    FILE *f = fopen(path, "w");
+    munit_assert_not_null(f);
+    fputs(text, f);
+    fclose(f);
+}
+
+static void remove_debug_dir(const char *dir) {
+    char path[512];
+    DIR *d = opendir(dir);
+    munit_assert_not_null(d);
+
+    for (struct dirent *e; (e = readdir(d));) {
+        if (e->d_name[0] != '.') {
+            snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+            remove(path);
+        }
+    }
+
+    closedir(d);
+    remove(dir);
+}
+
+static void build_debug_file(const char *dir, build_options *options,
+                             const char *out) {
+    // Builds main.bbb with debug information and writes it to `out`.
+    char path[256];
+    debug_builder debug = {0};
+    source_cache *cache = source_cache_init();
+
+    snprintf(path, sizeof(path), "%s/main.bbb", dir);
+    options->debug = &debug;
+
+    memory *m = build_file(cache, options, path);
+    munit_assert_not_null(m);
+    munit_assert_true(debug_write(out, &debug));
+
+    memory_free(m);
+    debug_builder_free(&debug);
+    source_cache_free(cache);
+}
+
+static void assert_debug_line(debug_info *info, uint32_t address,
+                              const char *name, uint32_t expected) {
+    const char *file;
+    uint32_t line;
+
+    munit_assert_true(debug_find_line(info, address, &file, &line));
+    munit_assert_string_equal(strrchr(file, '/') + 1, name);
+    munit_assert_uint32(line, ==, expected);
+}
+
+static MunitResult test_debug_lookup(const MunitParameter params[],
+                                     void *fixture) {
+    char dir[] = "/tmp/bbb-debug-XXXXXX";
+    char out[256];
+    debug_info info;
+    const char *file;
+    uint32_t line;
+    uint32_t offset;
+
+    munit_assert_not_null(mkdtemp(dir));
+    snprintf(out, sizeof(out), "%s/main.dbg", dir);
+    write_debug_file(dir, "main.bbb",
+                     "( Vectors )\n"
+                     "#data 0020\n"
+                     "#org 0020\n"
+                     "START: MOV 0x1 %a\n"
+                     "\n"
+                     "#inc lib.bbb\n"
+                     "JMP T .START\n"
+                     "#org 0040\n"
+                     "NOP\nNOP\n"
+                     "#org 0041\n"
+                     "INC %a\n");
+    write_debug_file(dir, "lib.bbb", "LOOP:\nADD %a %b\n");
+    build_debug_file(dir, &(build_options){0}, out);
+    munit_assert_true(debug_load(out, &info));
+
+    // Lines are found by any address they wrote, across included files.
+    assert_debug_line(&info, 0x0000, "main.bbb", 2);
+    assert_debug_line(&info, 0x0023, "main.bbb", 4);
+    assert_debug_line(&info, 0x0024, "lib.bbb", 2);
+    assert_debug_line(&info, 0x0027, "main.bbb", 7);
+    munit_assert_false(debug_find_line(&info, 0x0010, &file, &line));
+    munit_assert_false(debug_find_line(&info, 0xFFFF, &file, &line));
+
+    // Where a later #org wrote over a line, the later line owns the address.
+    assert_debug_line(&info, 0x0040, "main.bbb", 9);
+    assert_debug_line(&info, 0x0041, "main.bbb", 12);
+
+    // Addresses are attributed to the closest label before them.
+    munit_assert_null(debug_find_symbol(&info, 0x001F, &offset));
+    munit_assert_string_equal(debug_find_symbol(&info, 0x0020, &offset),
+                              "START");
+    munit_assert_uint32(offset, ==, 0);
+    munit_assert_string_equal(debug_find_symbol(&info, 0x0027, &offset),
+                              "LOOP");
+    munit_assert_uint32(offset, ==, 3);
+
+    debug_unload(&info);
+    remove_debug_dir(dir);
+    return MUNIT_OK;
+}
+
+static MunitResult test_debug_builds(const MunitParameter params[],
+                                     void *fixture) {
+    char dir[] = "/tmp/bbb-debug-XXXXXX";
+    char cache_dir[256];
+    char plain[256];
+    char cached[256];
+    debug_info info;
+    const char *file;
+    uint32_t line;
+
+    munit_assert_not_null(mkdtemp(dir));
+    snprintf(cache_dir, sizeof(cache_dir), "%s/cache", dir);
+    snprintf(plain, sizeof(plain), "%s/plain.dbg", dir);
+    snprintf(cached, sizeof(cached), "%s/cached.dbg", dir);
+    write_debug_file(dir, "main.bbb",
+                     "#org 0020\n"
+                     "MOV %a %a\n"
+                     "A: INC %a\n"
+                     "#inc lib.bbb\n"
+                     "JMP T .A\n");
+    write_debug_file(dir, "lib.bbb", "\n\nDEC %b\n");
+
+    // Lines follow the code the optimizer moves, and removed lines go.
+    peephole p = {0};
+    build_debug_file(dir, &(build_options){.peephole = &p}, plain);
+    peephole_free(&p);
+    munit_assert_true(debug_load(plain, &info));
+
+    assert_debug_line(&info, 0x0020, "main.bbb", 3);
+    assert_debug_line(&info, 0x0022, "lib.bbb", 3);
+    assert_debug_line(&info, 0x0024, "main.bbb", 5);
+    munit_assert_false(debug_find_line(&info, 0x002A, &file, &line));
+    munit_assert_uint32(info.line_count, ==, 3);
+    debug_unload(&info);
+
+    // Fragments keep their lines, which are numbered within the run so that
+    // blank lines added above it do not leave them stale.
+    fragment_cache *fragments = fragment_cache_init(cache_dir);
+    munit_assert_not_null(fragments);
+    build_debug_file(dir, &(build_options){.fragments = fragments}, plain);
+
+    write_debug_file(dir, "lib.bbb", "\n\n\n\nDEC %b\n");
+    build_debug_file(dir, &(build_options){0}, plain);
+    build_debug_file(dir, &(build_options){.fragments = fragments}, cached);
+    munit_assert_size(fragments->hits, ==, 3);
+
+    munit_assert_true(debug_load(cached, &info));
+    assert_debug_line(&info, 0x0025, "lib.bbb", 5);
+    munit_assert_uint32(info.line_count, ==, 4);
+
+    debug_info expected;
+    munit_assert_true(debug_load(plain, &expected));
+    munit_assert_size(info.length, ==, expected.length);
+    munit_assert_memory_equal(info.length, info.data, expected.data);
+
+    debug_unload(&info);
+    debug_unload(&expected);
+    fragment_cache_free(fragments);
+    remove_debug_dir(cache_dir);
+    remove_debug_dir(dir);
+    return MUNIT_OK;
+}
+
+static MunitResult test_debug_bad(const MunitParameter params[],
+                                  void *fixture) {
+    char dir[] = "/tmp/bbb-debug-XXXXXX";
+    char out[256];
+    debug_info info;
+
+    munit_assert_not_null(mkdtemp(dir));
+    snprintf(out, sizeof(out), "%s/main.dbg", dir);
+    write_debug_file(dir, "main.bbb", "START: NOP\nJMP T .START\n");
+    build_debug_file(dir, &(build_options){0}, out);
+    munit_assert_true(debug_load(out, &info));
+    size_t length = info.length;
+    debug_unload(&info);
+
+    // A truncated file, a file index out of range, and a missing file.
+    munit_assert_int(truncate(out, length - 1), ==, 0);
+    munit_assert_false(debug_load(out, &info));
+
+    build_debug_file(dir, &(build_options){0}, out);
+    FILE *f = fopen(out, "r+b");
+    munit_assert_not_null(f);
+    fseek(f, 24 + 8, SEEK_SET);
+    fputc(0x7, f);
+    fclose(f);
+    munit_assert_false(debug_load(out, &info));
+
+    munit_assert_false(debug_load("/nonexistent/main.dbg", &info));
+
+    remove_debug_dir(dir);
+    return MUNIT_OK;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-variable"
+static MunitTest assem_debug_tests[] = {
+    {(char *)"lines and symbols are found", test_debug_lookup, NULL, NULL,
+     MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"optimized and cached builds keep lines", test_debug_builds,
+     NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"bad debug files are rejected", test_debug_bad, NULL, NULL,
+     MUNIT_TEST_OPTION_NONE, NULL},
+    {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}};
+#pragma GCC diagnostic pop
@@ -0,0 +1,126 @@
+#include <memory.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../machine/image.h"
+#include "../machine/memory.h"
+#include "../munit/munit.h"
+
+#define IMAGE_MEMORY_SIZE (64 * 1024)
+
+static long image_test_write(const char *path, memory *mem) {
+    // Writes a sparse image and returns its size in bytes.
+    FILE *out = fopen(path, "wb");
+    munit_assert_not_null(out);
+    munit_assert_true(image_write(out, mem));
+
+    long size = ftell(out);
+    fclose(out);
+    return size;
+}
+
+static MunitResult test_image_round_trip(const MunitParameter params[],
+                                         void *fixture) {
+    char path[] = "/tmp/bbb-image-XXXXXX";
+    memory *mem = memory_init(IMAGE_MEMORY_SIZE);
+    memory *loaded = memory_init(IMAGE_MEMORY_SIZE);
+    image_header header;
+
+    munit_assert_int(close(mkstemp(path)), ==, 0);
+
+    // Reset vectors, a short program, a gap too short to split on, an odd
+    // length segment, and a quad in the last address.
+    uint8_t vectors[] = {0x0, 0x0, 0x2, 0x0, 0x1, 0x0, 0x0, 0x0};
+    memcpy(mem->data, vectors, sizeof(vectors));
+    mem->data[0x20] = 0x7;
+    mem->data[0x21] = 0xD;
+    mem->data[0x28] = 0x1;
+    mem->data[0x100] = 0xA;
+    mem->data[0x102] = 0xB;
+    mem->data[IMAGE_MEMORY_SIZE - 1] = 0xF;
+
+    long size = image_test_write(path, mem);
+    munit_assert_long(size, <, 128);
+
+    memset(loaded->data, 0x5, loaded->size);
+    munit_assert_true(image_load(path, loaded, &header));
+    munit_assert_memory_equal(mem->size, loaded->data, mem->data);
+    munit_assert_uint32(header.version, ==, IMAGE_VERSION);
+    munit_assert_uint16(header.vectors[0], ==, 0x0020);
+    munit_assert_uint16(header.vectors[1], ==, 0x1000);
+    munit_assert_uint32(header.segment_count, ==, 4);
+
+    // Empty memory needs no segments at all.
+    memset(mem->data, 0, mem->size);
+    image_test_write(path, mem);
+    munit_assert_true(image_load(path, loaded, &header));
+    munit_assert_uint32(header.segment_count, ==, 0);
+    munit_assert_memory_equal(mem->size, loaded->data, mem->data);
+
+    remove(path);
+    memory_free(mem);
+    memory_free(loaded);
+    return MUNIT_OK;
+}
+
+static MunitResult test_image_flat(const MunitParameter params[],
+                                   void *fixture) {
+    char path[] = "/tmp/bbb-image-XXXXXX";
+    memory *mem = memory_init(IMAGE_MEMORY_SIZE);
+    image_header header;
+    uint8_t flat[] = {0x0, 0x0, 0x2, 0x0, 0x1, 0x0, 0x0, 0x0, 0x0, 0x0, 0xA};
+
+    // Legacy images are a quad per byte, and may be shorter than memory.
+    FILE *out = fdopen(mkstemp(path), "wb");
+    munit_assert_not_null(out);
+    fwrite(flat, sizeof(flat), 1, out);
+    fclose(out);
+
+    mem->data[0x400] = 0x3;
+    munit_assert_true(image_load(path, mem, &header));
+    munit_assert_memory_equal(sizeof(flat), mem->data, flat);
+    munit_assert_uint8(mem->data[0x400], ==, 0);
+    munit_assert_uint32(header.version, ==, 0);
+    munit_assert_uint16(header.vectors[0], ==, 0x0020);
+    munit_assert_uint16(header.vectors[2], ==, 0x00A0);
+
+    remove(path);
+    memory_free(mem);
+    return MUNIT_OK;
+}
+
+static MunitResult test_image_bad(const MunitParameter params[],
+                                  void *fixture) {
+    char path[] = "/tmp/bbb-image-XXXXXX";
+    memory *mem = memory_init(IMAGE_MEMORY_SIZE);
+    memory *small = memory_init(0x100);
+
+    munit_assert_int(close(mkstemp(path)), ==, 0);
+    mem->data[0x200] = 0x1;
+    long size = image_test_write(path, mem);
+
+    // A segment past the end of memory is rejected, and so is a truncated
+    // image.
+    munit_assert_false(image_load(path, small, NULL));
+    munit_assert_int(truncate(path, size - 1), ==, 0);
+    munit_assert_false(image_load(path, mem, NULL));
+    munit_assert_false(image_load("/nonexistent/image", mem, NULL));
+
+    remove(path);
+    memory_free(mem);
+    memory_free(small);
+    return MUNIT_OK;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-variable"
+static MunitTest machine_image_tests[] = {
+    {(char *)"sparse images round trip", test_image_round_trip, NULL, NULL,
+     MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"flat images still load", test_image_flat, NULL, NULL,
+     MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"bad images are rejected", test_image_bad, NULL, NULL,
+     MUNIT_TEST_OPTION_NONE, NULL},
+    {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}};
+#pragma GCC diagnostic pop
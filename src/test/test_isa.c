@@ -0,0 +1,63 @@
+#include <memory.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../machine/isa.h"
+#include "../munit/munit.h"
+
+static MunitResult test_isa_names(const MunitParameter params[],
+                                  void *fixture) {
+    // Every name in the table is found by its lookup, and nothing else is.
+    for (int i = 0; i < ISA_OPCODE_COUNT; i++) {
+        const char *name = isa_opcodes[i].name;
+        munit_assert_int(isa_opcode_lookup(name, strlen(name)), ==, i);
+    }
+
+    for (int i = 0; i < ISA_REGISTER_COUNT; i++) {
+        const char *name = isa_registers[i];
+        munit_assert_int(isa_register_lookup(name, strlen(name)), ==, i);
+    }
+
+    munit_assert_int(isa_opcode_lookup("MOVE", 3), ==, MOV);
+    munit_assert_int(isa_opcode_lookup("MOVE", 4), ==, -1);
+    munit_assert_int(isa_opcode_lookup("ANT", 3), ==, -1);
+    munit_assert_int(isa_opcode_lookup("mov", 3), ==, -1);
+    munit_assert_int(isa_opcode_lookup("O", 1), ==, -1);
+    munit_assert_int(isa_opcode_lookup("", 0), ==, -1);
+
+    munit_assert_int(isa_register_lookup("g", 1), ==, -1);
+    munit_assert_int(isa_register_lookup("s2", 2), ==, -1);
+    munit_assert_int(isa_register_lookup("A", 1), ==, -1);
+    munit_assert_int(isa_register_lookup("cv", 2), ==, -1);
+    munit_assert_int(isa_register_lookup("", 0), ==, -1);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_isa_conditions(const MunitParameter params[],
+                                       void *fixture) {
+    for (int bit = 0; bit < ISA_CONDITION_COUNT; bit++) {
+        char name[2] = {'N', isa_conditions[bit]};
+
+        munit_assert_int(isa_condition_lookup(&name[1], 1), ==, 0x8 | bit);
+        munit_assert_int(isa_condition_lookup(name, 2), ==, bit);
+    }
+
+    munit_assert_int(isa_condition_lookup("T", 1), ==, 0xF);
+    munit_assert_int(isa_condition_lookup("X", 1), ==, -1);
+    munit_assert_int(isa_condition_lookup("ZZ", 2), ==, -1);
+    munit_assert_int(isa_condition_lookup("NZC", 3), ==, -1);
+    munit_assert_int(isa_condition_lookup("", 0), ==, -1);
+
+    return MUNIT_OK;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-variable"
+static MunitTest machine_isa_tests[] = {
+    {(char *)"names are found", test_isa_names, NULL, NULL,
+     MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"conditions are encoded", test_isa_conditions, NULL, NULL,
+     MUNIT_TEST_OPTION_NONE, NULL},
+    {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}};
+#pragma GCC diagnostic pop
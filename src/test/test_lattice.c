@@ -0,0 +1,572 @@
+#include <memory.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../assem/assem.h"
+#include "../machine/counters.h"
+#include "../machine/cpu.h"
+#include "../machine/lattice.h"
+#include "../machine/partition.h"
+#include "../munit/munit.h"
+
+static uint8_t lattice_vectors[] = {0x0, 0x0, 0x2, 0x0, 0x1, 0x0, 0x0, 0x0};
+
+static lattice *lattice_with_program(size_t workers, uint8_t *program,
+                                     size_t length) {
+    lattice *l = lattice_init(workers);
+    uint8_t *image = calloc(CPU_MAX_ADDRESS, sizeof(uint8_t));
+
+    memcpy(image, lattice_vectors, sizeof(lattice_vectors));
+    memcpy(image + 0x20, program, length);
+
+    for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+        lattice_load(l, i, image, CPU_MAX_ADDRESS);
+    }
+
+    free(image);
+    lattice_start(l);
+    return l;
+}
+
+static MunitResult test_lattice_node_id(const MunitParameter params[],
+                                        void *fixture) {
+    uint8_t program[] = {OR, REGISTER_CV, REGISTER_S1, 0x2};
+    lattice *l = lattice_with_program(1, program, sizeof(program));
+
+    for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+        memory *mem = l->nodes[i]->memory;
+        munit_assert_uint8(memory_read(mem, LATTICE_NODE_ROW), ==,
+                           i / LATTICE_COLUMNS);
+        munit_assert_uint8(memory_read(mem, LATTICE_NODE_COLUMN), ==,
+                           i % LATTICE_COLUMNS);
+    }
+
+    lattice_free(l);
+    return MUNIT_OK;
+}
+
+static MunitResult test_lattice_halt(const MunitParameter params[],
+                                     void *fixture) {
+    uint8_t program[] = {OR, REGISTER_CV, REGISTER_S1, 0x2};
+    lattice *l = lattice_with_program(4, program, sizeof(program));
+
+    lattice_run(l);
+
+    // Every node halts in the first quantum, so there is nothing left to
+    // schedule afterwards.
+    munit_assert_ullong(l->quanta, ==, 1);
+
+    for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+        munit_assert_true(l->nodes[i]->flags & FLAG_HALT);
+    }
+
+    lattice_free(l);
+    return MUNIT_OK;
+}
+
+static MunitResult test_lattice_mailbox(const MunitParameter params[],
+                                        void *fixture) {
+    // Write 7 to the east outbox, bump its write offset, and halt.
+    uint8_t program[] = {MOV, REGISTER_CV, REGISTER_MD, 0x7, 0xE, 0xA, 0x0,
+                         0x0, MOV, REGISTER_CV, REGISTER_MD, 0x1, 0xE, 0xB,
+                         0x0, 0x3, OR,  REGISTER_CV, REGISTER_S1, 0x2};
+    lattice *l = lattice_with_program(2, program, sizeof(program));
+
+    lattice_run(l);
+
+    for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+        uint8_t *data = l->nodes[i]->memory->data;
+        uint8_t *inbox = data + MAILBOX_INBOX + DIRECTION_WEST * MAILBOX_SIZE;
+        uint8_t *outbox = data + MAILBOX_OUTBOX + DIRECTION_EAST * MAILBOX_SIZE;
+
+        if (i % LATTICE_COLUMNS == 0) {
+            // Nothing arrives from the west on the western edge.
+            munit_assert_uint8(inbox[MAILBOX_WRITE + 1], ==, 0);
+        } else {
+            munit_assert_uint8(inbox[0], ==, 7);
+            munit_assert_uint8(inbox[MAILBOX_WRITE + 1], ==, 1);
+        }
+
+        if (i % LATTICE_COLUMNS == LATTICE_COLUMNS - 1) {
+            // The eastern edge has nobody to deliver to.
+            munit_assert_uint8(outbox[MAILBOX_READ + 1], ==, 0);
+        } else {
+            munit_assert_uint8(outbox[MAILBOX_READ + 1], ==, 1);
+        }
+    }
+
+    lattice_free(l);
+    return MUNIT_OK;
+}
+
+static MunitResult test_lattice_counters(const MunitParameter params[],
+                                         void *fixture) {
+    // Same as above: send one quad east and halt.
+    uint8_t program[] = {MOV, REGISTER_CV, REGISTER_MD, 0x7, 0xE, 0xA, 0x0,
+                         0x0, MOV, REGISTER_CV, REGISTER_MD, 0x1, 0xE, 0xB,
+                         0x0, 0x3, OR,  REGISTER_CV, REGISTER_S1, 0x2};
+    lattice *l = lattice_with_program(2, program, sizeof(program));
+
+    lattice_run(l);
+
+    for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+        mailbox_counters east = counters_mailbox(l, i, DIRECTION_EAST);
+        mailbox_counters west = counters_mailbox(l, i, DIRECTION_WEST);
+        bool first = i % LATTICE_COLUMNS == 0;
+        bool last = i % LATTICE_COLUMNS == LATTICE_COLUMNS - 1;
+
+        munit_assert_ullong(l->counters[i].retired, ==, 3);
+        munit_assert_ullong(l->counters[i].idle, ==, 0);
+        munit_assert_ullong(east.out, ==, last ? 0 : 1);
+        munit_assert_ullong(east.in, ==, 0);
+        munit_assert_ullong(west.in, ==, first ? 0 : 1);
+        munit_assert_uint8(west.high_water, ==, first ? 0 : 1);
+        munit_assert_ullong(west.stalls, ==, 0);
+    }
+
+    lattice_free(l);
+    return MUNIT_OK;
+}
+
+static void assert_lattice_equal(lattice *a, lattice *b) {
+    munit_assert_ullong(a->quanta, ==, b->quanta);
+
+    for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+        machine *x = a->nodes[i];
+        machine *y = b->nodes[i];
+
+        munit_assert_memory_equal(CPU_MAX_ADDRESS, x->memory->data,
+                                  y->memory->data);
+        munit_assert_memory_equal(CPU_REGISTER_COUNT, x->registers,
+                                  y->registers);
+        munit_assert_uint8(x->flags, ==, y->flags);
+        munit_assert_size(x->pc - x->memory->data, ==,
+                          y->pc - y->memory->data);
+        munit_assert_size(x->sp - x->memory->data, ==,
+                          y->sp - y->memory->data);
+    }
+}
+
+static MunitResult test_lattice_deterministic(const MunitParameter params[],
+                                              void *fixture) {
+    // Accumulate whatever shows up in the west inbox and forward the running
+    // total to the east outbox, forever.
+    uint8_t program[] = {ADD, REGISTER_MD, REGISTER_A, 0xE, 0x6, 0x0, 0x0,
+                         MOV, REGISTER_A,  REGISTER_MD, 0xE, 0xA, 0x0, 0x0,
+                         INC, REGISTER_MD, 0xE, 0xB, 0x0, 0x3,
+                         JMP, 0xF, 0x0, 0x0, 0x2, 0x0};
+
+    lattice *serial = lattice_with_program(1, program, sizeof(program));
+    lattice *parallel = lattice_with_program(4, program, sizeof(program));
+
+    serial->quantum = parallel->quantum = 100;
+    serial->max_quanta = parallel->max_quanta = 8;
+
+    lattice_run(serial);
+    lattice_run(parallel);
+
+    munit_assert_ullong(serial->quanta, ==, 8);
+    assert_lattice_equal(serial, parallel);
+
+    lattice_free(serial);
+    lattice_free(parallel);
+    return MUNIT_OK;
+}
+
+static MunitResult test_lattice_conservative(const MunitParameter params[],
+                                             void *fixture) {
+    // Same forwarding loop as above, but each node gives up after a number
+    // of rounds that depends on its column, so nodes halt at different times
+    // while their neighbours keep sending to them.
+    uint8_t program[] = {MOV, REGISTER_MD, REGISTER_B, 0xF, 0xF, 0xF, 0x5,
+                         INC, REGISTER_B,
+                         ADD, REGISTER_MD, REGISTER_A, 0xE, 0x6, 0x0, 0x0,
+                         MOV, REGISTER_A,  REGISTER_MD, 0xE, 0xA, 0x0, 0x0,
+                         INC, REGISTER_MD, 0xE, 0xB, 0x0, 0x3,
+                         DEC, REGISTER_C,
+                         JMP, 0x1, 0x0, 0x0, 0x2, 0x9,
+                         DEC, REGISTER_B,
+                         JMP, 0x1, 0x0, 0x0, 0x2, 0x9,
+                         OR, REGISTER_CV, REGISTER_S1, 0x2};
+
+    for (size_t workers = 1; workers <= 4; workers += 3) {
+        lattice *barrier = lattice_with_program(1, program, sizeof(program));
+        lattice *conservative =
+            lattice_with_program(workers, program, sizeof(program));
+
+        barrier->quantum = conservative->quantum = 37;
+        conservative->sync = LATTICE_CONSERVATIVE;
+
+        lattice_run(barrier);
+        lattice_run(conservative);
+
+        munit_assert_ullong(barrier->quanta, >, 1);
+        assert_lattice_equal(barrier, conservative);
+
+        lattice_free(barrier);
+        lattice_free(conservative);
+    }
+
+    return MUNIT_OK;
+}
+
+static MunitResult
+test_lattice_conservative_limit(const MunitParameter params[], void *fixture) {
+    uint8_t program[] = {ADD, REGISTER_MD, REGISTER_A, 0xE, 0x6, 0x0, 0x0,
+                         MOV, REGISTER_A,  REGISTER_MD, 0xE, 0xA, 0x0, 0x0,
+                         INC, REGISTER_MD, 0xE, 0xB, 0x0, 0x3,
+                         JMP, 0xF, 0x0, 0x0, 0x2, 0x0};
+
+    lattice *barrier = lattice_with_program(2, program, sizeof(program));
+    lattice *conservative = lattice_with_program(3, program, sizeof(program));
+
+    barrier->quantum = conservative->quantum = 100;
+    barrier->max_quanta = conservative->max_quanta = 8;
+    conservative->sync = LATTICE_CONSERVATIVE;
+
+    lattice_run(barrier);
+    lattice_run(conservative);
+
+    munit_assert_ullong(conservative->quanta, ==, 8);
+    assert_lattice_equal(barrier, conservative);
+
+    lattice_free(barrier);
+    lattice_free(conservative);
+    return MUNIT_OK;
+}
+
+static MunitResult test_lattice_partition(const MunitParameter params[],
+                                          void *fixture) {
+    uint8_t program[] = {MOV, REGISTER_MD, REGISTER_B, 0xF, 0xF, 0xF, 0x5,
+                         INC, REGISTER_B,
+                         ADD, REGISTER_MD, REGISTER_A, 0xE, 0x6, 0x0, 0x0,
+                         MOV, REGISTER_A,  REGISTER_MD, 0xE, 0xA, 0x0, 0x0,
+                         INC, REGISTER_MD, 0xE, 0xB, 0x0, 0x3,
+                         DEC, REGISTER_C,
+                         JMP, 0x1, 0x0, 0x0, 0x2, 0x9,
+                         DEC, REGISTER_B,
+                         JMP, 0x1, 0x0, 0x0, 0x2, 0x9,
+                         OR, REGISTER_CV, REGISTER_S1, 0x2};
+
+    for (size_t processes = 1; processes <= 4; processes++) {
+        lattice *local = lattice_with_program(1, program, sizeof(program));
+        lattice *shared = lattice_with_program(1, program, sizeof(program));
+
+        local->quantum = shared->quantum = 37;
+
+        lattice_run(local);
+        munit_assert_true(lattice_partition_run(shared, processes));
+
+        assert_lattice_equal(local, shared);
+
+        for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+            for (Direction d = DIRECTION_NORTH; d < DIRECTION_COUNT; d++) {
+                mailbox_counters x = counters_mailbox(local, i, d);
+                mailbox_counters y = counters_mailbox(shared, i, d);
+
+                munit_assert_ullong(x.in, ==, y.in);
+                munit_assert_ullong(x.out, ==, y.out);
+                munit_assert_uint8(x.high_water, ==, y.high_water);
+            }
+
+            munit_assert_ullong(local->counters[i].retired, ==,
+                                shared->counters[i].retired);
+        }
+
+        lattice_free(local);
+        lattice_free(shared);
+    }
+
+    return MUNIT_OK;
+}
+
+static void lattice_poll(lattice *l, size_t node, Direction inbox) {
+    // Replace the node's program with a loop that keeps loading the write
+    // offset of one of its inboxes and never stores anything.
+    uint8_t program[] = {MOV, REGISTER_MD, REGISTER_A,
+                         0xE, (uint8_t)(inbox * 2 + 1), 0x0, 0x3,
+                         JMP, 0xF, 0x0, 0x0, 0x2, 0x0};
+
+    memcpy(l->nodes[node]->memory->data + 0x20, program, sizeof(program));
+}
+
+static lattice *lattice_idle(size_t workers) {
+    uint8_t program[] = {OR, REGISTER_CV, REGISTER_S1, 0x2};
+    lattice *l = lattice_with_program(workers, program, sizeof(program));
+
+    // Every node in the first row waits on its west neighbour, and the
+    // first of them on the edge of the lattice. Everything else halts.
+    for (size_t i = 0; i < LATTICE_COLUMNS; i++) {
+        lattice_poll(l, i, DIRECTION_WEST);
+    }
+
+    l->quantum = 256;
+    l->max_quanta = 1000;
+    return l;
+}
+
+static void assert_lattice_idle(lattice *l) {
+    munit_assert_int(l->outcome, ==, LATTICE_IDLE);
+    munit_assert_ullong(l->quanta, <, 1000);
+    munit_assert_uint32(l->cycle, ==, 0);
+    munit_assert_int(l->waits[0].state, ==, NODE_WAITING);
+    munit_assert_int(l->waits[0].inbox, ==, DIRECTION_WEST);
+    munit_assert_int(l->waits[LATTICE_COLUMNS].state, ==, NODE_HALTED);
+}
+
+static MunitResult test_lattice_idle(const MunitParameter params[],
+                                     void *fixture) {
+    lattice *barrier = lattice_idle(2);
+    lattice *conservative = lattice_idle(3);
+    lattice *shared = lattice_idle(1);
+
+    conservative->sync = LATTICE_CONSERVATIVE;
+
+    lattice_run(barrier);
+    lattice_run(conservative);
+    munit_assert_true(lattice_partition_run(shared, 2));
+
+    // Every mode stops; the partitioned one in the same quantum.
+    assert_lattice_idle(barrier);
+    assert_lattice_idle(conservative);
+    assert_lattice_idle(shared);
+    munit_assert_ullong(shared->quanta, ==, barrier->quanta);
+
+    lattice_free(barrier);
+    lattice_free(conservative);
+    lattice_free(shared);
+    return MUNIT_OK;
+}
+
+static MunitResult test_lattice_cycle(const MunitParameter params[],
+                                      void *fixture) {
+    // Keep storing to memory forever.
+    uint8_t program[] = {INC, REGISTER_MD, 0x1, 0x0, 0x0, 0x0,
+                         JMP, 0xF, 0x0, 0x0, 0x2, 0x0};
+    size_t ring[] = {0, 1, LATTICE_COLUMNS + 1, LATTICE_COLUMNS};
+    Direction waits[] = {DIRECTION_EAST, DIRECTION_SOUTH, DIRECTION_WEST,
+                         DIRECTION_NORTH};
+
+    // The last pass runs the lattice in two processes.
+    for (int detect = 0; detect <= 2; detect++) {
+        lattice *l = lattice_with_program(3, program, sizeof(program));
+
+        // The top left 2x2 square waits on itself clockwise while the rest
+        // of the lattice stays busy.
+        for (size_t i = 0; i < 4; i++) {
+            lattice_poll(l, ring[i], waits[i]);
+        }
+
+        l->quantum = 100;
+        l->max_quanta = 500;
+        l->detect = detect;
+
+        if (detect == 2) {
+            munit_assert_true(lattice_partition_run(l, 2));
+        } else {
+            lattice_run(l);
+        }
+
+        if (!detect) {
+            munit_assert_int(l->outcome, ==, LATTICE_LIMIT);
+            munit_assert_ullong(l->quanta, ==, 500);
+        } else {
+            munit_assert_int(l->outcome, ==, LATTICE_DEADLOCK);
+            munit_assert_ullong(l->quanta, <, 500);
+            munit_assert_uint32(l->cycle, ==,
+                                1u << 0 | 1u << 1 | 1u << LATTICE_COLUMNS |
+                                    1u << (LATTICE_COLUMNS + 1));
+            munit_assert_int(l->waits[2].state, ==, NODE_RUNNING);
+        }
+
+        lattice_free(l);
+    }
+
+    return MUNIT_OK;
+}
+
+static void lattice_assemble(lattice *l, size_t node, const char *prog) {
+    memory *image = memory_init(CPU_MAX_ADDRESS);
+    assembler *a = assembler_init();
+
+    munit_assert_true(assembler_run(a, prog, strlen(prog), image, NULL));
+    lattice_load(l, node, image->data, image->size);
+
+    assembler_free(a);
+    memory_free(image);
+}
+
+static lattice *lattice_two_inboxes(size_t workers) {
+    // The first node counts down for a while, sends one quad east and
+    // halts. Its neighbour polls its west inbox and then its east one in a
+    // loop of eight instructions, so that a quantum always ends with the
+    // east inbox loaded last. Every other node halts.
+    lattice *l = lattice_init(workers);
+
+    lattice_assemble(l, 0,
+                     "#data 0020 0200\n"
+                     "#org 0020\n"
+                     "MOV 0xD %a\n"
+                     "OUTER: MOV 0xF %b\n"
+                     "MIDDLE: MOV 0xF %c\n"
+                     "INNER: DEC %c\n"
+                     "JMP NZ .INNER\n"
+                     "DEC %b\n"
+                     "JMP NZ .MIDDLE\n"
+                     "DEC %a\n"
+                     "JMP NZ .OUTER\n"
+                     "MOV 0x7 @EA00\n"
+                     "MOV 0x1 @EB03\n"
+                     "OR 0x2 %s1\n");
+    lattice_assemble(l, 1,
+                     "#data 0020 0200\n"
+                     "#org 0020\n"
+                     "LOOP: MOV @E703 %a\n"
+                     "CMP 0x0 %a\n"
+                     "JMP NZ .DONE\n"
+                     "MOV @E303 %b\n"
+                     "NOP\n"
+                     "NOP\n"
+                     "NOP\n"
+                     "JMP T .LOOP\n"
+                     "DONE: MOV 0x5 %f\n"
+                     "OR 0x2 %s1\n");
+
+    for (size_t i = 2; i < LATTICE_NODE_COUNT; i++) {
+        lattice_assemble(l, i,
+                         "#data 0020 0200\n"
+                         "#org 0020\n"
+                         "OR 0x2 %s1\n");
+    }
+
+    lattice_start(l);
+    l->quantum = 256;
+    l->max_quanta = 1000;
+    return l;
+}
+
+static MunitResult test_lattice_two_inboxes(const MunitParameter params[],
+                                            void *fixture) {
+    lattice *barrier = lattice_two_inboxes(2);
+    lattice *conservative = lattice_two_inboxes(3);
+    lattice *shared = lattice_two_inboxes(1);
+
+    barrier->detect = true;
+    conservative->sync = LATTICE_CONSERVATIVE;
+
+    lattice_run(barrier);
+    lattice_run(conservative);
+    munit_assert_true(lattice_partition_run(shared, 2));
+
+    // The poller goes idle long before the mail arrives, in the inbox it
+    // did not load last, and must still be let run to read it.
+    munit_assert_ullong(barrier->quanta, >, 16);
+    munit_assert_int(barrier->outcome, ==, LATTICE_FINISHED);
+    munit_assert_true(barrier->nodes[1]->flags & FLAG_HALT);
+    munit_assert_uint8(barrier->nodes[1]->registers[REGISTER_F], ==, 0x5);
+    assert_lattice_equal(barrier, conservative);
+    assert_lattice_equal(barrier, shared);
+
+    lattice_free(barrier);
+    lattice_free(conservative);
+    lattice_free(shared);
+    return MUNIT_OK;
+}
+
+static lattice *lattice_sleeping(size_t workers) {
+    // Send one quad east and wait for an interrupt, which halts the node.
+    // Every node but those on the western edge gets mail and wakes.
+    uint8_t program[] = {MOV, REGISTER_CV, REGISTER_MD, 0x7, 0xE, 0xA, 0x0,
+                         0x0, MOV, REGISTER_CV, REGISTER_MD, 0x1, 0xE, 0xB,
+                         0x0, 0x3, MOV, REGISTER_CV, REGISTER_MD, 0x1, 0xF,
+                         0xE, 0x0, 0x1};
+    uint8_t handler[] = {OR, REGISTER_CV, REGISTER_S1, 0x2};
+    lattice *l = lattice_with_program(workers, program, sizeof(program));
+
+    for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+        machine *m = l->nodes[i];
+
+        memcpy(m->memory->data + 0x40, handler, sizeof(handler));
+        m->iv = m->memory->data + 0x40;
+    }
+
+    return l;
+}
+
+static void assert_lattice_woke(lattice *l) {
+    munit_assert_int(l->outcome, ==, LATTICE_IDLE);
+
+    for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+        machine *m = l->nodes[i];
+        bool edge = i % LATTICE_COLUMNS == 0;
+
+        munit_assert_true(m->flags & FLAG_HALT);
+        munit_assert_int(m->status, ==, edge ? STATE_WAIT : STATE_RUN);
+        munit_assert_ullong(l->counters[i].interrupts, ==, edge ? 0 : 1);
+        munit_assert_ullong(l->counters[i].retired, ==, edge ? 3 : 4);
+    }
+}
+
+static MunitResult test_lattice_wait(const MunitParameter params[],
+                                     void *fixture) {
+    lattice *barrier = lattice_sleeping(2);
+    lattice *conservative = lattice_sleeping(3);
+    lattice *shared = lattice_sleeping(1);
+
+    barrier->detect = true;
+    conservative->sync = LATTICE_CONSERVATIVE;
+
+    lattice_run(barrier);
+    lattice_run(conservative);
+    munit_assert_true(lattice_partition_run(shared, 2));
+
+    // Mail wakes a node in the quantum after it was sent, and the nodes that
+    // never get any are left sleeping.
+    assert_lattice_woke(barrier);
+    munit_assert_ullong(barrier->quanta, ==, 2);
+    munit_assert_int(barrier->waits[0].state, ==, NODE_SLEEPING);
+    munit_assert_int(barrier->waits[1].state, ==, NODE_HALTED);
+
+    assert_lattice_woke(conservative);
+    assert_lattice_woke(shared);
+    assert_lattice_equal(barrier, shared);
+    munit_assert_int(shared->waits[0].state, ==, NODE_SLEEPING);
+    munit_assert_int(shared->waits[1].state, ==, NODE_HALTED);
+
+    lattice_free(barrier);
+    lattice_free(conservative);
+    lattice_free(shared);
+    return MUNIT_OK;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-variable"
+static MunitTest machine_lattice_tests[] = {
+    {(char *)"node position is mapped", test_lattice_node_id, NULL, NULL,
+     MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"halted nodes stop scheduling", test_lattice_halt, NULL, NULL,
+     MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"mailboxes deliver to neighbors", test_lattice_mailbox, NULL,
+     NULL, MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"counters track mailbox traffic", test_lattice_counters, NULL,
+     NULL, MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"worker count does not change results",
+     test_lattice_deterministic, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"conservative sync matches barrier", test_lattice_conservative,
+     NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"conservative sync honors quanta limit",
+     test_lattice_conservative_limit, NULL, NULL, MUNIT_TEST_OPTION_NONE,
+     NULL},
+    {(char *)"partitioned lattice matches in-process", test_lattice_partition,
+     NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"idle lattice is detected", test_lattice_idle, NULL, NULL,
+     MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"mail in another inbox wakes a poller",
+     test_lattice_two_inboxes, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"wait-for cycle is detected", test_lattice_cycle, NULL, NULL,
+     MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"mail wakes sleeping nodes", test_lattice_wait, NULL, NULL,
+     MUNIT_TEST_OPTION_NONE, NULL},
+    {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}};
+#pragma GCC diagnostic pop
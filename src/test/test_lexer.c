@@ -0,0 +1,92 @@
+#include <memory.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../assem/lexer.h"
+#include "../munit/munit.h"
+
+static MunitResult test_lexer_tokens(const MunitParameter params[],
+                                     void *fixture) {
+    const char *source = "LOOP:  MOV 0x1 %a (comment) ADD\n"
+                         "\t(((((() PSH %b\n"
+                         "(unterminated comment\n"
+                         "POP";
+    lexer lx;
+    token t;
+
+    lexer_init(&lx, source, strlen(source));
+
+    // Tokens are slices of the source with the line and column they start at
+    munit_assert_true(lexer_next(&lx, &t));
+    munit_assert_true(token_equal(&t, "LOOP:"));
+    munit_assert_ptr_equal(t.start, source);
+    munit_assert_uint32(t.line, ==, 1);
+    munit_assert_uint32(t.column, ==, 1);
+
+    munit_assert_true(lexer_next(&lx, &t));
+    munit_assert_true(token_equal(&t, "MOV"));
+    munit_assert_uint32(t.column, ==, 8);
+
+    munit_assert_true(lexer_next(&lx, &t));
+    munit_assert_true(token_equal(&t, "0x1"));
+    munit_assert_false(token_equal(&t, "0x"));
+    munit_assert_false(token_equal(&t, "0x10"));
+
+    munit_assert_true(lexer_next(&lx, &t));
+    munit_assert_true(token_equal(&t, "%a"));
+
+    // Comments are skipped, and tokens may follow them on the same line
+    munit_assert_true(lexer_next(&lx, &t));
+    munit_assert_true(token_equal(&t, "ADD"));
+    munit_assert_uint32(t.column, ==, 29);
+    munit_assert_false(lexer_next(&lx, &t));
+
+    munit_assert_true(lexer_next_line(&lx));
+    munit_assert_true(lexer_next(&lx, &t));
+    munit_assert_true(token_equal(&t, "PSH"));
+    munit_assert_uint32(t.line, ==, 2);
+    munit_assert_uint32(t.column, ==, 10);
+    munit_assert_size(lexer_line_length(&lx), ==, 15);
+
+    // An unterminated comment runs to the end of its line
+    munit_assert_true(lexer_next_line(&lx));
+    munit_assert_false(lexer_next(&lx, &t));
+
+    munit_assert_true(lexer_next_line(&lx));
+    munit_assert_true(lexer_next(&lx, &t));
+    munit_assert_true(token_equal(&t, "POP"));
+    munit_assert_uint32(t.line, ==, 4);
+    munit_assert_false(lexer_next(&lx, &t));
+    munit_assert_false(lexer_next_line(&lx));
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_lexer_empty(const MunitParameter params[],
+                                    void *fixture) {
+    lexer lx;
+    token t;
+
+    lexer_init(&lx, "", 0);
+    munit_assert_false(lexer_next(&lx, &t));
+    munit_assert_false(lexer_next_line(&lx));
+
+    lexer_init(&lx, "\n\n", 2);
+    munit_assert_false(lexer_next(&lx, &t));
+    munit_assert_true(lexer_next_line(&lx));
+    munit_assert_true(lexer_next_line(&lx));
+    munit_assert_uint32(lx.line, ==, 3);
+    munit_assert_false(lexer_next_line(&lx));
+
+    return MUNIT_OK;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-variable"
+static MunitTest assem_lexer_tests[] = {
+    {(char *)"tokens", test_lexer_tokens, NULL, NULL, MUNIT_TEST_OPTION_NONE,
+     NULL},
+    {(char *)"empty source", test_lexer_empty, NULL, NULL,
+     MUNIT_TEST_OPTION_NONE, NULL},
+    {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}};
+#pragma GCC diagnostic pop
@@ -0,0 +1,207 @@
+#include <memory.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../assem/assem.h"
+#include "../assem/link.h"
+#include "../assem/object.h"
+#include "../assem/source.h"
+#include "../machine/cpu.h"
+#include "../munit/munit.h"
+
+static void write_link_file(const char *dir, const char *name,
+                            const char *text) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    FILE *f = fopen(path, "w");
+    munit_assert_not_null(f);
+    fputs(text, f);
+    fclose(f);
+}
+
+static void build_test_object(source_cache *cache, const char *dir,
+                              const char *name, object *obj) {
+    // Assembles a source, then writes the object out and reads it back so
+    // every link goes through the file format.
+    char path[256];
+    object built;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    munit_assert_true(build_object(cache, NULL, path, &built));
+
+    snprintf(path, sizeof(path), "%s/%s.o", dir, name);
+    munit_assert_true(object_write(path, &built));
+    munit_assert_true(object_read(path, obj));
+    remove(path);
+
+    munit_assert_size(obj->section_count, ==, built.section_count);
+    munit_assert_size(obj->symbol_count, ==, built.symbol_count);
+    munit_assert_size(obj->reloc_count, ==, built.reloc_count);
+    object_free(&built);
+}
+
+static MunitResult test_link_single_object(const MunitParameter params[],
+                                           void *fixture) {
+    char dir[] = "/tmp/bbb-link-XXXXXX";
+    char path[256];
+    char *names[] = {"prog.bbb"};
+    object obj;
+
+    munit_assert_not_null(mkdtemp(dir));
+
+    // Labels are referenced across sections in both directions.
+    write_link_file(dir, "prog.bbb",
+                    "#data 0020\n"
+                    "START: JMP T .MIDDLE\n"
+                    "#org 0020\n"
+                    "MIDDLE: MOV 1 %a\n"
+                    "JMP NZ .END\n"
+                    "#org 0100\n"
+                    "END: JSR T .START\n"
+                    "MOV @F000 .MIDDLE\n");
+
+    source_cache *cache = source_cache_init();
+    build_test_object(cache, dir, "prog.bbb", &obj);
+    munit_assert_size(obj.section_count, ==, 3);
+    munit_assert_false(obj.sections[0].absolute);
+    munit_assert_true(obj.sections[2].absolute);
+    munit_assert_uint32(obj.sections[2].origin, ==, 0x100);
+
+    // Linked on its own, an object gives the image the assembler would.
+    snprintf(path, sizeof(path), "%s/prog.bbb", dir);
+    memory *expected = build_file(cache, NULL, path);
+    memory *linked = link_objects(&obj, names, 1, NULL);
+
+    munit_assert_not_null(expected);
+    munit_assert_not_null(linked);
+    munit_assert_memory_equal(expected->size, linked->data, expected->data);
+
+    memory_free(expected);
+    memory_free(linked);
+    object_free(&obj);
+    source_cache_free(cache);
+
+    remove(path);
+    remove(dir);
+    return MUNIT_OK;
+}
+
+static MunitResult test_link_placement(const MunitParameter params[],
+                                       void *fixture) {
+    char dir[] = "/tmp/bbb-link-XXXXXX";
+    char path[256];
+    char *names[] = {"main.bbb", "lib.bbb"};
+    object objs[2];
+    link_map map;
+
+    munit_assert_not_null(mkdtemp(dir));
+    write_link_file(dir, "main.bbb", "JMP T .LIB\n");
+    write_link_file(dir, "lib.bbb", "LIB: INC %a\nJMP T .LIB\n");
+    write_link_file(dir, "map", "( Libraries go high )\nlib.bbb 0400\n");
+
+    source_cache *cache = source_cache_init();
+    build_test_object(cache, dir, "main.bbb", &objs[0]);
+    build_test_object(cache, dir, "lib.bbb", &objs[1]);
+
+    // Without a map, the library follows the program.
+    uint8_t unplaced[] = {JMP, 0xF, 0x0, 0x0, 0x0, 0x6,
+                          INC, REGISTER_A, JMP, 0xF, 0x0, 0x0, 0x0, 0x6};
+    memory *m = link_objects(objs, names, 2, NULL);
+    munit_assert_not_null(m);
+    munit_assert_memory_equal(sizeof(unplaced), m->data, unplaced);
+    memory_free(m);
+
+    // The map moves it, and every reference to it moves too.
+    uint8_t program[] = {JMP, 0xF, 0x0, 0x4, 0x0, 0x0};
+    uint8_t library[] = {INC, REGISTER_A, JMP, 0xF, 0x0, 0x4, 0x0, 0x0};
+
+    snprintf(path, sizeof(path), "%s/map", dir);
+    munit_assert_true(link_map_load(&map, path));
+    m = link_objects(objs, names, 2, &map);
+    munit_assert_not_null(m);
+    munit_assert_memory_equal(sizeof(program), m->data, program);
+    munit_assert_memory_equal(sizeof(library), m->data + 0x400, library);
+    munit_assert_uint8(m->data[sizeof(program)], ==, 0);
+    memory_free(m);
+    link_map_free(&map);
+
+    // Objects may not overlap or define the same label twice.
+    write_link_file(dir, "map", "main.bbb 0000\nlib.bbb 0004\n");
+    munit_assert_true(link_map_load(&map, path));
+    munit_assert_null(link_objects(objs, names, 2, &map));
+    link_map_free(&map);
+
+    names[0] = "lib.bbb";
+    object same[] = {objs[1], objs[1]};
+    munit_assert_null(link_objects(same, names, 2, NULL));
+
+    // Every referenced label has to be defined somewhere.
+    munit_assert_null(link_objects(objs, names, 1, NULL));
+
+    write_link_file(dir, "map", "lib.bbb\n");
+    munit_assert_false(link_map_load(&map, path));
+
+    object_free(&objs[0]);
+    object_free(&objs[1]);
+    source_cache_free(cache);
+
+    const char *files[] = {"main.bbb", "lib.bbb", "map", ""};
+
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, files[i]);
+        remove(path);
+    }
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_link_bad_objects(const MunitParameter params[],
+                                         void *fixture) {
+    char dir[] = "/tmp/bbb-link-XXXXXX";
+    char path[256];
+    object obj;
+
+    munit_assert_not_null(mkdtemp(dir));
+    snprintf(path, sizeof(path), "%s/bad.o", dir);
+
+    // Relocations have to fit in their section.
+    object built = {0};
+    uint8_t quads[4] = {0};
+    object_add_section(&built, 0, false, quads, sizeof(quads));
+    munit_assert_true(object_add_reloc(&built, 0, 0, "LABEL"));
+    munit_assert_false(object_add_reloc(&built, 1, 0, "LABEL"));
+    built.relocs[0].offset = 1;
+    munit_assert_true(object_write(path, &built));
+    munit_assert_false(object_read(path, &obj));
+
+    built.relocs[0].offset = 0;
+    munit_assert_true(object_write(path, &built));
+    munit_assert_true(object_read(path, &obj));
+    object_free(&obj);
+    object_free(&built);
+
+    // Truncated files are rejected.
+    FILE *f = fopen(path, "r+b");
+    munit_assert_not_null(f);
+    munit_assert_int(ftruncate(fileno(f), 30), ==, 0);
+    fclose(f);
+    munit_assert_false(object_read(path, &obj));
+
+    remove(path);
+    remove(dir);
+    return MUNIT_OK;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-variable"
+static MunitTest assem_link_tests[] = {
+    {(char *)"an object links to the assembled image",
+     test_link_single_object, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"objects are placed by the map", test_link_placement, NULL, NULL,
+     MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"bad objects are rejected", test_link_bad_objects, NULL, NULL,
+     MUNIT_TEST_OPTION_NONE, NULL},
+    {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}};
+#pragma GCC diagnostic pop
@@ -0,0 +1,173 @@
+#include <string.h>
+#include <time.h>
+
+#include "../assem/assem.h"
+#include "../machine/cpu.h"
+#include "../machine/isa.h"
+#include "../machine/pace.h"
+#include "../munit/munit.h"
+
+static machine *pace_machine_init(assembler *a, const char *prog) {
+    machine *m = machine_init(CPU_MAX_ADDRESS);
+
+    munit_assert_true(assembler_run(a, prog, strlen(prog), m->memory, NULL));
+    machine_reset(m);
+    machine_start(m);
+    return m;
+}
+
+static MunitResult test_pace_schedule(const MunitParameter params[],
+                                      void *fixture) {
+    assembler *a = assembler_init();
+    machine *m = pace_machine_init(a, "#data 0020 0100 0000 0000 0000\n"
+                                      "#org 0020\n"
+                                      "LOOP: INC %a\n"
+                                      "JMP T .LOOP\n");
+    pacer p;
+
+    // At 1 MHz a batch is 10000 cycles, or 10 ms. Each ends within an
+    // instruction of its cycle count, and not before its deadline.
+    pace_start(&p, m, 1000000);
+    munit_assert_uint64(p.batch, ==, 10000);
+
+    for (uint64_t i = 1; i <= 5; i++) {
+        munit_assert_true(pace_run(&p, m));
+        munit_assert_uint64(m->cycles, >=, i * 10000);
+        munit_assert_uint64(m->cycles, <, i * 10000 + ISA_MAX_CYCLES);
+        munit_assert_uint64(pace_elapsed(&p), >=, i * 10000000);
+    }
+
+    munit_assert_uint64(p.batches, ==, 5);
+    munit_assert_uint64(pace_emulated(&p, m), >=, 50000000);
+
+    // The host runs far faster than 1 MHz, so most of the time was spent
+    // asleep.
+    munit_assert_uint64(p.slept, >, 0);
+
+    machine_free(m);
+    assembler_free(a);
+    return MUNIT_OK;
+}
+
+static MunitResult test_pace_halt(const MunitParameter params[],
+                                  void *fixture) {
+    assembler *a = assembler_init();
+    machine *m = pace_machine_init(a, "#data 0020 0100 0000 0000 0000\n"
+                                      "#org 0020\n"
+                                      "NOP\n"
+                                      "MOV 0x2 %s1\n");
+    pacer p;
+
+    // A machine that halts ends its batch early, without waiting. At 1 kHz
+    // the batch is 10 cycles, and the program halts after 6.
+    pace_start(&p, m, 1000);
+    munit_assert_false(pace_run(&p, m));
+    munit_assert_uint64(m->retired, ==, 2);
+    munit_assert_uint64(m->cycles, ==, 6);
+    munit_assert_uint64(p.slept, ==, 0);
+
+    machine_free(m);
+    assembler_free(a);
+    return MUNIT_OK;
+}
+
+static MunitResult test_pace_wait(const MunitParameter params[],
+                                  void *fixture) {
+    assembler *a = assembler_init();
+    machine *m = pace_machine_init(a, "#data 0020 0100 0040 0000 0000\n"
+                                      "#org 0020\n"
+                                      "NOP\n"
+                                      "MOV 0x1 @FE01\n"
+                                      "#org 0040\n"
+                                      "MOV 0x2 %s1\n");
+    pacer p;
+
+    // A waiting machine sleeps out the rest of its batch, whose cycles are
+    // counted as idle. At 10 kHz the batch is 100 cycles, and the machine
+    // waits after 11.
+    pace_start(&p, m, 10000);
+    munit_assert_true(pace_run(&p, m));
+    munit_assert_int(m->status, ==, STATE_WAIT);
+    munit_assert_uint64(m->cycles, ==, 100);
+    munit_assert_uint64(p.idle, ==, 89);
+
+    // An interrupt wakes it at the start of the next batch.
+    m->flags |= FLAG_INTERRUPT;
+    munit_assert_false(pace_run(&p, m));
+    munit_assert_uint32(m->interrupts, ==, 1);
+    munit_assert_uint64(m->retired, ==, 3);
+    munit_assert_uint64(p.idle, ==, 89);
+
+    machine_free(m);
+    assembler_free(a);
+    return MUNIT_OK;
+}
+
+static void pace_input_ended(machine *m) {
+    // What sim_wait does when the keypad input has ended.
+    m->status = STATE_HALT;
+}
+
+static void pace_input_key(machine *m) {
+    // A key pressed 25 ms into the wait.
+    struct timespec delay = {.tv_nsec = 25000000};
+
+    nanosleep(&delay, NULL);
+    m->flags |= FLAG_INTERRUPT;
+}
+
+static MunitResult test_pace_wait_input(const MunitParameter params[],
+                                        void *fixture) {
+    const char *prog = "#data 0020 0100 0040 0000 0000\n"
+                       "#org 0020\n"
+                       "NOP\n"
+                       "MOV 0x1 @FE01\n"
+                       "#org 0040\n"
+                       "MOV 0x2 %s1\n";
+    assembler *a = assembler_init();
+    machine *m = pace_machine_init(a, prog);
+    pacer p;
+
+    // With no input left, the wait callback halts the machine, and the run
+    // ends instead of idling forever.
+    m->event_wait = pace_input_ended;
+    pace_start(&p, m, 10000);
+    munit_assert_false(pace_run(&p, m));
+    munit_assert_int(m->status, ==, STATE_HALT);
+    munit_assert_uint64(p.batches, ==, 1);
+    machine_free(m);
+
+    // A key wakes the machine in the callback. The 25 ms it slept run past
+    // the first 10 ms batch, and go by as at least two more idle batches.
+    m = pace_machine_init(a, prog);
+    m->event_wait = pace_input_key;
+    pace_start(&p, m, 10000);
+    munit_assert_true(pace_run(&p, m));
+    munit_assert_int(m->status, ==, STATE_RUN);
+    munit_assert_uint64(p.batches, >=, 3);
+    munit_assert_uint64(m->cycles, ==, p.batches * 100);
+    munit_assert_uint64(p.idle, ==, m->cycles - 11);
+    munit_assert_uint64(pace_elapsed(&p), >=, pace_emulated(&p, m));
+
+    munit_assert_false(pace_run(&p, m));
+    munit_assert_uint32(m->interrupts, ==, 1);
+    munit_assert_uint64(m->retired, ==, 3);
+
+    machine_free(m);
+    assembler_free(a);
+    return MUNIT_OK;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-variable"
+static MunitTest machine_pace_tests[] = {
+    {(char *)"batches keep to the schedule", test_pace_schedule, NULL, NULL,
+     MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"a halted machine does not wait", test_pace_halt, NULL, NULL,
+     MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"a waiting machine idles until an interrupt", test_pace_wait,
+     NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"a waiting machine sleeps until its input", test_pace_wait_input,
+     NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+    {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}};
+#pragma GCC diagnostic pop
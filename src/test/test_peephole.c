@@ -0,0 +1,189 @@
+#include <dirent.h>
+#include <memory.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../assem/assem.h"
+#include "../assem/peephole.h"
+#include "../assem/source.h"
+#include "../machine/cpu.h"
+#include "../munit/munit.h"
+
+static void write_peephole_file(const char *dir, const char *name,
+                                const char *text) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    FILE *f = fopen(path, "w");
+    munit_assert_not_null(f);
+    fputs(text, f);
+    fclose(f);
+}
+
+static void remove_peephole_dir(const char *dir) {
+    char path[512];
+    DIR *d = opendir(dir);
+    munit_assert_not_null(d);
+
+    for (struct dirent *e; (e = readdir(d));) {
+        if (e->d_name[0] != '.') {
+            snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+            remove(path);
+        }
+    }
+
+    closedir(d);
+    remove(dir);
+}
+
+static MunitResult test_peephole_patterns(const MunitParameter params[],
+                                          void *fixture) {
+    char dir[] = "/tmp/bbb-peephole-XXXXXX";
+    char path[256];
+
+    munit_assert_not_null(mkdtemp(dir));
+    write_peephole_file(dir, "main.bbb",
+                        "#org 0020\n"
+                        "START: MOV %a %a\n"
+                        "MOV 0x1 %b\n"
+                        "MOV 0x2 %b\n"
+                        "PSH %a\nPSH %c\nPOP %c\nPOP %a\n"
+                        "PSH %d\n"
+                        "KEEP: POP %d\n"
+                        "ADD 0x0 %a\n"
+                        "JMP T .NEXT\n"
+                        "NEXT: JMP T .START\n"
+                        "#inc lib.bbb\n"
+                        "#org 0100\n"
+                        "JMP T .KEEP\n");
+    write_peephole_file(dir, "lib.bbb", "SUB: MOV %e %e\nJMP T .SUB\n");
+    snprintf(path, sizeof(path), "%s/main.bbb", dir);
+
+    source_cache *cache = source_cache_init();
+    peephole p = {0};
+    memory *m = build_file(cache, &(build_options){.peephole = &p}, path);
+    munit_assert_not_null(m);
+
+    // The last move to B, the push kept because its pop is a jump target,
+    // the ADD that still adds the carry, and the jump back, with every label
+    // after a removal moved down. Code after the #org stays where it was.
+    uint8_t expected[] = {MOV, REGISTER_CV, REGISTER_B, 0x2,
+                          PSH, REGISTER_D,  POP,        REGISTER_D,
+                          ADD, REGISTER_CV, REGISTER_A, 0x0,
+                          JMP, 0xF,         0x0,        0x0,
+                          0x2, 0x0,         JMP,        0xF,
+                          0x0, 0x0,         0x3,        0x2};
+    uint8_t fixed[] = {JMP, 0xF, 0x0, 0x0, 0x2, 0x6};
+
+    munit_assert_memory_equal(sizeof(expected), m->data + 0x20, expected);
+    munit_assert_uint8(m->data[0x20 + sizeof(expected)], ==, 0);
+    munit_assert_memory_equal(sizeof(fixed), m->data + 0x100, fixed);
+
+    // Savings are reported for the file each instruction came from.
+    munit_assert_size(p.file_count, ==, 2);
+    munit_assert_size(p.files[0].instructions, ==, 7);
+    munit_assert_size(p.files[0].quads, ==, 21);
+    munit_assert_size(p.files[1].instructions, ==, 1);
+    munit_assert_size(p.files[1].quads, ==, 3);
+
+    memory_free(m);
+    peephole_free(&p);
+    source_cache_free(cache);
+    remove_peephole_dir(dir);
+    return MUNIT_OK;
+}
+
+static MunitResult test_peephole_fragments(const MunitParameter params[],
+                                           void *fixture) {
+    char dir[] = "/tmp/bbb-peephole-XXXXXX";
+    char cache_dir[256];
+    char path[256];
+
+    munit_assert_not_null(mkdtemp(dir));
+    snprintf(cache_dir, sizeof(cache_dir), "%s/cache", dir);
+    write_peephole_file(dir, "main.bbb",
+                        "#org 0020\nA: MOV %b %b\n#inc lib.bbb\n"
+                        "JMP T .B\nB: JMP T .A\n");
+    write_peephole_file(dir, "lib.bbb", "PSH %sp\nPOP %sp\nINC %a\n");
+    snprintf(path, sizeof(path), "%s/main.bbb", dir);
+
+    source_cache *cache = source_cache_init();
+    fragment_cache *fragments = fragment_cache_init(cache_dir);
+    munit_assert_not_null(fragments);
+
+    peephole plain = {0};
+    memory *expected =
+        build_file(cache, &(build_options){.peephole = &plain}, path);
+    munit_assert_not_null(expected);
+
+    // Cached fragments carry their instructions, so a build that reuses
+    // them is optimized exactly like one that does not.
+    for (size_t i = 0; i < 2; i++) {
+        peephole p = {0};
+        build_options options = {.fragments = fragments, .peephole = &p};
+        memory *m = build_file(cache, &options, path);
+
+        munit_assert_not_null(m);
+        munit_assert_memory_equal(m->size, m->data, expected->data);
+        munit_assert_size(p.files[0].quads, ==, plain.files[0].quads);
+        munit_assert_size(p.files[1].quads, ==, plain.files[1].quads);
+
+        memory_free(m);
+        peephole_free(&p);
+    }
+
+    munit_assert_size(fragments->hits, ==, 3);
+    munit_assert_size(plain.files[0].instructions, ==, 2);
+    munit_assert_size(plain.files[1].instructions, ==, 2);
+    munit_assert_uint8(expected->data[0x20], ==, INC);
+
+    memory_free(expected);
+    peephole_free(&plain);
+    fragment_cache_free(fragments);
+    source_cache_free(cache);
+    remove_peephole_dir(cache_dir);
+    remove_peephole_dir(dir);
+    return MUNIT_OK;
+}
+
+static MunitResult test_peephole_overlap(const MunitParameter params[],
+                                         void *fixture) {
+    char dir[] = "/tmp/bbb-peephole-XXXXXX";
+    char path[256];
+
+    munit_assert_not_null(mkdtemp(dir));
+
+    // Code written over by a later #org is left alone.
+    write_peephole_file(dir, "main.bbb",
+                        "#org 0020\nMOV %a %a\nNOP\n#org 0021\nNOP\n");
+    snprintf(path, sizeof(path), "%s/main.bbb", dir);
+
+    source_cache *cache = source_cache_init();
+    peephole p = {0};
+    memory *expected = build_file(cache, NULL, path);
+    memory *m = build_file(cache, &(build_options){.peephole = &p}, path);
+
+    munit_assert_not_null(m);
+    munit_assert_memory_equal(m->size, m->data, expected->data);
+    munit_assert_size(p.files[0].instructions, ==, 0);
+
+    memory_free(m);
+    memory_free(expected);
+    peephole_free(&p);
+    source_cache_free(cache);
+    remove_peephole_dir(dir);
+    return MUNIT_OK;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-variable"
+static MunitTest assem_peephole_tests[] = {
+    {(char *)"redundant instructions are removed", test_peephole_patterns,
+     NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"cached fragments are optimized", test_peephole_fragments, NULL,
+     NULL, MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"overlapping output is not optimized", test_peephole_overlap,
+     NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+    {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}};
+#pragma GCC diagnostic pop
@@ -0,0 +1,55 @@
+#include <stdint.h>
+
+#include "../machine/perf.h"
+#include "../munit/munit.h"
+
+static MunitResult test_perf_counts(const MunitParameter params[],
+                                    void *fixture) {
+    perf_counters p;
+    size_t opened = perf_open(&p);
+    size_t available = 0;
+    volatile uint64_t sum = 0;
+
+    for (size_t e = 0; e < PERF_EVENT_COUNT; e++) {
+        available += perf_available(&p, e);
+        munit_assert_not_null(perf_event_names[e]);
+    }
+
+    munit_assert_size(available, ==, opened);
+
+    // Hosts without counters, such as most virtual machines, count nothing
+    // and report every event as unavailable.
+    perf_start(&p);
+
+    for (size_t i = 0; i < 1000000; i++) {
+        sum += i;
+    }
+
+    perf_stop(&p);
+
+    for (size_t e = 0; e < PERF_EVENT_COUNT; e++) {
+        if (!perf_available(&p, e)) {
+            munit_assert_uint64(p.values[e], ==, 0);
+        }
+    }
+
+    if (perf_available(&p, PERF_INSTRUCTIONS)) {
+        munit_assert_uint64(p.values[PERF_INSTRUCTIONS], >=, 1000000);
+    }
+
+    perf_close(&p);
+
+    for (size_t e = 0; e < PERF_EVENT_COUNT; e++) {
+        munit_assert_false(perf_available(&p, e));
+    }
+
+    return MUNIT_OK;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-variable"
+static MunitTest machine_perf_tests[] = {
+    {(char *)"host counters count or report that they cannot",
+     test_perf_counts, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+    {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}};
+#pragma GCC diagnostic pop
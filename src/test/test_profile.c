@@ -0,0 +1,290 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../assem/assem.h"
+#include "../machine/cpu.h"
+#include "../machine/profile.h"
+#include "../munit/munit.h"
+
+// A loop that calls a subroutine three times. The instructions start at
+// 0000, 0007, 000B, 0011, 0017, 001B and 001D.
+static const char profile_prog[] = "MOV 0x0100 %sp\n"
+                                   "MOV 0x3 %a\n"
+                                   "LOOP: JSR T .SUB\n"
+                                   "JMP NZ .LOOP\n"
+                                   "OR 0x2 %s1\n"
+                                   "SUB: DEC %a\n"
+                                   "POP %pc\n";
+
+// Recursion three deep, entered at 0015, then an interrupt handled at 0040
+// by a program that starts at 0020.
+static const char profile_recursive[] = "MOV 0x0100 %sp\n"
+                                        "MOV 0x3 %a\n"
+                                        "JSR T .REC\n"
+                                        "OR 0x2 %s1\n"
+                                        "REC: DEC %a\n"
+                                        "JMP Z .DONE\n"
+                                        "JSR T .REC\n"
+                                        "DONE: POP %pc\n";
+
+static const char profile_interrupt[] = "#data 0020 0100 0040\n"
+                                        "#org 0020\n"
+                                        "OR 0x1 %s1\n"
+                                        "OR 0x2 %s1\n"
+                                        "#org 0040\n"
+                                        "AND 0x0 %s1\n"
+                                        "POP %pc\n";
+
+// Memory reached directly and through the index register.
+static const char profile_memory[] = "MOV 0x5 @0200\n"
+                                     "MOV @0200 %a\n"
+                                     "ADD *0200 %a\n"
+                                     "MOV %a @0201\n"
+                                     "OR 0x2 %s1\n";
+
+static machine *profile_load(assembler *a, const char *prog) {
+    machine *m = machine_init(CPU_MAX_ADDRESS);
+
+    munit_assert_true(assembler_run(a, prog, strlen(prog), m->memory, NULL));
+    machine_reset(m);
+    return m;
+}
+
+static machine *profile_machine(assembler *a) {
+    return profile_load(a, profile_prog);
+}
+
+static MunitResult test_profile_counts(const MunitParameter params[],
+                                       void *fixture) {
+    assembler *a = assembler_init();
+    machine *m = profile_machine(a);
+    machine *plain = profile_machine(a);
+    profile *p = profile_init();
+
+    munit_assert_uint64(profile_run(m, p, 0), ==, 15);
+    munit_assert_uint64(p->instructions, ==, 15);
+
+    // Every address an instruction starts at is counted, and only those.
+    uint64_t expected[] = {[0x00] = 1, [0x07] = 1, [0x0B] = 3, [0x11] = 3,
+                           [0x17] = 1, [0x1B] = 3, [0x1D] = 3};
+
+    for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+        munit_assert_uint64(p->counts[i], ==, expected[i]);
+    }
+
+    munit_assert_uint64(p->opcodes[MOV], ==, 2);
+    munit_assert_uint64(p->opcodes[JSR], ==, 3);
+    munit_assert_uint64(p->opcodes[JMP], ==, 3);
+    munit_assert_uint64(p->opcodes[DEC], ==, 3);
+    munit_assert_uint64(p->opcodes[POP], ==, 3);
+    munit_assert_uint64(p->opcodes[OR], ==, 1);
+    munit_assert_uint64(p->opcodes[NOP], ==, 0);
+
+    // Branches are counted by their condition.
+    munit_assert_uint64(p->taken[0x0B], ==, 3);
+    munit_assert_uint64(p->not_taken[0x0B], ==, 0);
+    munit_assert_uint64(p->taken[0x11], ==, 2);
+    munit_assert_uint64(p->not_taken[0x11], ==, 1);
+    munit_assert_uint64(p->taken[0x1D] + p->not_taken[0x1D], ==, 0);
+
+    // Profiling does not change what the program does.
+    machine_run(plain);
+    munit_assert_memory_equal(CPU_REGISTER_COUNT, m->registers,
+                              plain->registers);
+    munit_assert_uint8(m->flags, ==, plain->flags);
+    munit_assert_size(m->pc - m->memory->data, ==,
+                      plain->pc - plain->memory->data);
+
+    profile_free(p);
+    machine_free(plain);
+    machine_free(m);
+    assembler_free(a);
+    return MUNIT_OK;
+}
+
+static MunitResult test_profile_limit(const MunitParameter params[],
+                                      void *fixture) {
+    assembler *a = assembler_init();
+    machine *m = profile_machine(a);
+    profile *p = profile_init();
+
+    // A run can stop at a limit and carry on, adding to the same counts.
+    munit_assert_uint64(profile_run(m, p, 4), ==, 4);
+    munit_assert_false(m->flags & FLAG_HALT);
+    munit_assert_uint64(p->counts[0x1B], ==, 1);
+    munit_assert_uint64(p->counts[0x1D], ==, 0);
+
+    munit_assert_uint64(profile_run(m, p, 100), ==, 11);
+    munit_assert_uint64(p->instructions, ==, 15);
+    munit_assert_uint64(p->counts[0x1D], ==, 3);
+
+    profile_free(p);
+    machine_free(m);
+    assembler_free(a);
+    return MUNIT_OK;
+}
+
+static MunitResult test_profile_calls(const MunitParameter params[],
+                                      void *fixture) {
+    assembler *a = assembler_init();
+    machine *m = profile_machine(a);
+    profile *p = profile_init();
+    uint64_t *inclusive = calloc(CPU_MAX_ADDRESS, sizeof(uint64_t));
+    uint64_t *exclusive = calloc(CPU_MAX_ADDRESS, sizeof(uint64_t));
+
+    // Each call to the same subroutine from the same place shares a node.
+    p->calls = callgraph_init();
+    profile_run(m, p, 0);
+    munit_assert_size(p->calls->node_count, ==, 2);
+    munit_assert_uint16(p->calls->nodes[1].entry, ==, 0x1B);
+    munit_assert_uint64(p->calls->nodes[0].self, ==, 9);
+    munit_assert_uint64(p->calls->nodes[1].self, ==, 6);
+    munit_assert_uint64(p->calls->calls[0x1B], ==, 3);
+    munit_assert_size(p->calls->depth, ==, 1);
+
+    callgraph_totals(p->calls, inclusive, exclusive);
+    munit_assert_uint64(inclusive[0x00], ==, 15);
+    munit_assert_uint64(exclusive[0x00], ==, 9);
+    munit_assert_uint64(inclusive[0x1B], ==, 6);
+    munit_assert_uint64(exclusive[0x1B], ==, 6);
+    callgraph_free(p->calls);
+    profile_free(p);
+    machine_free(m);
+
+    // Recursive calls nest, but only count once towards inclusive totals.
+    m = profile_load(a, profile_recursive);
+    p = profile_init();
+    p->calls = callgraph_init();
+    memset(inclusive, 0, CPU_MAX_ADDRESS * sizeof(uint64_t));
+    memset(exclusive, 0, CPU_MAX_ADDRESS * sizeof(uint64_t));
+
+    munit_assert_uint64(profile_run(m, p, 0), ==, 15);
+    munit_assert_size(p->calls->node_count, ==, 4);
+    munit_assert_uint64(p->calls->nodes[3].self, ==, 3);
+    munit_assert_uint32(p->calls->nodes[3].parent, ==, 2);
+    munit_assert_uint64(p->calls->calls[0x15], ==, 3);
+
+    callgraph_totals(p->calls, inclusive, exclusive);
+    munit_assert_uint64(inclusive[0x00], ==, 15);
+    munit_assert_uint64(exclusive[0x00], ==, 4);
+    munit_assert_uint64(inclusive[0x15], ==, 11);
+    munit_assert_uint64(exclusive[0x15], ==, 11);
+    callgraph_free(p->calls);
+    profile_free(p);
+    machine_free(m);
+
+    // Taking an interrupt enters its handler like a call.
+    m = profile_load(a, profile_interrupt);
+    p = profile_init();
+    p->calls = callgraph_init();
+    machine_start(m);
+
+    munit_assert_uint64(profile_run(m, p, 0), ==, 4);
+    munit_assert_size(p->calls->node_count, ==, 2);
+    munit_assert_uint16(p->calls->nodes[0].entry, ==, 0x20);
+    munit_assert_uint16(p->calls->nodes[1].entry, ==, 0x40);
+    munit_assert_uint64(p->calls->nodes[0].self, ==, 2);
+    munit_assert_uint64(p->calls->nodes[1].self, ==, 2);
+    munit_assert_uint64(p->calls->calls[0x40], ==, 1);
+
+    callgraph_free(p->calls);
+    profile_free(p);
+    machine_free(m);
+    free(exclusive);
+    free(inclusive);
+    assembler_free(a);
+    return MUNIT_OK;
+}
+
+static MunitResult test_profile_memory(const MunitParameter params[],
+                                       void *fixture) {
+    assembler *a = assembler_init();
+    machine *m = profile_load(a, profile_memory);
+    profile *p = profile_init();
+    memory_access *access = calloc(1, sizeof(memory_access));
+
+    // Reads and writes are counted by quad, and the working set of each
+    // window is what it touched.
+    p->access = access;
+    p->window = 2;
+    munit_assert_uint64(profile_run(m, p, 0), ==, 5);
+    munit_assert_null(m->memory->access);
+    munit_assert_uint64(access->writes[0x200], ==, 1);
+    munit_assert_uint64(access->reads[0x200], ==, 2);
+    munit_assert_uint64(access->writes[0x201], ==, 1);
+    munit_assert_uint64(access->reads[0x201], ==, 0);
+
+    munit_assert_size(p->window_count, ==, 3);
+    munit_assert_uint64(p->windows[0].length, ==, 2);
+    munit_assert_uint32(p->windows[0].quads, ==, 1);
+    munit_assert_uint32(p->windows[1].quads, ==, 2);
+    munit_assert_uint32(p->windows[1].pages, ==, 1);
+    munit_assert_uint64(p->windows[2].start, ==, 4);
+    munit_assert_uint64(p->windows[2].length, ==, 1);
+    munit_assert_uint32(p->windows[2].quads, ==, 0);
+
+    // The heat map has a pixel for every quad.
+    char path[] = "/tmp/bbb-heat-XXXXXX";
+    struct stat st;
+    int fd = mkstemp(path);
+    munit_assert_int(fd, >=, 0);
+    close(fd);
+    munit_assert_true(profile_write_heat_map(p, path));
+    munit_assert_int(stat(path, &st), ==, 0);
+    munit_assert_int(st.st_size, ==, 15 + 3 * MEMORY_ACCESS_SIZE);
+    remove(path);
+    profile_free(p);
+    machine_free(m);
+
+    // Calls and returns use the stack, four quads at a time.
+    m = profile_machine(a);
+    p = profile_init();
+    memset(access, 0, sizeof(memory_access));
+    p->access = access;
+    profile_run(m, p, 0);
+
+    for (size_t i = 0x100; i < 0x104; i++) {
+        munit_assert_uint64(access->writes[i], ==, 3);
+        munit_assert_uint64(access->reads[i], ==, 3);
+    }
+
+    munit_assert_uint64(access->writes[0x104], ==, 0);
+    profile_free(p);
+    machine_free(m);
+
+    // So does taking an interrupt.
+    m = profile_load(a, profile_interrupt);
+    p = profile_init();
+    memset(access, 0, sizeof(memory_access));
+    p->access = access;
+    machine_start(m);
+    profile_run(m, p, 0);
+
+    for (size_t i = 0x100; i < 0x104; i++) {
+        munit_assert_uint64(access->writes[i], ==, 1);
+        munit_assert_uint64(access->reads[i], ==, 1);
+    }
+
+    profile_free(p);
+    machine_free(m);
+    free(access);
+    assembler_free(a);
+    return MUNIT_OK;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-variable"
+static MunitTest machine_profile_tests[] = {
+    {(char *)"instructions and branches are counted", test_profile_counts,
+     NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"runs stop at the limit", test_profile_limit, NULL, NULL,
+     MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"calls and interrupts build the call tree", test_profile_calls,
+     NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"memory traffic and working sets are counted",
+     test_profile_memory, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+    {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}};
+#pragma GCC diagnostic pop
@@ -0,0 +1,106 @@
+#include <signal.h>
+#include <string.h>
+
+#include "../assem/assem.h"
+#include "../machine/cpu.h"
+#include "../machine/sample.h"
+#include "../munit/munit.h"
+
+// A loop that never ends, from 0020 to 0027.
+static const char sample_prog[] = "#data 0020 0100 0000 0000 0000\n"
+                                  "#org 0020\n"
+                                  "LOOP: INC %a\n"
+                                  "JMP T .LOOP\n";
+
+static machine *sample_machine_init(assembler *a) {
+    machine *m = machine_init(CPU_MAX_ADDRESS);
+
+    munit_assert_true(
+        assembler_run(a, sample_prog, strlen(sample_prog), m->memory, NULL));
+    machine_reset(m);
+    return m;
+}
+
+static MunitResult test_sample_signal(const MunitParameter params[],
+                                      void *fixture) {
+    assembler *a = assembler_init();
+    machine *m = sample_machine_init(a);
+    sampler *s = sample_init();
+
+    // A signal records the program counter of the attached machine, and
+    // counts as outside the program when there is none.
+    munit_assert_true(sample_start(s, 1));
+    munit_assert_false(sample_start(s, 1));
+
+    m->pc = m->memory->data + 0x1234;
+    sample_attach(m);
+    raise(SIGPROF);
+    raise(SIGPROF);
+    sample_attach(NULL);
+    raise(SIGPROF);
+
+    sample_drain(s);
+    munit_assert_uint64(s->samples, ==, 2);
+    munit_assert_uint64(s->counts[0x1234], ==, 2);
+    munit_assert_uint(atomic_load(&s->outside), ==, 1);
+
+    // A full ring drops samples until it is drained.
+    sample_attach(m);
+
+    for (size_t i = 0; i < SAMPLE_RING_LENGTH + 3; i++) {
+        raise(SIGPROF);
+    }
+
+    sample_attach(NULL);
+    munit_assert_uint(atomic_load(&s->dropped), ==, 3);
+    sample_stop(s);
+    munit_assert_uint64(s->samples, ==, 2 + SAMPLE_RING_LENGTH);
+
+    sample_free(s);
+    machine_free(m);
+    assembler_free(a);
+    return MUNIT_OK;
+}
+
+static MunitResult test_sample_run(const MunitParameter params[],
+                                   void *fixture) {
+    assembler *a = assembler_init();
+    machine *m = sample_machine_init(a);
+    sampler *s = sample_init();
+
+    // The timer counts CPU time, so the loop runs until a few samples have
+    // arrived, and every one of them lands in the loop or, while the jump is
+    // being read, just past it.
+    machine_start(m);
+    munit_assert_true(sample_start(s, 1000));
+
+    for (size_t i = 0; i < 1000 && s->samples < 5; i++) {
+        munit_assert_uint64(sample_run(s, m, 100000), ==, 100000);
+    }
+
+    sample_stop(s);
+    munit_assert_uint64(s->samples, >=, 5);
+
+    uint64_t inside = 0;
+
+    for (size_t i = 0x20; i <= 0x28; i++) {
+        inside += s->counts[i];
+    }
+
+    munit_assert_uint64(inside, ==, s->samples);
+
+    sample_free(s);
+    machine_free(m);
+    assembler_free(a);
+    return MUNIT_OK;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-variable"
+static MunitTest machine_sample_tests[] = {
+    {(char *)"signals record the program counter", test_sample_signal, NULL,
+     NULL, MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"the timer samples a running machine", test_sample_run, NULL,
+     NULL, MUNIT_TEST_OPTION_NONE, NULL},
+    {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}};
+#pragma GCC diagnostic pop
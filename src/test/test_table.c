@@ -89,6 +89,40 @@ static MunitResult test_symbol_resize(const MunitParameter params[],
     return MUNIT_OK;
 }
 
+static MunitResult test_symbol_many(const MunitParameter params[],
+                                    void *fixture) {
+    table *t = (table *)fixture;
+    char label[32];
+
+    // Enough labels to grow the label storage and the index several times.
+    for (int i = 0; i < 5000; i++) {
+        snprintf(label, sizeof(label), "label_%d", i);
+        table_symbol_define(t, label, i);
+        table_ref_add(t, label, NULL);
+    }
+
+    for (int i = 0; i < 5000; i++) {
+        snprintf(label, sizeof(label), "label_%d", i);
+        symbol *s = table_symbol_lookup(t, label);
+
+        munit_assert_not_null(s);
+        munit_assert_string_equal(s->label, label);
+        munit_assert_ulong(s->address, ==, i);
+        munit_assert_ptr_equal(t->refs[i].label, s->label);
+    }
+
+    munit_assert_null(table_symbol_lookup(t, "label_5000"));
+
+    // Deleting a label that was defined twice uncovers the second definition.
+    table_symbol_define(t, "label_7", 7000);
+    table_symbol_del(t, "label_7");
+    munit_assert_ulong(table_symbol_lookup(t, "label_7")->address, ==, 7000);
+    table_symbol_del(t, "label_7");
+    munit_assert_null(table_symbol_lookup(t, "label_7"));
+
+    return MUNIT_OK;
+}
+
 static MunitResult test_ref_add(const MunitParameter params[], void *fixture) {
     table *t = (table *)fixture;
     reference *r = NULL;
@@ -228,6 +262,8 @@ static MunitTest assem_table_tests[] = {
      test_table_tear_down, MUNIT_TEST_OPTION_NONE, NULL},
     {(char *)"resize symbols", test_symbol_resize, test_table_setup,
      test_table_tear_down, MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"many symbols", test_symbol_many, test_table_setup,
+     test_table_tear_down, MUNIT_TEST_OPTION_NONE, NULL},
     {(char *)"add reference", test_ref_add, test_table_setup,
      test_table_tear_down, MUNIT_TEST_OPTION_NONE, NULL},
     {(char *)"print table", test_table_print, test_table_setup,
@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../assem/assem.h"
+#include "../machine/cpu.h"
+#include "../machine/lattice.h"
+#include "../machine/trace.h"
+#include "../munit/munit.h"
+
+// Counts A down from 3, writing each count to 0100, from 0020.
+static const char trace_prog[] = "#data 0020 0200\n"
+                                 "#org 0020\n"
+                                 "MOV 0x3 %a\n"
+                                 "LOOP: MOV %a @0100\n"
+                                 "DEC %a\n"
+                                 "JMP NZ .LOOP\n"
+                                 "OR 0x2 %s1\n";
+
+// Nested loops that take each node a few hundred instructions.
+static const char trace_lattice_prog[] = "#data 0020 0200\n"
+                                         "#org 0020\n"
+                                         "MOV 0xF %a\n"
+                                         "LOOP: MOV 0xF %b\n"
+                                         "INNER: DEC %b\n"
+                                         "JMP NZ .INNER\n"
+                                         "DEC %a\n"
+                                         "JMP NZ .LOOP\n"
+                                         "OR 0x2 %s1\n";
+
+static void trace_assemble(const char *prog, memory *mem) {
+    assembler *a = assembler_init();
+    munit_assert_true(assembler_run(a, prog, strlen(prog), mem, NULL));
+    assembler_free(a);
+}
+
+static MunitResult test_trace_records(const MunitParameter params[],
+                                      void *fixture) {
+    char path[] = "/tmp/bbb-trace-XXXXXX";
+    machine *m = machine_init(CPU_MAX_ADDRESS);
+    trace_file f;
+
+    close(mkstemp(path));
+    trace_assemble(trace_prog, m->memory);
+    machine_start(m);
+
+    trace_writer *w = trace_open(path);
+    munit_assert_not_null(w);
+    trace_run(w, m);
+    munit_assert_true(trace_close(w));
+
+    // Every instruction is recorded, in order, with what it wrote.
+    munit_assert_true(trace_load(path, &f));
+    munit_assert_size(f.count, ==, 11);
+
+    const trace_record *t = f.records;
+    munit_assert_uint16(t[0].pc, ==, 0x20);
+    munit_assert_uint8(t[0].instr, ==, MOV);
+    munit_assert_uint8(t[0].operands, ==, REGISTER_CV << 4 | REGISTER_A);
+    munit_assert_uint16(t[0].src_ext, ==, 0x3);
+    munit_assert_uint16(t[0].value, ==, 0x3);
+
+    munit_assert_uint8(t[1].operands, ==, REGISTER_A << 4 | REGISTER_MD);
+    munit_assert_uint16(t[1].dst_ext, ==, 0x100);
+    munit_assert_uint16(t[1].value, ==, 0x3);
+    munit_assert_uint16(t[2].value, ==, 0x2);
+    munit_assert_uint16(t[3].value, ==, t[1].pc);
+    munit_assert_uint16(t[9].value, ==, t[10].pc);
+    munit_assert_uint8(t[8].flags & FLAG_ZERO, ==, FLAG_ZERO);
+    munit_assert_uint8(t[10].instr, ==, OR);
+    munit_assert_uint8(t[10].flags & FLAG_HALT, ==, FLAG_HALT);
+
+    for (size_t i = 0; i < f.count; i++) {
+        munit_assert_uint32(t[i].sequence, ==, i);
+        munit_assert_uint8(t[i].node, ==, 0);
+    }
+
+    trace_unload(&f);
+
+    // Anything but a whole number of records is rejected.
+    munit_assert_int(truncate(path, TRACE_HEADER_SIZE + 3), ==, 0);
+    munit_assert_false(trace_load(path, &f));
+    munit_assert_false(trace_load("/nonexistent/trace", &f));
+
+    remove(path);
+    machine_free(m);
+    return MUNIT_OK;
+}
+
+static void trace_raise_interrupt(machine *m) { m->flags |= FLAG_INTERRUPT; }
+
+static MunitResult test_trace_wait(const MunitParameter params[],
+                                   void *fixture) {
+    char path[] = "/tmp/bbb-trace-XXXXXX";
+    machine *m = machine_init(CPU_MAX_ADDRESS);
+    trace_file f;
+
+    // Waits for an interrupt, whose handler at 0040 halts.
+    close(mkstemp(path));
+    trace_assemble("#data 0020 0200 0040\n"
+                   "#org 0020\n"
+                   "MOV 0x0 @FE01\n"
+                   "OR 0x2 %s1\n"
+                   "#org 0040\n"
+                   "MOV 0x5 %a\n"
+                   "OR 0x2 %s1\n",
+                   m->memory);
+    m->event_wait = trace_raise_interrupt;
+    machine_start(m);
+
+    trace_writer *w = trace_open(path);
+    munit_assert_not_null(w);
+    trace_run(w, m);
+    munit_assert_true(trace_close(w));
+
+    // The run goes on into the handler after the wait, as it does untraced.
+    munit_assert_true(trace_load(path, &f));
+    munit_assert_size(f.count, ==, 3);
+    munit_assert_uint16(f.records[0].dst_ext, ==, CPU_WAIT);
+    munit_assert_uint16(f.records[1].pc, ==, 0x40);
+    munit_assert_uint16(f.records[2].pc, ==, 0x44);
+    munit_assert_uint8(m->registers[REGISTER_A], ==, 0x5);
+    munit_assert_uint32(m->interrupts, ==, 1);
+
+    trace_unload(&f);
+    remove(path);
+    machine_free(m);
+    return MUNIT_OK;
+}
+
+static MunitResult test_trace_lattice(const MunitParameter params[],
+                                      void *fixture) {
+    char path[] = "/tmp/bbb-trace-XXXXXX";
+    memory *image = memory_init(CPU_MAX_ADDRESS);
+    lattice *l = lattice_init(4);
+    uint32_t counts[LATTICE_NODE_COUNT] = {0};
+    trace_file f;
+
+    close(mkstemp(path));
+    trace_assemble(trace_lattice_prog, image);
+
+    for (size_t i = 0; i < LATTICE_NODE_COUNT; i++) {
+        lattice_load(l, i, image->data, image->size);
+    }
+
+    // Short quanta make the nodes move between workers while they run.
+    l->quantum = 16;
+    lattice_start(l);
+    l->trace = trace_open(path);
+    munit_assert_not_null(l->trace);
+    lattice_run(l);
+    munit_assert_true(trace_close(l->trace));
+    munit_assert_true(trace_load(path, &f));
+
+    // Each node's records are all there, numbered without gaps.
+    for (size_t i = 0; i < f.count; i++) {
+        munit_assert_uint8(f.records[i].node, <, LATTICE_NODE_COUNT);
+        counts[f.records[i].node]++;
+    }
+
+    for (size_t n = 0; n < LATTICE_NODE_COUNT; n++) {
+        uint8_t *seen = calloc(counts[n], 1);
+
+        munit_assert_uint64(counts[n], ==, l->counters[n].retired);
+
+        for (size_t i = 0; i < f.count; i++) {
+            const trace_record *t = &f.records[i];
+
+            if (t->node == n) {
+                munit_assert_uint32(t->sequence, <, counts[n]);
+                munit_assert_false(seen[t->sequence]);
+                seen[t->sequence] = 1;
+
+                if (t->sequence == 0) {
+                    munit_assert_uint16(t->pc, ==, 0x20);
+                } else if (t->sequence + 1 == counts[n]) {
+                    munit_assert_uint8(t->instr, ==, OR);
+                }
+            }
+        }
+
+        free(seen);
+    }
+
+    trace_unload(&f);
+    remove(path);
+    lattice_free(l);
+    memory_free(image);
+    return MUNIT_OK;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-variable"
+static MunitTest machine_trace_tests[] = {
+    {(char *)"instructions are recorded", test_trace_records, NULL, NULL,
+     MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"lattice nodes are traced in full", test_trace_lattice, NULL,
+     NULL, MUNIT_TEST_OPTION_NONE, NULL},
+    {(char *)"a waiting machine is traced through its interrupt",
+     test_trace_wait, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL},
+    {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}};
+#pragma GCC diagnostic pop